@@ -31,6 +31,18 @@ struct anthy_prediction_stat {
   int nr_prediction;
 };
 
+/* 辞書のキャッシュの統計情報 */
+struct anthy_dic_cache_stat {
+  long nr_hit;
+  /* 辞書に無いことが分かっている読みのヒット */
+  long nr_negative_hit;
+  long nr_miss;
+  long nr_eviction;
+  int nr_entries;
+  /* キャッシュが使っているおおよそのバイト数 */
+  long mem_used;
+};
+
 typedef struct anthy_context *anthy_context_t;
 
 
@@ -96,6 +108,15 @@ extern void anthy_set_logger(anthy_logger , int level);
 extern int anthy_context_set_encoding(anthy_context_t ac, int encoding);
 #define HAS_ANTHY_SET_RECONVERSION_MODE
 extern int anthy_set_reconversion_mode(anthy_context_t ac, int mode);
+#define HAS_ANTHY_DIC_CACHE_STAT
+extern int anthy_get_dic_cache_stat(anthy_context_t ac,
+				    struct anthy_dic_cache_stat *st);
+#define HAS_ANTHY_SEGMENTATION
+extern int anthy_get_nr_segmentation(anthy_context_t ac);
+/* context, nth segmentation, array of segment lengths, array len */
+extern int anthy_get_nth_segmentation(anthy_context_t ac, int nth,
+				      int *seg_len, int len);
+extern int anthy_select_segmentation(anthy_context_t ac, int nth);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,42 @@
+/*
+ * 変換一回分のオブジェクトを確保するためのアリーナ
+ *
+ * 確保したオブジェクトを個別に解放することはできず、
+ * anthy_arena_resetでまとめて解放する。
+ * 確保したメモリはresetの後も保持して次の変換で再利用する
+ */
+#ifndef _arena_h_included_
+#define _arena_h_included_
+
+#include <stddef.h>
+
+struct anthy_arena;
+
+/** anthy_arena_markで覚えた位置 */
+struct anthy_arena_mark {
+  void *block;
+  size_t used;
+};
+
+/* アリーナを作る */
+struct anthy_arena *anthy_create_arena(void);
+/* アリーナを、確保した全てのメモリとともに解放する */
+void anthy_free_arena(struct anthy_arena *a);
+
+/*
+ * sizeバイトの領域を確保する
+ * 返り値は確保した領域、中身は初期化されない
+ */
+void *anthy_arena_alloc(struct anthy_arena *a, size_t size);
+/* 確保した全てのオブジェクトを解放する */
+void anthy_arena_reset(struct anthy_arena *a);
+
+/*
+ * 現在の位置を覚えておき、anthy_arena_releaseでそれ以降に
+ * 確保したオブジェクトをまとめて解放する
+ * 一時的なオブジェクトに使う
+ */
+void anthy_arena_mark(struct anthy_arena *a, struct anthy_arena_mark *m);
+void anthy_arena_release(struct anthy_arena *a, struct anthy_arena_mark *m);
+
+#endif
@@ -48,13 +48,15 @@ struct wordseq_rule {
 /** 付属語グラフのファイル上での形式 */
 struct ondisk_wordseq_rule {
   char wt[8];
-  /* ネットワークバイトオーダー */
+  /* 辞書のバイトオーダー */
   uint32_t node_id;
 };
 
 /* 付属語グラフ */
 struct dep_dic {
   char* file_ptr;
+  /* 辞書のバイトオーダがホストと違う */
+  int swap;
 
   int nrRules;
   int nrNodes;
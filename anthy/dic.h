@@ -54,13 +54,23 @@ int anthy_compound_get_nth_segment_xstr(compound_ent_t ce, int nth, xstr *xs);
 
 
 /** 辞書セッション
- *
+ * 変換コンテキストごとに辞書のキャッシュを持つ。
+ * activateすると呼び出したスレッドのカレントのセッションになるので
+ * 別々のコンテキストを別々のスレッドで同時に変換することができる。
+ * 学習データはpersonalityごとに一つを全てのセッションで共有する。
  */
-typedef struct mem_dic *dic_session_t;
-/*typedef struct dic_session *dic_session_t;*/
+typedef struct dic_session *dic_session_t;
 
 dic_session_t anthy_dic_create_session(void);
+/* NULLを与えるとpersonality全体のものに戻す */
 void anthy_dic_activate_session(dic_session_t );
+/* 辞書のキャッシュを上限の大きさまで減らす(学習データは残す) */
+void anthy_dic_flush_session(dic_session_t);
+/* 個人辞書が変わってキャッシュの内容が古くなっていれば1を返す */
+int anthy_dic_session_is_stale(dic_session_t);
+/* NULLを与えるとpersonality全体のキャッシュの統計を返す */
+struct anthy_dic_cache_stat;
+void anthy_dic_get_session_stat(dic_session_t, struct anthy_dic_cache_stat *);
 void anthy_dic_release_session(dic_session_t);
 
 /* personality */
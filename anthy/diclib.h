@@ -1,19 +1,82 @@
 #ifndef __diclib_h_included__
 #define __diclib_h_included__
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* 全体の初期化、解放 */
 int anthy_init_diclib(void);
 void anthy_quit_diclib(void);
 
+/*
+ * 辞書ファイルのセクション
+ * 辞書のセクションの表はanthy_init_file_dicで一度だけ引いておき、
+ * 各モジュールはこの番号でセクションを得る
+ */
+enum anthy_dic_section {
+  ANTHY_DIC_WORD_DIC,
+  ANTHY_DIC_DEP_DIC,
+  ANTHY_DIC_TRANS_INFO,
+  ANTHY_DIC_TRANS_INFO_HASH,
+  ANTHY_DIC_CAND_INFO,
+  ANTHY_DIC_CAND_INFO_HASH,
+  ANTHY_DIC_WEAK_WORDS,
+  ANTHY_DIC_CORPUS_BUCKET,
+  ANTHY_DIC_CORPUS_ARRAY,
+  NR_ANTHY_DIC_SECTIONS
+};
+
+/* セクションの先頭と大きさを返す、辞書に無ければNULLと0を返す */
+void *anthy_file_dic_section(enum anthy_dic_section id);
+size_t anthy_file_dic_section_size(enum anthy_dic_section id);
+/* 名前でセクションを引く */
 void* anthy_file_dic_get_section(const char* section_name);
+/* 辞書ファイルを読み込むのにかかった時間(ナノ秒) */
+long long anthy_file_dic_load_time(void);
+
+/* 辞書の中の領域の使い方 */
+enum anthy_dic_access {
+  /* すぐに使うので先に読み込んでおく */
+  ANTHY_DIC_WILL_NEED,
+  /* まばらに引くので周りを先読みしない */
+  ANTHY_DIC_RANDOM
+};
+/* 辞書の中の領域の使い方をOSに伝える */
+void anthy_file_dic_advise(const void *p, size_t len,
+			   enum anthy_dic_access access);
 
 /*
   utility
  */
+/*
+ * 辞書の各セクションは作ったホストのバイトオーダで書かれ、
+ * 辞書ファイルの先頭のセクションの数に付けたフラグでどちらかが分かる
+ * anthy_dic_ntohlは辞書の値をホストのバイトオーダに、
+ * anthy_dic_htonlは辞書に書く値を辞書のバイトオーダにする
+ */
 uint32_t anthy_dic_ntohl(uint32_t a);
 uint32_t anthy_dic_htonl(uint32_t a);
 
+/* セクションがリトルエンディアンで書かれている */
+#define ANTHY_DIC_LITTLE_ENDIAN 0x40000000
+/* このホストで書いた辞書に付けるフラグ */
+uint32_t anthy_dic_host_order(void);
+/* 読み込んだ辞書のバイトオーダがホストと違えば1 */
+int anthy_dic_swapped(void);
+
+/*
+ * 変換の内側のループで使うanthy_dic_ntohl
+ * swapには初期化の際にanthy_dic_swapped()の値を覚えておいて渡す
+ * 辞書がホストのバイトオーダならただの読み込みになる
+ */
+static inline uint32_t
+anthy_dic_to_host(uint32_t a, int swap)
+{
+  if (swap) {
+    return (a >> 24) | ((a >> 8) & 0xff00) | ((a << 8) & 0xff0000) | (a << 24);
+  }
+  return a;
+}
+
 
 #endif
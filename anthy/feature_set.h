@@ -3,6 +3,7 @@
 #define _feature_set_h_included_
 
 #include <anthy/wtype.h>
+#include <anthy/diclib.h>
 
 /* hash collisionが出たら適宜増やす */
 #define WORD_HASH_MAX 1024
@@ -24,13 +25,35 @@ struct feature_freq {
   int f[NR_EM_FEATURES + 2];
 };
 
+/*
+ * calctransが出力する完全ハッシュの表の先頭の値
+ * 表はホストのバイトオーダなので、読む側のバイトオーダの確認にも使う
+ */
+#define FEATURE_HASH_MAGIC 0x46485431
+/* 値の数で数えた完全ハッシュの表のヘッダの大きさ */
+#define FEATURE_HASH_HEADER 4
+
+/* 素性の組に対する頻度の表 */
+struct feature_table {
+  /* 素性の組でソートした行の配列(辞書のバイトオーダ) */
+  const void *array;
+  /* 辞書のバイトオーダがホストと違う */
+  int swap;
+  /* 同じ行の完全ハッシュの表、無い場合はNULL */
+  const int *hash;
+};
+
 void anthy_init_features(void);
+void anthy_init_feature_table(struct feature_table *ft,
+			      enum anthy_dic_section array,
+			      enum anthy_dic_section hash);
+unsigned int anthy_feature_hash(const int *f, unsigned int seed);
 struct feature_freq *
-anthy_find_feature_freq(const void *array,
+anthy_find_feature_freq(const struct feature_table *ft,
 			const struct feature_list *fl,
 			struct feature_freq *arg);
 struct feature_freq *
-anthy_find_array_freq(const void *array,
+anthy_find_array_freq(const struct feature_table *ft,
 		      int *f, int nr,
 		      struct feature_freq *arg);
 
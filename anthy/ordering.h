@@ -15,8 +15,8 @@ struct ordering_context_wrapper{
 
 void anthy_proc_commit(struct segment_list *, struct splitter_context *);
 
-void anthy_sort_candidate(struct segment_list *c, int nth);
-void anthy_sort_metaword(struct segment_list *seg);
+void anthy_sort_candidate(struct segment_list *c, int from, int to);
+void anthy_sort_metaword(struct segment_list *seg, int nth);
 
 void anthy_do_commit_prediction(xstr *src, xstr *xs);
 
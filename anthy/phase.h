@@ -0,0 +1,34 @@
+/*
+ * 変換の段階ごとにかかった時間を計る
+ *
+ * ベンチマークなどでanthy_phase_enableした時だけ計り、
+ * 普段は時刻も取らない。時間はスレッドごとに足し込む
+ */
+#ifndef _phase_h_included_
+#define _phase_h_included_
+
+enum anthy_phase {
+  /* 部分文字列の辞書引きとword_listの作成 */
+  ANTHY_PHASE_WORD_LIST,
+  /* metawordの作成 */
+  ANTHY_PHASE_METAWORD,
+  /* latticeによる文節の境界の決定 */
+  ANTHY_PHASE_LATTICE,
+  /* 候補の列挙とソート */
+  ANTHY_PHASE_CANDIDATE,
+  NR_ANTHY_PHASES
+};
+
+/* 計るかどうかを設定する */
+void anthy_phase_enable(int enable);
+/* 段階の始まりの時刻を返す、計っていなければ0を返す */
+long long anthy_phase_begin(void);
+/* beginからの時間を段階phaseの分として足す */
+void anthy_phase_end(enum anthy_phase phase, long long begin);
+/* このスレッドで足した時間(ナノ秒)をnsに入れて、0に戻す */
+void anthy_phase_take(long long *ns);
+const char *anthy_phase_name(enum anthy_phase phase);
+/* 単調増加する時刻をナノ秒で返す */
+long long anthy_get_time_ns(void);
+
+#endif
@@ -13,6 +13,15 @@
 
 #include "xstr.h"
 
+/*
+ * データベースは全てのスレッドで共有されるので、カレントsectionや
+ * カレントrowを使う一連の操作はこの二つの間で行う。
+ * 同じスレッドからは入れ子にできる。
+ * 最後のanthy_unlock_recordでカレントsection,rowは無効になる
+ */
+void anthy_lock_record(void);
+void anthy_unlock_record(void);
+
 /*
  * カレントsectionを設定する
  * name: sectionの名前
@@ -93,6 +102,7 @@ void anthy_release_row(void);
 int anthy_mark_row_used(void);
 
 
+/* ロックは内部で取る */
 void anthy_reload_record(void);
 
 #endif
@@ -18,7 +18,8 @@ struct cand_elm {
 };
 
 /** 一つの候補に相当する。
- * anthy_release_cand_ent()で解放する
+ * 構造体と要素の配列は変換コンテキストのアリーナに確保され、
+ * anthy_release_cand_ent()では文字列を解放する
  */
 struct cand_ent {
   /** 候補のスコア */
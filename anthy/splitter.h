@@ -11,6 +11,17 @@
 #define RATIO_BASE 256
 #define OCHAIRE_SCORE 5000000
 
+/** 文節分割の候補(N-best)の一つ */
+struct split_path {
+  /* 各文字の位置が文節の先頭かどうか、char_count + 1個 */
+  int *seg_border;
+  /* latticeで選ばれたmetawordの列、左から順に並ぶ */
+  int nr_mw;
+  struct meta_word **mw;
+};
+
+struct lattice_info;
+
 /** splitterのコンテキスト．
  * 最初の境界設定からanthy_contextの解放まで有効
  */
@@ -27,6 +38,23 @@ struct splitter_context {
     enum seg_class best_seg_class;
     struct meta_word* best_mw; /* 一番優先して使いたいmetaword */
   }*ce;
+  /** 変換一回分のデータを確保するアリーナ、変換コンテキストが持つ */
+  struct anthy_arena *arena;
+  /** 文字列を追加する前の変換のデータ、差分を変換する間だけ残す */
+  struct anthy_arena *old_arena;
+  /** word_listとその元になった自立語などを確保するアリーナ
+   * 文字列が追加されても使い続けるので、変換をやめるまで空にしない */
+  struct anthy_arena *wl_arena;
+  /** wl_arenaに確保したword_listの数、作り直して使わなくなったものも含む */
+  int nr_word_lists;
+  /** 最後に文節分割した時のlattice、次に文節分割するまで残す */
+  struct lattice_info *lattice;
+  /** latticeを確保するアリーナ、文節分割の度に空にする */
+  struct anthy_arena *lattice_arena;
+  /** latticeから求めたおおよそ確率の高い順の分割の候補、先頭は実際に選ばれた分割
+   * 必要になるまで求めないので、まだ求めていなければnr_pathsは-1 */
+  int nr_paths;
+  struct split_path *paths;
 };
 
 /* 制約のチェックの状態 */
@@ -106,11 +134,29 @@ int anthy_init_splitter(void);
 void anthy_quit_splitter(void);
 
 void anthy_init_split_context(xstr *xs, struct splitter_context *, int is_reverse);
+/* 文字列の後ろに文字が追加された時に、差分だけ作り直す
+ * 文字列はanthy_renew_split_arenaの後にarenaに確保しておく */
+void anthy_renew_split_arena(struct splitter_context *);
+void anthy_extend_split_context(xstr *xs, struct splitter_context *);
 /*
  * mark_border(context, l1, l2, r1);
  * l1とr1の間の文節を検出する、ただしl1とl2の間は境界にしない。
  */
 void anthy_mark_border(struct splitter_context *, int from, int from2, int to);
+/*
+ * anthy_mark_borderと同じだが、latticeを使わずに
+ * nth番目の分割の候補に従って境界をマークする
+ */
+void anthy_mark_border_by_path(struct splitter_context *,
+			       int from, int from2, int to, int nth);
+/*
+ * 先頭からtoまでの文節境界が現在のものと一致する分割の候補を探す
+ * 返り値は候補の番号、無ければ-1
+ */
+int anthy_find_split_path(struct splitter_context *, int to);
+/* 分割の候補の数と、nth番目の候補 */
+int anthy_get_nr_split_path(struct splitter_context *);
+struct split_path *anthy_get_nth_split_path(struct splitter_context *, int nth);
 void anthy_commit_border(struct splitter_context *, int nr,
 		   struct meta_word **mw, int *len);
 void anthy_release_split_context(struct splitter_context *c);
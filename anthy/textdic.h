@@ -5,5 +5,8 @@ int anthy_textdic_scan(const char *fn, long offset, void *ptr,
 		       int (*func)(void *, long, const char *, const char *));
 int anthy_textdic_insert_line(const char *fn, long offset, const char *line);
 int anthy_textdic_delete_line(const char *fn, long offset);
+int anthy_textdic_gang_lookup(const char *fn, int nr, const char **keys,
+			      void *ptr, void (*func)(void *, int, const char *));
+void anthy_textdic_free_index(void);
 
 #endif
@@ -0,0 +1,52 @@
+/*
+ * スレッドまわりの移植用の定義
+ *
+ * 複数の変換コンテキストを別々のスレッドから同時に使えるようにするため
+ * プロセス全体で共有される状態はこのmutexで保護し、
+ * 「現在の」辞書セッションなどはスレッドごとの変数で持つ。
+ */
+#ifndef _thread_h_included_
+#define _thread_h_included_
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK anthy_mutex_t;
+#define ANTHY_MUTEX_INITIALIZER SRWLOCK_INIT
+#define anthy_mutex_init(m) InitializeSRWLock(m)
+#define anthy_mutex_destroy(m) ((void)(m))
+#define anthy_mutex_lock(m) AcquireSRWLockExclusive(m)
+#define anthy_mutex_unlock(m) ReleaseSRWLockExclusive(m)
+/* 読み込みは並行して行える */
+typedef SRWLOCK anthy_rwlock_t;
+#define ANTHY_RWLOCK_INITIALIZER SRWLOCK_INIT
+#define anthy_rwlock_rdlock(l) AcquireSRWLockShared(l)
+#define anthy_rwlock_rdunlock(l) ReleaseSRWLockShared(l)
+#define anthy_rwlock_wrlock(l) AcquireSRWLockExclusive(l)
+#define anthy_rwlock_wrunlock(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t anthy_mutex_t;
+#define ANTHY_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define anthy_mutex_init(m) pthread_mutex_init(m, NULL)
+#define anthy_mutex_destroy(m) pthread_mutex_destroy(m)
+#define anthy_mutex_lock(m) pthread_mutex_lock(m)
+#define anthy_mutex_unlock(m) pthread_mutex_unlock(m)
+/* 読み込みは並行して行える */
+typedef pthread_rwlock_t anthy_rwlock_t;
+#define ANTHY_RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+#define anthy_rwlock_rdlock(l) pthread_rwlock_rdlock(l)
+#define anthy_rwlock_rdunlock(l) pthread_rwlock_unlock(l)
+#define anthy_rwlock_wrlock(l) pthread_rwlock_wrlock(l)
+#define anthy_rwlock_wrunlock(l) pthread_rwlock_unlock(l)
+#endif
+
+/* スレッドごとの変数 */
+#if defined(_MSC_VER)
+#define ANTHY_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define ANTHY_THREAD_LOCAL __thread
+#else
+#define ANTHY_THREAD_LOCAL _Thread_local
+#endif
+
+#endif
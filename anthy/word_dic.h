@@ -16,13 +16,21 @@
 /* 1ページ内にいくつの単語を入れるか */
 #define WORDS_PER_PAGE 64
 
+/* ページの先頭の読みの表(page key)で1ページに使うxcharの数
+ * 各ページは読みの長さとこの数のxcharで表され、
+ * 表の前には、ページ数と幅が置かれる
+ * これより長い読みは切り詰められる */
+#define PAGE_KEY_WIDTH 15
+
 /** 辞書ファイル 
  * 辞書ライブラリ用
  */
 struct word_dic {
   /** 辞書ファイル自体のポインタ */
   char *dic_file;
-  /** 辞書エントリのインデックスの配列(ネットワークバイトオーダー) */
+  /** 辞書のバイトオーダがホストと違う */
+  int swap;
+  /** 辞書エントリのインデックスの配列(辞書のバイトオーダー) */
   int *entry_index;
   /** 辞書エントリ */
   char *entry;
@@ -36,6 +44,17 @@ struct word_dic {
   /* 単語辞書 */
   int nr_pages;
   unsigned char *hash_ent;
+  /** ページの先頭の読みの表、古い辞書ではNULL */
+  int *page_key;
+  int page_key_width;
+  /** 読みのダブル配列trie、古い辞書ではNULL */
+  int *trie;
+  int trie_nr_units;
+  int trie_nr_chars;
+  int *trie_chars;
+  int *trie_units;
+  /** 全てのコンテキストで共有する、この辞書から読み込んだ単語のキャッシュ */
+  struct mem_dic *shared_cache;
 };
 
 #endif
@@ -111,6 +111,17 @@ int anthy_euc_to_ucs(int ec);
 int anthy_ucs_to_euc(int uc);
 
 const char *anthy_utf8_to_ucs4_xchar(const char *s, xchar *res);
+
+/* utf8.c */
+/* UTF-8とUCS-4の変換の実装 */
+#define ANTHY_UTF8_SCALAR 0
+#define ANTHY_UTF8_SSE2 1
+#define ANTHY_UTF8_AVX2 2
+int anthy_utf8_select_impl(int impl);
+/* 書いた文字数、不正なバイト列なら-1を返す。dstにはlen文字分必要 */
+int anthy_utf8_to_ucs4(const char *s, int len, xchar *dst);
+/* 書いたバイト数を返す。dstにはlen * 4 + 1バイト必要 */
+int anthy_ucs4_to_utf8(const xchar *src, int len, char *dst);
 /**/
 char *anthy_conv_euc_to_utf8(const char *s);
 char *anthy_conv_utf8_to_euc(const char *s);
@@ -4,6 +4,7 @@
  * このコマンドは二つの機能を持っている。(-cオプションで制御)
  * (1) proccorpusの結果からテキスト形式で経験的確率の表を作る
  * (2) テキスト形式の表からバイナリ形式に変換する
+ *     素性の表については、完全ハッシュで引くための表も作る
  *
  * morphological-analyzerの出力には下記のマークが付けてある
  * ~ 候補の誤り
@@ -367,16 +368,269 @@ dump_input_info(FILE *ofp, struct input_info *m)
   input_set_output_feature_freq(ofp, m->seg_is);
 }
 
+/* 完全ハッシュの表も作る素性の表 */
+static const char *hashed_tables[] = {
+  "anthy.trans_info",
+  "anthy.cand_info",
+  NULL
+};
+
+/* 素性の表の一行の値の数 */
+#define LINE_SIZE (NR_EM_FEATURES + 2)
+/* 完全ハッシュの一つのバケツに入る行の数の平均 */
+#define LINES_PER_BUCKET 4
+/* 一つのバケツに試すseedの数の上限 */
+#define MAX_SEED (1 << 20)
+
+/* 完全ハッシュの表を作るために集めた行 */
+struct table_lines {
+  char fn[1024];
+  /* セクションのヘッダにある行数 */
+  int nr_declared;
+  int nr;
+  int size;
+  int *f;
+  /* 行の形が違うので表を作らない */
+  int broken;
+};
+
+/* 素性の組で行を比べる */
+static int
+compare_table_line(const void *p1, const void *p2)
+{
+  const int *l1 = p1, *l2 = p2;
+  int i;
+  for (i = 0; i < NR_EM_FEATURES; i++) {
+    if (l1[i] != l2[i]) {
+      return l1[i] - l2[i];
+    }
+  }
+  return 0;
+}
+
+struct bucket_order {
+  int bucket;
+  int size;
+};
+
+static int
+compare_bucket_order(const void *p1, const void *p2)
+{
+  const struct bucket_order *b1 = p1, *b2 = p2;
+  if (b1->size != b2->size) {
+    return b2->size - b1->size;
+  }
+  return b1->bucket - b2->bucket;
+}
+
+/*
+ * 行の多いバケツから順に、バケツ中の全ての行が空いているスロットに
+ * 入るseedを探す(hash and displace)
+ * 全てのバケツのseedが見つからなければ0を返す
+ */
+static int
+place_lines(struct table_lines *tl, int nr_buckets, int nr_slots,
+	    int *seeds, int *slot_of_line)
+{
+  int *start = calloc(nr_buckets + 1, sizeof(int));
+  int *members = malloc(sizeof(int) * (tl->nr + 1));
+  int *bucket_of = malloc(sizeof(int) * (tl->nr + 1));
+  struct bucket_order *order = malloc(sizeof(struct bucket_order) * nr_buckets);
+  char *used = calloc(nr_slots, 1);
+  int i, j, k, res = 1;
+
+  /* 行をバケツに分ける */
+  for (i = 0; i < tl->nr; i++) {
+    bucket_of[i] = anthy_feature_hash(&tl->f[i * LINE_SIZE], 0) % nr_buckets;
+    start[bucket_of[i] + 1] ++;
+  }
+  for (i = 0; i < nr_buckets; i++) {
+    order[i].bucket = i;
+    order[i].size = start[i + 1];
+    start[i + 1] += start[i];
+  }
+  for (i = 0; i < tl->nr; i++) {
+    members[start[bucket_of[i]] ++] = i;
+  }
+  for (i = nr_buckets; i > 0; i--) {
+    start[i] = start[i - 1];
+  }
+  start[0] = 0;
+  qsort(order, nr_buckets, sizeof(struct bucket_order), compare_bucket_order);
+
+  for (i = 0; i < nr_buckets && order[i].size > 0 && res; i++) {
+    int b = order[i].bucket;
+    int seed;
+    for (seed = 1; seed < MAX_SEED; seed++) {
+      for (j = start[b]; j < start[b + 1]; j++) {
+	int n = members[j];
+	int slot = anthy_feature_hash(&tl->f[n * LINE_SIZE], seed) % nr_slots;
+	if (used[slot]) {
+	  break;
+	}
+	used[slot] = 1;
+	slot_of_line[n] = slot;
+      }
+      if (j == start[b + 1]) {
+	break;
+      }
+      /* 入らなかったので、このバケツの分を空ける */
+      for (k = start[b]; k < j; k++) {
+	used[slot_of_line[members[k]]] = 0;
+      }
+    }
+    if (seed == MAX_SEED) {
+      res = 0;
+    }
+    seeds[b] = seed;
+  }
+
+  free(start);
+  free(members);
+  free(bucket_of);
+  free(order);
+  free(used);
+  return res;
+}
+
+/*
+ * 素性の表の行から完全ハッシュの表を作ってfn_hashに書き出す
+ * 表はホストのバイトオーダで書き、読む時に先頭の値で確認する
+ * 作れなかった場合もファイルは作り、読む側には使わせない
+ */
+static void
+write_feature_hash(struct table_lines *tl)
+{
+  char fn[1100];
+  FILE *ofp;
+  int header[FEATURE_HASH_HEADER];
+  int nr_buckets, nr_slots, i, nr;
+  int *seeds, *slot_of_line, *slots = NULL, *uniq;
+
+  sprintf(fn, "%s_hash", tl->fn);
+  ofp = fopen(fn, "wb");
+  if (!ofp) {
+    fprintf(stderr, "failed to open (%s)\n", fn);
+    exit (1);
+  }
+
+  /*
+   * 同じ素性の組の行が複数あれば、ソートした表をbsearchで引いた時に
+   * 見つかる行だけを残す
+   */
+  uniq = malloc(sizeof(int) * LINE_SIZE * (tl->nr + 1));
+  for (i = 0, nr = 0; i < tl->nr; i++) {
+    const int *line = &tl->f[i * LINE_SIZE];
+    if (nr > 0 && !memcmp(line, &uniq[(nr - 1) * LINE_SIZE],
+			  sizeof(int) * NR_EM_FEATURES)) {
+      continue;
+    }
+    line = bsearch(line, tl->f, tl->nr, sizeof(int) * LINE_SIZE,
+		   compare_table_line);
+    memcpy(&uniq[nr * LINE_SIZE], line, sizeof(int) * LINE_SIZE);
+    nr ++;
+  }
+  free(tl->f);
+  tl->f = uniq;
+  tl->nr = nr;
+
+  nr_buckets = tl->nr / LINES_PER_BUCKET + 1;
+  seeds = calloc(nr_buckets, sizeof(int));
+  slot_of_line = malloc(sizeof(int) * (tl->nr + 1));
+  /* 入らなければスロットを増やす */
+  for (nr_slots = tl->nr > 0 ? tl->nr : 1, i = 0; i < 8;
+       nr_slots += nr_slots / 16 + 1, i++) {
+    memset(seeds, 0, sizeof(int) * nr_buckets);
+    if (place_lines(tl, nr_buckets, nr_slots, seeds, slot_of_line)) {
+      break;
+    }
+  }
+
+  header[0] = FEATURE_HASH_MAGIC;
+  header[1] = tl->nr_declared;
+  header[2] = nr_buckets;
+  header[3] = nr_slots;
+  if (tl->broken || i == 8) {
+    fprintf(stderr, "failed to make perfect hash for (%s)\n", tl->fn);
+    header[0] = 0;
+    nr_slots = 0;
+  } else {
+    slots = malloc(sizeof(int) * LINE_SIZE * nr_slots);
+    for (i = 0; i < LINE_SIZE * nr_slots; i++) {
+      slots[i] = -1;
+    }
+    for (i = 0; i < tl->nr; i++) {
+      memcpy(&slots[slot_of_line[i] * LINE_SIZE], &tl->f[i * LINE_SIZE],
+	     sizeof(int) * LINE_SIZE);
+    }
+  }
+  fwrite(header, sizeof(int), FEATURE_HASH_HEADER, ofp);
+  if (nr_slots) {
+    fwrite(seeds, sizeof(int), nr_buckets, ofp);
+    fwrite(slots, sizeof(int), LINE_SIZE * nr_slots, ofp);
+  }
+  fclose(ofp);
+  free(seeds);
+  free(slot_of_line);
+  free(slots);
+}
+
 static void
-convert_line(FILE *ofp, char *buf)
+convert_line(FILE *ofp, char *buf, struct table_lines *tl)
 {
   char *tok;
+  int nr = 0;
+  int line[LINE_SIZE];
   tok = strtok(buf, ",");
   do {
     int n = atoi(tok);
     write_nl(ofp, n);
+    if (nr < LINE_SIZE) {
+      line[nr] = n;
+    }
+    nr ++;
     tok = strtok(NULL, ",");
   } while (tok);
+
+  if (!tl || tl->broken) {
+    return ;
+  }
+  if (nr != LINE_SIZE) {
+    tl->broken = 1;
+    return ;
+  }
+  if (tl->nr == tl->size) {
+    tl->size = tl->size ? tl->size * 2 : 1024;
+    tl->f = realloc(tl->f, sizeof(int) * LINE_SIZE * tl->size);
+  }
+  memcpy(&tl->f[tl->nr * LINE_SIZE], line, sizeof(line));
+  tl->nr ++;
+}
+
+static int
+is_hashed_table(const char *fn)
+{
+  int i;
+  for (i = 0; hashed_tables[i]; i++) {
+    if (!strcmp(hashed_tables[i], fn)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* セクションを閉じる、素性の表ならハッシュの表も書き出す */
+static void
+close_section(FILE *ofp, struct table_lines *tl)
+{
+  if (ofp) {
+    fclose(ofp);
+  }
+  if (tl) {
+    write_feature_hash(tl);
+    free(tl->f);
+    free(tl);
+  }
 }
 
 static void
@@ -384,6 +638,7 @@ convert_file(FILE *ifp)
 {
   char buf[1024];
   FILE *ofp = NULL;
+  struct table_lines *tl = NULL;
   while (fgets(buf, 1024, ifp)) {
     /**/
     if (buf[0] == '#') {
@@ -392,11 +647,10 @@ convert_file(FILE *ifp)
     if (!strncmp("section", buf, 7)) {
       int w, n, i;
       char fn[1024];
-      if (ofp) {
-	fclose(ofp);
-	ofp = NULL;
-      }
-      sscanf(buf, "section %s %d %d", fn, &w, &n);
+      close_section(ofp, tl);
+      ofp = NULL;
+      tl = NULL;
+      sscanf(buf, "section %1023s %d %d", fn, &w, &n);
       ofp = fopen(fn, "wb");
       if (!ofp) {
 	fprintf(stderr, "failed to open (%s)\n", fn);
@@ -407,13 +661,16 @@ convert_file(FILE *ifp)
       for (i = 0; i < NR_EM_FEATURES; i++) {
 	write_nl(ofp, 0);
       }
+      if (is_hashed_table(fn)) {
+	tl = calloc(1, sizeof(struct table_lines));
+	strcpy(tl->fn, fn);
+	tl->nr_declared = n;
+      }
     } else {
-      convert_line(ofp, buf);
+      convert_line(ofp, buf, tl);
     }
   }
-  if (ofp) {
-    fclose(ofp);
-  }
+  close_section(ofp, tl);
 }
 
 static void
@@ -411,7 +411,7 @@ init_indep_word_seq_tab (void)
 }
 
 /*
-    ネットワークバイトオーダーで4byte書き出す
+    辞書のバイトオーダーで4byte書き出す
 */
 static void
 write_nl(FILE* fp, uint32_t i)
@@ -7,6 +7,8 @@
  *
  * entry_num個のファイルに対して
  *  0: entry_num ファイルの個数
+ *     各ファイルがリトルエンディアンで書かれていれば
+ *     ANTHY_DIC_LITTLE_ENDIANとの論理和
  *  1: 各ファイルの情報
  *    n * 3    : name_offset
  *    n * 3 + 1: strlen(key)
@@ -16,6 +18,9 @@
  *  [file]*entry_num
  *   : 各ファイルの内容
  *
+ * 各ファイルはそれを作ったホストのバイトオーダで書かれているが、
+ * ここまでの表はビッグエンディアンで書く
+ *
  * Copyright (C) 2005-2006 YOSHIDA Yuichi
  * Copyright (C) 2006-2007 TABATA Yusuke
  *
@@ -54,8 +59,10 @@ struct header_entry {
 static void
 write_nl(FILE* fp, int i)
 {
-  i = anthy_dic_htonl(i);
-  fwrite(&i, sizeof(int), 1, fp);
+  fputc((i >> 24) & 255, fp);
+  fputc((i >> 16) & 255, fp);
+  fputc((i >> 8) & 255, fp);
+  fputc(i & 255, fp);
 }
 
 
@@ -95,8 +102,8 @@ write_header(FILE* fp, const char *prefix,
   contents_offset =
     (contents_offset + SECTION_ALIGNMENT - 1) & (-SECTION_ALIGNMENT);
 
-  /* ファイルの数 */
-  write_nl(fp, entry_num);
+  /* ファイルの数とバイトオーダ */
+  write_nl(fp, entry_num | anthy_dic_host_order());
 
   /* 各ファイルの場所を出力する */
   for (i = 0; i < entry_num; ++i) {
@@ -219,6 +226,8 @@ main(int argc, char* argv[])
     /* Following are optional entries */
     {"trans_info", "/mkanthydic/anthy.trans_info"},
     {"cand_info", "/mkanthydic/anthy.cand_info"},
+    {"trans_info_hash", "/mkanthydic/anthy.trans_info_hash"},
+    {"cand_info_hash", "/mkanthydic/anthy.cand_info_hash"},
     {"weak_words", "/mkanthydic/anthy.weak_words"},
     {"corpus_bucket", "/mkanthydic/anthy.corpus_bucket"},
     {"corpus_array", "/mkanthydic/anthy.corpus_array"},
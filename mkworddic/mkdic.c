@@ -13,7 +13,7 @@
  *
  * 読み -> 単語、単語、、
  *
- * 辞書ファイルはネットワークバイトオーダーを用いる。
+ * 辞書ファイルは作ったホストのバイトオーダーを用いる。
  *
  * 辞書ファイルは複数のセクションから構成されている
  *  0 ヘッダ 16*4 bytes
@@ -23,6 +23,8 @@
  *  5 ページのインデックス
  *  6 用例辞書(?)
  *  7 読み hash
+ *  8 各ページの先頭の読み
+ *  9 読みのダブル配列trie
  *
  * source 元の辞書ファイル
  * file_dic 生成するファイル
@@ -82,9 +84,11 @@ static const char *progname;
 /* writewords.cからアクセスするために、global変数 */
 FILE *yomi_entry_index_out, *yomi_entry_out;
 FILE *page_out, *page_index_out;
+FILE *page_key_out;
 /**/
 static FILE *uc_out;
 static FILE *yomi_hash_out;
+static FILE *yomi_trie_out;
 /* ハッシュの衝突の数、統計情報 */
 static int yomi_hash_collision;
 
@@ -99,6 +103,8 @@ struct file_section {
   {&page_index_out, NULL},
   {&uc_out, NULL},
   {&yomi_hash_out, NULL},
+  {&page_key_out, NULL},
+  {&yomi_trie_out, NULL},
   {NULL, NULL},
 };
 
@@ -188,7 +194,7 @@ flush_output_files (void)
   }
 }
 
-/* ネットワークbyteorderで4bytes書き出す */
+/* 辞書のbyteorderで4bytes書き出す */
 void
 write_nl(FILE* fp, uint32_t i)
 {
@@ -986,6 +992,8 @@ complete_words(struct mkdic_stat *mds)
 
   /* 読みハッシュを作る */
   mk_yomi_hash(yomi_hash_out, &mds->yl);
+  /* 読みのtrieを作る */
+  mk_yomi_trie(yomi_trie_out, &mds->yl);
 }
 
 static void
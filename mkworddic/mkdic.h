@@ -94,4 +94,7 @@ void output_word_dict(struct yomi_entry_list *yl);
 /* calcfreq.c */
 void calc_freq(struct yomi_entry_list *yl);
 
+/* mktrie.c */
+void mk_yomi_trie(FILE *fp, struct yomi_entry_list *yl);
+
 #endif
@@ -0,0 +1,240 @@
+/*
+ * 読みのダブル配列trieを作る
+ *
+ * ファイル辞書中の全ての読みを一つのtrieに格納し、
+ * ある位置から始まる読みを一度の走査で列挙できるようにする
+ * 葉には読みのインデックス(ページ中の読みの通し番号)を持たせる
+ *
+ * mk_yomi_trie()が呼び出される
+ */
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <anthy/anthy.h>
+#include <anthy/word_dic.h>
+#include "mkdic.h"
+
+#define UNUSED_UNIT -1
+
+struct trie_builder {
+  /* 読みの文字の表(昇順)、表中の順位+1が文字のコード */
+  xchar *chars;
+  int nr_chars;
+  /* コードに変換した読み */
+  int **keys;
+  int *lens;
+  /* ダブル配列 */
+  int *base;
+  int *check;
+  int size;
+  int nr_units;
+  /* これより前のユニットは全て使われている */
+  int first_free;
+};
+
+static int
+compare_xchar(const void *p1, const void *p2)
+{
+  const xchar *c1 = p1;
+  const xchar *c2 = p2;
+  if (*c1 < *c2) {
+    return -1;
+  }
+  return *c1 > *c2;
+}
+
+static int
+get_code(struct trie_builder *tb, xchar xc)
+{
+  xchar *p = bsearch(&xc, tb->chars, tb->nr_chars, sizeof(xchar),
+		     compare_xchar);
+  assert(p);
+  return (p - tb->chars) + 1;
+}
+
+/* 読みに使われている文字の表を作り、読みをコードの列にする */
+static void
+make_keys(struct trie_builder *tb, struct yomi_entry_list *yl)
+{
+  int i, j, nr = 0;
+  for (i = 0; i < yl->nr_valid_entries; i++) {
+    nr += yl->ye_array[i]->index_xstr->len;
+  }
+  tb->chars = malloc(sizeof(xchar) * (nr + 1));
+  for (i = 0, nr = 0; i < yl->nr_valid_entries; i++) {
+    xstr *xs = yl->ye_array[i]->index_xstr;
+    memcpy(&tb->chars[nr], xs->str, sizeof(xchar) * xs->len);
+    nr += xs->len;
+  }
+  qsort(tb->chars, nr, sizeof(xchar), compare_xchar);
+  tb->nr_chars = 0;
+  for (i = 0; i < nr; i++) {
+    if (tb->nr_chars == 0 || tb->chars[tb->nr_chars - 1] != tb->chars[i]) {
+      tb->chars[tb->nr_chars] = tb->chars[i];
+      tb->nr_chars ++;
+    }
+  }
+
+  tb->keys = malloc(sizeof(int *) * yl->nr_valid_entries);
+  tb->lens = malloc(sizeof(int) * yl->nr_valid_entries);
+  for (i = 0; i < yl->nr_valid_entries; i++) {
+    xstr *xs = yl->ye_array[i]->index_xstr;
+    tb->lens[i] = xs->len;
+    tb->keys[i] = malloc(sizeof(int) * (xs->len + 1));
+    for (j = 0; j < xs->len; j++) {
+      tb->keys[i][j] = get_code(tb, xs->str[j]);
+    }
+  }
+}
+
+static void
+ensure_size(struct trie_builder *tb, int size)
+{
+  int i, new_size;
+  if (size <= tb->size) {
+    return ;
+  }
+  new_size = tb->size ? tb->size : 1024;
+  while (new_size < size) {
+    new_size *= 2;
+  }
+  tb->base = realloc(tb->base, sizeof(int) * new_size);
+  tb->check = realloc(tb->check, sizeof(int) * new_size);
+  for (i = tb->size; i < new_size; i++) {
+    tb->base[i] = 0;
+    tb->check[i] = UNUSED_UNIT;
+  }
+  tb->size = new_size;
+}
+
+/* 全ての子を置くことのできるbaseを探す */
+static int
+find_base(struct trie_builder *tb, int *codes, int nr)
+{
+  int pos, b, i;
+  for (pos = tb->first_free; ; pos++) {
+    ensure_size(tb, pos + 1);
+    if (tb->check[pos] != UNUSED_UNIT) {
+      if (pos == tb->first_free) {
+	tb->first_free ++;
+      }
+      continue;
+    }
+    b = pos - codes[0];
+    if (b < 1) {
+      continue;
+    }
+    ensure_size(tb, b + codes[nr - 1] + 1);
+    for (i = 1; i < nr; i++) {
+      if (tb->check[b + codes[i]] != UNUSED_UNIT) {
+	break;
+      }
+    }
+    if (i == nr) {
+      return b;
+    }
+  }
+}
+
+/* 読み[from, to)の深さdepthより下の部分をnodeの子として置く */
+static void
+build_node(struct trie_builder *tb, int node, int from, int to, int depth)
+{
+  int *codes = malloc(sizeof(int) * (tb->nr_chars + 1));
+  int *starts = malloc(sizeof(int) * (tb->nr_chars + 2));
+  int i, nr = 0, b;
+
+  /* 読みはソートされているので、子は終端(コード0)から昇順に並ぶ */
+  for (i = from; i < to; i++) {
+    int c = depth < tb->lens[i] ? tb->keys[i][depth] : 0;
+    if (nr == 0 || codes[nr - 1] != c) {
+      codes[nr] = c;
+      starts[nr] = i;
+      nr ++;
+    }
+  }
+  starts[nr] = to;
+
+  b = find_base(tb, codes, nr);
+  tb->base[node] = b;
+  for (i = 0; i < nr; i++) {
+    tb->check[b + codes[i]] = node;
+  }
+  if (b + codes[nr - 1] + 1 > tb->nr_units) {
+    tb->nr_units = b + codes[nr - 1] + 1;
+  }
+
+  for (i = 0; i < nr; i++) {
+    if (codes[i] == 0) {
+      /* 終端には読みのインデックスを負の値で格納する */
+      tb->base[b] = -starts[i] - 1;
+    } else {
+      build_node(tb, b + codes[i], starts[i], starts[i + 1], depth + 1);
+    }
+  }
+  free(codes);
+  free(starts);
+}
+
+static void
+write_trie(FILE *fp, struct trie_builder *tb)
+{
+  int i;
+  write_nl(fp, tb->nr_units);
+  write_nl(fp, tb->nr_chars);
+  for (i = 0; i < tb->nr_chars; i++) {
+    write_nl(fp, tb->chars[i]);
+  }
+  for (i = 0; i < tb->nr_units; i++) {
+    write_nl(fp, tb->base[i]);
+    write_nl(fp, tb->check[i]);
+  }
+}
+
+/* 読みのダブル配列trieを作ってfpに出力する */
+void
+mk_yomi_trie(FILE *fp, struct yomi_entry_list *yl)
+{
+  struct trie_builder tb;
+  int i;
+
+  memset(&tb, 0, sizeof(tb));
+  make_keys(&tb, yl);
+
+  /* 根はユニット0 */
+  ensure_size(&tb, 1);
+  tb.check[0] = 0;
+  tb.nr_units = 1;
+  tb.first_free = 1;
+  if (yl->nr_valid_entries > 0) {
+    build_node(&tb, 0, 0, yl->nr_valid_entries, 0);
+  }
+  write_trie(fp, &tb);
+  printf("generated yomi trie (%d units, %d chars)\n",
+	 tb.nr_units, tb.nr_chars);
+
+  for (i = 0; i < yl->nr_valid_entries; i++) {
+    free(tb.keys[i]);
+  }
+  free(tb.keys);
+  free(tb.lens);
+  free(tb.chars);
+  free(tb.base);
+  free(tb.check);
+}
@@ -32,6 +32,7 @@
 #include "mkdic.h"
 
 extern FILE *page_out, *page_index_out;
+extern FILE *page_key_out;
 extern FILE *yomi_entry_index_out, *yomi_entry_out;
 
 static int
@@ -175,6 +176,21 @@ begin_new_page(int i)
   write_nl(page_index_out, i);
 }
 
+/* ページの先頭の読みを固定長のxcharの列として出力する */
+static void
+output_page_key(xstr *xs)
+{
+  int i;
+  write_nl(page_key_out, xs->len);
+  for (i = 0; i < PAGE_KEY_WIDTH; i++) {
+    if (i < xs->len) {
+      write_nl(page_key_out, xs->str[i]);
+    } else {
+      write_nl(page_key_out, 0);
+    }
+  }
+}
+
 static void
 output_entry_index(int i)
 {
@@ -195,6 +211,10 @@ generate_yomi_to_offset_map(struct yomi_entry_list *yl)
 
   /* まず、最初の読みに対するエントリのインデックスを書き出す */
   write_nl(page_index_out, page_index);
+  /* ページの先頭の読みの表のヘッダ */
+  write_nl(page_key_out,
+	   (yl->nr_valid_entries + WORDS_PER_PAGE - 1) / WORDS_PER_PAGE);
+  write_nl(page_key_out, PAGE_KEY_WIDTH);
   /**/
   for (i = 0; i < yl->nr_valid_entries; i++) {
     ye = yl->ye_array[i];
@@ -204,6 +224,9 @@ generate_yomi_to_offset_map(struct yomi_entry_list *yl)
       prev = NULL;
       begin_new_page(page_index);
     }
+    if ((i % WORDS_PER_PAGE) == 0) {
+      output_page_key(ye->index_xstr);
+    }
 
     /* 読みに対応する情報を出力する */
     page_index += output_diff(prev, ye->index_xstr, yl->index_encoding);
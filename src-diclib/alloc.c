@@ -8,7 +8,13 @@
  *
  * dtor: destructor
  *
- * ページ中のフリーなchunkは単方向リストに継がれている
+ * ページはPAGE_SIZEの境界に揃えて確保するので、オブジェクトのアドレスの
+ * 下位のビットを落とせばそれを含むページが求まる。
+ * 各allocatorの空いているchunkは単方向リスト(free_list)に継がれていて、
+ * 確保と解放はページの数によらない時間で行う。
+ *
+ * 複数のスレッドから使われるので、allocatorのリストと
+ * 各allocatorはそれぞれのmutexで保護する
  *
  */
 /*
@@ -30,13 +36,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 #include <anthy/alloc.h>
 #include <anthy/logger.h>
+#include <anthy/thread.h>
 
 /**/
 #define PAGE_MAGIC 0x12345678
+/* ページはこの大きさの境界に揃えて確保するので、2の冪でなくてはならない */
 #define PAGE_SIZE 2048
+#define PAGE_MASK (~((size_t)PAGE_SIZE - 1))
 
 /* ページ使用量の合計、デバッグの時等に用いる */
 static int nr_pages;
@@ -49,14 +61,21 @@ struct chunk {
 /* CPUもしくは、OSの種類によって要求されるアライメント */
 #define CHUNK_ALIGN (sizeof(double))
 
+/* 空いているchunkのstorageにはfree_listの次の要素へのポインタを置く */
+struct free_chunk {
+  struct free_chunk *next;
+};
+
 /*
  * pageのstorage中には
  * max_obj = (PAGE_SIZE - PAGE_HEADER_SIZE) / (size + CHUNK_HEADER_SIZE)個の
- * スロットがある。そのうちuse_count個のスロットがfree_listにつながっている、
- * もしくは使用中である。
+ * スロットがある。そのうち使用中のものはビットマップで1になっていて、
+ * 残りはallocatorのfree_listにつながっている。
  */
 struct page {
   int magic;
+  /* このページを持つallocator */
+  struct allocator_priv *ator;
   struct page *prev, *next;
 };
 
@@ -65,6 +84,8 @@ struct page {
 #define PAGE_AVAIL(p) ((unsigned char*)p + sizeof(struct page))
 #define PAGE_STORAGE(a, p) (((unsigned char *)p) + (a->storage_offset))
 #define PAGE_CHUNK(a, p, i) (struct chunk*)(&PAGE_STORAGE(a, p)[((a->size) + CHUNK_HEADER_SIZE) * (i)])
+/* chunkを含むページ */
+#define CHUNK_PAGE(c) ((struct page *)((size_t)(c) & PAGE_MASK))
 
 
 /**/
@@ -81,13 +102,19 @@ struct allocator_priv {
   int storage_offset;
   /* このallocatorが使用しているページのリスト */
   struct page page_list;
+  /* 空いているchunkのリスト */
+  struct free_chunk *free_list;
   /* allocatorのリスト */
   struct allocator_priv *next;
   /* sfreeした際に呼ばれる */
   void (*dtor)(void *);
+  /* ページリストとfree_listを保護する */
+  anthy_mutex_t lock;
 };
 
 static struct allocator_priv *allocator_list;
+/* allocator_listとnr_pagesを保護する */
+static anthy_mutex_t allocator_list_lock = ANTHY_MUTEX_INITIALIZER;
 
 static int bit_test(unsigned char* bits, int pos)
 {
@@ -118,38 +145,62 @@ get_chunk_address(void *s)
   return (struct chunk*) ((unsigned char*)s - CHUNK_HEADER_SIZE);
 }
 
+/* PAGE_SIZEの境界に揃ったメモリを確保する */
+static void *
+alloc_aligned_page(void)
+{
+#ifdef _WIN32
+  return _aligned_malloc(PAGE_SIZE, PAGE_SIZE);
+#else
+  void *p;
+  if (posix_memalign(&p, PAGE_SIZE, PAGE_SIZE)) {
+    return NULL;
+  }
+  return p;
+#endif
+}
+
+static void
+free_aligned_page(void *p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
 // @return If failed, NULL.
 static struct page *
 alloc_page(struct allocator_priv *ator)
 {
   struct page *p;
   unsigned char* avail;
+  int i;
 
-  p = (struct page*) malloc(PAGE_SIZE);
+  p = (struct page*) alloc_aligned_page();
   if (!p)
     return NULL;
 
   p->magic = PAGE_MAGIC;
+  p->ator = ator;
   avail = PAGE_AVAIL(p);
   memset(avail, 0, (ator->max_num >> 3) + 1);
+  /* 先頭のchunkから使われるように、後ろから順にfree_listにつなぐ */
+  for (i = ator->max_num - 1; i >= 0; i--) {
+    struct free_chunk *fc = (struct free_chunk *)(PAGE_CHUNK(ator, p, i))->storage;
+    fc->next = ator->free_list;
+    ator->free_list = fc;
+  }
   return p;
 }
 
-static struct chunk *
-get_chunk_from_page(allocator a, struct page *p)
+/* ページ中の何番目のオブジェクトかを求める */
+static int
+get_chunk_index(allocator a, struct page *p, struct chunk *c)
 {
-  int i;
-
-  int num = a->max_num;
-  unsigned char* avail = PAGE_AVAIL(p);
-
-  for (i = 0; i < num; ++i) {
-    if (bit_test(avail, i) == 0) {
-      bit_set(avail, i, 1);
-      return PAGE_CHUNK(a, p, i);
-    }
-  }
-  return NULL;
+  return ((unsigned char*)c - PAGE_STORAGE(a, p)) /
+    (a->size + CHUNK_HEADER_SIZE);
 }
 
 static int
@@ -183,6 +234,9 @@ anthy_create_allocator(int size, void (*dtor)(void *))
     //exit(1);
     abort();
   }
+  if (size < (int)sizeof(struct free_chunk)) {
+    size = roundup_align(sizeof(struct free_chunk));
+  }
   a = (allocator) malloc(sizeof(*a));
   if (!a) {
     anthy_log(0, "Fatal error: Failed to allocate memory.\n");
@@ -195,8 +249,12 @@ anthy_create_allocator(int size, void (*dtor)(void *))
   a->dtor = dtor;
   a->page_list.next = &a->page_list;
   a->page_list.prev = &a->page_list;
+  a->free_list = NULL;
+  anthy_mutex_init(&a->lock);
+  anthy_mutex_lock(&allocator_list_lock);
   a->next = allocator_list;
   allocator_list = a;
+  anthy_mutex_unlock(&allocator_list_lock);
   return a;
 }
 
@@ -222,9 +280,12 @@ anthy_free_allocator_internal(allocator a)
 	}
       }
     }
-    free(p);
+    free_aligned_page(p);
+    anthy_mutex_lock(&allocator_list_lock);
     nr_pages--;
+    anthy_mutex_unlock(&allocator_list_lock);
   }
+  anthy_mutex_destroy(&a->lock);
   free(a);
 }
 
@@ -233,6 +294,7 @@ anthy_free_allocator(allocator a)
 {
   allocator a0, *a_prev_p;
 
+  anthy_mutex_lock(&allocator_list_lock);
   /* リストからaの前の要素を見付ける */
   a_prev_p = &allocator_list;
   for (a0 = allocator_list; a0; a0 = a0->next) {
@@ -243,77 +305,94 @@ anthy_free_allocator(allocator a)
   }
   /* aをリストから外す */
   *a_prev_p = a->next;
+  anthy_mutex_unlock(&allocator_list_lock);
 
   anthy_free_allocator_internal(a);
 }
 
-void *
-anthy_smalloc(allocator a)
+static void *
+do_smalloc(allocator a)
 {
   struct page *p;
   struct chunk *c;
-
-  /* 空いてるページをさがす */
-  for (p = a->page_list.next; p != &a->page_list; p = p->next) {
-    c = get_chunk_from_page(a, p);
-    if (c) {
-      return c->storage;
+  struct free_chunk *fc;
+
+  if (!a->free_list) {
+    /* ページを作って、リンクする */
+    p = alloc_page(a);
+    if (!p) {
+      anthy_log(0, "Fatal error: Failed to allocate memory.\n");
+      return NULL;
     }
+    anthy_mutex_lock(&allocator_list_lock);
+    nr_pages++;
+    anthy_mutex_unlock(&allocator_list_lock);
+
+    p->next = a->page_list.next;
+    p->prev = &a->page_list;
+    a->page_list.next->prev = p;
+    a->page_list.next = p;
   }
-  /* ページを作って、リンクする */
-  p = alloc_page(a);
-  if (!p) {
-    anthy_log(0, "Fatal error: Failed to allocate memory.\n");
-    return NULL;
-  }
-  nr_pages++;
-
-  p->next = a->page_list.next;
-  p->prev = &a->page_list;
-  a->page_list.next->prev = p;
-  a->page_list.next = p;
-  /* やり直す */
-  return anthy_smalloc(a);
+  /* 空いているchunkを取り出す */
+  fc = a->free_list;
+  a->free_list = fc->next;
+  c = get_chunk_address(fc);
+  p = CHUNK_PAGE(c);
+  bit_set(PAGE_AVAIL(p), get_chunk_index(a, p, c), 1);
+  return c->storage;
+}
+
+void *
+anthy_smalloc(allocator a)
+{
+  void *res;
+  anthy_mutex_lock(&a->lock);
+  res = do_smalloc(a);
+  anthy_mutex_unlock(&a->lock);
+  return res;
 }
 
 void
 anthy_sfree(allocator a, void *ptr)
 {
   struct chunk *c = get_chunk_address(ptr);
-  struct page *p;
+  struct page *p = CHUNK_PAGE(c);
+  struct free_chunk *fc;
   int index;
-  /* ポインタの含まれるページを探す */
-  for (p = a->page_list.next; p != &a->page_list; p = p->next) {
-    if ((unsigned char*)p < (unsigned char*)c &&
-        (unsigned char*)c < (unsigned char*)p + PAGE_SIZE) {
-      break;
-    }
-  }
 
   /* sanity check */
-  if (!p || p->magic != PAGE_MAGIC) {
+  if (p->magic != PAGE_MAGIC || p->ator != a) {
     anthy_log(0, "sfree()ing Invalid Object\n");
     abort();
   }
 
-  /* ページ中の何番目のオブジェクトかを求める */
-  index = ((unsigned char*)c - PAGE_STORAGE(a, p)) /
-          (a->size + CHUNK_HEADER_SIZE);
-  bit_set(PAGE_AVAIL(p), index, 0);
-
-  /* デストラクタを呼ぶ */
+  /* デストラクタを呼ぶ
+   * 他のスレッドに再利用されないように、スロットを空ける前に呼ぶ */
   if (a->dtor) {
     a->dtor(ptr);
   }
+
+  anthy_mutex_lock(&a->lock);
+  index = get_chunk_index(a, p, c);
+  bit_set(PAGE_AVAIL(p), index, 0);
+
+  /* 空いたchunkをfree_listの先頭につなぎ、次のsmallocで使う */
+  fc = (struct free_chunk *)c->storage;
+  fc->next = a->free_list;
+  a->free_list = fc;
+  anthy_mutex_unlock(&a->lock);
 }
 
 void
 anthy_quit_allocator(void)
 {
   allocator a, a_next;
-  for (a = allocator_list; a; a = a_next) {
+  anthy_mutex_lock(&allocator_list_lock);
+  a = allocator_list;
+  allocator_list = NULL;
+  anthy_mutex_unlock(&allocator_list_lock);
+  for (; a; a = a_next) {
     a_next = a->next;
     anthy_free_allocator_internal(a);
   }
-  allocator_list = NULL;
 }
@@ -0,0 +1,164 @@
+/*
+ * 変換一回分のオブジェクトを確保するアリーナ
+ *
+ * ブロックの列から先頭から順に切り出して確保する。
+ * resetの際にブロックは解放せずに残しておき、次の変換で使う。
+ * 複数のブロックを使った場合は、resetの際にそれらを合計した大きさの
+ * 一つのブロックに作り直すので、同じような長さの変換を繰り返す間は
+ * mallocを呼ばない。
+ *
+ * 一つのアリーナは一つの変換コンテキストからしか使わないので、
+ * ロックはしない
+ */
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+#include <stdlib.h>
+
+#include <anthy/arena.h>
+#include <anthy/logger.h>
+
+/* 最初に確保するブロックの大きさ */
+#define DEFAULT_BLOCK_SIZE (16 * 1024)
+/* CPUもしくは、OSの種類によって要求されるアライメント */
+#define ARENA_ALIGN (sizeof(double))
+
+struct arena_block {
+  struct arena_block *next;
+  /* 領域の大きさと使用中のバイト数 */
+  size_t size;
+  size_t used;
+  /* この後ろに領域が続く */
+  double storage[1];
+};
+
+#define BLOCK_HEADER_SIZE ((size_t)&((struct arena_block *)0)->storage)
+#define BLOCK_STORAGE(b) ((unsigned char *)(b) + BLOCK_HEADER_SIZE)
+
+struct anthy_arena {
+  /* ブロックのリストの先頭と、現在切り出しているブロック */
+  struct arena_block *head;
+  struct arena_block *cur;
+};
+
+static size_t
+roundup_align(size_t size)
+{
+  return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+static struct arena_block *
+alloc_block(size_t size)
+{
+  struct arena_block *b = malloc(BLOCK_HEADER_SIZE + size);
+  if (!b) {
+    anthy_log(0, "Fatal error: Failed to allocate memory.\n");
+    abort();
+  }
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+struct anthy_arena *
+anthy_create_arena(void)
+{
+  struct anthy_arena *a = malloc(sizeof(struct anthy_arena));
+  if (!a) {
+    anthy_log(0, "Fatal error: Failed to allocate memory.\n");
+    abort();
+  }
+  a->head = alloc_block(DEFAULT_BLOCK_SIZE);
+  a->cur = a->head;
+  return a;
+}
+
+static void
+free_blocks(struct arena_block *b)
+{
+  struct arena_block *next;
+  for (; b; b = next) {
+    next = b->next;
+    free(b);
+  }
+}
+
+void
+anthy_free_arena(struct anthy_arena *a)
+{
+  if (!a) {
+    return ;
+  }
+  free_blocks(a->head);
+  free(a);
+}
+
+void *
+anthy_arena_alloc(struct anthy_arena *a, size_t size)
+{
+  struct arena_block *b = a->cur;
+  void *p;
+
+  size = roundup_align(size);
+  while (b->used + size > b->size) {
+    if (!b->next) {
+      /* ブロックを足す */
+      size_t new_size = b->size * 2;
+      if (new_size < size) {
+	new_size = roundup_align(size);
+      }
+      b->next = alloc_block(new_size);
+    }
+    b = b->next;
+    /* markより後ろのブロックは空になっている */
+    b->used = 0;
+  }
+  a->cur = b;
+  p = BLOCK_STORAGE(b) + b->used;
+  b->used += size;
+  return p;
+}
+
+void
+anthy_arena_reset(struct anthy_arena *a)
+{
+  if (a->head->next) {
+    /* 全部が入る大きさの一つのブロックにする */
+    struct arena_block *b;
+    size_t total = 0;
+    for (b = a->head; b; b = b->next) {
+      total += b->size;
+    }
+    free_blocks(a->head);
+    a->head = alloc_block(total);
+  }
+  a->head->used = 0;
+  a->cur = a->head;
+}
+
+void
+anthy_arena_mark(struct anthy_arena *a, struct anthy_arena_mark *m)
+{
+  m->block = a->cur;
+  m->used = a->cur->used;
+}
+
+void
+anthy_arena_release(struct anthy_arena *a, struct anthy_arena_mark *m)
+{
+  a->cur = m->block;
+  a->cur->used = m->used;
+}
@@ -75,9 +75,9 @@ val_ent_dtor(void *p)
   }
 }
 
-/** 変数名に対応するval_entを取得する */
+/** 変数名に対応するval_entを探す、無ければNULLを返す */
 static struct val_ent *
-find_val_ent(const char *v)
+lookup_val_ent(const char *v)
 {
   struct val_ent *e;
   for (e = ent_list; e; e = e->next) {
@@ -85,6 +85,17 @@ find_val_ent(const char *v)
       return e;
     }
   }
+  return NULL;
+}
+
+/** 変数名に対応するval_entを取得する、無ければ作る */
+static struct val_ent *
+find_val_ent(const char *v)
+{
+  struct val_ent *e = lookup_val_ent(v);
+  if (e) {
+    return e;
+  }
   e = (struct val_ent*) malloc(sizeof(struct val_ent));
   if (!e)
     return NULL;
@@ -294,11 +305,11 @@ anthy_conf_free(void)
   confIsInit = 0;
 }
 
+/* 変換中に複数のスレッドから呼ばれるので、リストを変更しない */
 const char *
 anthy_conf_get_str(const char *var)
 {
   struct val_ent *e;
-  e = find_val_ent(var);
-  assert(e);
-  return e->val;
+  e = lookup_val_ent(var);
+  return e ? e->val : NULL;
 }
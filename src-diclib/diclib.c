@@ -1,11 +1,3 @@
-
-#ifndef _WIN32
-  #include <arpa/inet.h>
-#else
-  #define STRICT 1
-  #include <winsock2.h>
-#endif
-
 /**/
 #include <anthy/diclib.h>
 #include <anthy/xstr.h>
@@ -17,13 +9,24 @@
 uint32_t
 anthy_dic_ntohl(uint32_t a)
 {
-  return ntohl(a);
+  return anthy_dic_to_host(a, anthy_dic_swapped());
 }
 
+/* 辞書はホストのバイトオーダで書く */
 uint32_t
 anthy_dic_htonl(uint32_t a)
 {
-  return htonl(a);
+  return a;
+}
+
+uint32_t
+anthy_dic_host_order(void)
+{
+  const uint32_t one = 1;
+  if (*(const unsigned char *)&one) {
+    return ANTHY_DIC_LITTLE_ENDIAN;
+  }
+  return 0;
 }
 
 int
@@ -18,8 +18,33 @@
 #include <anthy/alloc.h>
 #include <anthy/conf.h>
 #include <anthy/logger.h>
+#include <anthy/phase.h>
 #include "diclib_inner.h"
 
+/* copyの際にバッファを揃える境界(x86-64のhugepageの大きさ) */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * 辞書の読み込み方、設定変数DIC_LOAD_MODEで選ぶ
+ * mmap以外は起動を遅くしてメモリを使う代わりに、最初の変換や
+ * メモリが足りなくなった後の変換でページフォルトを待たない
+ */
+enum load_mode {
+  /* 必要になったページから読む */
+  LOAD_MMAP,
+  /* mapする際に全てのページを読み込む */
+  LOAD_POPULATE,
+  /* 全てのページを読み込んでメモリ上に固定する */
+  LOAD_LOCK,
+  /* hugepageの境界に揃えたバッファに複写する */
+  LOAD_COPY,
+  NR_LOAD_MODES
+};
+
+static const char *load_mode_names[NR_LOAD_MODES] = {
+  "mmap", "populate", "lock", "copy"
+};
+
 /**
    複数セクションがリンクされた辞書
  */
@@ -27,6 +52,18 @@ struct file_dic
 {
   void *ptr;
   size_t size;
+  /* セクションのバイトオーダがホストと違う */
+  int swap;
+  enum load_mode mode;
+  /* copyの際にmallocした領域、ptrはこの中の揃えた位置を指す */
+  void *buf;
+  /* 読み込みにかかった時間(ナノ秒) */
+  long long load_ns;
+  /* 初期化の際に引いておいたセクションの場所 */
+  struct {
+    char *ptr;
+    size_t size;
+  } sections[NR_ANTHY_DIC_SECTIONS];
 #ifdef _WIN32
   HANDLE hMap;
 #endif
@@ -35,33 +72,229 @@ struct file_dic
 static struct file_dic fdic;
 
 
+/* 先頭のセクションの表はバイトオーダによらずビッグエンディアンで書く */
+static uint32_t
+read_header_word(const char *p)
+{
+  const unsigned char *c = (const unsigned char *)p;
+  return ((uint32_t)c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+}
+
+int
+anthy_dic_swapped(void)
+{
+  return fdic.swap;
+}
+
+/*
+ * セクションの名前と、変換の度に引くセクションかどうか
+ * 単語辞書の中は引き方が部分ごとに違うので、word_lookup.cで指定する
+ */
+static const struct {
+  const char *name;
+  int hot;
+} section_info[NR_ANTHY_DIC_SECTIONS] = {
+  {"word_dic", 0},
+  {"dep_dic", 1},
+  {"trans_info", 1},
+  {"trans_info_hash", 1},
+  {"cand_info", 1},
+  {"cand_info_hash", 1},
+  {"weak_words", 1},
+  {"corpus_bucket", 1},
+  {"corpus_array", 1},
+};
+
+void *
+anthy_file_dic_section(enum anthy_dic_section id)
+{
+  return fdic.sections[id].ptr;
+}
+
+size_t
+anthy_file_dic_section_size(enum anthy_dic_section id)
+{
+  return fdic.sections[id].size;
+}
+
 /**
  * @return the pointer to contents. If failed, NULL.
  */
 void*
 anthy_file_dic_get_section(const char* section_name)
 {
+  int i;
   assert(section_name);
+  for (i = 0; i < NR_ANTHY_DIC_SECTIONS; i++) {
+    if (!strcmp(section_name, section_info[i].name)) {
+      return fdic.sections[i].ptr;
+    }
+  }
+  return NULL;
+}
+
+/* 先頭のセクションの表を引いて、各セクションの場所と大きさを覚える */
+static int
+resolve_sections(void)
+{
+  const char *head = (const char *)fdic.ptr;
+  uint32_t entry_num = read_header_word(head) & ~ANTHY_DIC_LITTLE_ENDIAN;
+  uint32_t i, j;
+
+  memset(fdic.sections, 0, sizeof(fdic.sections));
+  if (fdic.size < 4 || entry_num > (fdic.size - 4) / 12) {
+    return -1;
+  }
+  for (i = 0; i < entry_num; i++) {
+    const char *p = &head[4 + i * 12];
+    uint32_t name_offset = read_header_word(p);
+    uint32_t key_len = read_header_word(p + 4);
+    uint32_t contents_offset = read_header_word(p + 8);
+    size_t end = fdic.size;
+    int id;
+    if (name_offset > fdic.size || key_len > fdic.size - name_offset ||
+	contents_offset > fdic.size) {
+      return -1;
+    }
+    /* 次のセクションの先頭までをこのセクションとする */
+    for (j = 0; j < entry_num; j++) {
+      uint32_t o = read_header_word(&head[4 + j * 12 + 8]);
+      if (o > contents_offset && o < end) {
+	end = o;
+      }
+    }
+    for (id = 0; id < NR_ANTHY_DIC_SECTIONS; id++) {
+      /* "trans_info_hash"を"trans_info"と一致させない */
+      if (strlen(section_info[id].name) == key_len &&
+	  !memcmp(section_info[id].name, &head[name_offset], key_len)) {
+	fdic.sections[id].ptr = (char *)&head[contents_offset];
+	fdic.sections[id].size = end - contents_offset;
+      }
+    }
+  }
+  return 0;
+}
+
+void
+anthy_file_dic_advise(const void *p, size_t len,
+		      enum anthy_dic_access access)
+{
+#ifndef _WIN32
+  /* madviseにはページの境界から渡す */
+  uintptr_t mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  uintptr_t start = (uintptr_t)p & ~mask;
+  /* 読み込み済みの辞書には要らない */
+  if (fdic.mode != LOAD_MMAP || !p || !len) {
+    return ;
+  }
+  madvise((void *)start, (uintptr_t)p + len - start,
+	  access == ANTHY_DIC_RANDOM ? MADV_RANDOM : MADV_WILLNEED);
+#else
+  (void)p;
+  (void)len;
+  (void)access;
+#endif
+}
 
+/* 変換の度に引く小さいセクションは最初の変換の前に読み込ませておく */
+static void
+advise_sections(void)
+{
   int i;
-  char* head = (char *)fdic.ptr;
-  int* p = (int*)head;
-  int entry_num = anthy_dic_ntohl(*p++);
-
-  for (i = 0; i < entry_num; ++i) {
-    int hash_offset = anthy_dic_ntohl(*p++);
-    int key_len =  anthy_dic_ntohl(*p++);
-    int contents_offset = anthy_dic_ntohl(*p++);
-    if (hash_offset > fdic.size || contents_offset > fdic.size) {
-      abort(); // invalid data.
+  for (i = 0; i < NR_ANTHY_DIC_SECTIONS; i++) {
+    if (section_info[i].hot) {
+      anthy_file_dic_advise(fdic.sections[i].ptr, fdic.sections[i].size,
+			    ANTHY_DIC_WILL_NEED);
     }
-    if (strncmp(section_name, head + hash_offset, key_len) == 0) {
-      return (void*)(head + contents_offset);
+  }
+}
+
+long long
+anthy_file_dic_load_time(void)
+{
+  return fdic.load_ns;
+}
+
+static enum load_mode
+get_load_mode(void)
+{
+  const char *val = anthy_conf_get_str("DIC_LOAD_MODE");
+  int i;
+  if (!val) {
+    return LOAD_MMAP;
+  }
+  for (i = 0; i < NR_LOAD_MODES; i++) {
+    if (!strcmp(val, load_mode_names[i])) {
+      return i;
     }
   }
-  return NULL;
+  anthy_log(1, "unknown DIC_LOAD_MODE (%s).\n", val);
+  return LOAD_MMAP;
 }
 
+#if defined(_WIN32) || !defined(MAP_POPULATE)
+/* MAP_POPULATEが無い環境では各ページを読んで読み込ませる */
+static void
+touch_pages(const void *ptr, size_t size)
+{
+  const volatile char *p = ptr;
+  size_t i;
+  for (i = 0; i < size; i += 4096) {
+    (void)p[i];
+  }
+}
+#endif
+
+/**
+ * copy a file to a buffer aligned to hugepages.
+ * @param fn file name.
+ * @return 0 if succeeded, -1 if failed.
+ */
+static int
+copy_file(const char *fn)
+{
+  FILE *fp = fopen(fn, "rb");
+  long len;
+  size_t buf_size;
+  char *ptr;
+  if (!fp) {
+    anthy_log(0, "Failed to open (%s).\n", fn);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (len <= 0) {
+    anthy_log(0, "Failed to read 0 size file (%s).\n", fn);
+    fclose(fp);
+    return -1;
+  }
+  /* 最後のhugepageまで使えるように切り上げて、境界に揃える分を足す */
+  buf_size = (len + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+  fdic.buf = malloc(buf_size + HUGEPAGE_SIZE);
+  if (!fdic.buf) {
+    anthy_log(0, "Failed to allocate memory for (%s).\n", fn);
+    fclose(fp);
+    return -1;
+  }
+  ptr = (char *)(((uintptr_t)fdic.buf + HUGEPAGE_SIZE - 1) &
+		 ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+  /* 書き込む前に指定しておけば最初からhugepageが割り当てられる */
+  madvise(ptr, buf_size, MADV_HUGEPAGE);
+#endif
+  if (fread(ptr, 1, len, fp) != (size_t)len) {
+    anthy_log(0, "Failed to read (%s).\n", fn);
+    fclose(fp);
+    free(fdic.buf);
+    fdic.buf = NULL;
+    return -1;
+  }
+  fclose(fp);
+  fdic.ptr = ptr;
+  fdic.size = len;
+  return 0;
+}
 
 /**
  * map a file to memory. No need to share inter-process.
@@ -72,7 +305,7 @@ static int
 anthy_mmap (const char *fn)
 {
 #ifndef _WIN32
-  int fd;
+  int fd, flags;
   struct stat st;
 #else
   HANDLE fd;
@@ -99,12 +332,27 @@ anthy_mmap (const char *fn)
     return -1;
   }
 
-  ptr = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  if (fdic.mode != LOAD_MMAP) {
+    flags |= MAP_POPULATE;
+  }
+#endif
+  ptr = mmap (NULL, st.st_size, PROT_READ, flags, fd, 0);
   close(fd);
   if (ptr == MAP_FAILED) {
     anthy_log(0, "Failed to mmap() (%s).\n", fn);
     return -1;
   }
+#ifndef MAP_POPULATE
+  if (fdic.mode != LOAD_MMAP) {
+    touch_pages(ptr, st.st_size);
+  }
+#endif
+  /* 固定できなくても、読み込んだページはそのまま使う */
+  if (fdic.mode == LOAD_LOCK && mlock(ptr, st.st_size) < 0) {
+    anthy_log(1, "Failed to mlock() (%s).\n", fn);
+  }
 
   fdic.size = st.st_size;
 #else
@@ -151,6 +399,11 @@ anthy_mmap (const char *fn)
     return -1;
   }
 
+  /* 固定はせずに読み込むだけにする */
+  if (fdic.mode != LOAD_MMAP) {
+    touch_pages(ptr, st.QuadPart);
+  }
+
   fdic.size = st.QuadPart;
   fdic.hMap = hMap;
 #endif
@@ -163,6 +416,7 @@ int
 anthy_init_file_dic(void)
 {
   const char *fn;
+  long long begin;
   fn = anthy_conf_get_str("DIC_FILE");
   printf("DIC_FILE = %s\n", fn);
   if (!fn) {
@@ -171,10 +425,26 @@ anthy_init_file_dic(void)
   }
 
   /* 辞書をメモリ上にmapする */
-  if (anthy_mmap (fn) < 0) {
+  fdic.mode = get_load_mode();
+  begin = anthy_get_time_ns();
+  if ((fdic.mode == LOAD_COPY ? copy_file(fn) : anthy_mmap(fn)) < 0) {
     anthy_log(0, "failed to init file dic.\n");
     return -1;
   }
+  fdic.load_ns = anthy_get_time_ns() - begin;
+  if (fdic.mode != LOAD_MMAP) {
+    anthy_log(1, "Loaded %s in %.1f msec (%s).\n", fn,
+	      fdic.load_ns / 1000000.0, load_mode_names[fdic.mode]);
+  }
+  /* 他のバイトオーダのホストで作られた辞書は、読む度に変換する */
+  fdic.swap = ((read_header_word(fdic.ptr) & ANTHY_DIC_LITTLE_ENDIAN) !=
+	       anthy_dic_host_order());
+  if (resolve_sections() < 0) {
+    anthy_log(0, "invalid dictionary file (%s).\n", fn);
+    anthy_quit_file_dic();
+    return -1;
+  }
+  advise_sections();
 
   return 0;
 }
@@ -182,11 +452,17 @@ anthy_init_file_dic(void)
 void
 anthy_quit_file_dic(void)
 {
+  if (fdic.mode == LOAD_COPY) {
+    free(fdic.buf);
+    fdic.buf = NULL;
+  } else {
 #ifndef _WIN32
-  munmap (fdic.ptr, fdic.size);
+    munmap (fdic.ptr, fdic.size);
 #else
-  UnmapViewOfFile(fdic.ptr);
-  CloseHandle(fdic.hMap);
-  fdic.hMap = INVALID_HANDLE_VALUE;
+    UnmapViewOfFile(fdic.ptr);
+    CloseHandle(fdic.hMap);
+    fdic.hMap = INVALID_HANDLE_VALUE;
 #endif
+  }
+  memset(fdic.sections, 0, sizeof(fdic.sections));
 }
@@ -0,0 +1,91 @@
+/*
+ * 変換の段階ごとにかかった時間を計る
+ *
+ * 有効にされていなければ、anthy_phase_beginは時刻を取らずに0を返し、
+ * anthy_phase_endは何もしない。
+ * 有効にするのは変換を始める前で、変換中に切り替えることはない
+ */
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+#include <time.h>
+#ifdef _WIN32
+  #include <windows.h>
+#endif
+
+#include <anthy/phase.h>
+#include <anthy/thread.h>
+
+static int phase_enabled;
+static ANTHY_THREAD_LOCAL long long phase_ns[NR_ANTHY_PHASES];
+
+static const char *phase_names[NR_ANTHY_PHASES] = {
+  "word_list", "metaword", "lattice", "candidate"
+};
+
+long long
+anthy_get_time_ns(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, freq;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (long long)(count.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+void
+anthy_phase_enable(int enable)
+{
+  phase_enabled = enable;
+}
+
+long long
+anthy_phase_begin(void)
+{
+  if (!phase_enabled) {
+    return 0;
+  }
+  return anthy_get_time_ns();
+}
+
+void
+anthy_phase_end(enum anthy_phase phase, long long begin)
+{
+  if (!phase_enabled || !begin) {
+    return ;
+  }
+  phase_ns[phase] += anthy_get_time_ns() - begin;
+}
+
+void
+anthy_phase_take(long long *ns)
+{
+  int i;
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    ns[i] = phase_ns[i];
+    phase_ns[i] = 0;
+  }
+}
+
+const char *
+anthy_phase_name(enum anthy_phase phase)
+{
+  return phase_names[phase];
+}
@@ -36,6 +36,7 @@
 #include <anthy/conf.h>
 #include <anthy/ruleparser.h>
 #include <anthy/logger.h>
+#include <anthy/thread.h>
 
 /* 文法ファイルのパーザ用の定義 */
 #define MAX_TOKEN_LEN 256
@@ -49,7 +50,9 @@
 
 static const char *NL = "NL";
 
-static struct parser_stat {
+/* 学習データを読む際などに複数のスレッドから使われるので、
+ * パーザの状態はスレッドごとに持つ */
+static ANTHY_THREAD_LOCAL struct parser_stat {
   FILE *fp_stack[MAX_INCLUDE_DEPTH];
   FILE *fp;
   int cur_fpp;/* スタックのインデックス */
@@ -0,0 +1,477 @@
+/*
+ * UTF-8とUCS-4(xchar)の文字列の変換
+ *
+ * xstr.cのanthy_utf8_to_ucs4_xcharとput_xchar_to_utf8_strを
+ * 文字列に対して繰り返すのと同じ結果を返す。
+ * ASCIIの並びはSSE2で16文字ずつ、AVX2が使えるCPUでは32文字ずつ変換し、
+ * AVX2では3バイトの文字(かな、漢字)の並びも8文字ずつ変換する。
+ * 使う実装はanthy_init_xstrでCPUを調べて選ぶ
+ */
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+#include <assert.h>
+
+#include <anthy/xstr.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(USE_SSE2) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define USE_AVX2
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+/* anthy_utf8_select_implで選ばれた実装 */
+static int utf8_impl = ANTHY_UTF8_SCALAR;
+
+/*
+ * 1文字を変換して、読んだバイト数を返す
+ * 不正なバイト列かendを越える場合は0を返す
+ */
+static int
+decode_char(const unsigned char *p, const unsigned char *end, xchar *res)
+{
+  xchar c = p[0];
+  int i, len;
+  if (c < 0x80) {
+    *res = c;
+    return 1;
+  }
+  if (c <= 0xc1 || c > 0xf4) {
+    return 0;
+  }
+  if (c < 0xe0) {
+    c &= 0x1f;
+    len = 2;
+  } else if (c < 0xf0) {
+    c &= 0x0f;
+    len = 3;
+  } else {
+    c &= 0x07;
+    len = 4;
+  }
+  if (end - p < len) {
+    return 0;
+  }
+  for (i = 1; i < len; i++) {
+    if ((p[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    c = (c << 6) | (p[i] & 0x3f);
+  }
+  if (c >= 0xd800 && c <= 0xdfff) {
+    return 0;
+  }
+  *res = c;
+  return len;
+}
+
+/* 1文字をbufに書いて、書いたバイト数を返す */
+static int
+encode_char(xchar xc, unsigned char *buf)
+{
+  int i, len;
+  assert(xc <= 0x1fffff);
+  assert(!(xc >= 0xd800 && xc <= 0xdfff));
+  if (xc < 0x80) {
+    buf[0] = xc;
+    return 1;
+  }
+  if (xc < 0x800) {
+    buf[0] = 0xc0;
+    len = 2;
+  } else if (xc < 0x10000) {
+    buf[0] = 0xe0;
+    len = 3;
+  } else {
+    buf[0] = 0xf0;
+    len = 4;
+  }
+  for (i = len - 1; i > 0; i--) {
+    buf[i] = (xc & 0x3f) | 0x80;
+    xc >>= 6;
+  }
+  buf[0] += xc;
+  return len;
+}
+
+static int
+decode_scalar(const unsigned char *p, const unsigned char *end, xchar *dst)
+{
+  xchar *d = dst;
+  while (p < end) {
+    int l = decode_char(p, end, d);
+    if (!l) {
+      return -1;
+    }
+    p += l;
+    d ++;
+  }
+  return (int)(d - dst);
+}
+
+static int
+encode_scalar(const xchar *src, int len, unsigned char *dst)
+{
+  unsigned char *d = dst;
+  int i;
+  for (i = 0; i < len; i++) {
+    d += encode_char(src[i], d);
+  }
+  return (int)(d - dst);
+}
+
+#ifdef USE_SSE2
+static int
+decode_sse2(const unsigned char *p, const unsigned char *end, xchar *dst)
+{
+  const __m128i zero = _mm_setzero_si128();
+  xchar *d = dst;
+  while (p < end) {
+    if (*p < 0x80) {
+      if (end - p >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	if (!_mm_movemask_epi8(v)) {
+	  /* 16文字のASCII */
+	  __m128i lo = _mm_unpacklo_epi8(v, zero);
+	  __m128i hi = _mm_unpackhi_epi8(v, zero);
+	  _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(lo, zero));
+	  _mm_storeu_si128((__m128i *)(d + 4), _mm_unpackhi_epi16(lo, zero));
+	  _mm_storeu_si128((__m128i *)(d + 8), _mm_unpacklo_epi16(hi, zero));
+	  _mm_storeu_si128((__m128i *)(d + 12), _mm_unpackhi_epi16(hi, zero));
+	  p += 16;
+	  d += 16;
+	  continue;
+	}
+      }
+      /* 次のASCIIでない文字まで */
+      do {
+	*d++ = *p++;
+      } while (p < end && *p < 0x80);
+      continue;
+    }
+    /* 次のASCIIの文字まで */
+    do {
+      int l = decode_char(p, end, d);
+      if (!l) {
+	return -1;
+      }
+      p += l;
+      d ++;
+    } while (p < end && *p >= 0x80);
+  }
+  return (int)(d - dst);
+}
+
+/* ASCIIの文字を8文字ずつ変換する */
+static int
+encode_sse2(const xchar *src, int len, unsigned char *dst)
+{
+  const __m128i high = _mm_set1_epi32(~0x7f);
+  const __m128i zero = _mm_setzero_si128();
+  unsigned char *d = dst;
+  int i = 0;
+  while (i < len) {
+    if (len - i >= 8 && src[i] < 0x80) {
+      __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+      __m128i b = _mm_loadu_si128((const __m128i *)&src[i + 4]);
+      __m128i t = _mm_and_si128(_mm_or_si128(a, b), high);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(t, zero)) == 0xffff) {
+	__m128i w = _mm_packs_epi32(a, b);
+	_mm_storel_epi64((__m128i *)d, _mm_packus_epi16(w, w));
+	i += 8;
+	d += 8;
+	continue;
+      }
+    }
+    d += encode_char(src[i], d);
+    i ++;
+  }
+  return (int)(d - dst);
+}
+#endif
+
+#ifdef USE_AVX2
+/*
+ * 3バイトの文字を8文字変換して、変換できた先頭からの文字数を返す
+ * pからは28バイト読めなくてはならない
+ */
+static AVX2_FUNC int
+decode_3byte_avx2(const unsigned char *p, xchar *d)
+{
+  /* 各32ビットに1文字の3バイトを並べる */
+  const __m256i shuf = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+					8, 7, 6, -1, 11, 10, 9, -1,
+					2, 1, 0, -1, 5, 4, 3, -1,
+					8, 7, 6, -1, 11, 10, 9, -1);
+  const __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i v, c, ok, bad;
+  int mask, n;
+
+  v = _mm256_inserti128_si256(
+	_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+	_mm_loadu_si128((const __m128i *)(p + 12)), 1);
+  v = _mm256_shuffle_epi8(v, shuf);
+  /* 1110xxxx 10xxxxxx 10xxxxxx */
+  ok = _mm256_cmpeq_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xf0c0c0)),
+			  _mm256_set1_epi32(0xe08080));
+  c = _mm256_or_si256(
+	_mm256_or_si256(
+	  _mm256_and_si256(v, _mm256_set1_epi32(0x3f)),
+	  _mm256_and_si256(_mm256_srli_epi32(v, 2), _mm256_set1_epi32(0xfc0))),
+	_mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi32(0xf000)));
+  /* サロゲート */
+  bad = _mm256_cmpeq_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xf800)),
+			   _mm256_set1_epi32(0xd800));
+  ok = _mm256_andnot_si256(bad, ok);
+  mask = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+  if (mask == 0xff) {
+    _mm256_storeu_si256((__m256i *)d, c);
+    return 8;
+  }
+  /* 先頭から続く変換できた文字だけを書く */
+  for (n = 0; mask & (1 << n); n++);
+  if (n) {
+    _mm256_maskstore_epi32((int *)d,
+			   _mm256_cmpgt_epi32(_mm256_set1_epi32(n), idx), c);
+  }
+  return n;
+}
+
+static AVX2_FUNC int
+decode_avx2(const unsigned char *p, const unsigned char *end, xchar *dst)
+{
+  xchar *d = dst;
+  while (p < end) {
+    if (*p < 0x80) {
+      if (end - p >= 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	if (!_mm256_movemask_epi8(v)) {
+	  /* 32文字のASCII */
+	  _mm256_storeu_si256((__m256i *)d, _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)p)));
+	  _mm256_storeu_si256((__m256i *)(d + 8), _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)(p + 8))));
+	  _mm256_storeu_si256((__m256i *)(d + 16), _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)(p + 16))));
+	  _mm256_storeu_si256((__m256i *)(d + 24), _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)(p + 24))));
+	  p += 32;
+	  d += 32;
+	  continue;
+	}
+      }
+      do {
+	*d++ = *p++;
+      } while (p < end && *p < 0x80);
+      continue;
+    }
+    if ((*p & 0xf0) == 0xe0 && end - p >= 28) {
+      int n = decode_3byte_avx2(p, d);
+      if (n) {
+	p += n * 3;
+	d += n;
+	continue;
+      }
+    }
+    {
+      int l = decode_char(p, end, d);
+      if (!l) {
+	return -1;
+      }
+      p += l;
+      d ++;
+    }
+  }
+  return (int)(d - dst);
+}
+
+/*
+ * 3バイトになる文字を8文字変換して、変換できた先頭からの文字数を返す
+ * dには28バイト書けなくてはならない
+ */
+static AVX2_FUNC int
+encode_3byte_avx2(const xchar *s, unsigned char *d)
+{
+  /* 各32ビットの下位3バイトを詰める */
+  const __m256i shuf = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					10, 12, 13, 14, -1, -1, -1, -1,
+					0, 1, 2, 4, 5, 6, 8, 9,
+					10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i x, top, ok, v;
+  int mask, n;
+
+  x = _mm256_loadu_si256((const __m256i *)s);
+  /* 0x800から0xffffまでのサロゲートでない文字 */
+  top = _mm256_and_si256(x, _mm256_set1_epi32(0xf800));
+  ok = _mm256_cmpeq_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0xffff0000)),
+			  zero);
+  ok = _mm256_andnot_si256(_mm256_cmpeq_epi32(top, zero), ok);
+  ok = _mm256_andnot_si256(_mm256_cmpeq_epi32(top, _mm256_set1_epi32(0xd800)),
+			   ok);
+  mask = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+  for (n = 0; n < 8 && (mask & (1 << n)); n++);
+  if (!n) {
+    return 0;
+  }
+  /* 1110xxxx 10xxxxxx 10xxxxxx */
+  v = _mm256_or_si256(
+	_mm256_or_si256(_mm256_set1_epi32(0x8080e0),
+			_mm256_srli_epi32(x, 12)),
+	_mm256_or_si256(
+	  _mm256_slli_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0x3f)), 16),
+	  _mm256_and_si256(_mm256_slli_epi32(x, 2),
+			   _mm256_set1_epi32(0x3f00))));
+  v = _mm256_shuffle_epi8(v, shuf);
+  _mm_storeu_si128((__m128i *)d, _mm256_castsi256_si128(v));
+  _mm_storeu_si128((__m128i *)(d + 12), _mm256_extracti128_si256(v, 1));
+  return n;
+}
+
+static AVX2_FUNC int
+encode_avx2(const xchar *src, int len, unsigned char *dst)
+{
+  const __m128i high = _mm_set1_epi32(~0x7f);
+  const __m128i zero = _mm_setzero_si128();
+  unsigned char *d = dst;
+  int i = 0;
+  while (i < len) {
+    if (src[i] < 0x80) {
+      if (len - i >= 16) {
+	__m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+	__m128i b = _mm_loadu_si128((const __m128i *)&src[i + 4]);
+	__m128i c = _mm_loadu_si128((const __m128i *)&src[i + 8]);
+	__m128i e = _mm_loadu_si128((const __m128i *)&src[i + 12]);
+	__m128i t = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, e));
+	t = _mm_and_si128(t, high);
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(t, zero)) == 0xffff) {
+	  /* 16文字のASCII */
+	  _mm_storeu_si128((__m128i *)d,
+			   _mm_packus_epi16(_mm_packs_epi32(a, b),
+					    _mm_packs_epi32(c, e)));
+	  i += 16;
+	  d += 16;
+	  continue;
+	}
+      }
+    } else if (len - i >= 8) {
+      /* 残りの文字が8文字以上あるので、dには33バイト以上書ける */
+      int n = encode_3byte_avx2(&src[i], d);
+      if (n) {
+	i += n;
+	d += n * 3;
+	continue;
+      }
+    }
+    d += encode_char(src[i], d);
+    i ++;
+  }
+  return (int)(d - dst);
+}
+
+static int
+cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/**
+ * UTF-8のバイト列を変換する
+ * @param s 変換するバイト列、NULで終わっていなくても良い
+ * @param len sのバイト数
+ * @param [out] dst 変換した文字を書く、len文字分の大きさが必要
+ * @return dstに書いた文字数。不正なバイト列の場合は-1
+ */
+int
+anthy_utf8_to_ucs4(const char *s, int len, xchar *dst)
+{
+  const unsigned char *p = (const unsigned char *)s;
+  switch (utf8_impl) {
+#ifdef USE_AVX2
+  case ANTHY_UTF8_AVX2:
+    return decode_avx2(p, p + len, dst);
+#endif
+#ifdef USE_SSE2
+  case ANTHY_UTF8_SSE2:
+    return decode_sse2(p, p + len, dst);
+#endif
+  default:
+    return decode_scalar(p, p + len, dst);
+  }
+}
+
+/**
+ * len文字をUTF-8にする
+ * @param [out] dst 変換したバイト列を書いてNULで終える、
+ *                  len * 4 + 1バイトの大きさが必要
+ * @return dstに書いたバイト数(NULを除く)
+ */
+int
+anthy_ucs4_to_utf8(const xchar *src, int len, char *dst)
+{
+  unsigned char *d = (unsigned char *)dst;
+  int n;
+  switch (utf8_impl) {
+#ifdef USE_AVX2
+  case ANTHY_UTF8_AVX2:
+    n = encode_avx2(src, len, d);
+    break;
+#endif
+#ifdef USE_SSE2
+  case ANTHY_UTF8_SSE2:
+    n = encode_sse2(src, len, d);
+    break;
+#endif
+  default:
+    n = encode_scalar(src, len, d);
+    break;
+  }
+  dst[n] = 0;
+  return n;
+}
+
+/**
+ * 変換に使う実装を選ぶ
+ * @param impl ANTHY_UTF8_*
+ * @return 選ばれた実装。CPUもしくはコンパイラが対応していなければ、
+ *         implより下の実装が選ばれる
+ */
+int
+anthy_utf8_select_impl(int impl)
+{
+#ifdef USE_AVX2
+  if (impl >= ANTHY_UTF8_AVX2 && cpu_has_avx2()) {
+    utf8_impl = ANTHY_UTF8_AVX2;
+    return utf8_impl;
+  }
+#endif
+#ifdef USE_SSE2
+  if (impl >= ANTHY_UTF8_SSE2) {
+    utf8_impl = ANTHY_UTF8_SSE2;
+    return utf8_impl;
+  }
+#endif
+  utf8_impl = ANTHY_UTF8_SCALAR;
+  return utf8_impl;
+}
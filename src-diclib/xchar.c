@@ -248,6 +248,26 @@ anthy_find_half_kana(xchar xc)
   return NULL;
 }
 
+/*
+ * 文字のタイプの表
+ * BMPの文字をTYPE_PAGE_SIZE文字ずつのページに分け、ページの番号の表と
+ * ページの表の二段で引く。内容が同じページ(例えば漢字だけのページ)は
+ * 共有するので、表は小さい。
+ * 表はanthy_init_xchar_tabでcompute_xchar_typeから作り、
+ * 作る前とBMPの外の文字は表を使わずに求める
+ */
+#define TYPE_PAGE_BITS 7
+#define TYPE_PAGE_SIZE (1 << TYPE_PAGE_BITS)
+#define NR_TYPE_CHARS 0x10000
+#define NR_TYPE_PAGE_INDEX (NR_TYPE_CHARS >> TYPE_PAGE_BITS)
+#define MAX_TYPE_PAGES 64
+static int type_tab_ready;
+static unsigned char type_page_index[NR_TYPE_PAGE_INDEX];
+static unsigned short type_pages[MAX_TYPE_PAGES][TYPE_PAGE_SIZE];
+#define TYPE_TAB_LOOKUP(xc) \
+  (type_pages[type_page_index[(xc) >> TYPE_PAGE_BITS]] \
+   [(xc) & (TYPE_PAGE_SIZE - 1)])
+
 static int
 find_xchar_type(xchar xc)
 {
@@ -354,8 +374,9 @@ anthy_ucs_to_euc(int uc)
   return r;
 }
 
-int
-anthy_get_xchar_type(const xchar xc)
+/* 表を使わずに文字のタイプを求める */
+static int
+compute_xchar_type(const xchar xc)
 {
   int t = find_xchar_type(xc);
   if (xc > 47 && xc < 58) {
@@ -381,14 +402,44 @@ anthy_get_xchar_type(const xchar xc)
   return t;
 }
 
+int
+anthy_get_xchar_type(const xchar xc)
+{
+  if (type_tab_ready && xc < NR_TYPE_CHARS) {
+    return TYPE_TAB_LOOKUP(xc);
+  }
+  return compute_xchar_type(xc);
+}
+
 int
 anthy_get_xstr_type(const xstr *xs)
 {
-  int i, t = XCT_ALL;
-  for (i = 0; i < xs->len; i++) {
-    t &= anthy_get_xchar_type(xs->str[i]);
+  const xchar *str = xs->str;
+  int i = 0, len = xs->len;
+  int t0 = XCT_ALL, t1 = XCT_ALL, t2 = XCT_ALL, t3 = XCT_ALL;
+
+  if (type_tab_ready) {
+    /* SIMD命令は使わず、ループを4文字ずつ展開して互いに依存しない
+     * 4つの論理積をとる(スカラーのままで表の参照を重ねられる) */
+    for (; i + 4 <= len; i += 4) {
+      xchar c0 = str[i], c1 = str[i + 1], c2 = str[i + 2], c3 = str[i + 3];
+      if ((unsigned int)(c0 | c1 | c2 | c3) >= NR_TYPE_CHARS) {
+	break;
+      }
+      t0 &= TYPE_TAB_LOOKUP(c0);
+      t1 &= TYPE_TAB_LOOKUP(c1);
+      t2 &= TYPE_TAB_LOOKUP(c2);
+      t3 &= TYPE_TAB_LOOKUP(c3);
+      if (!(t0 & t1 & t2 & t3)) {
+	/* これ以上は変わらない */
+	return XCT_NONE;
+      }
+    }
   }
-  return t;
+  for (; i < len; i++) {
+    t0 &= anthy_get_xchar_type(str[i]);
+  }
+  return t0 & t1 & t2 & t3;
 }
 
 int
@@ -430,7 +481,37 @@ anthy_xchar_wide_num_to_num(xchar c)
   }
 }
 
+/*
+ * BMPの全ての文字のタイプの表を作る
+ * 同じ内容のページは一つにまとめる
+ */
 void
 anthy_init_xchar_tab(void)
 {
+  unsigned short page[TYPE_PAGE_SIZE];
+  int i, j, nr = 0;
+
+  if (type_tab_ready) {
+    return ;
+  }
+  for (i = 0; i < NR_TYPE_PAGE_INDEX; i++) {
+    for (j = 0; j < TYPE_PAGE_SIZE; j++) {
+      page[j] = compute_xchar_type((i << TYPE_PAGE_BITS) | j);
+    }
+    for (j = 0; j < nr; j++) {
+      if (!memcmp(type_pages[j], page, sizeof(page))) {
+	break;
+      }
+    }
+    if (j == nr) {
+      if (nr == MAX_TYPE_PAGES) {
+	/* 表に入りきらないので、表を使わずに求める */
+	return ;
+      }
+      memcpy(type_pages[nr], page, sizeof(page));
+      nr ++;
+    }
+    type_page_index[i] = j;
+  }
+  type_tab_ready = 1;
 }
@@ -146,8 +146,8 @@ utf8_to_ucs4_xstr(const char *s)
 {
   assert(s);
 
-  const char* str = s;
   xstr* res = (xstr*) malloc(sizeof(xstr));
+  int len;
   if (!res)
     return NULL;
   res->len = 0;
@@ -155,21 +155,17 @@ utf8_to_ucs4_xstr(const char *s)
     res->str = NULL;
     return res;
   }
-  res->str = (xchar*) malloc(sizeof(xchar) * strlen(s));
+  len = strlen(s);
+  res->str = (xchar*) malloc(sizeof(xchar) * len);
   if (!res->str) {
     anthy_free_xstr(res);
     return NULL;
   }
 
-  while (*str) {
-    xchar cur;
-    str = anthy_utf8_to_ucs4_xchar(str, &cur);
-    if (!str) { // error
-      anthy_free_xstr(res);
-      return NULL;
-    }
-    res->str[res->len] = cur;
-    res->len ++;
+  res->len = anthy_utf8_to_ucs4(s, len, res->str);
+  if (res->len < 0) { // error
+    anthy_free_xstr(res);
+    return NULL;
   }
   return res;
 }
@@ -223,13 +219,7 @@ ucs4_xstr_to_utf8(const xstr* xs)
   if (!buf)
     return NULL;
 
-  int i, t = 0;
-  buf[0] = '\0';
-  for (i = 0; i < xs->len; i++) {
-    xchar xc = xs->str[i];
-    put_xchar_to_utf8_str(xc, &buf[t]);
-    t = strlen(buf);
-  }
+  anthy_ucs4_to_utf8(xs->str, xs->len, buf);
   return buf;
 }
 
@@ -765,6 +755,7 @@ anthy_xstr_set_print_encoding(int encoding)
 int
 anthy_init_xstr(void)
 {
+  anthy_utf8_select_impl(ANTHY_UTF8_AVX2);
   return 0;
 }
 
@@ -44,9 +44,12 @@
 
 #include <anthy/anthy.h>
 #include <anthy/alloc.h>
+#include <anthy/arena.h>
 #include <anthy/record.h>
 #include <anthy/ordering.h>
+#include <anthy/phase.h>
 #include <anthy/splitter.h>
+#include <anthy/thread.h>
 #include <anthy/xstr.h>
 #include "main.h"
 
@@ -59,6 +62,8 @@ static allocator context_ator;
  * anonymousの場合: ""
  */
 static char *current_personality;
+/* 別々のスレッドで同時にコンテキストを作っても一度だけ設定する */
+static anthy_mutex_t personality_mutex = ANTHY_MUTEX_INITIALIZER;
 
 /**/
 #define HISTORY_FILE_LIMIT 100000
@@ -66,7 +71,20 @@ static char *current_personality;
 static void
 context_dtor(void *p)
 {
-  anthy_do_reset_context((struct anthy_context *)p);
+  struct anthy_context *ac = (struct anthy_context *)p;
+  anthy_do_reset_context(ac);
+  if (ac->dic_session) {
+    anthy_dic_release_session(ac->dic_session);
+    ac->dic_session = NULL;
+  }
+  anthy_free_arena(ac->split_info.lattice_arena);
+  ac->split_info.lattice_arena = NULL;
+  anthy_free_arena(ac->split_info.arena);
+  ac->split_info.arena = NULL;
+  anthy_free_arena(ac->split_info.old_arena);
+  ac->split_info.old_arena = NULL;
+  anthy_free_arena(ac->split_info.wl_arena);
+  ac->split_info.wl_arena = NULL;
 }
 
 
@@ -77,11 +95,15 @@ context_dtor(void *p)
 static char *
 get_personality(void)
 {
+  char *p;
+  anthy_mutex_lock(&personality_mutex);
   if (!current_personality) {
     current_personality = strdup("default");
     anthy_dic_set_personality(current_personality);
   }
-  return current_personality;
+  p = current_personality;
+  anthy_mutex_unlock(&personality_mutex);
+  return p;
 }
 
 static void
@@ -94,11 +116,7 @@ release_segment(struct seg_ent *s)
     }
     free (s->cands);
   }
-  if (s->mw_array) {
-    free(s->mw_array);
-  }
-  free(s);
-
+  /* 文節とmetawordの配列はアリーナに確保されている */
 }
 
 /** 文節リストの最後の要素を削除する */
@@ -117,6 +135,40 @@ pop_back_seg_ent(struct anthy_context *c)
 }
 
 
+/** nth番目以降の文節を文節リストから外して、oldにつなぐ */
+static void
+detach_segments(struct anthy_context *c, int nth, struct segment_list *old)
+{
+  struct seg_ent *s;
+  old->list_head.next = &old->list_head;
+  old->list_head.prev = &old->list_head;
+  old->nr_segments = 0;
+  if (nth >= c->seg_list.nr_segments) {
+    return ;
+  }
+  s = anthy_get_nth_segment(&c->seg_list, nth);
+  old->list_head.next = s;
+  old->list_head.prev = c->seg_list.list_head.prev;
+  old->list_head.prev->next = &old->list_head;
+  c->seg_list.list_head.prev = s->prev;
+  s->prev->next = &c->seg_list.list_head;
+  s->prev = &old->list_head;
+  old->nr_segments = c->seg_list.nr_segments - nth;
+  c->seg_list.nr_segments = nth;
+}
+
+/** detach_segmentsで外した文節を解放する */
+static void
+release_detached_segments(struct segment_list *old)
+{
+  struct seg_ent *s, *next;
+  for (s = old->list_head.next; s != &old->list_head; s = next) {
+    next = s->next;
+    release_segment(s);
+  }
+  old->nr_segments = 0;
+}
+
 /** n番目の文節の文字のindexを求める */
 static int
 get_nth_segment_index(struct anthy_context *c, int n)
@@ -176,7 +228,8 @@ make_metaword_array(struct anthy_context *ac,
       continue ;
     }
     /* metawordを配列に取り込む */
-    se->mw_array = malloc(sizeof(struct meta_word*) * se->nr_metaword);
+    se->mw_array = anthy_arena_alloc(ac->split_info.arena,
+				     sizeof(struct meta_word*) * se->nr_metaword);
     for (j = 0; j < se->nr_metaword; j++) {
       se->mw_array[j] = anthy_get_nth_metaword(&ac->split_info, se->from, i, j);
     }
@@ -189,7 +242,8 @@ create_segment(struct anthy_context *ac, int from, int len,
 	       struct meta_word* best_mw)
 {
   struct seg_ent* s;
-  s = (struct seg_ent *)malloc(sizeof(struct seg_ent));
+  s = (struct seg_ent *)anthy_arena_alloc(ac->split_info.arena,
+					  sizeof(struct seg_ent));
   s->str.str = &ac->str.str[from];
   s->str.len = len;
   s->from = from;
@@ -259,6 +313,14 @@ anthy_do_create_context(int encoding)
   ac->seg_list.list_head.next = &ac->seg_list.list_head;
   ac->split_info.word_split_info = NULL;
   ac->split_info.ce = NULL;
+  ac->split_info.arena = anthy_create_arena();
+  ac->split_info.old_arena = anthy_create_arena();
+  ac->split_info.wl_arena = anthy_create_arena();
+  ac->split_info.nr_word_lists = 0;
+  ac->split_info.lattice_arena = anthy_create_arena();
+  ac->split_info.lattice = NULL;
+  ac->split_info.nr_paths = 0;
+  ac->split_info.paths = NULL;
   ac->ordering_info.oc = NULL;
   ac->dic_session = NULL;
   ac->prediction.str.str = NULL;
@@ -320,20 +382,17 @@ anthy_do_reset_context(struct anthy_context *ac)
 {
   assert(ac);
 
-  /* まず辞書セッションを解放 */
+  /* まず辞書のキャッシュを解放 */
   if (ac->dic_session) {
-    anthy_dic_release_session(ac->dic_session);
-    ac->dic_session = NULL;
+    anthy_dic_flush_session(ac->dic_session);
   }
 
-  if (ac->str.str) {
-    /* 文字列が設定されていなければ解放すべき物はもう無い */
-    free(ac->str.str);
-    ac->str.str = NULL;
-    ac->str.len = 0;
-  }
-  anthy_release_split_context(&ac->split_info);
+  /* 文節はアリーナに確保されているので、先に解放する */
   anthy_release_segment_list(ac);
+  /* 文字列もアリーナに確保されている */
+  ac->str.str = NULL;
+  ac->str.len = 0;
+  anthy_release_split_context(&ac->split_info);
 
   /* 予測された文字列の解放 */
   release_prediction(&ac->prediction);
@@ -345,26 +404,160 @@ anthy_do_release_context(struct anthy_context *ac)
   anthy_sfree(context_ator, ac);
 }
 
+/** 文節の直前の文節のクラス */
+static enum seg_class
+prev_seg_class(struct segment_list *sl, struct seg_ent *se,
+	       enum seg_class head_class)
+{
+  if (se->prev == &sl->list_head) {
+    return head_class;
+  }
+  return se->prev->best_seg_class;
+}
+
+/*
+ * 作り直す前の文節から、位置と構造が同じでクラスも前の文節の
+ * クラスも同じものを探す
+ * oldは位置の順に並んでいるので、*curから探し始める
+ */
+static struct seg_ent *
+find_same_segment(struct anthy_context *ac, struct seg_ent *se,
+		  struct segment_list *old, struct seg_ent **cur,
+		  enum seg_class head_class)
+{
+  struct seg_ent *old_se = *cur;
+  while (old_se != &old->list_head && old_se->from < se->from) {
+    old_se = old_se->next;
+  }
+  *cur = old_se;
+  if (old_se == &old->list_head || !old_se->cands ||
+      old_se->from != se->from || old_se->len != se->len ||
+      old_se->best_mw != se->best_mw ||
+      old_se->best_seg_class != se->best_seg_class ||
+      prev_seg_class(old, old_se, head_class) !=
+      prev_seg_class(&ac->seg_list, se, head_class)) {
+    return NULL;
+  }
+  return old_se;
+}
+
+/*
+ * pathが0以上なら文節分割をやり直さずに、
+ * 以前の文節分割で見つけたpath番目の分割の候補を使う
+ * oldにはfromから後ろにあった文節を渡す
+ */
 static void
-make_candidates(struct anthy_context *ac, int from, int from2, int is_reverse)
+make_candidates(struct anthy_context *ac, int from, int from2, int is_reverse,
+		int path, struct segment_list *old)
 {
-  int i;
+  int i, nth, first, last;
   int len = ac->str.len;
+  enum seg_class head_class = SEG_HEAD;
+  struct seg_ent *se, *old_se, *cur;
+  long long t;
+
+  /* fromより前の文節は作り直さない */
+  nth = ac->seg_list.nr_segments;
+  if (nth > 0) {
+    head_class = ac->seg_list.list_head.prev->best_seg_class;
+  }
+  /* 伸縮では逆変換でない候補を作るので、逆変換の候補は引き継がない */
+  if (ac->split_info.is_reverse) {
+    old = NULL;
+  }
 
   /* 文節の境界を設定 */
   /* from と from2の間に境界を作ることを禁止する */
-  anthy_mark_border(&ac->split_info, from, from2, len);
+  if (path < 0) {
+    anthy_mark_border(&ac->split_info, from, from2, len);
+  } else {
+    anthy_mark_border_by_path(&ac->split_info, from, from2, len, path);
+  }
+  t = anthy_phase_begin();
   create_segment_list(ac, from, len);
-  anthy_sort_metaword(&ac->seg_list);
+  anthy_sort_metaword(&ac->seg_list, nth);
+
+  /* 前と同じ文節が無い範囲を探す */
+  first = nth;
+  last = ac->seg_list.nr_segments;
+  if (old) {
+    first = -1;
+    cur = old->list_head.next;
+    se = anthy_get_nth_segment(&ac->seg_list, nth);
+    for (i = nth; i < ac->seg_list.nr_segments; i++, se = se->next) {
+      if (!find_same_segment(ac, se, old, &cur, head_class)) {
+	if (first < 0) {
+	  first = i;
+	}
+	last = i + 1;
+      }
+    }
+    if (first < 0) {
+      first = last = ac->seg_list.nr_segments;
+    }
+  }
+  /* 用例による並び替えは前後2文節の候補を見るので、その範囲の文節は
+   * 前と同じでも候補を作ってソートし直す。ソート済みの候補には
+   * 重複した候補のフラグが付いているので、もう一度ソートするだけでは
+   * 作り直した結果と違ってしまう */
+  if (first < last) {
+    first = first - 2 < 0 ? 0 : first - 2;
+    last = last + 2 > ac->seg_list.nr_segments ?
+      ac->seg_list.nr_segments : last + 2;
+  }
+
+  /* 候補を列挙、範囲の外の文節は前の候補をそのまま使う
+   * fromより前の文節には今の候補に加えて作る */
+  cur = old ? old->list_head.next : NULL;
+  se = anthy_get_nth_segment(&ac->seg_list, first < nth ? first : nth);
+  for (i = first < nth ? first : nth; i < ac->seg_list.nr_segments;
+       i++, se = se->next) {
+    if (i < nth) {
+      anthy_do_make_candidates(&ac->split_info, se, is_reverse);
+      continue;
+    }
+    if (old && (i < first || i >= last)) {
+      old_se = find_same_segment(ac, se, old, &cur, head_class);
+      se->cands = old_se->cands;
+      se->nr_cands = old_se->nr_cands;
+      old_se->cands = NULL;
+      old_se->nr_cands = 0;
+      continue;
+    }
+    anthy_do_make_candidates(&ac->split_info, se, is_reverse);
+  }
+
+  /* 候補をソート */
+  if (first < last) {
+    anthy_sort_candidate(&ac->seg_list, first, last);
+  }
+  anthy_phase_end(ANTHY_PHASE_CANDIDATE, t);
+}
 
-  /* 候補を列挙 */
+/* 文字列をコピー(一文字分余計にして0をセット) */
+static void
+copy_str(struct anthy_context *ac, const xstr* s)
+{
+  ac->str.str = (xchar *)anthy_arena_alloc(ac->split_info.arena,
+					   sizeof(xchar)*(s->len+1));
+  memcpy(ac->str.str, s->str, sizeof(xchar)*s->len);
+  ac->str.str[s->len] = 0;
+  ac->str.len = s->len;
+}
+
+/* 文字列全体の解の候補を作成する */
+static void
+make_all_candidates(struct anthy_context *ac, int is_reverse)
+{
+  int i;
+
+  make_candidates(ac, 0, 0, is_reverse, -1, NULL);
+
+  /* 最初に設定した文節境界を覚えておく */
   for (i = 0; i < ac->seg_list.nr_segments; i++) {
-    anthy_do_make_candidates(&ac->split_info,
-			     anthy_get_nth_segment(&ac->seg_list, i),
-			     is_reverse);
+    struct seg_ent *s = anthy_get_nth_segment(&ac->seg_list, i);
+    ac->split_info.ce[s->from].initial_seg_len = s->len;
   }
-  /* 候補をソート */
-  anthy_sort_candidate(&ac->seg_list, 0);
 }
 
 int
@@ -374,24 +567,70 @@ anthy_do_context_set_str(struct anthy_context *ac, const xstr* s,
   assert(ac);
   assert(s);
 
-  int i;
-
-  /* 文字列をコピー(一文字分余計にして0をセット) */
-  //ac->str.str = (xchar *)malloc(sizeof(xchar)*(s->len+1));
-  anthy_xstrcpy(&ac->str, s);
-  //ac->str.str[s->len] = 0;
+  copy_str(ac, s);
 
   /* splitterの初期化*/
   anthy_init_split_context(&ac->str, &ac->split_info, is_reverse);
 
   /* 解の候補を作成 */
-  make_candidates(ac, 0, 0, is_reverse);
+  make_all_candidates(ac, is_reverse);
 
-  /* 最初に設定した文節境界を覚えておく */
-  for (i = 0; i < ac->seg_list.nr_segments; i++) {
-    struct seg_ent *s = anthy_get_nth_segment(&ac->seg_list, i);
-    ac->split_info.ce[s->from].initial_seg_len = s->len;
+  return 0;
+}
+
+/*
+ * 前回変換した文字列の後ろに文字を追加したものか
+ * 辞書や学習の状態が変わっていなければ、差分だけを変換できる
+ */
+int
+anthy_do_context_can_append_str(struct anthy_context *ac, const xstr *s)
+{
+  struct seg_ent *se;
+
+  if (!ac->str.str || !ac->dic_session || ac->split_info.is_reverse) {
+    return 0;
+  }
+  if (s->len <= ac->str.len ||
+      memcmp(s->str, ac->str.str, sizeof(xchar) * ac->str.len)) {
+    return 0;
+  }
+  /* 予測の際に辞書のキャッシュを減らしている */
+  if (ac->prediction.str.str) {
+    return 0;
+  }
+  /* コミットした文節があれば学習している */
+  for (se = ac->seg_list.list_head.next; se != &ac->seg_list.list_head;
+       se = se->next) {
+    if (se->committed >= 0) {
+      return 0;
+    }
+  }
+  if (anthy_dic_session_is_stale(ac->dic_session)) {
+    return 0;
   }
+  return 1;
+}
+
+/*
+ * 前回変換した文字列の後ろに文字を追加した文字列を変換する
+ * 追加した文字の影響を受けないword_listは作り直さない
+ */
+int
+anthy_do_context_append_str(struct anthy_context *ac, const xstr *s)
+{
+  assert(ac);
+  assert(s);
+
+  /* 文節と予測は作り直す */
+  anthy_release_segment_list(ac);
+  release_prediction(&ac->prediction);
+
+  /* 前回のデータは作り直す間だけ残しておく */
+  anthy_renew_split_arena(&ac->split_info);
+  copy_str(ac, s);
+  anthy_extend_split_context(&ac->str, &ac->split_info);
+
+  make_all_candidates(ac, 0);
 
   return 0;
 }
@@ -401,7 +640,8 @@ anthy_do_resize_segment(struct anthy_context *ac,
 			int nth, int resize)
 {
   int i;
-  int index, len, sc;
+  int index, len;
+  struct segment_list old;
 
   /* resizeが可能か検査する */
   if (nth >= ac->seg_list.nr_segments) {
@@ -416,11 +656,8 @@ anthy_do_resize_segment(struct anthy_context *ac,
     return ;
   }
 
-  /* nth以降のseg_entを解放する */
-  sc = ac->seg_list.nr_segments;
-  for (i = nth; i < sc; i++) {
-    pop_back_seg_ent(ac);
-  }
+  /* nth以降のseg_entを外す、候補は引き継げるものがあるので後で解放する */
+  detach_segments(ac, nth, &old);
 
   /* resizeしたseg_borderをマークする */
   /* 現在のマークを消して新しいマークをつける */
@@ -434,8 +671,60 @@ anthy_do_resize_segment(struct anthy_context *ac,
     ac->split_info.ce[i].best_mw = NULL;
   }
 
-  /* 解の候補を作成 */
-  make_candidates(ac, index, index+len+resize, 0);
+  /* 解の候補を作成
+   * 伸縮した文節までの境界が一致する分割の候補があれば、それを使う */
+  make_candidates(ac, index, index+len+resize, 0,
+		  anthy_find_split_path(&ac->split_info, index+len+resize),
+		  &old);
+  release_detached_segments(&old);
+}
+
+/*
+ * 文節分割の候補のnth番目に従って文節を区切り直す
+ * 返り値は成功なら0、失敗なら-1
+ */
+int
+anthy_do_select_split_path(struct anthy_context *ac, int nth)
+{
+  struct split_path *path;
+  struct segment_list old;
+  int i, n, from;
+
+  path = anthy_get_nth_split_path(&ac->split_info, nth);
+  if (!path) {
+    return -1;
+  }
+
+  /* 境界が変わる最初の文節を探す */
+  from = ac->str.len;
+  for (i = 1; i < ac->str.len; i++) {
+    if (!path->seg_border[i] != !ac->split_info.ce[i].seg_border) {
+      from = i;
+      break;
+    }
+  }
+  if (from == ac->str.len) {
+    /* 同じ分割 */
+    return 0;
+  }
+  /* fromの直前の文字を含む文節の先頭は、どちらの分割でも境界になっている */
+  for (n = 0, i = 0; i + get_nth_segment_len(ac, n) < from; n++) {
+    i += get_nth_segment_len(ac, n);
+  }
+  from = i;
+
+  /* n以降のseg_entを外す */
+  detach_segments(ac, n, &old);
+  for (i = from + 1; i < ac->str.len; i++) {
+    ac->split_info.ce[i].seg_border = 0;
+  }
+  for (i = from; i < ac->str.len; i++) {
+    ac->split_info.ce[i].best_mw = NULL;
+  }
+
+  make_candidates(ac, from, from, ac->split_info.is_reverse, nth, &old);
+  release_detached_segments(&old);
+  return 0;
 }
 
 /*
@@ -460,26 +749,19 @@ anthy_do_set_prediction_str(struct anthy_context *ac, xstr* xs)
   struct prediction_cache* prediction = &ac->prediction;
   int nr_prediction;
 
-  /* まず辞書セッションを解放 */
+  /* まず辞書のキャッシュを解放 */
   if (ac->dic_session) {
-    anthy_dic_release_session(ac->dic_session);
-    ac->dic_session = NULL;
+    anthy_dic_flush_session(ac->dic_session);
   }
   /* 予測された文字列の解放 */
   release_prediction(&ac->prediction);
 
-  /* 辞書セッションの開始 */
-  if (!ac->dic_session) {
-    ac->dic_session = anthy_dic_create_session();
-    if (!ac->dic_session) {
-      return -1;
-    }
-  }
-
   prediction->str.str = (xchar*)malloc(sizeof(xchar*)*(xs->len+1));
   anthy_xstrcpy(&prediction->str, xs);
   prediction->str.str[xs->len]=0;
 
+  /* 数えてから取り出すまでの間に他のスレッドが学習しないようにする */
+  anthy_lock_record();
   nr_prediction = anthy_traverse_record_for_prediction(xs, NULL);
   prediction->nr_prediction = nr_prediction;
 
@@ -488,6 +770,7 @@ anthy_do_set_prediction_str(struct anthy_context *ac, xstr* xs)
 							   nr_prediction);
     anthy_traverse_record_for_prediction(xs, prediction->predictions);
   }
+  anthy_unlock_record();
   return 0;
 }
 
@@ -674,16 +957,14 @@ anthy_do_print_context(struct anthy_context *ac, int encoding)
   printf("\n");
 }
 
+/* 候補と要素の配列は変換コンテキストのアリーナにあるので、
+ * 文字列だけを解放する */
 void
 anthy_release_cand_ent(struct cand_ent *ce)
 {
-  if (ce->elm) {
-    free(ce->elm);
-  }
   if (&ce->str) {
     anthy_free_xstr_str(&ce->str);
   }
-  free(ce);
 }
 
 
@@ -691,15 +972,18 @@ anthy_release_cand_ent(struct cand_ent *ce)
 int
 anthy_do_set_personality(const char *id)
 {
-  if (current_personality) {
-    /* すでに設定されてる */
+  if (!id || strchr(id, '/')) {
     return -1;
   }
-  if (!id || strchr(id, '/')) {
+  anthy_mutex_lock(&personality_mutex);
+  if (current_personality) {
+    /* すでに設定されてる */
+    anthy_mutex_unlock(&personality_mutex);
     return -1;
   }
   current_personality = strdup(id);
   anthy_dic_set_personality(current_personality);
+  anthy_mutex_unlock(&personality_mutex);
   return 0;
 }
 
@@ -221,22 +221,32 @@ anthy_set_string(struct anthy_context *ac, const char *s)
     return -1;
   }
 
-  /*初期化*/
-  anthy_do_reset_context(ac);
+  xs = anthy_cstr_to_xstr(s, ac->encoding);
 
   /* 辞書セッションの開始 */
   if (!ac->dic_session) {
     ac->dic_session = anthy_dic_create_session();
     if (!ac->dic_session) {
+      anthy_free_xstr(xs);
       return -1;
     }
   }
 
   anthy_dic_activate_session(ac->dic_session);
-  /* 変換を開始する前に個人辞書をreloadする */
+  /* 変換を開始する前に個人辞書をreloadする
+   * 学習データの未知語が変わっていれば、差分だけの変換はできない */
   anthy_reload_record();
 
-  xs = anthy_cstr_to_xstr(s, ac->encoding);
+  if (!need_reconvert(ac, xs) && anthy_do_context_can_append_str(ac, xs)) {
+    /* 前回の文字列の後ろに文字を追加しただけなら、差分だけを変換する */
+    retval = anthy_do_context_append_str(ac, xs);
+    anthy_free_xstr(xs);
+    return retval;
+  }
+
+  /*初期化*/
+  anthy_do_reset_context(ac);
+
   /**/
   if (!need_reconvert(ac, xs)) {
     /* 普通に変換する */
@@ -275,6 +285,58 @@ anthy_resize_segment(struct anthy_context *ac, int nth, int resize)
   anthy_do_resize_segment(ac, nth, resize);
 }
 
+/** (API) 文節分割の候補の数の取得 */
+int
+anthy_get_nr_segmentation(struct anthy_context *ac)
+{
+  if (!ac || !ac->str.str) {
+    return 0;
+  }
+  return anthy_get_nr_split_path(&ac->split_info);
+}
+
+/**
+ * (API) 文節分割の候補の取得
+ * @param [out] seg_len  各文節の長さ、lenより多い文節は格納しない
+ * @return 文節の数、候補が無ければ-1
+ */
+int
+anthy_get_nth_segmentation(struct anthy_context *ac, int nth,
+			   int *seg_len, int len)
+{
+  struct split_path *path;
+  int i, from, nr;
+  if (!ac || !ac->str.str) {
+    return -1;
+  }
+  path = anthy_get_nth_split_path(&ac->split_info, nth);
+  if (!path) {
+    return -1;
+  }
+  nr = 0;
+  for (i = 1, from = 0; i <= ac->str.len; i++) {
+    if (path->seg_border[i]) {
+      if (seg_len && nr < len) {
+	seg_len[nr] = i - from;
+      }
+      nr ++;
+      from = i;
+    }
+  }
+  return nr;
+}
+
+/** (API) 文節分割の候補を選んで区切り直す */
+int
+anthy_select_segmentation(struct anthy_context *ac, int nth)
+{
+  if (!ac || !ac->str.str) {
+    return -1;
+  }
+  anthy_dic_activate_session(ac->dic_session);
+  return anthy_do_select_split_path(ac, nth);
+}
+
 /** (API) 変換の状態の取得 */
 int
 anthy_get_stat(struct anthy_context *ac, struct anthy_conv_stat *s)
@@ -447,6 +509,14 @@ anthy_set_prediction_string(struct anthy_context *ac, const char* s)
   int retval;
   xstr *xs;
 
+  /* 辞書セッションの開始 */
+  if (!ac->dic_session) {
+    ac->dic_session = anthy_dic_create_session();
+    if (!ac->dic_session) {
+      return -1;
+    }
+  }
+
   anthy_dic_activate_session(ac->dic_session);
   /* 予測を開始する前に個人辞書をreloadする */
   anthy_reload_record();
@@ -509,6 +579,7 @@ anthy_commit_prediction(struct anthy_context *ac, int nth)
   if (nth < 0 || nth >= pc->nr_prediction) {
     return -1;
   }
+  anthy_dic_activate_session(ac->dic_session);
   anthy_do_commit_prediction(pc->predictions[nth].src_str,
 			     pc->predictions[nth].str);
   return 0;
@@ -558,3 +629,14 @@ anthy_set_reconversion_mode(anthy_context_t ac, int mode)
   }
   return ac->reconversion_mode;
 }
+
+/** (API) 辞書のキャッシュの統計情報の取得 */
+int
+anthy_get_dic_cache_stat(anthy_context_t ac, struct anthy_dic_cache_stat *st)
+{
+  if (!ac || !st) {
+    return -1;
+  }
+  anthy_dic_get_session_stat(ac->dic_session, st);
+  return 0;
+}
@@ -53,11 +53,14 @@ struct anthy_context *anthy_do_create_context(int);
 
 int anthy_do_context_set_str(struct anthy_context *c, const xstr* x,
                              int is_reverse);
+int anthy_do_context_can_append_str(struct anthy_context *c, const xstr *x);
+int anthy_do_context_append_str(struct anthy_context *c, const xstr *x);
 
 void anthy_do_reset_context(struct anthy_context *c);
 void anthy_do_release_context(struct anthy_context *c);
 
 void anthy_do_resize_segment(struct anthy_context *c,int nth,int resize);
+int anthy_do_select_split_path(struct anthy_context *c, int nth);
 
 int anthy_do_set_prediction_str(struct anthy_context *c, xstr *x);
 void anthy_release_segment_list(struct anthy_context *ac);
@@ -78,6 +78,7 @@ void
 anthy_learn_cand_history(struct segment_list *sl)
 {
   int i, nr = 0;
+  anthy_lock_record();
   for (i = 0; i < sl->nr_segments; i++) {
     struct seg_ent *seg = anthy_get_nth_segment(sl, i);
     xstr *xs = &seg->str;
@@ -103,6 +104,7 @@ anthy_learn_cand_history(struct segment_list *sl)
       anthy_truncate_section(MAX_HISTORY_ENTRY);
     }
   }
+  anthy_unlock_record();
 }
 
 /* 履歴をみて候補の重みを計算する */
@@ -202,6 +204,8 @@ reorder_by_suffix(struct seg_ent *se)
 void
 anthy_reorder_candidates_by_history(struct seg_ent *se)
 {
+  anthy_lock_record();
   reorder_by_candidate(se);
   reorder_by_suffix(se);
+  anthy_unlock_record();
 }
@@ -217,7 +217,7 @@ eval_segment(struct seg_ent *se)
 
 /* 学習履歴の内容で順位を調整する */
 static void
-apply_learning(struct segment_list *sl, int nth)
+apply_learning(struct segment_list *sl, int from, int to)
 {
   int i;
 
@@ -226,9 +226,9 @@ apply_learning(struct segment_list *sl, int nth)
    */
 
   /* 用例辞書による順序の変更 */
-  anthy_reorder_candidates_by_relation(sl, nth);
+  anthy_reorder_candidates_by_relation(sl, from, to);
   /* 候補の交換 */
-  for (i = nth; i < sl->nr_segments; i++) {
+  for (i = from; i < to; i++) {
     struct seg_ent *seg = anthy_get_nth_segment(sl, i);
     /* 候補の交換 */
     anthy_proc_swap_candidate(seg);
@@ -238,13 +238,13 @@ apply_learning(struct segment_list *sl, int nth)
 }
 
 /** 外から呼ばれるエントリポイント
- * @nth以降の文節を対象とする
+ * @from番目から@to番目の手前までの文節を対象とする
  */
 void
-anthy_sort_candidate(struct segment_list *sl, int nth)
+anthy_sort_candidate(struct segment_list *sl, int from, int to)
 {
   int i;
-  for (i = nth; i < sl->nr_segments; i++) {
+  for (i = from; i < to; i++) {
     struct seg_ent *seg = anthy_get_nth_segment(sl, i);
     /* まず評価する */
     eval_segment(seg);
@@ -259,18 +259,18 @@ anthy_sort_candidate(struct segment_list *sl, int nth)
   }
 
   /* 学習の履歴を適用する */
-  apply_learning(sl, nth);
+  apply_learning(sl, from, to);
 
   /* またソートする */
-  for ( i = nth ; i < sl->nr_segments ; i++){
+  for ( i = from ; i < to ; i++){
     sort_segment(anthy_get_nth_segment(sl, i));
   }
   /* カタカナの候補が先頭でなければ最後に回す */
-  for (i = nth; i < sl->nr_segments; i++) {
+  for (i = from; i < to; i++) {
     trim_kana_candidate(anthy_get_nth_segment(sl, i));
   }
   /* またソートする */
-  for ( i = nth ; i < sl->nr_segments ; i++){
+  for ( i = from ; i < to ; i++){
     sort_segment(anthy_get_nth_segment(sl, i));
   }
 }
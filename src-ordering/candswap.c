@@ -74,7 +74,9 @@ anthy_swap_cand_ent(struct cand_ent *o, struct cand_ent *n)
     return ;
   }
   /* 自立語部 */
+  anthy_lock_record();
   learn_swap_cand_indep(o, n);
+  anthy_unlock_record();
 }
 
 
@@ -203,14 +205,18 @@ anthy_proc_swap_candidate(struct seg_ent *seg)
     return ;
   }
   /**/
+  anthy_lock_record();
   proc_swap_candidate_indep(seg);
+  anthy_unlock_record();
 }
 
 /* 候補交換の古いエントリを消す */
 void
 anthy_cand_swap_ageup(void)
 {
+  anthy_lock_record();
   if (anthy_select_section("INDEPPAIR", 0) == 0) {
     anthy_truncate_section(MAX_INDEP_PAIR_ENTRY);
   }
+  anthy_unlock_record();
 }
@@ -257,10 +257,11 @@ learn_unknown(struct segment_list *sl)
 void
 anthy_do_commit_prediction(xstr *src, xstr *xs)
 {
-  if (anthy_select_section("PREDICTION", 1)) {
-    return ;
+  anthy_lock_record();
+  if (!anthy_select_section("PREDICTION", 1)) {
+    learn_prediction_str(src, xs);
   }
-  learn_prediction_str(src, xs);
+  anthy_unlock_record();
 }
 
 void
@@ -268,6 +269,7 @@ anthy_proc_commit(struct segment_list *sl,
 		  struct splitter_context *sc)
 {
   /* 各種の学習を行う */
+  anthy_lock_record();
   learn_swapped_candidates(sl);
   learn_resized_segment(sc, sl);
   clear_resized_segment(sc, sl);
@@ -275,4 +277,5 @@ anthy_proc_commit(struct segment_list *sl,
   learn_prediction(sl);
   learn_unknown(sl);
   anthy_learn_cand_history(sl);
+  anthy_unlock_record();
 }
@@ -31,14 +31,13 @@
 #include <anthy/diclib.h>
 #include "sorter.h"
 
-static void *cand_info_array;
+static struct feature_table cand_info;
 
 static double
 calc_probability(struct feature_list *fl)
 {
   struct feature_freq *res, arg;
-  res = anthy_find_feature_freq(cand_info_array,
-				fl, &arg);
+  res = anthy_find_feature_freq(&cand_info, fl, &arg);
   if (res) {
     double pos = (double)res->f[15];
     double neg = (double)res->f[14];
@@ -105,11 +104,11 @@ seg_eval(struct seg_ent *prev_seg,
 }
 
 static void
-sl_eval(struct segment_list *seg_list)
+sl_eval(struct segment_list *seg_list, int nth)
 {
   int i;
-  struct seg_ent *prev_seg = NULL;
-  for (i = 0; i < seg_list->nr_segments; i++) {
+  struct seg_ent *prev_seg = anthy_get_nth_segment(seg_list, nth - 1);
+  for (i = nth; i < seg_list->nr_segments; i++) {
     struct seg_ent *seg;
     seg = anthy_get_nth_segment(seg_list, i);
     seg_eval(prev_seg, seg);
@@ -125,14 +124,15 @@ metaword_compare_func(const void *p1, const void *p2)
   return (*s2)->struct_score - (*s1)->struct_score;
 }
 
+/* @nth以降の文節を対象とする */
 void
-anthy_sort_metaword(struct segment_list *seg_list)
+anthy_sort_metaword(struct segment_list *seg_list, int nth)
 {
   int i;
   /**/
-  sl_eval(seg_list);
+  sl_eval(seg_list, nth);
   /**/
-  for (i = 0; i < seg_list->nr_segments; i++) {
+  for (i = nth; i < seg_list->nr_segments; i++) {
     struct seg_ent *seg = anthy_get_nth_segment(seg_list, i);
     if (seg->mw_array) {    /* 不正なメモリアクセスを行うバグの修正 */
     qsort(seg->mw_array, seg->nr_metaword, sizeof(struct meta_word *),
@@ -144,5 +144,6 @@ anthy_sort_metaword(struct segment_list *seg_list)
 void
 anthy_infosort_init(void)
 {
-  cand_info_array = anthy_file_dic_get_section("cand_info");
+  anthy_init_feature_table(&cand_info, ANTHY_DIC_CAND_INFO,
+			   ANTHY_DIC_CAND_INFO_HASH);
 }
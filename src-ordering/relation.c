@@ -23,12 +23,6 @@
  */
 
 #include <stdlib.h>
-#ifndef _WIN32
-  #include <arpa/inet.h>
-#else
-  #define STRICT 1
-  #include <winsock2.h>
-#endif
 
 #include <anthy/segclass.h>
 #include <anthy/segment.h>
@@ -55,8 +49,13 @@ static struct corpus_ {
   /**/
   int bucket_size;
   int array_size;
+  /* 辞書のバイトオーダがホストと違う */
+  int swap;
 } corpus_info;
 
+/* コーパスの値をホストのバイトオーダで読む */
+#define CORPUS_VAL(v) ((int)anthy_dic_to_host((v), corpus_info.swap))
+
 /* 検索用のiterator */
 struct iterator {
   /* 検索のキーと現在の場所 */
@@ -154,7 +153,7 @@ find_border_of_this_word(int idx)
   if (idx < 0) {
     return 0;
   }
-  val = ntohl(corpus_info.array[idx * 2]);
+  val = CORPUS_VAL(corpus_info.array[idx * 2]);
   while (!(val & ELM_WORD_BORDER) &&
 	 idx > -1) {
     idx --;
@@ -169,7 +168,7 @@ find_left_word_border(int idx)
   if (idx == -1) {
     return -1;
   }
-  val = ntohl(corpus_info.array[idx * 2]);
+  val = CORPUS_VAL(corpus_info.array[idx * 2]);
   if (val & ELM_BOS) {
     return -1;
   }
@@ -186,7 +185,7 @@ find_right_word_border(int idx)
   while (idx < corpus_info.array_size - 2) {
     int val;
     idx ++;
-    val = ntohl(corpus_info.array[idx * 2]);
+    val = CORPUS_VAL(corpus_info.array[idx * 2]);
     if (val & ELM_BOS) {
       return -1;
     }
@@ -210,7 +209,7 @@ push_id(struct neighbor *ctx,
 static void
 collect_word_context(struct neighbor *ctx, int idx)
 {
-  int id = ntohl(corpus_info.array[idx * 2]) & CORPUS_KEY_MASK;
+  int id = CORPUS_VAL(corpus_info.array[idx * 2]) & CORPUS_KEY_MASK;
   /*printf("  id=%d\n", id);*/
   push_id(ctx, id);
 }
@@ -315,8 +314,8 @@ find_first_pos(int key)
   int i;
   for (i = 0; i < MAX_COLLISION; i++) {
     int bkt = (key + i) % corpus_info.bucket_size;
-    if ((int)ntohl(corpus_info.bucket[bkt * 2]) == key) {
-      return ntohl(corpus_info.bucket[bkt * 2 + 1]);
+    if (CORPUS_VAL(corpus_info.bucket[bkt * 2]) == key) {
+      return CORPUS_VAL(corpus_info.bucket[bkt * 2 + 1]);
     }
   }
   return -1;
@@ -346,7 +345,7 @@ find_next_from_corpus(struct iterator *it)
     it->idx = -1;
     return -1;
   }
-  it->idx = ntohl(corpus_info.array[it->idx * 2 + 1]);
+  it->idx = CORPUS_VAL(corpus_info.array[it->idx * 2 + 1]);
   if (it->idx < 0 || it->idx >= corpus_info.array_size ||
       it->idx < idx) {
     it->idx = -1;
@@ -415,13 +414,14 @@ reorder_by_corpus(struct segment_list *sl, int nth)
 
 /*
  * 用例を用いて候補を並び替える
- *  @nth番目以降の文節を対象とする
+ *  @from番目から@to番目の手前までの文節を対象とする
  */
 void
-anthy_reorder_candidates_by_relation(struct segment_list *sl, int nth)
+anthy_reorder_candidates_by_relation(struct segment_list *sl,
+				     int from, int to)
 {
   int i;
-  for (i = nth; i < sl->nr_segments; i++) {
+  for (i = from; i < to; i++) {
     reorder_by_use_dict(sl, i);
     if (corpus_info.array)
       reorder_by_corpus(sl, i);
@@ -431,8 +431,9 @@ anthy_reorder_candidates_by_relation(struct segment_list *sl, int nth)
 void
 anthy_relation_init(void)
 {
-  corpus_info.corpus_array = anthy_file_dic_get_section("corpus_array");
-  corpus_info.corpus_bucket = anthy_file_dic_get_section("corpus_bucket");
+  corpus_info.corpus_array = anthy_file_dic_section(ANTHY_DIC_CORPUS_ARRAY);
+  corpus_info.corpus_bucket = anthy_file_dic_section(ANTHY_DIC_CORPUS_BUCKET);
+  corpus_info.swap = anthy_dic_swapped();
   if (!corpus_info.corpus_array ||
       !corpus_info.corpus_bucket) {
     corpus_info.array = NULL;
@@ -441,15 +442,15 @@ anthy_relation_init(void)
     corpus_info.bucket_size = 0;
     return ;
   }
-  corpus_info.array_size = ntohl(((int *)corpus_info.corpus_array)[1]);
-  corpus_info.bucket_size = ntohl(((int *)corpus_info.corpus_bucket)[1]);
+  corpus_info.array_size = CORPUS_VAL(((int *)corpus_info.corpus_array)[1]);
+  corpus_info.bucket_size = CORPUS_VAL(((int *)corpus_info.corpus_bucket)[1]);
   corpus_info.array = &(((int *)corpus_info.corpus_array)[16]);
   corpus_info.bucket = &(((int *)corpus_info.corpus_bucket)[16]);
   /*
   {
     int i;
     for (i = 0; i < corpus_info.array_size; i++) {
-      int v = ntohl(corpus_info.array[i * 2]);
+      int v = CORPUS_VAL(corpus_info.array[i * 2]);
       printf("%d: %d %d\n", i, v, v & CORPUS_KEY_MASK);
     }
   }
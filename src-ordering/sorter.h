@@ -10,7 +10,8 @@ void anthy_proc_swap_candidate(struct seg_ent *se);
 void anthy_cand_swap_ageup(void);
 
 /**/
-void anthy_reorder_candidates_by_relation(struct segment_list *sl, int nth);
+void anthy_reorder_candidates_by_relation(struct segment_list *sl,
+					  int from, int to);
 
 void anthy_learn_cand_history(struct segment_list *sl);
 void anthy_reorder_candidates_by_history(struct seg_ent *se);
@@ -34,17 +34,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <anthy/arena.h>
 #include <anthy/dic.h>
 #include <anthy/splitter.h>
 #include <anthy/segment.h>
 #include "wordborder.h"
 
 
+/* 候補と要素の配列はsplitter_contextのアリーナに確保し、
+ * 候補の文字列だけをmallocで確保する */
 static struct cand_ent *
-alloc_cand_ent(void)
+alloc_cand_ent(struct splitter_context *sc)
 {
   struct cand_ent *ce;
-  ce = (struct cand_ent *)malloc(sizeof(struct cand_ent));
+  ce = (struct cand_ent *)anthy_arena_alloc(sc->arena,
+					    sizeof(struct cand_ent));
   ce->nr_words = 0;
   ce->elm = NULL;
   ce->mw = NULL;
@@ -57,15 +61,16 @@ alloc_cand_ent(void)
  * 候補を複製する
  */
 static struct cand_ent *
-dup_candidate(struct cand_ent *ce)
+dup_candidate(struct splitter_context *sc, struct cand_ent *ce)
 {
   struct cand_ent *ce_new;
   int i;
-  ce_new = alloc_cand_ent();
+  ce_new = alloc_cand_ent(sc);
   ce_new->nr_words = ce->nr_words;
   ce_new->str.len = ce->str.len;
   ce_new->str.str = anthy_xstr_dup_str(&ce->str);
-  ce_new->elm = malloc(sizeof(struct cand_elm)*ce->nr_words);
+  ce_new->elm = anthy_arena_alloc(sc->arena,
+				  sizeof(struct cand_elm)*ce->nr_words);
   ce_new->flag = ce->flag;
   ce_new->core_elm_index = ce->core_elm_index;
   ce_new->mw = ce->mw;
@@ -95,7 +100,7 @@ push_back_candidate(struct seg_ent *seg, struct cand_ent *ce)
 }
 
 static void
-push_back_guessed_candidate(struct seg_ent *seg)
+push_back_guessed_candidate(struct splitter_context *sc, struct seg_ent *seg)
 {
   xchar xc;
   xstr *xs;
@@ -109,7 +114,7 @@ push_back_guessed_candidate(struct seg_ent *seg)
     return ;
   }
   /* 最後の文字以外をカタカナにしてみる */
-  ce = alloc_cand_ent();
+  ce = alloc_cand_ent(sc);
   xs = anthy_xstr_hira_to_kata(&seg->str);
   xs->str[xs->len-1] = xc;
   ce->str.str = anthy_xstr_dup_str(xs);
@@ -121,7 +126,7 @@ push_back_guessed_candidate(struct seg_ent *seg)
 
 /** 再帰で1単語ずつ候補を割当てていく */
 static int
-enum_candidates(struct seg_ent *seg,
+enum_candidates(struct splitter_context *sc, struct seg_ent *seg,
 		struct cand_ent *ce,
 		int from, int n)
 {
@@ -138,7 +143,7 @@ enum_candidates(struct seg_ent *seg,
     tail.str = &seg->str.str[from];
     anthy_xstrcat(&ce->str, &tail);
     if (ce->str.str && (0 < ce->str.len)) { /* 辞書もしくは学習データが壊れていた時の対策 */
-      push_back_candidate(seg, dup_candidate(ce));
+      push_back_candidate(seg, dup_candidate(sc, ce));
     }
     return 1;
   }
@@ -158,7 +163,7 @@ enum_candidates(struct seg_ent *seg,
 
       yomi.len = ce->elm[n].str.len;
       yomi.str = &seg->str.str[from];
-      cand = dup_candidate(ce);
+      cand = dup_candidate(sc, ce);
       anthy_get_nth_dic_ent_str(cand->elm[n].se,
 				&yomi, i, &word);
       cand->elm[n].nth = i;
@@ -168,7 +173,7 @@ enum_candidates(struct seg_ent *seg,
       anthy_xstrcat(&cand->str, &word);
       free(word.str);
       /* 自分を再帰呼び出しして続きを割り当てる */
-      nr_cands += enum_candidates(seg, cand,
+      nr_cands += enum_candidates(sc, seg, cand,
 				  from + yomi.len,
 				  n+1);
       anthy_release_cand_ent(cand);
@@ -181,11 +186,11 @@ enum_candidates(struct seg_ent *seg,
     xstr xs;
     xs.len = ce->elm[n].str.len;
     xs.str = &seg->str.str[from];
-    cand = dup_candidate(ce);
+    cand = dup_candidate(sc, ce);
     cand->elm[n].nth = -1;
     cand->elm[n].id = -1;
     anthy_xstrcat(&cand->str, &xs);
-    nr_cands = enum_candidates(seg,cand,
+    nr_cands = enum_candidates(sc, seg, cand,
 			       from + xs.len,
 			       n + 1);
     anthy_release_cand_ent(cand);
@@ -199,7 +204,8 @@ enum_candidates(struct seg_ent *seg,
  * 文節全体を含む一単語(単漢字を含む)の候補を生成する
  */
 static void
-push_back_singleword_candidate(struct seg_ent *seg,
+push_back_singleword_candidate(struct splitter_context *sc,
+			       struct seg_ent *seg,
 			       int is_reverse)
 {
   seq_ent_t se;
@@ -221,7 +227,7 @@ push_back_singleword_candidate(struct seg_ent *seg,
     ct = anthy_wtype_get_ct(wt);
     /* 終止形か活用しないものの原形なら */
     if (ct == CT_SYUSI || ct == CT_NONE) {
-      ce = alloc_cand_ent();
+      ce = alloc_cand_ent(sc);
       anthy_get_nth_dic_ent_str(se,&seg->str, i, &xs);
       ce->str.str = xs.str;
       ce->str.len = xs.len;
@@ -232,21 +238,21 @@ push_back_singleword_candidate(struct seg_ent *seg,
 }
 
 static void
-push_back_noconv_candidate(struct seg_ent *seg)
+push_back_noconv_candidate(struct splitter_context *sc, struct seg_ent *seg)
 {
   /* 無変換で片仮名になる候補と平仮名のみになる候補を追加 */
   struct cand_ent *ce;
   xstr *xs;
 
   /* ひらがなのみ */
-  ce = alloc_cand_ent();
+  ce = alloc_cand_ent(sc);
   ce->str.str = anthy_xstr_dup_str(&seg->str);
   ce->str.len = seg->str.len;
   ce->flag = CEF_HIRAGANA;
   push_back_candidate(seg, ce);
 
   /* 次にカタカナ */
-  ce = alloc_cand_ent();
+  ce = alloc_cand_ent(sc);
   xs = anthy_xstr_hira_to_kata(&seg->str);
   ce->str.str = anthy_xstr_dup_str(xs);
   ce->str.len = xs->len;
@@ -257,7 +263,7 @@ push_back_noconv_candidate(struct seg_ent *seg)
   /* 記号のみの文節 */
   xs = anthy_conv_half_wide(&seg->str);
   if (xs) {
-    ce = alloc_cand_ent();
+    ce = alloc_cand_ent(sc);
     ce->str.str = anthy_xstr_dup_str(xs);
     ce->str.len = xs->len;
     ce->flag = CEF_NONE;
@@ -304,7 +310,8 @@ make_cand_elem_from_word_list(struct seg_ent *se,
 
 /** まずwordlistを持つmetawordからmeta_wordを取り出す */
 static void
-make_candidate_from_simple_metaword(struct seg_ent *se,
+make_candidate_from_simple_metaword(struct splitter_context *sc,
+				    struct seg_ent *se,
 				    struct meta_word *mw,
 				    struct meta_word *top_mw,
 				    int is_reverse)
@@ -315,11 +322,13 @@ make_candidate_from_simple_metaword(struct seg_ent *se,
   struct cand_ent *ce;
 
   /* 複数(1も含む)の単語で構成される文節に単語を割当てていく */
-  ce = alloc_cand_ent();
+  ce = alloc_cand_ent(sc);
   ce->nr_words = mw->nr_parts;
   ce->str.str = NULL;
   ce->str.len = 0;
-  ce->elm = calloc(sizeof(struct cand_elm),ce->nr_words);
+  ce->elm = anthy_arena_alloc(sc->arena,
+			      sizeof(struct cand_elm) * ce->nr_words);
+  memset(ce->elm, 0, sizeof(struct cand_elm) * ce->nr_words);
   ce->mw = mw;
   ce->score = 0;
 
@@ -333,13 +342,14 @@ make_candidate_from_simple_metaword(struct seg_ent *se,
     ce->flag = CEF_GUESS;
   }
 
-  enum_candidates(se, ce, 0, 0);
+  enum_candidates(sc, se, ce, 0, 0);
   anthy_release_cand_ent(ce);
 }
 
 /** combinedなmetawordは二つの語を合体して一つの語として出す */
 static void
-make_candidate_from_combined_metaword(struct seg_ent *se,
+make_candidate_from_combined_metaword(struct splitter_context *sc,
+				      struct seg_ent *se,
 				      struct meta_word *mw,
 				      struct meta_word *top_mw,
 				      int is_reverse)
@@ -350,12 +360,14 @@ make_candidate_from_combined_metaword(struct seg_ent *se,
   struct cand_ent *ce;
 
   /* 複数(1も含む)の単語で構成される文節に単語を割当てていく */
-  ce = alloc_cand_ent();
+  ce = alloc_cand_ent(sc);
   ce->nr_words = mw->nr_parts;
   ce->score = 0;
   ce->str.str = NULL;
   ce->str.len = 0;
-  ce->elm = calloc(sizeof(struct cand_elm),ce->nr_words);
+  ce->elm = anthy_arena_alloc(sc->arena,
+			      sizeof(struct cand_elm) * ce->nr_words);
+  memset(ce->elm, 0, sizeof(struct cand_elm) * ce->nr_words);
   ce->mw = top_mw;
 
   /* 接頭辞, 自立語部, 接尾辞, 付属語 */
@@ -371,7 +383,7 @@ make_candidate_from_combined_metaword(struct seg_ent *se,
     ce->flag = CEF_GUESS;
   }
 
-  enum_candidates(se, ce, 0, 0);
+  enum_candidates(sc, se, ce, 0, 0);
   anthy_release_cand_ent(ce);
 }
 
@@ -379,7 +391,8 @@ make_candidate_from_combined_metaword(struct seg_ent *se,
 /** splitterの情報を利用して候補を生成する
  */
 static void
-proc_splitter_info(struct seg_ent *se,
+proc_splitter_info(struct splitter_context *sc,
+		   struct seg_ent *se,
 		   struct meta_word *mw,
 		   /* topとはtreeのトップ */
 		   struct meta_word *top_mw,
@@ -390,7 +403,7 @@ proc_splitter_info(struct seg_ent *se,
 
   /* まずwordlistを持つmetawordの場合 */
   if (mw->wl && mw->wl->len) {
-    make_candidate_from_simple_metaword(se, mw, top_mw, is_reverse);
+    make_candidate_from_simple_metaword(sc, se, mw, top_mw, is_reverse);
     return;
   }
 
@@ -398,16 +411,16 @@ proc_splitter_info(struct seg_ent *se,
   switch (st) {
   case MW_STATUS_WRAPPED:
     /* wrapされたものの情報を取り出す */
-    proc_splitter_info(se, mw->mw1, top_mw, is_reverse);
+    proc_splitter_info(sc, se, mw->mw1, top_mw, is_reverse);
     break;
   case MW_STATUS_COMBINED:
-    make_candidate_from_combined_metaword(se, mw, top_mw, is_reverse);
+    make_candidate_from_combined_metaword(sc, se, mw, top_mw, is_reverse);
     break;
   case MW_STATUS_COMPOUND:
     /* 連文節の葉 */
     {
       struct cand_ent *ce;
-      ce = alloc_cand_ent();
+      ce = alloc_cand_ent(sc);
       ce->str.str = anthy_xstr_dup_str(&mw->cand_hint);
       ce->str.len = mw->cand_hint.len;
       ce->flag = CEF_COMPOUND;
@@ -423,7 +436,7 @@ proc_splitter_info(struct seg_ent *se,
     /* metawordを持たない候補文字列が
        直接に指定された */
       struct cand_ent *ce;
-      ce = alloc_cand_ent();
+      ce = alloc_cand_ent(sc);
       ce->str.str = anthy_xstr_dup_str(&mw->cand_hint);
       ce->str.len = mw->cand_hint.len;
       ce->mw = top_mw;
@@ -461,17 +474,17 @@ anthy_do_make_candidates(struct splitter_context *sc,
     if (anthy_splitter_debug_flags() & SPLITTER_DEBUG_CAND) {
       anthy_print_metaword(sc, mw);
     }
-    proc_splitter_info(se, mw, mw, is_reverse);
+    proc_splitter_info(sc, se, mw, mw, is_reverse);
   }
   if (anthy_splitter_debug_flags() & SPLITTER_DEBUG_CAND) {
     printf("#done\n");
   }
   /* 単漢字などの候補 */
-  push_back_singleword_candidate(se, is_reverse);
+  push_back_singleword_candidate(sc, se, is_reverse);
 
   /* ひらがな、カタカナの無変換エントリを作る */
-  push_back_noconv_candidate(se);
+  push_back_noconv_candidate(sc, se);
 
   /* 候補が二つしか無いときは最後が助詞で残りが平仮名の候補を作れるか試す */
-  push_back_guessed_candidate(se);
+  push_back_guessed_candidate(sc, se);
 }
@@ -59,7 +59,7 @@ anthy_xstrcmp_with_ondisk(xstr *xs,
 			  ondisk_xstr *dxs)
 {
   int *d = (int *)dxs;
-  int len = anthy_dic_ntohl(d[0]);
+  int len = anthy_dic_to_host(d[0], ddic.swap);
   int i;
   xchar c;
   if (len != xs->len) {
@@ -67,7 +67,7 @@ anthy_xstrcmp_with_ondisk(xstr *xs,
   }
   d++;
   for (i = 0; i < len; i++) {
-    c = anthy_dic_ntohl(d[i]);
+    c = anthy_dic_to_host(d[i], ddic.swap);
     if (xs->str[i] != c) {
       return 1;
     }
@@ -75,11 +75,28 @@ anthy_xstrcmp_with_ondisk(xstr *xs,
   return 0;
 }
 
+/* xsがdxsの先頭の部分と一致するか */
+static int
+anthy_ondisk_xstr_has_prefix(xstr *xs, ondisk_xstr *dxs)
+{
+  int *d = (int *)dxs;
+  int i;
+  xchar c;
+  d++;
+  for (i = 0; i < xs->len; i++) {
+    c = anthy_dic_to_host(d[i], ddic.swap);
+    if (xs->str[i] != c) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 static ondisk_xstr *
 anthy_next_ondisk_xstr(ondisk_xstr *dxs)
 {
   int *d = (int *)dxs;
-  int len = anthy_dic_ntohl(d[0]);
+  int len = anthy_dic_to_host(d[0], ddic.swap);
   return &d[len+1];
 }
 
@@ -87,7 +104,7 @@ static int
 anthy_ondisk_xstr_len(ondisk_xstr *dxs)
 {
   int *d = (int *)dxs;
-  return anthy_dic_ntohl(d[0]);
+  return anthy_dic_to_host(d[0], ddic.swap);
 }
 
 /*
@@ -118,6 +135,10 @@ match_nodes(struct splitter_context *sc,
       xstr cond_xs;
       /* 付属語の方が遷移条件より長いことが必要 */
       if (follow_str.len < anthy_ondisk_xstr_len(dep_xs)) {
+	/* 文字列が追加されると一致するかもしれない */
+	if (anthy_ondisk_xstr_has_prefix(&follow_str, dep_xs)) {
+	  anthy_word_list_reach_end(sc);
+	}
 	continue;
       }
       /* 遷移条件の部分を切り出す */
@@ -165,23 +186,24 @@ match_branch(struct splitter_context *sc,
     /**/
     struct dep_transition *transition = &db->transition[i];
 
-    tmpl->tail_ct = anthy_dic_ntohl(transition->ct);
+    tmpl->tail_ct = anthy_dic_to_host(transition->ct, ddic.swap);
     /* 遷移の活用形と品詞 */
-    if (anthy_dic_ntohl(transition->dc) != DEP_NONE) {
-      part->dc = anthy_dic_ntohl(transition->dc);
+    if (anthy_dic_to_host(transition->dc, ddic.swap) != DEP_NONE) {
+      part->dc = anthy_dic_to_host(transition->dc, ddic.swap);
     }
     /* 名詞化する動詞等で品詞名を上書き */
-    if (anthy_dic_ntohl(transition->head_pos) != POS_NONE) {
-      tmpl->head_pos = anthy_dic_ntohl(transition->head_pos);
+    if (anthy_dic_to_host(transition->head_pos, ddic.swap) != POS_NONE) {
+      tmpl->head_pos = anthy_dic_to_host(transition->head_pos, ddic.swap);
     }
     if (transition->weak) {
       tmpl->mw_features |= MW_FEATURE_WEAK_CONN;
     }
 
     /* 遷移か終端か */
-    if (anthy_dic_ntohl(transition->next_node)) {
+    if (anthy_dic_to_host(transition->next_node, ddic.swap)) {
       /* 遷移 */
-      match_nodes(sc, tmpl, *xs, anthy_dic_ntohl(transition->next_node));
+      match_nodes(sc, tmpl, *xs,
+		  anthy_dic_to_host(transition->next_node, ddic.swap));
     } else {
       struct word_list *wl;
 
@@ -271,7 +293,8 @@ read_file(void)
 
   int offset = 0;
 
-  ddic.file_ptr = anthy_file_dic_get_section("dep_dic");
+  ddic.file_ptr = anthy_file_dic_section(ANTHY_DIC_DEP_DIC);
+  ddic.swap = anthy_dic_swapped();
 
   /* 最初にルールの数 */
   ddic.nrRules = anthy_dic_ntohl(*(int*)&ddic.file_ptr[offset]);
@@ -185,3 +185,25 @@ anthy_eval_border(struct splitter_context *sc, int from, int from2, int to)
   /* 文節の境界を設定する */
   anthy_mark_borders(sc, from, to);
 }
+
+/*
+ * latticeを使わずに、以前の文節分割で見つけた分割の候補に従って
+ * 文節境界をマークする
+ */
+void
+anthy_eval_border_by_path(struct splitter_context *sc, int from, int from2,
+			  int to, struct split_path *path)
+{
+  struct word_split_info_cache *info = sc->word_split_info;
+  int i;
+
+  metaword_constraint_check_all(sc, from, to, from2);
+
+  /* 複合語のmetawordはfromより前から始まっていることがあるので、
+   * 全てマークしてから、呼び出し元でfromからtoの間を使う */
+  for (i = 0; i < path->nr_mw; i++) {
+    struct meta_word *mw = path->mw[i];
+    info->best_seg_class[mw->from] = mw->seg_class;
+    anthy_mark_border_by_metaword(sc, mw);
+  }
+}
@@ -42,7 +42,8 @@
 #include <string.h>
 #include <math.h>
 
-#include <anthy/alloc.h>
+#include <anthy/arena.h>
+#include <anthy/conf.h>
 #include <anthy/xstr.h>
 #include <anthy/segclass.h>
 #include <anthy/splitter.h>
@@ -51,9 +52,49 @@
 #include "wordborder.h"
 
 static float anthy_normal_length = 20.0; /* 文節の期待される長さ */
-static void *trans_info_array;
+static struct feature_table trans_info;
 
-#define NODE_MAX_SIZE 50
+/*
+ * 一つの位置に残すノードの数(ビーム幅)の既定値
+ * anthy-confのSPLITTER_BEAM_WIDTHで変えられる
+ * 以前のリストが50個になったら一つ削る動作と同じになる値
+ */
+#define DEFAULT_BEAM_WIDTH 49
+static int beam_width = DEFAULT_BEAM_WIDTH;
+/* 同じ状態のノードを探すハッシュ表の大きさ(ビーム幅以上の2の冪) */
+static int nr_node_buckets;
+
+/*
+ * 文節分割の候補として残す経路の数の既定値
+ * anthy-confのSPLITTER_NBESTで変えられる
+ */
+#define DEFAULT_NBEST 5
+static int nbest = DEFAULT_NBEST;
+/* N-bestの経路を探す間に作る途中の経路の数の上限 */
+#define MAX_PATH_STATES 2048
+
+/* 文節長によるスコアの調整に使う長さの範囲 */
+#define FORM_MIN_LEN 2
+#define FORM_MAX_LEN 6
+/* 文節長ごとのポワソン分布の値、初期化時に計算する */
+static double form_bias[FORM_MAX_LEN + 1];
+
+/* 素性の組から遷移確率を引くキャッシュの大きさ(2の冪) */
+#define TRANS_CACHE_SIZE 512
+
+/*
+ * パスの確率
+ * 遷移確率を掛け合わせていくとdoubleではアンダーフローするので、
+ * 仮数部と2を底とする指数部に分けて持つ(値は frac * 2^exp)。
+ * 指数部は対数そのものなので桁が落ちることはなく、仮数部の積は
+ * doubleの積と同じ丸めになるので、アンダーフローしない範囲では
+ * doubleで掛けていった時と同じ大小関係になる
+ */
+struct path_prob {
+  /* 0.5以上1未満、もしくは0 */
+  double frac;
+  int exp;
+};
 
 /* グラフのノード(遷移状態) */
 struct lattice_node {
@@ -61,29 +102,151 @@ struct lattice_node {
   enum seg_class seg_class; /* この状態の品詞 */
 
 
-  double real_probability;  /* ここに至るまでの確率(文節数補正無し) */
-  double adjusted_probability;  /* ここに至るまでの確率(文節数補正有り) */
+  struct path_prob real_probability;  /* ここに至るまでの確率(文節数補正無し) */
+  struct path_prob adjusted_probability;  /* ここに至るまでの確率(文節数補正有り) */
 
 
   struct lattice_node* before_node; /* 一つ前の遷移状態 */
   struct meta_word* mw; /* この遷移状態に対応するmeta_word */
 
-  struct lattice_node* next; /* リスト構造のためのポインタ */
+  /* 同じ位置のノードを追加された順につなぐリスト */
+  struct lattice_node *prev, *next;
+  /* 追加された順番、置き換えたノードは元のノードの順番を引き継ぐ */
+  int seq;
+  /* 確率の低い順のヒープ中の位置 */
+  int heap_index;
+  /* (seg_class, border)のハッシュ表の同じバケツのノード */
+  struct lattice_node *hash_next;
 };
 
+/* 同じ位置で終わるノードの集合 */
 struct node_list_head {
-  struct lattice_node *head;
+  /* 追加された順のリスト */
+  struct lattice_node *head, *tail;
   int nr_nodes;
+  /* 次に追加するノードの順番 */
+  int seq;
+  /* 一番確率の低いノードを根とするヒープ、要素はbeam_width + 1個まで */
+  struct lattice_node **heap;
+  /* (seg_class, border)から同じ状態のノードを探すハッシュ表 */
+  struct lattice_node **buckets;
+};
+
+/* 素性の組と遷移確率の組 */
+struct trans_cache_ent {
+  /* 素性の数、0なら空きエントリ */
+  int nr;
+  short index[NR_EM_FEATURES];
+  double prob;
 };
 
 struct lattice_info {
   /* 遷移状態のリストの配列 */
   struct node_list_head *lattice_node_list;
   struct splitter_context *sc;
-  /* ノードのアロケータ */
-  allocator node_allocator;
+  /* 枝刈りで捨てたノードのリスト、次のノードに使う */
+  struct lattice_node *free_nodes;
+  /* 一回の文節分割の間、同じ素性の組の確率を再計算しないためのキャッシュ */
+  struct trans_cache_ent *trans_cache;
+  int nr_cached;
+  /* 文末の遷移確率、最後の文字まで到達したノードが無ければ1 */
+  double tail_probability;
+  /* N-bestの分割を後から探すための情報 */
+  struct lattice_node *best_node;
+  int last;
+  /* lattice作成時の文節境界、latticeの対象外の部分も含む */
+  int *base_border;
 };
 
+/*
+ * N-bestの経路を後ろからたどって探す途中の経路
+ * nodeから文末までの経路を表す
+ */
+struct path_state {
+  struct lattice_node *node;
+  /* 経路上でnodeの右にある状態 */
+  struct path_state *succ;
+  /* nodeより右の遷移の確率の積(文末補正とスコア込み) */
+  struct path_prob suffix;
+  /* nodeまでの最大の確率とsuffixの積、この経路を延ばした時の見積もり */
+  struct path_prob prob;
+};
+
+/* 途中の経路の確率の高い順のヒープ */
+struct path_queue {
+  struct path_state **heap;
+  int nr;
+  /* これまでに作った途中の経路の数 */
+  int nr_states;
+};
+
+static void
+path_prob_set_one(struct path_prob *p)
+{
+  p->frac = 0.5;
+  p->exp = 1;
+}
+
+/* pにxを掛ける */
+static void
+path_prob_mul(struct path_prob *p, double x)
+{
+  int e;
+  double f = frexp(x, &e);
+  p->exp += e;
+  p->frac = frexp(p->frac * f, &e);
+  p->exp += e;
+  if (p->frac == 0) {
+    p->exp = 0;
+  }
+}
+
+static int
+path_prob_cmp(const struct path_prob *lhs, const struct path_prob *rhs)
+{
+  /* 0は指数部によらず最小 */
+  if (lhs->frac == 0 || rhs->frac == 0) {
+    if (lhs->frac > 0) {
+      return 1;
+    }
+    if (rhs->frac > 0) {
+      return -1;
+    }
+    return 0;
+  }
+  if (lhs->exp != rhs->exp) {
+    return lhs->exp > rhs->exp ? 1 : -1;
+  }
+  if (lhs->frac > rhs->frac) {
+    return 1;
+  } else if (lhs->frac < rhs->frac) {
+    return -1;
+  }
+  return 0;
+}
+
+/* pにqを掛ける */
+static void
+path_prob_mul_prob(struct path_prob *p, const struct path_prob *q)
+{
+  int e;
+  p->frac = frexp(p->frac * q->frac, &e);
+  p->exp += q->exp + e;
+  if (p->frac == 0) {
+    p->exp = 0;
+  }
+}
+
+/* 確率の自然対数、表示用 */
+static double
+path_prob_log(const struct path_prob *p)
+{
+  if (p->frac == 0) {
+    return -HUGE_VAL;
+  }
+  return log(p->frac) + p->exp * log(2.0);
+}
+
 /*
  */
 static void
@@ -93,7 +256,8 @@ print_lattice_node(struct lattice_info *info, struct lattice_node *node)
     printf("**lattice_node (null)*\n");
     return ;
   }
-  printf("**lattice_node probability=%.128f\n", node->real_probability);
+  printf("**lattice_node log probability=%f\n",
+	 path_prob_log(&node->real_probability));
   if (node->mw) {
     anthy_print_metaword(info->sc, node->mw);
   }
@@ -118,7 +282,6 @@ get_poisson(double lambda, int r)
 static double
 get_form_bias(struct meta_word *mw)
 {
-  double bias;
   int r;
   /* wrapされている場合は内部のを使う */
   while (mw->type == MW_WRAP) {
@@ -126,19 +289,18 @@ get_form_bias(struct meta_word *mw)
   }
   /* 文節長による調整 */
   r = mw->len;
-  if (r > 6) {
-    r = 6;
+  if (r > FORM_MAX_LEN) {
+    r = FORM_MAX_LEN;
   }
-  if (r < 2) {
-    r = 2;
+  if (r < FORM_MIN_LEN) {
+    r = FORM_MIN_LEN;
   }
   if (mw->seg_class == SEG_RENTAI_SHUSHOKU &&
       r < 3) {
     /* 指示語 */
     r = 3;
   }
-  bias = get_poisson(anthy_normal_length, r);
-  return bias;
+  return form_bias[r];
 }
 
 static void
@@ -178,8 +340,7 @@ calc_probability(int cc, struct feature_list *fl)
   double prob;
 
   /* 確率を計算する */
-  res = anthy_find_feature_freq(trans_info_array,
-				fl, &arg);
+  res = anthy_find_feature_freq(&trans_info, fl, &arg);
   prob = 0;
   if (res) {
     double pos = res->f[15];
@@ -198,8 +359,53 @@ calc_probability(int cc, struct feature_list *fl)
   return prob;
 }
 
+static unsigned int
+hash_feature_list(struct feature_list *fl)
+{
+  unsigned int h = fl->nr;
+  int i;
+  for (i = 0; i < fl->nr; i++) {
+    h = h * 31 + (unsigned short)fl->u.index[i];
+  }
+  return h;
+}
+
+/*
+ * 素性の組に対する遷移確率をキャッシュから探し、
+ * 無ければ計算してキャッシュに入れる
+ */
 static double
-get_transition_probability(struct lattice_node *node)
+lookup_probability(struct lattice_info *info, int cc, struct feature_list *fl)
+{
+  struct trans_cache_ent *ent;
+  unsigned int h = hash_feature_list(fl);
+  double prob;
+
+  for (;; h++) {
+    ent = &info->trans_cache[h & (TRANS_CACHE_SIZE - 1)];
+    if (ent->nr == 0) {
+      break;
+    }
+    if (ent->nr == fl->nr &&
+	!memcmp(ent->index, fl->u.index, sizeof(short) * fl->nr)) {
+      return ent->prob;
+    }
+  }
+
+  prob = calc_probability(cc, fl);
+  /* 表が埋まってきたら、それ以上は覚えない */
+  if (fl->nr > 0 && info->nr_cached < TRANS_CACHE_SIZE * 3 / 4) {
+    ent->nr = fl->nr;
+    memcpy(ent->index, fl->u.index, sizeof(short) * fl->nr);
+    ent->prob = prob;
+    info->nr_cached ++;
+  }
+  return prob;
+}
+
+static double
+get_transition_probability(struct lattice_info *info,
+			   struct lattice_node *node)
 {
   struct feature_list features;
   double probability;
@@ -207,7 +413,7 @@ get_transition_probability(struct lattice_node *node)
   /**/
   anthy_feature_list_init(&features);
   build_feature_list(node, &features);
-  probability = calc_probability(node->seg_class, &features);
+  probability = lookup_probability(info, node->seg_class, &features);
   anthy_feature_list_free(&features);
 
   /* 文節の形に対する評価 */
@@ -215,38 +421,55 @@ get_transition_probability(struct lattice_node *node)
   return probability;
 }
 
+/* latticeの情報はsplitter_contextのlattice用のアリーナに確保し、
+ * 次のanthy_mark_bordersか文節分割の解放の時にまとめて捨てる */
 static struct lattice_info*
 alloc_lattice_info(struct splitter_context *sc, int size)
 {
   int i;
-  struct lattice_info* info = (struct lattice_info*)malloc(sizeof(struct lattice_info));
+  struct lattice_info* info = (struct lattice_info*)
+    anthy_arena_alloc(sc->lattice_arena, sizeof(struct lattice_info));
   info->sc = sc;
   info->lattice_node_list = (struct node_list_head*)
-    malloc((size + 1) * sizeof(struct node_list_head));
+    anthy_arena_alloc(sc->lattice_arena, (size + 1) * sizeof(struct node_list_head));
   for (i = 0; i < size + 1; i++) {
     info->lattice_node_list[i].head = NULL;
+    info->lattice_node_list[i].tail = NULL;
     info->lattice_node_list[i].nr_nodes = 0;
+    info->lattice_node_list[i].seq = 0;
+    /* ヒープとハッシュ表は最初にノードを追加する時に確保する */
+    info->lattice_node_list[i].heap = NULL;
+    info->lattice_node_list[i].buckets = NULL;
   }
-  info->node_allocator = anthy_create_allocator(sizeof(struct lattice_node),
-						NULL);
+  info->free_nodes = NULL;
+  info->trans_cache = (struct trans_cache_ent*)
+    anthy_arena_alloc(sc->lattice_arena,
+		      TRANS_CACHE_SIZE * sizeof(struct trans_cache_ent));
+  for (i = 0; i < TRANS_CACHE_SIZE; i++) {
+    info->trans_cache[i].nr = 0;
+  }
+  info->nr_cached = 0;
+  info->tail_probability = 1.0;
   return info;
 }
 
 static void
-calc_node_parameters(struct lattice_node *node)
+calc_node_parameters(struct lattice_info *info, struct lattice_node *node)
 {
   /* 対応するmetawordが無い場合は文頭と判断する */
   node->seg_class = node->mw ? node->mw->seg_class : SEG_HEAD;
 
   if (node->before_node) {
     /* 左に隣接するノードがある場合 */
-    node->real_probability = node->before_node->real_probability *
-      get_transition_probability(node);
-    node->adjusted_probability = node->real_probability *
-      (node->mw ? node->mw->score : 1000);
+    node->real_probability = node->before_node->real_probability;
+    path_prob_mul(&node->real_probability,
+		  get_transition_probability(info, node));
+    node->adjusted_probability = node->real_probability;
+    path_prob_mul(&node->adjusted_probability,
+		  node->mw ? node->mw->score : 1000);
   } else {
     /* 左に隣接するノードが無い場合 */
-    node->real_probability = 1.0;
+    path_prob_set_one(&node->real_probability);
     node->adjusted_probability = node->real_probability;
   }
 }
@@ -257,13 +480,20 @@ alloc_lattice_node(struct lattice_info *info,
 		   struct meta_word* mw, int border)
 {
   struct lattice_node* node;
-  node = anthy_smalloc(info->node_allocator);
+  if (info->free_nodes) {
+    node = info->free_nodes;
+    info->free_nodes = node->next;
+  } else {
+    node = anthy_arena_alloc(info->sc->lattice_arena, sizeof(struct lattice_node));
+  }
   node->before_node = before_node;
   node->border = border;
+  node->prev = NULL;
   node->next = NULL;
+  node->hash_next = NULL;
   node->mw = mw;
 
-  calc_node_parameters(node);
+  calc_node_parameters(info, node);
 
   return node;
 }
@@ -271,15 +501,8 @@ alloc_lattice_node(struct lattice_info *info,
 static void
 release_lattice_node(struct lattice_info *info, struct lattice_node* node)
 {
-  anthy_sfree(info->node_allocator, node);
-}
-
-static void
-release_lattice_info(struct lattice_info* info)
-{
-  anthy_free_allocator(info->node_allocator);
-  free(info->lattice_node_list);
-  free(info);
+  node->next = info->free_nodes;
+  info->free_nodes = node;
 }
 
 /*
@@ -293,41 +516,170 @@ release_lattice_info(struct lattice_info* info)
 static int
 cmp_node(struct lattice_node *lhs, struct lattice_node *rhs)
 {
-  struct lattice_node *lhs_before = lhs;
-  struct lattice_node *rhs_before = rhs;
-
   if (lhs && !rhs) return 1;
   if (!lhs && rhs) return -1;
   if (!lhs && !rhs) return 0;
 
-  while (lhs_before && rhs_before) {
-    if (lhs_before->mw && rhs_before->mw &&
-	lhs_before->mw->from + lhs_before->mw->len == rhs_before->mw->from + rhs_before->mw->len) {
-      /* Give preference to OCHAIRE */
-      if (lhs->mw->type == MW_OCHAIRE && rhs->mw->type != MW_OCHAIRE)
-	return 1;
-      else if (lhs->mw->type != MW_OCHAIRE && rhs->mw->type == MW_OCHAIRE)
-	return -1;
-
-      /* Give negative preference to COMPOUND_PART */
-      if (lhs->mw->type != MW_COMPOUND_PART && rhs->mw->type == MW_COMPOUND_PART)
-	return 1;
-      else if (lhs->mw->type == MW_COMPOUND_PART && rhs->mw->type != MW_COMPOUND_PART)
-	return -1;
-    } else {
+  /* 以前は前のノードを順にたどっていたが、判定に使うのは
+   * lhsとrhs自身のmetawordの種類だけなので一度だけ調べる */
+  if (lhs->mw && rhs->mw &&
+      lhs->mw->from + lhs->mw->len == rhs->mw->from + rhs->mw->len) {
+    /* Give preference to OCHAIRE */
+    if (lhs->mw->type == MW_OCHAIRE && rhs->mw->type != MW_OCHAIRE)
+      return 1;
+    else if (lhs->mw->type != MW_OCHAIRE && rhs->mw->type == MW_OCHAIRE)
+      return -1;
+
+    /* Give negative preference to COMPOUND_PART */
+    if (lhs->mw->type != MW_COMPOUND_PART && rhs->mw->type == MW_COMPOUND_PART)
+      return 1;
+    else if (lhs->mw->type == MW_COMPOUND_PART && rhs->mw->type != MW_COMPOUND_PART)
+      return -1;
+  }
+
+  /* 最後に遷移確率を見る */
+  return path_prob_cmp(&lhs->adjusted_probability,
+		       &rhs->adjusted_probability);
+}
+
+/*
+ * ヒープの中での順序
+ * 確率が同じなら先に追加された方を低いとみなす
+ */
+static int
+node_is_lower(struct lattice_node *lhs, struct lattice_node *rhs)
+{
+  int c = cmp_node(lhs, rhs);
+  if (c) {
+    return c < 0;
+  }
+  return lhs->seq < rhs->seq;
+}
+
+static void
+heap_set(struct node_list_head *list, int idx, struct lattice_node *node)
+{
+  list->heap[idx] = node;
+  node->heap_index = idx;
+}
+
+static void
+heap_sift_up(struct node_list_head *list, int idx)
+{
+  struct lattice_node *node = list->heap[idx];
+  while (idx > 0) {
+    int parent = (idx - 1) / 2;
+    if (!node_is_lower(node, list->heap[parent])) {
       break;
     }
-    lhs_before = lhs_before->before_node;
-    rhs_before = rhs_before->before_node;
+    heap_set(list, idx, list->heap[parent]);
+    idx = parent;
   }
+  heap_set(list, idx, node);
+}
 
-  /* 最後に遷移確率を見る */
-  if (lhs->adjusted_probability > rhs->adjusted_probability) {
-    return 1;
-  } else if (lhs->adjusted_probability < rhs->adjusted_probability) {
-    return -1;
+static void
+heap_sift_down(struct node_list_head *list, int idx)
+{
+  struct lattice_node *node = list->heap[idx];
+  for (;;) {
+    int child = idx * 2 + 1;
+    if (child >= list->nr_nodes) {
+      break;
+    }
+    if (child + 1 < list->nr_nodes &&
+	node_is_lower(list->heap[child + 1], list->heap[child])) {
+      child ++;
+    }
+    if (!node_is_lower(list->heap[child], node)) {
+      break;
+    }
+    heap_set(list, idx, list->heap[child]);
+    idx = child;
+  }
+  heap_set(list, idx, node);
+}
+
+static struct lattice_node **
+node_bucket(struct node_list_head *list, struct lattice_node *node)
+{
+  unsigned int h = node->border * SEG_SIZE + node->seg_class;
+  return &list->buckets[h & (nr_node_buckets - 1)];
+}
+
+/* 同じ状態(seg_class, border)のノードのうち、先に追加されたものを探す */
+static struct lattice_node *
+find_same_node(struct node_list_head *list, struct lattice_node *new_node)
+{
+  struct lattice_node *node, *found = NULL;
+  for (node = *node_bucket(list, new_node); node; node = node->hash_next) {
+    if (node->seg_class == new_node->seg_class &&
+	node->border == new_node->border &&
+	(!found || node->seq < found->seq)) {
+      found = node;
+    }
+  }
+  return found;
+}
+
+static void
+unlink_node(struct node_list_head *list, struct lattice_node *node)
+{
+  struct lattice_node **p;
+  /* 追加順のリストから外す */
+  if (node->prev) {
+    node->prev->next = node->next;
   } else {
-    return 0;
+    list->head = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
+  } else {
+    list->tail = node->prev;
+  }
+  /* ハッシュ表から外す */
+  for (p = node_bucket(list, node); *p != node; p = &(*p)->hash_next);
+  *p = node->hash_next;
+}
+
+/* old_nodeの位置をnew_nodeで置き換える */
+static void
+replace_node(struct node_list_head *list, struct lattice_node *old_node,
+	     struct lattice_node *new_node)
+{
+  struct lattice_node **p;
+  new_node->seq = old_node->seq;
+  new_node->prev = old_node->prev;
+  new_node->next = old_node->next;
+  if (new_node->prev) {
+    new_node->prev->next = new_node;
+  } else {
+    list->head = new_node;
+  }
+  if (new_node->next) {
+    new_node->next->prev = new_node;
+  } else {
+    list->tail = new_node;
+  }
+  /* 状態が同じなのでバケツも同じ */
+  for (p = node_bucket(list, old_node); *p != old_node; p = &(*p)->hash_next);
+  new_node->hash_next = old_node->hash_next;
+  *p = new_node;
+  /* 新しいノードの方が確率が低くないので、根から遠ざかる方に動かす */
+  heap_set(list, old_node->heap_index, new_node);
+  heap_sift_down(list, new_node->heap_index);
+}
+
+static void
+alloc_node_list(struct lattice_info *info, struct node_list_head *list)
+{
+  int i;
+  list->heap = anthy_arena_alloc(info->sc->lattice_arena, (beam_width + 1) *
+				 sizeof(struct lattice_node *));
+  list->buckets = anthy_arena_alloc(info->sc->lattice_arena, nr_node_buckets *
+				    sizeof(struct lattice_node *));
+  for (i = 0; i < nr_node_buckets; i++) {
+    list->buckets[i] = NULL;
   }
 }
 
@@ -338,103 +690,94 @@ static void
 push_node(struct lattice_info* info, struct lattice_node* new_node,
 	  int position)
 {
+  struct node_list_head *list = &info->lattice_node_list[position];
   struct lattice_node* node;
-  struct lattice_node* previous_node = NULL;
 
   if (anthy_splitter_debug_flags() & SPLITTER_DEBUG_LN) {
     print_lattice_node(info, new_node);
   }
 
-  /* 先頭のnodeが無ければ無条件に追加 */
-  node = info->lattice_node_list[position].head;
-  if (!node) {
-    info->lattice_node_list[position].head = new_node;
-    info->lattice_node_list[position].nr_nodes ++;
-    return;
+  if (!list->heap) {
+    alloc_node_list(info, list);
   }
 
-  while (node->next) {
-    /* 余計なノードを追加しないための枝刈り */
-    if (new_node->seg_class == node->seg_class &&
-	new_node->border == node->border) {
-      /* segclassが同じで、始まる位置が同じなら */
-      switch (cmp_node(new_node, node)) {
-      case 0:
-      case 1:
-	/* 新しい方が確率が大きいか学習によるものなら、古いのと置き換え*/
-	if (previous_node) {
-	  previous_node->next = new_node;
-	} else {
-	  info->lattice_node_list[position].head = new_node;
-	}
-	new_node->next = node->next;
-	release_lattice_node(info, node);
-	break;
-      case -1:
-	/* そうでないなら削除 */
-	release_lattice_node(info, new_node);
-	break;
-      }
-      return;
+  /* 余計なノードを追加しないための枝刈り
+   * 以前のリストをたどる実装と同じく、リストの末尾のノードとは比べない */
+  node = find_same_node(list, new_node);
+  if (node && node != list->tail) {
+    /* segclassが同じで、始まる位置が同じなら */
+    switch (cmp_node(new_node, node)) {
+    case 0:
+    case 1:
+      /* 新しい方が確率が大きいか学習によるものなら、古いのと置き換え*/
+      replace_node(list, node, new_node);
+      release_lattice_node(info, node);
+      break;
+    case -1:
+      /* そうでないなら削除 */
+      release_lattice_node(info, new_node);
+      break;
     }
-    previous_node = node;
-    node = node->next;
+    return;
   }
 
   /* 最後のノードの後ろに追加 */
-  node->next = new_node;
-  info->lattice_node_list[position].nr_nodes ++;
+  new_node->seq = list->seq ++;
+  new_node->prev = list->tail;
+  if (list->tail) {
+    list->tail->next = new_node;
+  } else {
+    list->head = new_node;
+  }
+  list->tail = new_node;
+  node = *node_bucket(list, new_node);
+  new_node->hash_next = node;
+  *node_bucket(list, new_node) = new_node;
+  heap_set(list, list->nr_nodes, new_node);
+  list->nr_nodes ++;
+  heap_sift_up(list, new_node->heap_index);
 }
 
 /* 一番確率の低いノードを消去する*/
 static void
 remove_min_node(struct lattice_info *info, struct node_list_head *node_list)
 {
-  struct lattice_node* node = node_list->head;
-  struct lattice_node* previous_node = NULL;
-  struct lattice_node* min_node = node;
-  struct lattice_node* previous_min_node = NULL;
-
-  /* 一番確率の低いノードを探す */
-  while (node) {
-    if (cmp_node(node, min_node) < 0) {
-      previous_min_node = previous_node;
-      min_node = node;
-    }
-    previous_node = node;
-    node = node->next;
-  }
+  /* 確率の同じノードの中では、先に追加されたものがヒープの根に来る */
+  struct lattice_node* min_node = node_list->heap[0];
 
-  /* 一番確率の低いノードを削除する */
-  if (previous_min_node) {
-    previous_min_node->next = min_node->next;
-  } else {
-    node_list->head = min_node->next;
+  node_list->nr_nodes --;
+  if (node_list->nr_nodes > 0) {
+    heap_set(node_list, 0, node_list->heap[node_list->nr_nodes]);
+    heap_sift_down(node_list, 0);
   }
+  unlink_node(node_list, min_node);
   release_lattice_node(info, min_node);
-  node_list->nr_nodes --;
 }
 
-/* いわゆるビタビアルゴリズムを使用して経路を選ぶ */
-static void
-choose_path(struct lattice_info* info, int to)
+/* 最後まで到達した遷移のなかで一番確率の大きいものを選ぶ */
+static struct lattice_node *
+find_best_node(struct lattice_info* info, int to, int *last)
 {
-  /* 最後まで到達した遷移のなかで一番確率の大きいものを選ぶ */
   struct lattice_node* node;
   struct lattice_node* best_node = NULL;
-  int last = to; 
-  while (!info->lattice_node_list[last].head) {
+  *last = to;
+  while (!info->lattice_node_list[*last].head) {
     /* 最後の文字まで遷移していなかったら後戻り */
-    --last;
+    --(*last);
   }
-  for (node = info->lattice_node_list[last].head; node; node = node->next) {
+  for (node = info->lattice_node_list[*last].head; node; node = node->next) {
     if (cmp_node(node, best_node) > 0) {
       best_node = node;
     }
   }
-  if (!best_node) {
-    return;
-  }
+  return best_node;
+}
+
+/* いわゆるビタビアルゴリズムを使用して経路を選ぶ */
+static void
+choose_path(struct lattice_info* info, struct lattice_node *best_node)
+{
+  struct lattice_node* node;
 
   /* 遷移を逆にたどりつつ文節の切れ目を記録 */
   node = best_node;
@@ -454,6 +797,191 @@ choose_path(struct lattice_info* info, int to)
   }
 }
 
+/*
+ * N-bestの分割の候補を格納する領域を確保する
+ * 探索の途中の状態と違って次の文節分割まで使うので、
+ * アリーナのmarkより前に確保する
+ */
+static struct split_path *
+alloc_split_paths(struct splitter_context *sc)
+{
+  struct split_path *paths;
+  int i;
+  paths = anthy_arena_alloc(sc->lattice_arena, sizeof(struct split_path) * nbest);
+  for (i = 0; i < nbest; i++) {
+    paths[i].seg_border = anthy_arena_alloc(sc->lattice_arena, sizeof(int) *
+					    (sc->char_count + 1));
+    /* 各metawordは1文字以上 */
+    paths[i].mw = anthy_arena_alloc(sc->lattice_arena,
+				    sizeof(struct meta_word *) * sc->char_count);
+    paths[i].nr_mw = 0;
+  }
+  return paths;
+}
+
+static void
+path_queue_push(struct lattice_info *info, struct path_queue *q,
+		struct lattice_node *node, struct path_state *succ,
+		struct path_prob *suffix)
+{
+  struct path_state *st;
+  int idx;
+  if (q->nr_states >= MAX_PATH_STATES) {
+    return ;
+  }
+  q->nr_states ++;
+  st = anthy_arena_alloc(info->sc->lattice_arena, sizeof(struct path_state));
+  st->node = node;
+  st->succ = succ;
+  st->suffix = *suffix;
+  st->prob = node->real_probability;
+  path_prob_mul_prob(&st->prob, suffix);
+
+  /* 確率の高いものを根の方に上げる */
+  for (idx = q->nr; idx > 0; idx = (idx - 1) / 2) {
+    struct path_state *parent = q->heap[(idx - 1) / 2];
+    if (path_prob_cmp(&st->prob, &parent->prob) <= 0) {
+      break;
+    }
+    q->heap[idx] = parent;
+  }
+  q->heap[idx] = st;
+  q->nr ++;
+}
+
+static struct path_state *
+path_queue_pop(struct path_queue *q)
+{
+  struct path_state *top, *last;
+  int idx;
+  if (q->nr == 0) {
+    return NULL;
+  }
+  top = q->heap[0];
+  q->nr --;
+  last = q->heap[q->nr];
+  idx = 0;
+  for (;;) {
+    int child = idx * 2 + 1;
+    if (child >= q->nr) {
+      break;
+    }
+    if (child + 1 < q->nr &&
+	path_prob_cmp(&q->heap[child + 1]->prob, &q->heap[child]->prob) > 0) {
+      child ++;
+    }
+    if (path_prob_cmp(&q->heap[child]->prob, &last->prob) <= 0) {
+      break;
+    }
+    q->heap[idx] = q->heap[child];
+    idx = child;
+  }
+  q->heap[idx] = last;
+  return top;
+}
+
+/*
+ * 文頭のノードから右にたどれる経路を分割の候補として格納する
+ * 既に格納したものと文節の境界が同じなら0を返す
+ */
+static int
+record_split_path(struct lattice_info *info, struct split_path *paths,
+		  int nr, struct path_state *head)
+{
+  struct split_path *path = &paths[nr];
+  struct path_state *st;
+  int i, len = info->sc->char_count + 1;
+
+  /* 境界の初期状態は、lattice作成時の状態 */
+  memcpy(path->seg_border, info->base_border, sizeof(int) * len);
+  path->nr_mw = 0;
+  for (st = head->succ; st; st = st->succ) {
+    path->mw[path->nr_mw] = st->node->mw;
+    path->nr_mw ++;
+    anthy_get_border_by_metaword(st->node->mw, path->seg_border);
+  }
+  for (i = 0; i < nr; i++) {
+    if (!memcmp(paths[i].seg_border, path->seg_border, sizeof(int) * len)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * 確率の高い順にnbest個までの分割の候補を探す
+ *
+ * 先頭には実際に選ぶbest_nodeの経路を入れる。
+ * それ以外は文末のノードから左にたどるA*探索で探す。
+ * 途中の経路の確率は各ノードのreal_probabilityを使って見積もる。
+ * 同じ状態のノードは一つにまとめられているので、ノードを
+ * 経由する経路はlatticeに残った左のノード全てから選び直す。
+ *
+ * ただし、まとめられたノードの遷移の確率は選び直した左のノードによって
+ * 変わり、ビームで枝刈りされたノードはlatticeに残っていないので、
+ * 見積もりは確率の上限とは限らない。さらに途中の経路の数も
+ * MAX_PATH_STATESで打ち切るので、得られるのはおおよそのN-bestである。
+ */
+static int
+enum_split_paths(struct lattice_info *info, struct lattice_node *best_node,
+		 int last, struct split_path *paths)
+{
+  struct path_queue q;
+  struct path_state *st, *head = NULL;
+  struct path_prob suffix;
+  struct lattice_node *node;
+  int nr;
+
+  /* 選ばれた経路 */
+  path_prob_set_one(&suffix);
+  for (node = best_node; node; node = node->before_node) {
+    st = anthy_arena_alloc(info->sc->lattice_arena, sizeof(struct path_state));
+    st->node = node;
+    st->succ = head;
+    head = st;
+  }
+  record_split_path(info, paths, 0, head);
+  nr = 1;
+  if (nbest <= 1) {
+    return nr;
+  }
+
+  q.heap = anthy_arena_alloc(info->sc->lattice_arena,
+			     sizeof(struct path_state *) * MAX_PATH_STATES);
+  q.nr = 0;
+  q.nr_states = 0;
+  for (node = info->lattice_node_list[last].head; node; node = node->next) {
+    path_prob_set_one(&suffix);
+    path_prob_mul(&suffix, node->mw ? node->mw->score : 1000);
+    path_prob_mul(&suffix, info->tail_probability);
+    path_queue_push(info, &q, node, NULL, &suffix);
+  }
+
+  while (nr < nbest && (st = path_queue_pop(&q))) {
+    struct lattice_node *left;
+    node = st->node;
+    if (!node->before_node) {
+      /* 文頭に到達した */
+      if (record_split_path(info, paths, nr, st)) {
+	nr ++;
+      }
+      continue;
+    }
+    /* nodeの左に来ることのできる全てのノード */
+    for (left = info->lattice_node_list[node->border].head; left;
+	 left = left->next) {
+      struct lattice_node tmp;
+      tmp.seg_class = node->seg_class;
+      tmp.before_node = left;
+      tmp.mw = node->mw;
+      suffix = st->suffix;
+      path_prob_mul(&suffix, get_transition_probability(info, &tmp));
+      path_queue_push(info, &q, left, st, &suffix);
+    }
+  }
+  return nr;
+}
+
 static void
 build_graph(struct lattice_info* info, int from, int to)
 {
@@ -489,30 +1017,96 @@ build_graph(struct lattice_info* info, int from, int to)
 	push_node(info, new_node, position);
 
 	/* 解の候補が多すぎたら、確率の低い方から削る */
-	if (info->lattice_node_list[position].nr_nodes >= NODE_MAX_SIZE) {
+	if (info->lattice_node_list[position].nr_nodes > beam_width) {
 	  remove_min_node(info, &info->lattice_node_list[position]);
 	}
       }
     }
   }
 
-  /* 文末補正 */
-  for (node = info->lattice_node_list[to].head; node; node = node->next) {
+  /* 文末補正、素性はノードによらない */
+  if (info->lattice_node_list[to].head) {
     struct feature_list features;
+    double tail_probability;
     anthy_feature_list_init(&features);
     build_feature_list(NULL, &features);
-    node->adjusted_probability = node->adjusted_probability *
-      calc_probability(SEG_TAIL, &features);
+    tail_probability = lookup_probability(info, SEG_TAIL, &features);
     anthy_feature_list_free(&features);
+    for (node = info->lattice_node_list[to].head; node; node = node->next) {
+      path_prob_mul(&node->adjusted_probability, tail_probability);
+    }
+    info->tail_probability = tail_probability;
   }
 }
 
 void
 anthy_mark_borders(struct splitter_context *sc, int from, int to)
 {
-  struct lattice_info* info = alloc_lattice_info(sc, to);
-  trans_info_array = anthy_file_dic_get_section("trans_info");
+  struct lattice_info* info;
+  int len = sc->char_count + 1;
+
+  /* 前回のlatticeとN-bestの分割を捨てる */
+  anthy_arena_reset(sc->lattice_arena);
+  info = alloc_lattice_info(sc, to);
   build_graph(info, from, to);
-  choose_path(info, to);
-  release_lattice_info(info);
+  info->best_node = find_best_node(info, to, &info->last);
+  info->base_border = anthy_arena_alloc(sc->lattice_arena, sizeof(int) * len);
+  memcpy(info->base_border, sc->word_split_info->seg_border,
+	 sizeof(int) * len);
+  if (info->best_node) {
+    choose_path(info, info->best_node);
+  }
+  /* N-bestの分割は必要になった時に探す */
+  sc->lattice = info;
+  sc->nr_paths = -1;
+  sc->paths = NULL;
+}
+
+/*
+ * 最後のlatticeからN-bestの分割を探してscに格納する
+ * latticeは次の文節分割までアリーナに残っている
+ */
+void
+anthy_enum_split_paths(struct splitter_context *sc)
+{
+  struct lattice_info *info = sc->lattice;
+  struct anthy_arena_mark mark;
+  struct split_path *paths;
+  int nr;
+
+  if (!info || !info->best_node) {
+    sc->nr_paths = 0;
+    return ;
+  }
+  paths = alloc_split_paths(sc);
+  /* 探索の途中の状態は分割を格納したら要らない */
+  anthy_arena_mark(sc->lattice_arena, &mark);
+  nr = enum_split_paths(info, info->best_node, info->last, paths);
+  anthy_arena_release(sc->lattice_arena, &mark);
+  sc->paths = paths;
+  sc->nr_paths = nr;
+}
+
+/* 複数のスレッドから参照されるので初期化時に一度だけ設定する */
+void
+anthy_init_lattice(void)
+{
+  const char *val = anthy_conf_get_str("SPLITTER_BEAM_WIDTH");
+  int r;
+  anthy_init_feature_table(&trans_info, ANTHY_DIC_TRANS_INFO,
+			   ANTHY_DIC_TRANS_INFO_HASH);
+  beam_width = DEFAULT_BEAM_WIDTH;
+  if (val && atoi(val) > 0) {
+    beam_width = atoi(val);
+  }
+  for (nr_node_buckets = 1; nr_node_buckets < beam_width;
+       nr_node_buckets *= 2);
+  val = anthy_conf_get_str("SPLITTER_NBEST");
+  nbest = DEFAULT_NBEST;
+  if (val && atoi(val) > 0) {
+    nbest = atoi(val);
+  }
+  for (r = 0; r <= FORM_MAX_LEN; r++) {
+    form_bias[r] = get_poisson(anthy_normal_length, r);
+  }
 }
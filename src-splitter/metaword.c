@@ -13,8 +13,10 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
+#include <anthy/arena.h>
 #include <anthy/record.h>
 #include <anthy/splitter.h>
 #include <anthy/xchar.h>
@@ -122,7 +124,7 @@ static struct meta_word *
 alloc_metaword(struct splitter_context *sc)
 {
   struct meta_word *mw;
-  mw = anthy_smalloc(sc->word_split_info->MwAllocator);
+  mw = anthy_arena_alloc(sc->arena, sizeof(struct meta_word));
   mw->type = MW_SINGLE;
   mw->score = 0;
   mw->struct_score = 0;
@@ -130,6 +132,7 @@ alloc_metaword(struct splitter_context *sc)
   mw->core_wt = anthy_wt_none;
   mw->mw_features = 0;
   mw->dep_class = DEP_NONE;
+  mw->nr_parts = 0;
   mw->wl = NULL;
   mw->mw1 = NULL;
   mw->mw2 = NULL;
@@ -140,6 +143,27 @@ alloc_metaword(struct splitter_context *sc)
   return mw;
 }
 
+/*
+ * mwの候補の文字列の後ろにxsを付ける
+ * 文字列はアリーナに確保するので、解放しなくてよい
+ */
+static void
+append_cand_hint(struct splitter_context *sc, struct meta_word *mw,
+		 const xstr *xs)
+{
+  xchar *str;
+  if (xs->len < 1) {
+    return ;
+  }
+  str = anthy_arena_alloc(sc->arena,
+			  sizeof(xchar) * (mw->cand_hint.len + xs->len));
+  if (mw->cand_hint.len) {
+    memcpy(str, mw->cand_hint.str, sizeof(xchar) * mw->cand_hint.len);
+  }
+  memcpy(&str[mw->cand_hint.len], xs->str, sizeof(xchar) * xs->len);
+  mw->cand_hint.str = str;
+  mw->cand_hint.len += xs->len;
+}
 
 /*
  * wlの接頭辞部分と接尾辞部分を文字列として取り出す
@@ -211,11 +235,11 @@ make_compound_nth_metaword(struct splitter_context* sc,
 
   anthy_compound_get_nth_segment_xstr(ce, nth, &xs_core);
   if (nth == 0) {
-    anthy_xstrcat(&mw->cand_hint, &xs_pre);
+    append_cand_hint(sc, mw, &xs_pre);
   }
-  anthy_xstrcat(&mw->cand_hint, &xs_core);
+  append_cand_hint(sc, mw, &xs_core);
   if (nth == seg_num - 1) {
-    anthy_xstrcat(&mw->cand_hint, &xs_post);
+    append_cand_hint(sc, mw, &xs_post);
   }
   return mw;
 }
@@ -318,7 +342,7 @@ make_compound_part_metaword(struct splitter_context* sc, struct word_list* wl)
 	mw2 = make_compound_nth_metaword(sc, ce, k, wl, MW_COMPOUND_PART);
 	mw2->len += mw->len;
 	mw2->score += mw->score;
-	anthy_xstrcat(&mw2->cand_hint, &mw->cand_hint);
+	append_cand_hint(sc, mw2, &mw->cand_hint);
 
 	anthy_commit_meta_word(sc, mw2);	
 	mw = mw2;
@@ -643,8 +667,7 @@ make_ochaire_metaword(struct splitter_context *sc,
   mw->from = from + s;
   mw->len = seg_len;
   mw->score = OCHAIRE_SCORE;
-  mw->cand_hint.str = malloc(sizeof(xchar)*xs->len);
-  anthy_xstrcpy(&mw->cand_hint, xs);
+  append_cand_hint(sc, mw, xs);
   anthy_commit_meta_word(sc, mw);
   mw_len += seg_len;
   /* それ以外の文節でmetawordを構成 */
@@ -663,8 +686,7 @@ make_ochaire_metaword(struct splitter_context *sc,
     n->from = from + s;
     n->len = seg_len;
     n->score = OCHAIRE_SCORE;
-    n->cand_hint.str = malloc(sizeof(xchar)*xs->len);
-    anthy_xstrcpy(&n->cand_hint, xs);
+    append_cand_hint(sc, n, xs);
     anthy_commit_meta_word(sc, n);
     mw = n;
     mw_len += seg_len;
@@ -860,11 +882,14 @@ bias_to_single_char_metaword(struct splitter_context *sc)
   }
 }
 
-void
-anthy_mark_border_by_metaword(struct splitter_context* sc,
-			      struct meta_word* mw)
+/*
+ * metawordの中の文節の境界をseg_borderにマークする
+ * best_mwがNULLでなければ複合語の文節のmetawordも記録する
+ */
+static void
+mark_border_by_metaword(struct meta_word* mw, int *seg_border,
+			struct meta_word **best_mw)
 {
-  struct word_split_info_cache* info = sc->word_split_info;
   if (!mw) return;
 
   switch (mw->type) {
@@ -873,39 +898,58 @@ anthy_mark_border_by_metaword(struct splitter_context* sc,
   case MW_SINGLE:
     /* BREAK THROUGH */
   case MW_COMPOUND_PART: 
-    info->seg_border[mw->from] = 1;    
+    seg_border[mw->from] = 1;    
     break;
   case MW_COMPOUND_LEAF:
-    info->seg_border[mw->from] = 1;    
-    info->best_mw[mw->from] = mw;
-    mw->can_use = ok;
+    seg_border[mw->from] = 1;    
+    if (best_mw) {
+      best_mw[mw->from] = mw;
+      mw->can_use = ok;
+    }
     break;
   case MW_COMPOUND_HEAD:
     /* BREAK THROUGH */
   case MW_COMPOUND:
     /* BREAK THROUGH */
   case MW_NUMBER:
-    info->best_mw[mw->mw1->from] = mw->mw1;
-    anthy_mark_border_by_metaword(sc, mw->mw1);
-    anthy_mark_border_by_metaword(sc, mw->mw2);
+    if (best_mw) {
+      best_mw[mw->mw1->from] = mw->mw1;
+    }
+    mark_border_by_metaword(mw->mw1, seg_border, best_mw);
+    mark_border_by_metaword(mw->mw2, seg_border, best_mw);
     break;
   case MW_V_RENYOU_A:
     /* BREAK THROUGH */
   case MW_V_RENYOU_NOUN:
-    info->seg_border[mw->from] = 1;    
+    seg_border[mw->from] = 1;    
     break;
   case MW_WRAP:
-    anthy_mark_border_by_metaword(sc, mw->mw1);
+    mark_border_by_metaword(mw->mw1, seg_border, best_mw);
     break;
   case MW_OCHAIRE:
-    info->seg_border[mw->from] = 1;
-    anthy_mark_border_by_metaword(sc, mw->mw1);
+    seg_border[mw->from] = 1;
+    mark_border_by_metaword(mw->mw1, seg_border, best_mw);
     break;
   default:
     break;
   }
 }
 
+void
+anthy_mark_border_by_metaword(struct splitter_context* sc,
+			      struct meta_word* mw)
+{
+  struct word_split_info_cache* info = sc->word_split_info;
+  mark_border_by_metaword(mw, info->seg_border, info->best_mw);
+}
+
+/* 文節の境界だけをマークする、metawordの状態は変えない */
+void
+anthy_get_border_by_metaword(struct meta_word* mw, int *seg_border)
+{
+  mark_border_by_metaword(mw, seg_border, NULL);
+}
+
 void
 anthy_make_metaword_all(struct splitter_context *sc)
 {
@@ -916,13 +960,17 @@ anthy_make_metaword_all(struct splitter_context *sc)
   combine_metaword_all(sc);
 
   /* 拡大された文節を処理する */
+  anthy_lock_record();
   make_expanded_metaword_all(sc);
+  anthy_unlock_record();
 
   /* 濁点や長音などの記号、その他の記号を処理 */
   make_metaword_with_depchar_all(sc);
 
   /* おちゃをいれる */
+  anthy_lock_record();
   make_ochaire_metaword_all(sc);
+  anthy_unlock_record();
 
   /* 一文字の文節は減点 */
   bias_to_single_char_metaword(sc);
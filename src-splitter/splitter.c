@@ -4,6 +4,8 @@
  * 文節の境界を検出する
  *  anthy_init_split_context() 分割用のコンテキストを作って
  *  anthy_mark_border() 分割をして
+ *  anthy_renew_split_arena() 文字列が後ろに追加されたら前回のデータを退避して
+ *  anthy_extend_split_context() コンテキストを作り直し
  *  anthy_release_split_context() コンテキストを解放する
  *
  *  anthy_commit_border() コミットされた内容に対して学習をする
@@ -40,41 +42,19 @@
   #include <malloc.h> // alloca
 #endif
 
-#include <anthy/alloc.h>
+#include <anthy/arena.h>
 #include <anthy/record.h>
 #include <anthy/splitter.h>
 #include <anthy/logger.h>
+#include <anthy/phase.h>
 #include "wordborder.h"
 
 #define MAX_EXPAND_PAIR_ENTRY_COUNT 1000
+/* 文字列を追加した時に、これより少なければ使わなくなったword_listは残しておく */
+#define MIN_DROPPED_WORD_LISTS 1000
 
 static int splitter_debug_flags;
 
-/** make_word_cacheで作成した文節情報を解放する
- */
-static void
-release_info_cache(struct splitter_context *sc)
-{
-  struct word_split_info_cache *info = sc->word_split_info;
-
-  anthy_free_allocator(info->MwAllocator);
-  anthy_free_allocator(info->WlAllocator);
-  free(info->cnode);
-  free(info->seq_len);
-  free(info->rev_seq_len);
-  free(info);
-}
-
-static void
-metaword_dtor(void *p)
-{
-  struct meta_word *mw = (struct meta_word*)p;
-  if (mw->cand_hint.str) {
-    free(mw->cand_hint.str);
-  }
-}
-
-
 static void
 alloc_char_ent(const xstr* xs, struct splitter_context *sc)
 {
@@ -84,10 +64,8 @@ alloc_char_ent(const xstr* xs, struct splitter_context *sc)
   int i;
 
   sc->char_count = xs->len;
-  if (sc->ce)
-    free(sc->ce);
   sc->ce = (struct char_ent*)
-    malloc(sizeof(struct char_ent)*(xs->len + 1));
+    anthy_arena_alloc(sc->arena, sizeof(struct char_ent)*(xs->len + 1));
   for (i = 0; i <= xs->len; i++) {
     sc->ce[i].c = &xs->str[i];
     sc->ce[i].seg_border = 0;
@@ -103,7 +81,8 @@ alloc_char_ent(const xstr* xs, struct splitter_context *sc)
 
 
 /**
- * ここで確保した内容はrelease_info_cacheで解放される
+ * ここで確保した内容は変換コンテキストのアリーナとともに
+ * anthy_release_split_contextで解放される
  */
 static void
 alloc_info_cache(struct splitter_context *sc)
@@ -112,15 +91,19 @@ alloc_info_cache(struct splitter_context *sc)
   struct word_split_info_cache *info;
 
   /* キャッシュのデータを確保 */
-  sc->word_split_info = malloc(sizeof(struct word_split_info_cache));
+  sc->word_split_info =
+    anthy_arena_alloc(sc->arena, sizeof(struct word_split_info_cache));
   info = sc->word_split_info;
-  info->MwAllocator = anthy_create_allocator(sizeof(struct meta_word), metaword_dtor);
-  info->WlAllocator = anthy_create_allocator(sizeof(struct word_list), 0);
-  info->cnode =
-    malloc(sizeof(struct char_node) * (sc->char_count + 1));
+  info->cnode = anthy_arena_alloc(sc->arena,
+				  sizeof(struct char_node) * (sc->char_count + 1));
 
-  info->seq_len = malloc(sizeof(int) * (sc->char_count + 1));
-  info->rev_seq_len = malloc(sizeof(int) * (sc->char_count + 1));
+  info->seq_len = anthy_arena_alloc(sc->arena,
+				    sizeof(int) * (sc->char_count + 1));
+  info->rev_seq_len = anthy_arena_alloc(sc->arena,
+					sizeof(int) * (sc->char_count + 1));
+  info->sources = NULL;
+  info->cur_source = NULL;
+  info->nr_word_lists = 0;
 
   /* 各文字インデックスに対して初期化を行う */
   for (i = 0; i <= sc->char_count; i++) {
@@ -132,18 +115,23 @@ alloc_info_cache(struct splitter_context *sc)
   }
 }
 
-/** 外から呼び出されるwordsplitterのトップレベルの関数 */
-void
-anthy_mark_border(struct splitter_context *sc,
-		  int from, int from2, int to)
+/*
+ * 境界を決定する
+ * pathがNULLならlatticeで探し、そうでなければpathに従う
+ */
+static void
+mark_border(struct splitter_context *sc, int from, int from2, int to,
+	    struct split_path *path)
 {
   int i;
   struct word_split_info_cache *info;
+  long long t;
 
   /* sanity check */
   if ((to - from) <= 0) {
     return ;
   }
+  t = anthy_phase_begin();
 
   /* 境界マーク用とlatticeの検索で用いられるクラス用の領域を確保 */
   info = sc->word_split_info;
@@ -157,13 +145,73 @@ anthy_mark_border(struct splitter_context *sc,
   }
 
   /* 境界を決定する */
-  anthy_eval_border(sc, from, from2, to);
+  if (path) {
+    anthy_eval_border_by_path(sc, from, from2, to, path);
+  } else {
+    anthy_eval_border(sc, from, from2, to);
+  }
 
   for (i = from; i < to; ++i) {
     sc->ce[i].seg_border = info->seg_border[i];
     sc->ce[i].best_seg_class = info->best_seg_class[i];
     sc->ce[i].best_mw = info->best_mw[i];
   }
+  anthy_phase_end(ANTHY_PHASE_LATTICE, t);
+}
+
+/** 外から呼び出されるwordsplitterのトップレベルの関数 */
+void
+anthy_mark_border(struct splitter_context *sc,
+		  int from, int from2, int to)
+{
+  mark_border(sc, from, from2, to, NULL);
+}
+
+void
+anthy_mark_border_by_path(struct splitter_context *sc,
+			  int from, int from2, int to, int nth)
+{
+  struct split_path *path = anthy_get_nth_split_path(sc, nth);
+  if (!path) {
+    return ;
+  }
+  mark_border(sc, from, from2, to, path);
+}
+
+int
+anthy_get_nr_split_path(struct splitter_context *sc)
+{
+  if (sc->nr_paths < 0) {
+    anthy_enum_split_paths(sc);
+  }
+  return sc->nr_paths;
+}
+
+struct split_path *
+anthy_get_nth_split_path(struct splitter_context *sc, int nth)
+{
+  if (nth < 0 || nth >= anthy_get_nr_split_path(sc)) {
+    return NULL;
+  }
+  return &sc->paths[nth];
+}
+
+int
+anthy_find_split_path(struct splitter_context *sc, int to)
+{
+  int i, j;
+  for (i = 0; i < anthy_get_nr_split_path(sc); i++) {
+    int *seg_border = sc->paths[i].seg_border;
+    for (j = 0; j <= to; j++) {
+      if (!seg_border[j] != !sc->ce[j].seg_border) {
+	break;
+      }
+    }
+    if (j > to) {
+      return i;
+    }
+  }
+  return -1;
 }
 
 /* 文節が拡大されたので，それを学習する */
@@ -204,6 +252,7 @@ anthy_commit_border(struct splitter_context *sc, int nr_segments,
 {
   int i, from = 0;
 
+  anthy_lock_record();
   /* 伸ばした文節 */
   for (i = 0; i < nr_segments; i++) {
     /* それぞれの文節に対して */
@@ -233,6 +282,7 @@ anthy_commit_border(struct splitter_context *sc, int nr_segments,
   tail:
     from += len;
   }
+  anthy_unlock_record();
 }
 
 int
@@ -244,29 +294,93 @@ anthy_splitter_debug_flags(void)
 void
 anthy_init_split_context(xstr *xs, struct splitter_context *sc, int is_reverse)
 {
+  long long t;
   alloc_char_ent(xs, sc);
   alloc_info_cache(sc);
   sc->is_reverse = is_reverse;
+  sc->lattice = NULL;
+  sc->nr_paths = 0;
+  sc->paths = NULL;
   /* 全ての部分文字列をチェックして、文節の候補を列挙する
      word_listを構成してからmetawordを構成する */
+  t = anthy_phase_begin();
   anthy_lock_dic();
   anthy_make_word_list_all(sc);
   anthy_unlock_dic();
+  anthy_phase_end(ANTHY_PHASE_WORD_LIST, t);
+  t = anthy_phase_begin();
   anthy_make_metaword_all(sc);
+  anthy_phase_end(ANTHY_PHASE_METAWORD, t);
+}
 
+/**
+ * 文字列を追加して変換し直す前に、前回の変換のデータをold_arenaに移す
+ * old_arenaにあった前々回のデータは捨てて、空にしたものをarenaにする。
+ * word_list以外のデータは文字列の長さに比例するので、
+ * 文字を一つずつ追加してもメモリは増え続けない
+ * (word_listはanthy_extend_split_contextで必要なら最初から作り直す)
+ */
+void
+anthy_renew_split_arena(struct splitter_context *sc)
+{
+  struct anthy_arena *a = sc->old_arena;
+  sc->old_arena = sc->arena;
+  sc->arena = a;
+  anthy_arena_reset(sc->arena);
+  anthy_arena_reset(sc->lattice_arena);
 }
 
+/**
+ * 前回の文字列の後ろに文字を追加した文字列で、分割用のコンテキストを作り直す
+ * 前回のword_listのうち、追加した文字の影響を受けないものはそのまま使う
+ * 前回のword_listはwl_arenaに、それ以外のデータはold_arenaに残っている
+ */
 void
-anthy_release_split_context(struct splitter_context *sc)
+anthy_extend_split_context(xstr *xs, struct splitter_context *sc)
 {
-  if (sc->word_split_info) {
-    release_info_cache(sc);
-    sc->word_split_info = NULL;
-  }
-  if (sc->ce) {
-    free(sc->ce);
-    sc->ce = NULL;
+  struct word_split_info_cache *old_info = sc->word_split_info;
+  int old_count = sc->char_count;
+  long long t;
+
+  /* 作り直して使わなくなったword_listが増えすぎたら、最初から作る */
+  if (sc->nr_word_lists >
+      old_info->nr_word_lists * 2 + MIN_DROPPED_WORD_LISTS) {
+    anthy_arena_reset(sc->wl_arena);
+    sc->nr_word_lists = 0;
+    anthy_init_split_context(xs, sc, 0);
+    return ;
   }
+
+  alloc_char_ent(xs, sc);
+  alloc_info_cache(sc);
+  sc->lattice = NULL;
+  sc->nr_paths = 0;
+  sc->paths = NULL;
+  t = anthy_phase_begin();
+  anthy_lock_dic();
+  anthy_extend_word_list_all(sc, old_info, old_count);
+  anthy_unlock_dic();
+  anthy_phase_end(ANTHY_PHASE_WORD_LIST, t);
+  /* metawordは学習データにもよるので、全部作り直す */
+  t = anthy_phase_begin();
+  anthy_make_metaword_all(sc);
+  anthy_phase_end(ANTHY_PHASE_METAWORD, t);
+}
+
+/** 変換一回分のデータを、アリーナに確保したものとともに解放する */
+void
+anthy_release_split_context(struct splitter_context *sc)
+{
+  sc->word_split_info = NULL;
+  sc->ce = NULL;
+  sc->lattice = NULL;
+  sc->nr_paths = 0;
+  sc->paths = NULL;
+  anthy_arena_reset(sc->lattice_arena);
+  anthy_arena_reset(sc->arena);
+  anthy_arena_reset(sc->old_arena);
+  anthy_arena_reset(sc->wl_arena);
+  sc->nr_word_lists = 0;
 }
 
 /** splitter全体の初期化を行う */
@@ -302,6 +416,7 @@ anthy_init_splitter(void)
     anthy_log(0, "Failed to init dependent word table.\n");
     return -1;
   }
+  anthy_init_lattice();
   return 0;
 }
 
@@ -9,6 +9,8 @@
 #include <anthy/depgraph.h>
 
 struct splitter_context;
+struct split_path;
+struct word_list_source;
 
 /*
  * meta_wordの使用可能チェックのやり方
@@ -53,8 +55,13 @@ struct word_split_info_cache {
   enum seg_class* best_seg_class;
   /*  */
   struct meta_word **best_mw;
-  /* アロケータ */
-  allocator MwAllocator, WlAllocator;
+
+  /* word_listを作った自立語などのリスト、文字列の追加の時に使う */
+  struct word_list_source *sources;
+  /* word_listを作っている最中のもの */
+  struct word_list_source *cur_source;
+  /* sourceに記録されたword_listの数 */
+  int nr_word_lists;
 };
 
 /*
@@ -173,6 +180,10 @@ void anthy_commit_word_list(struct splitter_context *, struct word_list *wl);
 struct word_list *anthy_alloc_word_list(struct splitter_context *);
 void anthy_print_word_list(struct splitter_context *, struct word_list *);
 void anthy_make_word_list_all(struct splitter_context *);
+void anthy_extend_word_list_all(struct splitter_context *,
+				struct word_split_info_cache *old_info,
+				int old_count);
+void anthy_word_list_reach_end(struct splitter_context *);
 
 /* defined in metaword.c */
 void anthy_make_metaword_all(struct splitter_context *);
@@ -180,13 +191,18 @@ void anthy_print_metaword(struct splitter_context *, struct meta_word *);
 
 void anthy_mark_border_by_metaword(struct splitter_context* sc,
 				   struct meta_word* mw);
+void anthy_get_border_by_metaword(struct meta_word* mw, int *seg_border);
 
 
 /* defined in evalborder.c */
 void anthy_eval_border(struct splitter_context *, int, int, int);
+void anthy_eval_border_by_path(struct splitter_context *, int, int, int,
+			       struct split_path *);
 
 /* defined at lattice.c */
 void anthy_mark_borders(struct splitter_context *sc, int from, int to);
+void anthy_enum_split_paths(struct splitter_context *sc);
+void anthy_init_lattice(void);
 
 /* defined at seg_class.c */
 void anthy_set_seg_class(struct word_list* wl);
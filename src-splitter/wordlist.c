@@ -16,14 +16,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#ifndef _WIN32
-  #include <arpa/inet.h>
-#else
-  #define STRICT 1
-  #include <winsock2.h>
-#endif
 
-#include <anthy/alloc.h>
+#include <anthy/arena.h>
 #include <anthy/record.h>
 #include <anthy/xstr.h>
 #include <anthy/diclib.h>
@@ -35,8 +29,38 @@
 #include "wordborder.h"
 
 #define HF_THRESH 784
+/* 自立語として探す部分文字列の最大の長さ */
+#define MAX_CORE_LEN 30
+
+/* word_list_sourceの種類 */
+#define WLS_CORE 0
+#define WLS_NO_CORE 1
+#define WLS_DUMMY_HEAD 2
+
+/*
+ * word_listを作る元になった自立語など
+ * 作ったword_listを記録しておき、文字列が後ろに追加された時に
+ * 影響を受けないものは作り直さずに使う
+ */
+struct word_list_source {
+  struct word_list_source *next;
+  int kind;
+  /* 自立語の位置と長さ */
+  int from, len;
+  int is_compound;
+  int is_weak;
+  seq_ent_t se;
+  /* 作ったword_list、コミットの時に重複していたものも含む
+   * まだ作っていなければnr_wlは-1 */
+  struct word_list **wl;
+  int nr_wl, max_wl;
+  /* 付属語の検索が文字列の末尾で打ち切られた */
+  int reach_end;
+};
 
 static void *weak_word_array;
+/* weak_word_arrayのバイトオーダがホストと違う */
+static int weak_word_swap;
 
 static wtype_t anthy_wtype_name_noun;
 #if 0
@@ -47,6 +71,25 @@ static wtype_t anthy_wtype_num_postfix;
 static wtype_t anthy_wtype_name_postfix;
 static wtype_t anthy_wtype_sv_postfix;
 
+static struct word_list_source *
+alloc_source(struct splitter_context *sc, int kind, int from, int len)
+{
+  struct word_list_source *src;
+  src = anthy_arena_alloc(sc->wl_arena, sizeof(struct word_list_source));
+  src->next = NULL;
+  src->kind = kind;
+  src->from = from;
+  src->len = len;
+  src->is_compound = 0;
+  src->is_weak = 0;
+  src->se = NULL;
+  src->wl = NULL;
+  src->nr_wl = -1;
+  src->max_wl = 0;
+  src->reach_end = 0;
+  return src;
+}
+
 /* デバッグ用 */
 void
 anthy_print_word_list(struct splitter_context *sc,
@@ -136,12 +179,58 @@ set_features(struct word_list *wl)
   }
 }
 
+/** word_listを重複が無ければ開始位置のリストに追加する */
+static void
+insert_word_list(struct splitter_context *sc,
+		 struct word_list *wl)
+{
+  struct word_list *tmp;
+
+  /* 同じ内容のword_listがないかを調べる */
+  for (tmp = sc->word_split_info->cnode[wl->from].wl; tmp; tmp = tmp->next) {
+    if (word_list_same(tmp, wl)) {
+      return ;
+    }
+  }
+  /* wordlistのリストに追加 */
+  wl->next = sc->word_split_info->cnode[wl->from].wl;
+  sc->word_split_info->cnode[wl->from].wl = wl;
+
+  /* デバッグプリント */
+  if (anthy_splitter_debug_flags() & SPLITTER_DEBUG_WL) {
+    anthy_print_word_list(sc, wl);
+  }
+}
+
+/** 作ったword_listを作っている最中のsourceに記録する */
+static void
+record_word_list(struct splitter_context *sc,
+		 struct word_list *wl)
+{
+  struct word_list_source *src = sc->word_split_info->cur_source;
+  if (!src) {
+    return ;
+  }
+  if (src->nr_wl == src->max_wl) {
+    struct word_list **wls;
+    src->max_wl = src->max_wl ? src->max_wl * 2 : 8;
+    wls = anthy_arena_alloc(sc->wl_arena,
+			    sizeof(struct word_list *) * src->max_wl);
+    if (src->nr_wl) {
+      memcpy(wls, src->wl, sizeof(struct word_list *) * src->nr_wl);
+    }
+    src->wl = wls;
+  }
+  src->wl[src->nr_wl] = wl;
+  src->nr_wl ++;
+  sc->word_split_info->nr_word_lists ++;
+}
+
 /** 作ったword_listのスコアを計算してからコミットする */
 void
 anthy_commit_word_list(struct splitter_context *sc,
 		       struct word_list *wl)
 {
-  struct word_list *tmp;
   xstr xs;
 
   /* 付属語だけのword_listで、長さ0のもやってくるので */
@@ -162,26 +251,27 @@ anthy_commit_word_list(struct splitter_context *sc,
     xs.str = sc->ce[wl->part[PART_POSTFIX].from].c;
   }
 
-  /* 同じ内容のword_listがないかを調べる */
-  for (tmp = sc->word_split_info->cnode[wl->from].wl; tmp; tmp = tmp->next) {
-    if (word_list_same(tmp, wl)) {
-      return ;
-    }
-  }
-  /* wordlistのリストに追加 */
-  wl->next = sc->word_split_info->cnode[wl->from].wl;
-  sc->word_split_info->cnode[wl->from].wl = wl;
+  /* 重複していても、文字列が追加された時に順番通りに並べ直せるように
+   * 記録しておく */
+  record_word_list(sc, wl);
+  insert_word_list(sc, wl);
+}
 
-  /* デバッグプリント */
-  if (anthy_splitter_debug_flags() & SPLITTER_DEBUG_WL) {
-    anthy_print_word_list(sc, wl);
+/** 付属語の検索が文字列の末尾で打ち切られたことを記録する */
+void
+anthy_word_list_reach_end(struct splitter_context *sc)
+{
+  struct word_list_source *src = sc->word_split_info->cur_source;
+  if (src) {
+    src->reach_end = 1;
   }
 }
 
 struct word_list *
 anthy_alloc_word_list(struct splitter_context *sc)
 {
-  return anthy_smalloc(sc->word_split_info->WlAllocator);
+  sc->nr_word_lists ++;
+  return anthy_arena_alloc(sc->wl_arena, sizeof(struct word_list));
 }
 
 /* 後続の活用語尾、助詞、助動詞を付ける */
@@ -462,7 +552,7 @@ compare_hash(const void *kp, const void *cp)
 {
   const int *h = kp;
   const int *c = cp;
-  return (*h) - ntohl(*c);
+  return (*h) - anthy_dic_to_host(*c, weak_word_swap);
 }
 
 static int
@@ -474,7 +564,7 @@ check_weak(xstr *xs)
   if (!array) {
     return 0;
   }
-  nr = ntohl(array[1]);
+  nr = anthy_dic_to_host(array[1], weak_word_swap);
   h = anthy_xstr_hash(xs);
   if (bsearch(&h, &array[16], nr,
 	      sizeof(int), compare_hash)) {
@@ -483,28 +573,136 @@ check_weak(xstr *xs)
   return 0;
 }
 
+/* 位置iから始まる長さjの部分文字列を辞書から探し、
+ * 自立語や複合語ならsourceとしてリストの先頭に加える */
+static struct word_list_source *
+lookup_core(struct splitter_context *sc, int i, int j,
+	    struct word_list_source *head)
+{
+  struct word_split_info_cache *info = sc->word_split_info;
+  struct word_list_source *src;
+  seq_ent_t se;
+  xstr xs;
+
+  /* seq_entを取得する */
+  xs.len = j;
+  xs.str = sc->ce[i].c;
+  se = anthy_get_seq_ent_from_xstr(&xs, sc->is_reverse);
+
+  /* 単語として認識できない */
+  if (!se) {
+    return head;
+  }
+
+  /* 各、部分文字列が単語ならば接頭辞、接尾辞の
+     最大長を調べてマークする */
+  if (j > info->seq_len[i] &&
+      anthy_get_seq_ent_pos(se, POS_SUC)) {
+    info->seq_len[i] = j;
+  }
+  if (j > info->rev_seq_len[i + j] &&
+      anthy_get_seq_ent_pos(se, POS_PRE)) {
+    info->rev_seq_len[i + j] = j;
+  }
+
+  /* 発見した自立語をリストに追加 */
+  if (anthy_get_seq_ent_indep(se) &&
+      /* 複合語で無い候補があることを確認 */
+      anthy_has_non_compound_ents(se)) {
+    src = alloc_source(sc, WLS_CORE, i, j);
+    src->se = se;
+    src->is_weak = check_weak(&xs);
+    src->next = head;
+    head = src;
+  }
+  /* 発見した複合語をリストに追加 */
+  if (anthy_has_compound_ents(se)) {
+    src = alloc_source(sc, WLS_CORE, i, j);
+    src->se = se;
+    src->is_compound = 1;
+    src->next = head;
+    head = src;
+  }
+  return head;
+}
+
+/* 自立語の無いword_listを作る位置か */
+static int
+is_no_core_pos(struct splitter_context *sc, int i)
+{
+  int type;
+  if (i == 0) {
+    return 1;
+  }
+  type = anthy_get_xchar_type(*sc->ce[i - 1].c);
+  /* 句読点以外の記号 */
+  return (type & (XCT_CLOSE | XCT_SYMBOL)) && !(type & XCT_PUNCTUATION);
+}
+
+/* 位置from以降の自立語の無いword_listのsourceをtailにつなげる */
+static struct word_list_source **
+append_no_core_sources(struct splitter_context *sc, int from,
+		       struct word_list_source **tail)
+{
+  int i;
+  for (i = from; i < sc->char_count; i++) {
+    if (is_no_core_pos(sc, i)) {
+      *tail = alloc_source(sc, WLS_NO_CORE, i, 0);
+      tail = &(*tail)->next;
+    }
+  }
+  return tail;
+}
+
+/* sourceからword_listを作り、作ったものを記録する */
+static void
+make_source_word_list(struct splitter_context *sc,
+		      struct word_list_source *src)
+{
+  struct word_list tmpl;
+  sc->word_split_info->cur_source = src;
+  src->nr_wl = 0;
+  src->reach_end = 0;
+  switch (src->kind) {
+  case WLS_CORE:
+    /* 自立語に対して付属語パターンの検索 */
+    make_word_list(sc, src->se, src->from, src->len,
+		   src->is_compound, src->is_weak);
+    break;
+  case WLS_NO_CORE:
+    setup_word_list(&tmpl, src->from, 0, 0, 0);
+    make_following_word_list(sc, &tmpl);
+    break;
+  case WLS_DUMMY_HEAD:
+    make_dummy_head(sc);
+    break;
+  }
+  sc->word_split_info->cur_source = NULL;
+}
+
+/* 前回作ったword_listを同じ順番でコミットし直す */
+static void
+replay_source_word_list(struct splitter_context *sc,
+			struct word_list_source *src)
+{
+  int i;
+  for (i = 0; i < src->nr_wl; i++) {
+    insert_word_list(sc, src->wl[i]);
+  }
+  sc->word_split_info->nr_word_lists += src->nr_wl;
+}
+
 /* コンテキストに設定された文字列の部分文字列から全てのword_listを列挙する */
 void 
 anthy_make_word_list_all(struct splitter_context *sc)
 {
   int i, j;
   xstr xs;
-  seq_ent_t se;
-  struct depword_ent {
-    struct depword_ent *next;
-    int from, len;
-    int is_compound;
-    int is_weak;
-    seq_ent_t se;
-  } *head, *de;
   struct word_split_info_cache *info;
-  allocator de_ator;
-
-  weak_word_array = anthy_file_dic_get_section("weak_words");
+  struct word_list_source *head, *src, **tail;
 
   info = sc->word_split_info;
   head = NULL;
-  de_ator = anthy_create_allocator(sizeof(struct depword_ent), 0);
 
   xs.str = sc->ce[0].c;
   xs.len = sc->char_count;
@@ -514,94 +712,121 @@ anthy_make_word_list_all(struct splitter_context *sc)
   /* 開始地点のループ */
   for (i = 0; i < sc->char_count ; i++) {
     int search_len = sc->char_count - i;
-    int search_from = 0;
-    if (search_len > 30) {
-      search_len = 30;
+    if (search_len > MAX_CORE_LEN) {
+      search_len = MAX_CORE_LEN;
     }
 
     /* 文字列長のループ(長い方から) */
-    for (j = search_len; j > search_from; j--) {
-      /* seq_entを取得する */
-      xs.len = j;
-      xs.str = sc->ce[i].c;
-      se = anthy_get_seq_ent_from_xstr(&xs, sc->is_reverse);
-
-      /* 単語として認識できない */
-      if (!se) {
-	continue;
-      }
+    for (j = search_len; j > 0; j--) {
+      head = lookup_core(sc, i, j, head);
+    }
+  }
 
-      /* 各、部分文字列が単語ならば接頭辞、接尾辞の
-	 最大長を調べてマークする */
-      if (j > info->seq_len[i] &&
-	  anthy_get_seq_ent_pos(se, POS_SUC)) {
-	info->seq_len[i] = j;
-      }
-      if (j > info->rev_seq_len[i + j] &&
-	  anthy_get_seq_ent_pos(se, POS_PRE)) {
-	info->rev_seq_len[i + j] = j;
-      }
+  /* 発見した自立語全て、自立語の無いword_list、先頭の0文字の自立語の順 */
+  info->sources = head;
+  for (tail = &info->sources; *tail; tail = &(*tail)->next);
+  tail = append_no_core_sources(sc, 0, tail);
+  *tail = alloc_source(sc, WLS_DUMMY_HEAD, 0, 0);
 
-      /* 発見した自立語をリストに追加 */
-      if (anthy_get_seq_ent_indep(se) &&
-	  /* 複合語で無い候補があることを確認 */
-	  anthy_has_non_compound_ents(se)) {
-	de = (struct depword_ent *)anthy_smalloc(de_ator);
-	de->from = i;
-	de->len = j;
-	de->se = se;
-	de->is_compound = 0;
-	de->is_weak = check_weak(&xs);
-
-	de->next = head;
-	head = de;
-      }
-      /* 発見した複合語をリストに追加 */
-      if (anthy_has_compound_ents(se)) {
-	de = (struct depword_ent *)anthy_smalloc(de_ator);
-	de->from = i;
-	de->len = j;
-	de->se = se;
-	de->is_compound = 1;
-	de->is_weak = 0;
-
-	de->next = head;
-	head = de;
-      }
-    }
+  for (src = info->sources; src; src = src->next) {
+    make_source_word_list(sc, src);
   }
+}
+
+/*
+ * 前回の文字列の後ろに文字が追加された時に、word_listを作り直す
+ *
+ * 追加された文字にかかる部分文字列だけを辞書から探す。
+ * 前回のsourceのうち、付属語の検索が文字列の末尾に達したものと、
+ * 接尾辞の最大長が変わったものだけword_listを作り直し、
+ * それ以外は前回作ったword_listを使う。
+ * sourceを全部作り直した時と同じ順番で並べてからコミットするので、
+ * 結果は最初から作った場合と同じになる。
+ */
+void
+anthy_extend_word_list_all(struct splitter_context *sc,
+			   struct word_split_info_cache *old_info,
+			   int old_count)
+{
+  int i, j, start;
+  xstr xs;
+  struct word_split_info_cache *info;
+  struct word_list_source *head, *src, *next, **tail;
 
-  /* 発見した自立語全てに対して付属語パターンの検索 */
-  for (de = head; de; de = de->next) {
-    make_word_list(sc, de->se, de->from, de->len,
-		   de->is_compound, de->is_weak);
+  info = sc->word_split_info;
+  for (i = 0; i <= old_count; i++) {
+    info->seq_len[i] = old_info->seq_len[i];
+    info->rev_seq_len[i] = old_info->rev_seq_len[i];
   }
 
-    /* 自立語の無いword_list */
-  for (i = 0; i < sc->char_count; i++) {
-    struct word_list tmpl;
-    setup_word_list(&tmpl, i, 0, 0, 0);
-    if (i == 0) {
-      make_following_word_list(sc, &tmpl);
-    } else {
-      int type = anthy_get_xchar_type(*sc->ce[i - 1].c);
-      if ((type & (XCT_CLOSE | XCT_SYMBOL)) &&
-	  !(type & XCT_PUNCTUATION)) {
-	/* 句読点以外の記号 */
-	make_following_word_list(sc, &tmpl);
-      }
-    }
-  }  
+  /* 追加された文字にかかる部分文字列を含む範囲だけ辞書を読み込む */
+  start = old_count - MAX_CORE_LEN + 1;
+  if (start < 0) {
+    start = 0;
+  }
+  xs.str = sc->ce[start].c;
+  xs.len = sc->char_count - start;
+  anthy_gang_load_dic(&xs, sc->is_reverse);
 
-  /* 先頭に0文字の自立語を付ける */
-  make_dummy_head(sc);
+  head = NULL;
+  for (i = start; i < sc->char_count; i++) {
+    int search_len = sc->char_count - i;
+    if (search_len > MAX_CORE_LEN) {
+      search_len = MAX_CORE_LEN;
+    }
+    for (j = search_len; j > 0 && i + j > old_count; j--) {
+      head = lookup_core(sc, i, j, head);
+    }
+  }
 
-  anthy_free_allocator(de_ator);
+  /* 前回の自立語の間に、同じ順番になるように新しい自立語を入れる */
+  tail = &info->sources;
+  for (src = old_info->sources; src && src->kind == WLS_CORE; src = next) {
+    next = src->next;
+    while (head && head->from > src->from) {
+      *tail = head;
+      tail = &head->next;
+      head = head->next;
+    }
+    *tail = src;
+    tail = &src->next;
+  }
+  *tail = head;
+  for (; *tail; tail = &(*tail)->next);
+  /* 自立語の無いword_list */
+  for (; src && src->kind == WLS_NO_CORE; src = next) {
+    next = src->next;
+    *tail = src;
+    tail = &src->next;
+  }
+  tail = append_no_core_sources(sc, old_count, tail);
+  /* 先頭の0文字の自立語 */
+  *tail = src;
+
+  for (src = info->sources; src; src = src->next) {
+    int right;
+    if (src->nr_wl < 0 || src->reach_end) {
+      /* 新しいものか、付属語が続くかもしれない */
+      make_source_word_list(sc, src);
+      continue;
+    }
+    right = src->kind == WLS_CORE ? src->from + src->len : 0;
+    if (src->kind != WLS_NO_CORE &&
+	info->seq_len[right] != old_info->seq_len[right]) {
+      /* 長い接尾辞が見つかった */
+      make_source_word_list(sc, src);
+      continue;
+    }
+    replay_source_word_list(sc, src);
+  }
 }
 
 int
 anthy_init_wordlist (void)
 {
+  /* 複数のスレッドから参照されるので初期化時に一度だけ設定する */
+  weak_word_array = anthy_file_dic_section(ANTHY_DIC_WEAK_WORDS);
+  weak_word_swap = anthy_dic_swapped();
   /* {"人名",POS_NOUN,COS_JN,SCOS_NONE,CC_NONE,CT_NONE,WF_INDEP} */
   anthy_type_to_wtype ("#JN", &anthy_wtype_name_noun);
 #if 0
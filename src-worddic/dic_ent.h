@@ -8,6 +8,8 @@
 #define ST_NONE 0
 /**/
 #define ST_REVERSE 8
+/* gang loadで全ての辞書から読み込み済み */
+#define ST_LOADED 16
 
 /** ある単語 */
 struct dic_ent {
@@ -33,6 +35,8 @@ struct seq_ent {
   /** dic_entの配列 */
   int nr_dic_ents;
   struct dic_ent **dic_ents;
+  /** dic_entsの先頭のこの数の要素は共有キャッシュのもの */
+  int nr_shared_ents;
   /** compound_entの配列 */
   int nr_compound_ents;
 
@@ -40,10 +44,15 @@ struct seq_ent {
   struct mem_dic *md;
   /* メモリ辞書中のhash chain */
   struct seq_ent *next;
+  /* 読みのハッシュ値 */
+  unsigned int hash;
+  /* メモリ辞書中のLRUリスト */
+  struct seq_ent *lru_prev, *lru_next;
 };
 
 /* ext_ent.c */
 void anthy_init_ext_ent(void);
+void anthy_quit_ext_ent(void);
 /**/
 int anthy_get_nr_dic_ents_of_ext_ent(struct seq_ent *se,xstr *xs);
 int anthy_get_nth_dic_ent_str_of_ext_ent(seq_ent_t ,xstr *,int ,xstr *);
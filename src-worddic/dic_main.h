@@ -17,6 +17,8 @@ struct seq_ent *anthy_cache_get_seq_ent(xstr *x, int is_reverse);
 
 
 /* word_dic.c */
+/* 辞書に無い読みのインデックス */
+#define NO_WORD -1
 /* 辞書検索のキーに使用する部分文字列 */
 struct gang_elm {
   char *key;
@@ -39,6 +41,13 @@ void anthy_release_word_dic(struct word_dic *);
 void anthy_gang_fill_seq_ent(struct word_dic *wd,
 			     struct gang_elm **array, int nr,
 			     int is_reverse);
+void anthy_gang_find_words(struct word_dic *wd,
+			   struct gang_elm **array, int nr);
+void anthy_gang_load_words(struct word_dic *wd,
+			   struct gang_elm **array, int nr,
+			   int is_reverse);
+int anthy_word_dic_prefix_search(struct word_dic *wd, xstr *xs,
+				 int *lens, int *indices);
 
 
 /* use_dic.c */
@@ -63,12 +72,20 @@ struct seq_ent *anthy_mem_dic_alloc_seq_ent_by_xstr(struct mem_dic * d,
 /* node がなければ作らない */
 struct seq_ent *anthy_mem_dic_find_seq_ent_by_xstr(struct mem_dic * d,
 						   xstr *, int is_reverse);
+/* LRUの順序を変えない、並行して読める */
+struct seq_ent *anthy_mem_dic_peek_seq_ent_by_xstr(struct mem_dic * d,
+						   xstr *, int is_reverse);
+void anthy_mem_dic_share_dic_ents(struct seq_ent *se, struct seq_ent *shared);
 /**/
 void anthy_mem_dic_push_back_dic_ent(struct seq_ent *se, int is_compound,
 				     xstr *xs, wtype_t wt,
 				     const char *wt_name, int freq,
 				     int feature);
 void anthy_mem_dic_release_seq_ent(struct mem_dic * d, xstr *, int is_reverse);
+/* 使用メモリ量がlimitバイト以下になるまで追い出す */
+void anthy_mem_dic_trim(struct mem_dic *d, long limit);
+struct anthy_dic_cache_stat;
+void anthy_mem_dic_get_stat(struct mem_dic *d, struct anthy_dic_cache_stat *st);
 
 
 /* priv_dic.c */
@@ -81,6 +98,8 @@ void anthy_check_user_dir(void);
 void anthy_priv_dic_lock(void);
 void anthy_priv_dic_unlock(void);
 void anthy_priv_dic_update(void);
+unsigned long anthy_get_private_dic_stamp(void);
+void anthy_private_dic_changed(void);
 struct word_line {
   char wt[10];
   int freq;
@@ -5,8 +5,11 @@
 #ifndef _dic_personality_h_included_
 #define _dic_personality_h_included_
 
-extern struct mem_dic *anthy_current_personal_dic_cache;
-extern struct record_stat *anthy_current_record;
+#include <anthy/thread.h>
+
+/* スレッドごとのカレントの辞書セッションの内容 */
+extern ANTHY_THREAD_LOCAL struct mem_dic *anthy_current_personal_dic_cache;
+extern ANTHY_THREAD_LOCAL struct record_stat *anthy_current_record;
 
 /* record */
 void anthy_init_record(void);
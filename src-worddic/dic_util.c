@@ -146,6 +146,7 @@ anthy_priv_dic_delete(void)
   while (!anthy_textdic_delete_line(anthy_private_text_dic, 0)) {
     /**/
   }
+  anthy_private_dic_changed();
 }
 
 static int
@@ -345,6 +346,7 @@ add_word_to_textdic(const char *yomi, const char *word,
   anthy_textdic_scan(anthy_private_text_dic, 0, &sc, find_cb);
   if (sc.found_word == 1) {
     anthy_textdic_delete_line(anthy_private_text_dic, sc.offset);
+    anthy_private_dic_changed();
   }
   if (freq == 0) {
     return ANTHY_DIC_UTIL_OK;
@@ -356,6 +358,7 @@ add_word_to_textdic(const char *yomi, const char *word,
   /* 追加する */
   rv = do_add_word_to_textdic(anthy_private_text_dic, sc.offset,
 			      yomi, word, wt_name, freq);
+  anthy_private_dic_changed();
   if (!rv) {
     return ANTHY_DIC_UTIL_OK;
   }
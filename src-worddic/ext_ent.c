@@ -25,13 +25,21 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <sys/mman.h>
+#endif
 
 #include <anthy/anthy.h> /* for ANTHY_*_ENCODING */
 #include <anthy/conf.h>
+#include <anthy/thread.h>
 #include <anthy/xstr.h>
 #include <anthy/xchar.h>
 #include "dic_main.h"
@@ -65,29 +73,175 @@ pushback_place_name(struct zipcode_line *zl, char *pn)
   zl->nr++;
 }
 
+#define MAX_LINE_LEN 2048
+
 /*
- * This comment is written by NIIBE Yutaka -- 2010-05-17
- *
- * XXX: The implementation of search_zipcode_dict is quite bad.
- * XXX: Every call of search_zipcode_dict opens/parse the file, amazing...
- *
+ * 郵便番号辞書の索引
+ * 最初に引く時にファイルをmmapして、行を先頭の番号でソートした表を作る。
+ * 以降は表を二分探索して引くので、ファイルを開いたり読んだりしない
  */
-#define MAX_LINE_LEN 2048	/* XXX: Please kill this limit too */
+struct zipcode_index {
+  /* 一度作ろうとしたか(ファイルが無い場合も含む) */
+  int loaded;
+  const char *buf;
+  long size;
+  /* 番号でソートした行の先頭、同じ番号の行はファイル中の順 */
+  const char **lines;
+  int nr_lines;
+};
+
+static struct zipcode_index zipcode_index;
+static anthy_mutex_t zipcode_lock = ANTHY_MUTEX_INITIALIZER;
+
+/* 郵便番号辞書の内容をメモリ上に置く */
+static const char *
+map_zipcode_dict(const char *fn, long *size)
+{
+  char *ptr;
+#ifndef _WIN32
+  struct stat st;
+  int fd = open(fn, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+  *size = st.st_size;
+#else
+  FILE *fp = fopen(fn, "rb");
+  long len;
+  if (!fp) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (len <= 0 || !(ptr = malloc(len))) {
+    fclose(fp);
+    return NULL;
+  }
+  len = fread(ptr, 1, len, fp);
+  fclose(fp);
+  *size = len;
+#endif
+  return ptr;
+}
+
+static void
+unmap_zipcode_dict(const char *ptr, long size)
+{
+#ifndef _WIN32
+  munmap((void *)ptr, size);
+#else
+  (void)size;
+  free((void *)ptr);
+#endif
+}
+
+/* 行の先頭の番号を比べる、番号は空白で終わる */
+static int
+compare_zipcode(const char *p1, const char *p2)
+{
+  for (; *p1 == *p2; p1++, p2++) {
+    if (*p1 == ' ') {
+      return 0;
+    }
+  }
+  if (*p1 == ' ') {
+    return -1;
+  }
+  if (*p2 == ' ') {
+    return 1;
+  }
+  return (unsigned char)*p1 - (unsigned char)*p2;
+}
+
+static int
+compare_zipcode_line(const void *p1, const void *p2)
+{
+  const char *l1 = *(const char **)p1;
+  const char *l2 = *(const char **)p2;
+  int r = compare_zipcode(l1, l2);
+  if (r) {
+    return r;
+  }
+  /* 同じ番号の行はファイル中の順にする */
+  return (l1 > l2) - (l1 < l2);
+}
 
-/* 郵便番号辞書をパースしてスペース区切りを検出する */
+/* zipcode_lockを取って呼ぶ */
 static void
-parse_zipcode_line(struct zipcode_line *zl, char *ln)
+load_zipcode_index(struct zipcode_index *zi)
+{
+  const char *p, *end, *eol;
+  int nr;
+
+  zi->loaded = 1;
+  zi->buf = map_zipcode_dict(anthy_conf_get_str("ZIPDICT"), &zi->size);
+  if (!zi->buf) {
+    return ;
+  }
+  end = zi->buf + zi->size;
+  for (p = zi->buf, nr = 0; p < end; p = eol + 1, nr++) {
+    eol = memchr(p, '\n', end - p);
+    if (!eol) {
+      eol = end;
+    }
+  }
+  zi->lines = malloc(sizeof(char *) * (nr + 1));
+  if (!zi->lines) {
+    return ;
+  }
+  /* 番号と地名の間に空白の無い行は使わない */
+  for (p = zi->buf; p < end; p = eol + 1) {
+    const char *sp;
+    eol = memchr(p, '\n', end - p);
+    if (!eol) {
+      eol = end;
+    }
+    sp = memchr(p, ' ', eol - p);
+    if (sp && sp > p) {
+      zi->lines[zi->nr_lines] = p;
+      zi->nr_lines ++;
+    }
+  }
+  qsort(zi->lines, zi->nr_lines, sizeof(char *), compare_zipcode_line);
+}
+
+static struct zipcode_index *
+get_zipcode_index(void)
+{
+  struct zipcode_index *zi = &zipcode_index;
+  anthy_mutex_lock(&zipcode_lock);
+  if (!zi->loaded) {
+    load_zipcode_index(zi);
+  }
+  anthy_mutex_unlock(&zipcode_lock);
+  return zi;
+}
+
+/* 郵便番号辞書の行(lnからendの前まで)をパースしてスペース区切りを検出する */
+static void
+parse_zipcode_line(struct zipcode_line *zl, const char *ln, const char *end)
 {
   char buf[MAX_LINE_LEN];
   int i = 0;
-  while (*ln) {
+  while (ln < end && i < MAX_LINE_LEN - 1) {
     buf[i] = *ln;
     if (*ln == '\\') {
-      buf[i] = ln[1];
-      i ++;
-      if (ln[1]) {
+      buf[i] = 0;
+      if (ln + 1 < end) {
+	buf[i] = ln[1];
 	ln ++;
       }
+      i ++;
     } else if (*ln == ' ') {
       buf[i] = 0;
       i = 0;
@@ -106,36 +260,50 @@ parse_zipcode_line(struct zipcode_line *zl, char *ln)
 static void
 search_zipcode_dict(struct zipcode_line *zl, xstr* xs)
 {
-  FILE *fp;
-  char buf[MAX_LINE_LEN];
-  int len;
+  struct zipcode_index *zi;
+  char key[MAX_LINE_LEN];
   xstr *temp;
   char *index;
+  int lo, hi;
 
   zl->nr = 0;
   zl->strs = NULL;
-  fp = fopen(anthy_conf_get_str("ZIPDICT"), "r");
-  if (!fp) {
+  zi = get_zipcode_index();
+  if (!zi->lines) {
     return ;
   }
 
   /* 半角、全角を吸収する */
   temp = anthy_xstr_wide_num_to_num(xs);
   index = anthy_xstr_to_cstr(temp, ANTHY_UTF8_ENCODING);
-  len = strlen(index);
-
-  /* 全部grepする */
-  while (fgets(buf, MAX_LINE_LEN, fp)) {
-    /* 3文字の郵便番号が7文字の郵便番号の頭にマッチしないように */
-    if (!strncmp(buf, index, len) && buf[len] == ' ') {
-      /* 改行を消す */
-      buf[strlen(buf) - 1] = 0;
-      parse_zipcode_line(zl, &buf[len + 1]);
-    }
+  anthy_free_xstr(temp);
+  if (strlen(index) + 2 > MAX_LINE_LEN || strchr(index, ' ')) {
+    free(index);
+    return ;
   }
-  anthy_free_xstr(temp);    /* メモリリークの修正 */
+  sprintf(key, "%s ", index);
   free(index);
-  fclose(fp);
+
+  /* 番号が一致する最初の行を探す */
+  lo = 0;
+  hi = zi->nr_lines;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (compare_zipcode(zi->lines[mid], key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  /* 3文字の郵便番号が7文字の郵便番号の頭にマッチしないように、
+   * 番号全体が一致する行だけを使う */
+  for (; lo < zi->nr_lines && !compare_zipcode(zi->lines[lo], key); lo++) {
+    const char *ln = zi->lines[lo];
+    const char *end = zi->buf + zi->size;
+    const char *eol = memchr(ln, '\n', end - ln);
+    parse_zipcode_line(zl, (const char *)memchr(ln, ' ', end - ln) + 1,
+		       eol ? eol : end);
+  }
 }
 
 /* 郵便番号辞書の情報を解放する */
@@ -569,3 +737,16 @@ anthy_init_ext_ent(void)
   sep_ent.seq_type = 0;
   sep_ent.nr_dic_ents = 0;
 }
+
+void
+anthy_quit_ext_ent(void)
+{
+  struct zipcode_index *zi = &zipcode_index;
+  anthy_mutex_lock(&zipcode_lock);
+  if (zi->buf) {
+    unmap_zipcode_dict(zi->buf, zi->size);
+  }
+  free(zi->lines);
+  memset(zi, 0, sizeof(struct zipcode_index));
+  anthy_mutex_unlock(&zipcode_lock);
+}
@@ -23,14 +23,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifndef _WIN32
-  #include <arpa/inet.h>
-#else
-  #define STRICT 1
-  #include <winsock2.h>
-#endif
-
 #include <anthy/segclass.h>
+#include <anthy/diclib.h>
 #include <anthy/feature_set.h>
 /* for MW_FEATURE* constants */
 #include <anthy/splitter.h>
@@ -90,17 +84,18 @@ anthy_feature_list_nth(const struct feature_list *fl, int nth)
   return fl->u.index[nth];
 }
 
-static int
-cmp_short(const void *p1, const void *p2)
-{
-  return *((short *)p1) - *((short *)p2);
-}
-
+/* 素性は高々NR_EM_FEATURES個なので挿入ソートで並べる */
 void
 anthy_feature_list_sort(struct feature_list *fl)
 {
-  qsort(fl->u.index, fl->nr, sizeof(fl->u.index[0]),
-	cmp_short);
+  int i, j;
+  for (i = 1; i < fl->nr; i++) {
+    short f = fl->u.index[i];
+    for (j = i; j > 0 && fl->u.index[j - 1] > f; j--) {
+      fl->u.index[j] = fl->u.index[j - 1];
+    }
+    fl->u.index[j] = f;
+  }
 }
 
 
@@ -188,22 +183,80 @@ compare_line(const void *kp, const void *cp)
   const struct feature_freq *c = cp;
   int i;
   for (i = 0; i < NR_EM_FEATURES; i++) {
-    if (f[i] != (int)ntohl(c->f[i])) {
-      return f[i] - ntohl(c->f[i]);
+    if (f[i] != c->f[i]) {
+      return f[i] - c->f[i];
+    }
+  }
+  return 0;
+}
+
+/* 他のバイトオーダのホストで作られた辞書の行と比べる */
+static int
+compare_swapped_line(const void *kp, const void *cp)
+{
+  const int *f = kp;
+  const struct feature_freq *c = cp;
+  int i;
+  for (i = 0; i < NR_EM_FEATURES; i++) {
+    int v = anthy_dic_to_host(c->f[i], 1);
+    if (f[i] != v) {
+      return f[i] - v;
     }
   }
   return 0;
 }
 
+/*
+ * 素性の組のハッシュ値
+ * calctransが完全ハッシュの表を作る時にも同じものを使う
+ */
+unsigned int
+anthy_feature_hash(const int *f, unsigned int seed)
+{
+  unsigned int h = 2166136261U ^ (seed * 0x9e3779b9U);
+  int i;
+  for (i = 0; i < NR_EM_FEATURES; i++) {
+    h = (h ^ (unsigned int)f[i]) * 16777619U;
+  }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dU;
+  h ^= h >> 12;
+  return h;
+}
+
+/*
+ * 完全ハッシュの表
+ *  ヘッダ: FEATURE_HASH_MAGIC, 行数, バケツの数, スロットの数
+ *  バケツごとのseed
+ *  スロットごとの行(空きスロットの先頭の素性は-1)
+ * 行はバケツのseedで計算したハッシュ値のスロットに入っている
+ */
+static const int *
+find_hashed_line(const int *hash, const int *n)
+{
+  const int *seeds = &hash[FEATURE_HASH_HEADER];
+  const int *line;
+  unsigned int b, slot;
+
+  b = anthy_feature_hash(n, 0) % (unsigned int)hash[2];
+  slot = anthy_feature_hash(n, (unsigned int)seeds[b]) %
+    (unsigned int)hash[3];
+  line = &seeds[hash[2] + slot * (NR_EM_FEATURES + 2)];
+  if (memcmp(line, n, sizeof(int) * NR_EM_FEATURES)) {
+    return NULL;
+  }
+  return line;
+}
+
 struct feature_freq *
-anthy_find_array_freq(const void *image, int *f, int nr,
+anthy_find_array_freq(const struct feature_table *ft, int *f, int nr,
 		      struct feature_freq *arg)
 {
   struct feature_freq *res;
   int nr_lines, i;
-  const int *array = (int *)image;
+  const int *array = (int *)ft->array;
   int n[NR_EM_FEATURES];
-  if (!image) {
+  if (!array) {
     return NULL;
   }
   /* コピーする */
@@ -214,22 +267,30 @@ anthy_find_array_freq(const void *image, int *f, int nr,
       n[i] = 0;
     }
   }
+  if (ft->hash) {
+    const int *line = find_hashed_line(ft->hash, n);
+    if (!line) {
+      return NULL;
+    }
+    memcpy(arg->f, line, sizeof(int) * (NR_EM_FEATURES + 2));
+    return arg;
+  }
   /**/
-  nr_lines = ntohl(array[1]);
+  nr_lines = anthy_dic_to_host(array[1], ft->swap);
   res = bsearch(n, &array[16], nr_lines,
 		sizeof(struct feature_freq),
-		compare_line);
+		ft->swap ? compare_swapped_line : compare_line);
   if (!res) {
     return NULL;
   }
   for (i = 0; i < NR_EM_FEATURES + 2; i++) {
-    arg->f[i] = ntohl(res->f[i]);
+    arg->f[i] = anthy_dic_to_host(res->f[i], ft->swap);
   }
   return arg;
 }
 
 struct feature_freq *
-anthy_find_feature_freq(const void *image,
+anthy_find_feature_freq(const struct feature_table *ft,
 			const struct feature_list *fl,
 			struct feature_freq *arg)
 {
@@ -245,7 +306,40 @@ anthy_find_feature_freq(const void *image,
       f[i] = 0;
     }
   }
-  return anthy_find_array_freq(image, f, NR_EM_FEATURES, arg);
+  return anthy_find_array_freq(ft, f, NR_EM_FEATURES, arg);
+}
+
+/* ハッシュの表がソートした表と同じ行を持っているか調べる */
+static const int *
+check_feature_hash(const int *array, const int *hash, int swap)
+{
+  if (!array || !hash) {
+    return NULL;
+  }
+  if (hash[0] != FEATURE_HASH_MAGIC) {
+    /* バイトオーダの違う計算機で作られた */
+    return NULL;
+  }
+  if (hash[1] != (int)anthy_dic_to_host(array[1], swap) ||
+      hash[2] < 1 || hash[3] < 1) {
+    return NULL;
+  }
+  return hash;
+}
+
+/*
+ * 辞書のarrayのセクションを素性の表として使う
+ * calctransが作った完全ハッシュの表(hash)があれば、そちらを引く
+ */
+void
+anthy_init_feature_table(struct feature_table *ft,
+			 enum anthy_dic_section array,
+			 enum anthy_dic_section hash)
+{
+  ft->array = anthy_file_dic_section(array);
+  ft->swap = anthy_dic_swapped();
+  ft->hash = check_feature_hash(ft->array, anthy_file_dic_section(hash),
+				ft->swap);
 }
 
 void
@@ -441,19 +441,16 @@ anthy_matrix_image_new(struct sparse_matrix *s)
 }
 
 static int
-read_int(int *image, int idx, int en)
+read_int(int *image, int idx, int swap)
 {
-  if (en) {
-    return anthy_dic_ntohl(image[idx]);
-  }
-  return image[idx];
+  return anthy_dic_to_host(image[idx], swap);
 }
 
 static int
-do_matrix_peek(int *image, int row, int col, int en)
+do_matrix_peek(int *image, int row, int col, int swap)
 {
   int n, h, shift, next_shift;
-  int row_array_len = read_int(image, 0, en);
+  int row_array_len = read_int(image, 0, swap);
   int column_array_len;
   int cell_offset;
 
@@ -463,11 +460,11 @@ do_matrix_peek(int *image, int row, int col, int en)
   }
   for (n = 0; ; n++) {
     h = hash(row, row_array_len, n);
-    if (read_int(image, 2+ h * 2, en) == row) {
-      shift = read_int(image, 2+h*2+1, en);
+    if (read_int(image, 2+ h * 2, swap) == row) {
+      shift = read_int(image, 2+h*2+1, swap);
       break;
     }
-    if (read_int(image, 2+ h * 2, en) == -1) {
+    if (read_int(image, 2+ h * 2, swap) == -1) {
       return 0;
     }
     if (n > MAX_FAILURE) {
@@ -478,10 +475,10 @@ do_matrix_peek(int *image, int row, int col, int en)
   /* find shift count of next row */
   if (h == row_array_len - 1) {
     /* last one */
-    next_shift = read_int(image, 1, en);
+    next_shift = read_int(image, 1, swap);
   } else {
     /* not last one */
-    next_shift = read_int(image, 2+h*2+2+1, en);
+    next_shift = read_int(image, 2+h*2+2+1, swap);
   }
 
   /* crammed width of this row */
@@ -491,10 +488,10 @@ do_matrix_peek(int *image, int row, int col, int en)
   cell_offset = 2 + row_array_len * 2;
   for (n = 0; ; n++) {
     h = hash(col, column_array_len, n);
-    if (read_int(image, cell_offset + shift * 2+ h * 2, en) == col) {
-      return read_int(image, cell_offset + shift * 2 + h*2+1, en);
+    if (read_int(image, cell_offset + shift * 2+ h * 2, swap) == col) {
+      return read_int(image, cell_offset + shift * 2 + h*2+1, swap);
     }
-    if (read_int(image, cell_offset + shift * 2+ h * 2, en) == -1) {
+    if (read_int(image, cell_offset + shift * 2+ h * 2, swap) == -1) {
       /* not exist */
       return 0;
     }
@@ -512,7 +509,7 @@ anthy_matrix_image_peek(int *image, int row, int col)
   if (!image) {
     return 0;
   }
-  return do_matrix_peek(image, row, col, 1);
+  return do_matrix_peek(image, row, col, anthy_dic_swapped());
 }
 
 #ifdef DEBUG
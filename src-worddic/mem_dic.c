@@ -4,6 +4,14 @@
  * キャッシュは読みの文字列と逆変換用かのフラグ(is_reverse)の
  * 二つをキーとして操作される。
  *
+ * seq_entは読み全体のハッシュ値で引くハッシュテーブルに格納する。
+ * テーブルは要素数がサイズを超えると倍の大きさにし、
+ * 古いテーブルの内容は以後の追加・削除の度に少しずつ移す。
+ *
+ * seq_entは最近使われた順のリスト(LRU)にもつないでおき、
+ * 使用メモリ量が上限を超えたらanthy_mem_dic_trim()で古いものから追い出す。
+ * 単語の無いseq_entも「辞書に無い」ことを覚えておくために残す。
+ *
  * Copyright (C) 2000-2007 TABATA Yusuke
  */
 /*
@@ -22,11 +30,17 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 #include <stdlib.h>
+#include <string.h>
 
+#include <anthy/anthy.h>
 #include <anthy/alloc.h>
+#include <anthy/logger.h>
 #include "dic_main.h"
 #include "mem_dic.h"
 
+/* 一回の操作で古いテーブルから移すチェインの数 */
+#define REHASH_STEP 4
+
 static allocator mem_dic_ator;
 
 static void
@@ -44,7 +58,8 @@ seq_ent_dtor(void *p)
   struct seq_ent *seq = p;
   int i;
   /**/
-  for (i = 0; i < seq->nr_dic_ents; i++) {
+  /* 共有キャッシュのdic_entは共有キャッシュが解放する */
+  for (i = seq->nr_shared_ents; i < seq->nr_dic_ents; i++) {
     anthy_sfree(seq->md->dic_ent_allocator, seq->dic_ents[i]);
   }
   if (seq->nr_dic_ents) {
@@ -60,6 +75,8 @@ mem_dic_dtor(void *p)
   struct mem_dic * md = p;
   anthy_free_allocator(md->seq_ent_allocator);
   anthy_free_allocator(md->dic_ent_allocator);
+  free(md->seq_ent_hash);
+  free(md->old_hash);
 }
 
 /** xstrに対応するseq_entを確保する */
@@ -78,6 +95,7 @@ alloc_seq_ent_by_xstr(struct mem_dic * md, xstr *x, int is_reverse)
   /**/
   se->nr_dic_ents = 0;
   se->dic_ents = NULL;
+  se->nr_shared_ents = 0;
   /**/
   se->nr_compound_ents = 0;
 
@@ -85,42 +103,77 @@ alloc_seq_ent_by_xstr(struct mem_dic * md, xstr *x, int is_reverse)
   return se;
 }
 
-/* ハッシュ関数。とりあえずてきとー */
-static int
-hash_function(xstr *xs)
+static long
+seq_ent_mem_size(struct seq_ent *se)
+{
+  return sizeof(struct seq_ent) + sizeof(xchar) * se->str.len;
+}
+
+static long
+dic_ent_mem_size(struct dic_ent *de)
 {
-  if (xs->len) {
-    return xs->str[0]% HASH_SIZE;
+  return sizeof(struct dic_ent) + sizeof(struct dic_ent *) +
+    sizeof(xchar) * de->str.len;
+}
+
+/* LRUリストの先頭につなぐ */
+static void
+lru_push_front(struct mem_dic *md, struct seq_ent *se)
+{
+  se->lru_prev = NULL;
+  se->lru_next = md->lru_head;
+  if (md->lru_head) {
+    md->lru_head->lru_prev = se;
+  } else {
+    md->lru_tail = se;
   }
-  return 0;
+  md->lru_head = se;
 }
 
-/** xstrに対応するseq_entを返す */
-struct seq_ent *
-anthy_mem_dic_alloc_seq_ent_by_xstr(struct mem_dic * md, xstr *xs,
-				    int is_reverse)
+static void
+lru_unlink(struct mem_dic *md, struct seq_ent *se)
 {
-  struct seq_ent *se;
-  int h;
-  /* キャッシュにあればそれを返す */
-  se = anthy_mem_dic_find_seq_ent_by_xstr(md, xs, is_reverse);
-  if (se) {
-    return se;
+  if (se->lru_prev) {
+    se->lru_prev->lru_next = se->lru_next;
+  } else {
+    md->lru_head = se->lru_next;
   }
-  /* キャッシュには無いので作る */
-  se = alloc_seq_ent_by_xstr(md, xs, is_reverse);
+  if (se->lru_next) {
+    se->lru_next->lru_prev = se->lru_prev;
+  } else {
+    md->lru_tail = se->lru_prev;
+  }
+}
 
-  /* mem_dic中につなぐ */
-  h = hash_function(xs);
-  se->next = md->seq_ent_hash[h];
-  md->seq_ent_hash[h] = se;
+/* 使われたのでLRUリストの先頭に移す */
+static void
+lru_touch(struct mem_dic *md, struct seq_ent *se)
+{
+  if (md->lru_head != se) {
+    lru_unlink(md, se);
+    lru_push_front(md, se);
+  }
+}
 
-  return se;
+/* 読みの全ての文字を使うハッシュ関数(FNV-1a) */
+static unsigned int
+hash_function(xstr *xs)
+{
+  unsigned int h = 2166136261u;
+  int i;
+  for (i = 0; i < xs->len; i++) {
+    h = (h ^ (unsigned int)xs->str[i]) * 16777619u;
+  }
+  return h;
 }
 
 static int
-compare_seq_ent(struct seq_ent *seq, xstr *xs, int is_reverse)
+compare_seq_ent(struct seq_ent *seq, xstr *xs, unsigned int h, int is_reverse)
 {
+  /* ハッシュ値が違えば文字列も違う */
+  if (seq->hash != h) {
+    return 1;
+  }
   /* まず、どちらかが逆変換用のエントリかをチェック */
   if (seq->seq_type & ST_REVERSE) {
     if (!is_reverse) {
@@ -135,41 +188,216 @@ compare_seq_ent(struct seq_ent *seq, xstr *xs, int is_reverse)
   return anthy_xstrcmp(&seq->str, xs);
 }
 
+/* 古いテーブルのチェインを幾つか新しいテーブルに移す */
+static void
+rehash_step(struct mem_dic *md)
+{
+  int i;
+  if (!md->old_hash) {
+    return ;
+  }
+  for (i = 0; i < REHASH_STEP && md->rehash_pos <= md->old_hash_mask; i++) {
+    struct seq_ent *se, *next;
+    for (se = md->old_hash[md->rehash_pos]; se; se = next) {
+      next = se->next;
+      se->next = md->seq_ent_hash[se->hash & md->hash_mask];
+      md->seq_ent_hash[se->hash & md->hash_mask] = se;
+    }
+    md->old_hash[md->rehash_pos] = NULL;
+    md->rehash_pos ++;
+  }
+  if (md->rehash_pos > md->old_hash_mask) {
+    free(md->old_hash);
+    md->old_hash = NULL;
+  }
+}
+
+/* 要素数がテーブルのサイズを超えたら倍の大きさのテーブルを用意する */
+static void
+grow_hash(struct mem_dic *md)
+{
+  struct seq_ent **new_hash;
+  unsigned int size = md->hash_mask + 1;
+  if ((unsigned int)md->nr_seq_ents <= size) {
+    return ;
+  }
+  /* 前回の拡張が終わってなければ終わらせる */
+  while (md->old_hash) {
+    rehash_step(md);
+  }
+  new_hash = calloc(size * 2, sizeof(struct seq_ent *));
+  if (!new_hash) {
+    /* 拡張できなくてもチェインが長くなるだけ */
+    anthy_log(0, "Failed to grow the hash table of mem_dic.\n");
+    return ;
+  }
+  md->old_hash = md->seq_ent_hash;
+  md->old_hash_mask = md->hash_mask;
+  md->rehash_pos = 0;
+  md->seq_ent_hash = new_hash;
+  md->hash_mask = size * 2 - 1;
+}
+
+/* チェインchain中でseq_entを指しているポインタの場所を返す */
+static struct seq_ent **
+find_in_chain(struct seq_ent **chain, xstr *xs, unsigned int h,
+	      int is_reverse)
+{
+  for (; *chain; chain = &(*chain)->next) {
+    if (!compare_seq_ent(*chain, xs, h, is_reverse)) {
+      return chain;
+    }
+  }
+  return NULL;
+}
+
+/* seq_entを指しているポインタの場所を返す、無ければNULL */
+static struct seq_ent **
+find_seq_ent_link(struct mem_dic *md, xstr *xs, unsigned int h,
+		  int is_reverse)
+{
+  struct seq_ent **link;
+  link = find_in_chain(&md->seq_ent_hash[h & md->hash_mask],
+		       xs, h, is_reverse);
+  if (link) {
+    return link;
+  }
+  /* まだ新しいテーブルに移されていないかもしれない */
+  if (md->old_hash && (h & md->old_hash_mask) >= md->rehash_pos) {
+    return find_in_chain(&md->old_hash[h & md->old_hash_mask],
+			 xs, h, is_reverse);
+  }
+  return NULL;
+}
+
+static struct seq_ent *
+find_seq_ent(struct mem_dic *md, xstr *xs, unsigned int h, int is_reverse)
+{
+  struct seq_ent **link = find_seq_ent_link(md, xs, h, is_reverse);
+  return link ? *link : NULL;
+}
+
+/** xstrに対応するseq_entを返す */
+struct seq_ent *
+anthy_mem_dic_alloc_seq_ent_by_xstr(struct mem_dic * md, xstr *xs,
+				    int is_reverse)
+{
+  struct seq_ent *se;
+  unsigned int h = hash_function(xs);
+  /* キャッシュにあればそれを返す */
+  se = find_seq_ent(md, xs, h, is_reverse);
+  if (se) {
+    lru_touch(md, se);
+    if (se->nr_dic_ents == 0 && se->nr_compound_ents == 0) {
+      md->nr_negative_hit ++;
+    } else {
+      md->nr_hit ++;
+    }
+    return se;
+  }
+  md->nr_miss ++;
+  /* キャッシュには無いので作る */
+  se = alloc_seq_ent_by_xstr(md, xs, is_reverse);
+  se->hash = h;
+
+  /* mem_dic中につなぐ */
+  se->next = md->seq_ent_hash[h & md->hash_mask];
+  md->seq_ent_hash[h & md->hash_mask] = se;
+  md->nr_seq_ents ++;
+  lru_push_front(md, se);
+  md->mem_used += seq_ent_mem_size(se);
+
+  grow_hash(md);
+  rehash_step(md);
+  return se;
+}
+
+/** LRUリストや統計を変えずにseq_entを探す
+ * 他のスレッドが同じmem_dicを同時に読んでいてもよい
+ */
+struct seq_ent *
+anthy_mem_dic_peek_seq_ent_by_xstr(struct mem_dic *md, xstr *xs,
+				   int is_reverse)
+{
+  return find_seq_ent(md, xs, hash_function(xs), is_reverse);
+}
+
 /*** mem_dicの中から文字列に対応するseq_ent*を取得する
  * */
 struct seq_ent *
 anthy_mem_dic_find_seq_ent_by_xstr(struct mem_dic * md, xstr *xs,
 				   int is_reverse)
 {
-  struct seq_ent *sn;
-  int h;
-  h = hash_function(xs);
-  for (sn = md->seq_ent_hash[h]; sn; sn = sn->next) {
-    if (!compare_seq_ent(sn, xs, is_reverse)){
-      return sn;
-    }
+  struct seq_ent *se = find_seq_ent(md, xs, hash_function(xs), is_reverse);
+  if (se) {
+    lru_touch(md, se);
+  }
+  return se;
+}
+
+/* 見付かったseq_entを取り除く */
+static void
+release_seq_ent(struct mem_dic *md, struct seq_ent **link)
+{
+  struct seq_ent *sn = *link;
+  int i;
+  *link = sn->next;
+  lru_unlink(md, sn);
+  md->mem_used -= seq_ent_mem_size(sn);
+  md->mem_used -= sizeof(struct dic_ent *) * sn->nr_shared_ents;
+  for (i = sn->nr_shared_ents; i < sn->nr_dic_ents; i++) {
+    md->mem_used -= dic_ent_mem_size(sn->dic_ents[i]);
   }
-  return 0;
+  anthy_sfree(md->seq_ent_allocator, sn);
+  md->nr_seq_ents --;
 }
 
 void
 anthy_mem_dic_release_seq_ent(struct mem_dic * md, xstr *xs, int is_reverse)
 {
-  struct seq_ent *sn;
-  struct seq_ent **sn_prev_p;
-  int h;
-
-  h = hash_function(xs);
-  sn_prev_p = &md->seq_ent_hash[h];
-  for (sn = md->seq_ent_hash[h]; sn; sn = sn->next) {
-    if (!compare_seq_ent(sn, xs, is_reverse)){
-      *sn_prev_p = sn->next;
-      anthy_sfree(md->seq_ent_allocator, sn);
-      return;
-    } else {
-      sn_prev_p = &sn->next;
+  struct seq_ent **link;
+
+  link = find_seq_ent_link(md, xs, hash_function(xs), is_reverse);
+  if (link) {
+    release_seq_ent(md, link);
+  }
+  rehash_step(md);
+}
+
+/** 使用メモリ量がlimitバイト以下になるまで、最近使われていないseq_entを
+ * 追い出す。seq_entへのポインタを保持している者がいない時に呼ぶこと
+ */
+void
+anthy_mem_dic_trim(struct mem_dic *md, long limit)
+{
+  while (md->lru_tail && md->mem_used > limit) {
+    struct seq_ent *se = md->lru_tail;
+    struct seq_ent **link;
+    link = find_seq_ent_link(md, &se->str, se->hash,
+			     se->seq_type & ST_REVERSE);
+    if (!link) {
+      /* ハッシュテーブルとLRUリストの不整合 */
+      anthy_log(0, "mem_dic: a seq_ent is missing from the hash table.\n");
+      break;
     }
+    release_seq_ent(md, link);
+    md->nr_eviction ++;
   }
+  /* 拡張途中の古いテーブルもこの機会に片付ける */
+  while (md->old_hash) {
+    rehash_step(md);
+  }
+}
+
+void
+anthy_mem_dic_get_stat(struct mem_dic *md, struct anthy_dic_cache_stat *st)
+{
+  st->nr_hit = md->nr_hit;
+  st->nr_negative_hit = md->nr_negative_hit;
+  st->nr_miss = md->nr_miss;
+  st->nr_eviction = md->nr_eviction;
+  st->nr_entries = md->nr_seq_ents;
+  st->mem_used = md->mem_used;
 }
 
 /** seq_entにdic_entを追加する */
@@ -192,6 +420,7 @@ anthy_mem_dic_push_back_dic_ent(struct seq_ent *se, int is_compound,
   if (is_compound) {
     se->nr_compound_ents ++;
   }
+  se->md->mem_used += dic_ent_mem_size(de);
 
   /* orderを計算する */
   if (se->nr_dic_ents > 0) {
@@ -209,17 +438,47 @@ anthy_mem_dic_push_back_dic_ent(struct seq_ent *se, int is_compound,
   se->dic_ents[se->nr_dic_ents-1] = de;
 }
 
+/** 共有キャッシュのseq_entの単語をコピーせずにseに追加する
+ * seにはまだ単語が無いこと
+ */
+void
+anthy_mem_dic_share_dic_ents(struct seq_ent *se, struct seq_ent *shared)
+{
+  if (!shared->nr_dic_ents) {
+    return ;
+  }
+  se->dic_ents = malloc(sizeof(struct dic_ent *) * shared->nr_dic_ents);
+  if (!se->dic_ents) {
+    return ;
+  }
+  memcpy(se->dic_ents, shared->dic_ents,
+	 sizeof(struct dic_ent *) * shared->nr_dic_ents);
+  se->nr_dic_ents = shared->nr_dic_ents;
+  se->nr_shared_ents = shared->nr_dic_ents;
+  se->nr_compound_ents = shared->nr_compound_ents;
+  se->md->mem_used += sizeof(struct dic_ent *) * shared->nr_dic_ents;
+}
+
 struct mem_dic *
 anthy_create_mem_dic(void)
 {
-  int i;
   struct mem_dic *md;
 
   md = anthy_smalloc(mem_dic_ator);
-  for (i = 0; i < HASH_SIZE; i++) {
-    md->seq_ent_hash[i] = NULL;
-  }
-  
+  md->seq_ent_hash = calloc(HASH_SIZE, sizeof(struct seq_ent *));
+  md->hash_mask = HASH_SIZE - 1;
+  md->nr_seq_ents = 0;
+  md->old_hash = NULL;
+  md->old_hash_mask = 0;
+  md->rehash_pos = 0;
+  md->lru_head = NULL;
+  md->lru_tail = NULL;
+  md->mem_used = 0;
+  md->nr_hit = 0;
+  md->nr_negative_hit = 0;
+  md->nr_miss = 0;
+  md->nr_eviction = 0;
+
   md->seq_ent_allocator = 
     anthy_create_allocator(sizeof(struct seq_ent),
 			   seq_ent_dtor);
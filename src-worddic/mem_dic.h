@@ -5,11 +5,28 @@
 #include "dic_ent.h"
 
 
-#define HASH_SIZE 64 /*ハッシュテーブルのサイズ…64(なんとなく)*/
+/* ハッシュテーブルの最初のサイズ、2のべき乗 */
+#define HASH_SIZE 64
 
 /** メモリ辞書 */
 struct mem_dic {
-  struct seq_ent *seq_ent_hash[HASH_SIZE];
+  /* seq_entのハッシュテーブル、要素数がサイズを超えたら倍にする */
+  struct seq_ent **seq_ent_hash;
+  unsigned int hash_mask;
+  int nr_seq_ents;
+  /* 拡張中の古いテーブル、少しずつ新しいテーブルに移す */
+  struct seq_ent **old_hash;
+  unsigned int old_hash_mask;
+  unsigned int rehash_pos;
+  /* 最近使われた順のseq_entのリスト、追い出しは末尾から行う */
+  struct seq_ent *lru_head, *lru_tail;
+  /* seq_entとdic_entが使っているおおよそのメモリ量 */
+  long mem_used;
+  /* 統計情報 */
+  long nr_hit;
+  long nr_negative_hit;
+  long nr_miss;
+  long nr_eviction;
   allocator seq_ent_allocator;
   allocator dic_ent_allocator;
 };
@@ -25,6 +25,10 @@
 #define NO_OLDNAMES 1  // mingw
 #define _CRT_SECURE_NO_WARNINGS
 
+#ifndef _MSC_VER
+  #include <config.h>
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -56,6 +60,8 @@
 #include <anthy/dicutil.h>
 #include <anthy/conf.h>
 #include <anthy/logger.h>
+#include <anthy/thread.h>
+#include <anthy/phase.h>
 #include <anthy/textdic.h>
 #include <anthy/word_dic.h>
 #include "dic_main.h"
@@ -71,7 +77,14 @@ static char *imported_dic_dir;
  */
 static char* lock_fn = NULL;
 
-static long lock_depth = 0;
+/* ロックはスレッドごとに入れ子にできる。
+ * ファイルのロックはプロセスに対して掛かるので、同じプロセスの
+ * スレッドでは共有し、最後に外したスレッドがファイルを閉じる。
+ * 変換中の他のスレッドとはこのロックでは排他しない */
+static ANTHY_THREAD_LOCAL long lock_depth = 0;
+/* ロックを持っているスレッドの数、lock_mutexで保護する */
+static int lock_holders;
+static anthy_mutex_t lock_mutex = ANTHY_MUTEX_INITIALIZER;
 
 #ifndef _WIN32
 static int lock_fd = -1;
@@ -81,6 +94,17 @@ static HANDLE lock_fd = INVALID_HANDLE_VALUE;
 
 #define MAX_DICT_SIZE 100000000
 
+/* 未知語の学習で個人辞書の内容が変わった回数 */
+static unsigned long unknown_word_generation;
+static anthy_mutex_t generation_mutex = ANTHY_MUTEX_INITIALIZER;
+
+/* 個人辞書のファイルを調べる間隔(ミリ秒) */
+#define STAMP_CHECK_INTERVAL 1000
+/* 最後にファイルを調べた結果と時刻、generation_mutexで保護する */
+static unsigned long file_stamp;
+static long long file_stamp_time;
+static int file_stamp_valid;
+
 /**
  * Check if HOME/.anthy exists, create the directory if not.
  */
@@ -137,21 +161,13 @@ textdicname (const char *home, const char *name, const char *id)
   return (const char *)fn;
 }
 
-void
-anthy_priv_dic_lock(void)
+static void
+open_lock_file(void)
 {
 #ifndef _WIN32
   struct flock lck;
 #endif
 
-#ifndef _WIN32
-  if (__sync_add_and_fetch(&lock_depth, 1) > 1)
-    return; // succeeded
-#else
-  if (InterlockedIncrement(&lock_depth) > 1)
-    return; // succeeded
-#endif
-
   if (!lock_fn) {
     /* 初期化をミスってる */
 #ifndef _WIN32
@@ -194,14 +210,9 @@ anthy_priv_dic_lock(void)
 #endif
 }
 
-void
-anthy_priv_dic_unlock(void)
+static void
+close_lock_file(void)
 {
-  lock_depth --;
-  if (lock_depth > 0) {
-    return ;
-  }
-
 #ifndef _WIN32
   if (lock_fd != -1) {
     close(lock_fd);
@@ -215,6 +226,32 @@ anthy_priv_dic_unlock(void)
 #endif
 }
 
+void
+anthy_priv_dic_lock(void)
+{
+  if (++lock_depth > 1)
+    return; // succeeded
+  anthy_mutex_lock(&lock_mutex);
+  if (lock_holders++ == 0) {
+    open_lock_file();
+  }
+  anthy_mutex_unlock(&lock_mutex);
+}
+
+void
+anthy_priv_dic_unlock(void)
+{
+  lock_depth --;
+  if (lock_depth > 0) {
+    return ;
+  }
+  anthy_mutex_lock(&lock_mutex);
+  if (--lock_holders == 0) {
+    close_lock_file();
+  }
+  anthy_mutex_unlock(&lock_mutex);
+}
+
 #if 0
 /* seq_entに追加する */
 static void
@@ -243,6 +280,7 @@ anthy_copy_words_from_private_dic(struct seq_ent *seq,
     return ;
   }
   /**/
+  anthy_lock_record();
   if (!anthy_select_section("UNKNOWN_WORD", 0) &&
       !anthy_select_row(xs, 0)) {
     wtype_t wt;
@@ -251,6 +289,7 @@ anthy_copy_words_from_private_dic(struct seq_ent *seq,
     word_xs = anthy_get_nth_xstr(0);
     anthy_mem_dic_push_back_dic_ent(seq, 0, word_xs, wt, NULL, 10, 0);
   }
+  anthy_unlock_record();
 }
 
 int
@@ -355,6 +394,56 @@ anthy_ask_scan (void (*request_scan)(const char *, void *), void *arg)
 #endif
 }
 
+/** 未知語が他のプロセスなどによって変更されたことを知らせる */
+void
+anthy_private_dic_changed(void)
+{
+  anthy_mutex_lock(&generation_mutex);
+  unknown_word_generation ++;
+  /* ファイルも書き換えたかもしれないので、次は調べ直す */
+  file_stamp_valid = 0;
+  anthy_mutex_unlock(&generation_mutex);
+}
+
+static void
+stamp_file(const char *fn, void *arg)
+{
+  unsigned long *stamp = arg;
+  struct stat st;
+  if (stat(fn, &st)) {
+    return ;
+  }
+  *stamp = *stamp * 31 + (unsigned long)st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  /* 同じ秒のうちに書き換えられても分かるように */
+  *stamp = *stamp * 31 + (unsigned long)st.st_mtim.tv_nsec;
+#endif
+  *stamp = *stamp * 31 + (unsigned long)st.st_size;
+}
+
+/** 個人辞書の内容が変わったことを検出するための値を返す
+ * 未知語の学習の回数と、個人辞書のファイルの更新時刻と大きさから作る
+ * ファイルはSTAMP_CHECK_INTERVALごとにしか調べないので、
+ * 他のプロセスによる変更はその間だけ遅れて分かる
+ */
+unsigned long
+anthy_get_private_dic_stamp(void)
+{
+  unsigned long stamp;
+  long long now = anthy_get_time_ns() / 1000000;
+  anthy_mutex_lock(&generation_mutex);
+  if (!file_stamp_valid ||
+      now - file_stamp_time >= STAMP_CHECK_INTERVAL) {
+    file_stamp = 0;
+    anthy_ask_scan(stamp_file, &file_stamp);
+    file_stamp_time = now;
+    file_stamp_valid = 1;
+  }
+  stamp = unknown_word_generation * 31 + file_stamp;
+  anthy_mutex_unlock(&generation_mutex);
+  return stamp;
+}
+
 static void
 add_unknown_word(xstr *yomi, xstr *word)
 {
@@ -369,6 +458,7 @@ add_unknown_word(xstr *yomi, xstr *word)
     return ;
   }
   anthy_set_nth_xstr(0, word);
+  anthy_private_dic_changed();
 }
 
 void
@@ -382,19 +472,22 @@ anthy_add_unknown_word(xstr *yomi, xstr *word)
     return ;
   }
   /**/
+  anthy_lock_record();
   add_unknown_word(yomi, word);
+  anthy_unlock_record();
 }
 
 void
 anthy_forget_unused_unknown_word(xstr *xs)
 {
   /* recordに記録された物を消す */
-  if (anthy_select_section("UNKNOWN_WORD", 0)) {
-    return ;
-  }
-  if (!anthy_select_row(xs, 0)) {
+  anthy_lock_record();
+  if (!anthy_select_section("UNKNOWN_WORD", 0) &&
+      !anthy_select_row(xs, 0)) {
     anthy_release_row();
+    anthy_private_dic_changed();
   }
+  anthy_unlock_record();
 }
 
 void
@@ -49,9 +49,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 #ifndef _WIN32
   #include <unistd.h>
+  #ifdef HAVE_SYS_INOTIFY_H
+    #include <sys/inotify.h>
+  #endif
 #else
+  #include <windows.h> // GetTickCount()
   #ifdef _MSC_VER
     #include <malloc.h> // alloca
   #endif
@@ -63,6 +68,7 @@
 #include <anthy/anthy.h>
 #include <anthy/dic.h>
 #include <anthy/alloc.h>
+#include <anthy/thread.h>
 #include <anthy/conf.h>
 #include <anthy/ruleparser.h>
 #include <anthy/record.h>
@@ -71,9 +77,12 @@
 
 #include "dic_main.h"
 #include "dic_personality.h"
+#include "record_bin.h"
 
 /* 個人辞書をセーブするファイル名のsuffix */
 #define ENCODING_SUFFIX ".utf8"
+/* バイナリ形式のファイル名のsuffix */
+#define BINARY_SUFFIX ".bin"
 
 
 enum val_type {
@@ -157,6 +166,7 @@ struct record_stat {
   struct trie_node *cur_row;
   int row_dirty; /* cur_row が保存の必要があるか */
   int encoding;
+  int is_binary; /* ファイルがバイナリ形式(record_bin.c)か */
   /**/
   int is_anon;
   const char *id;         /* パーソナリティのid */
@@ -166,6 +176,16 @@ struct record_stat {
   time_t base_timestamp; /* 基本ファイルのタイムスタンプ */
   int last_update;  /* 差分ファイルの最後に読んだ位置 */
   time_t journal_timestamp; /* 差分ファイルのタイムスタンプ */
+  /**/
+  long check_interval; /* ファイルを調べる間隔(ミリ秒)、0なら毎回調べる */
+  unsigned long last_check; /* 最後にファイルを調べた時刻(ミリ秒) */
+  int watching; /* ファイルの変更の通知を受け取っているか */
+  int notified; /* 変更の通知が届いている、watch_mutexで保護する */
+  struct record_stat *watch_next; /* 通知を受け取るデータベースのリスト */
+  long journal_seen; /* 差分ファイルのどこまでを読んだことがあるか */
+  int unknown_word_updated; /* 未知語のセクションの新しい行を読み込んだ */
+  /* 全ての変換コンテキストで共有するので、操作する間はこれを持つ */
+  anthy_mutex_t mutex;
 };
 
 /* 差分が100KB越えたら基本ファイルへマージ */
@@ -1147,9 +1167,10 @@ read_del_row(FILE *fp, struct record_stat* rst,
   free(token);
 }
 
-/** 差分ファイルから1行読み込む */
+/** 差分ファイルから1行読み込む
+ * is_newは初めて読む行であることを表す */
 static void
-read_1_row(struct record_stat* rst, FILE* fp, char *op)
+read_1_row(struct record_stat* rst, FILE* fp, char *op, int is_new)
 {
   char* sec_name;
   struct record_section* rsc;
@@ -1160,6 +1181,9 @@ read_1_row(struct record_stat* rst, FILE* fp, char *op)
     free(sec_name);
     return ;
   }
+  if (is_new && !strcmp(sec_name, "UNKNOWN_WORD")) {
+    rst->unknown_word_updated = 1;
+  }
   rsc = do_select_section(rst, sec_name, 1);
   free(sec_name);
   if (!rsc) {
@@ -1173,6 +1197,94 @@ read_1_row(struct record_stat* rst, FILE* fp, char *op)
   }
 }
 
+/* バイナリ形式の行の値を設定する
+ * is_baseが0の時は差分ファイルと同じく空の値を読み飛ばす */
+static void
+set_bin_values(struct record_stat *rst, struct trie_node *node,
+	       struct record_bin_row *row, int is_base)
+{
+  int i;
+  for (i = 0; i < row->nr_vals; i++) {
+    struct record_bin_val *v = &row->vals[i];
+    if (v->type == RB_VAL_STR) {
+      xstr *xs = anthy_cstr_to_xstr(v->str, ANTHY_UTF8_ENCODING);
+      do_set_nth_xstr(node, i, xs, &rst->xstrs);
+      anthy_free_xstr(xs);
+    } else if (v->type == RB_VAL_NUM) {
+      do_set_nth_value(node, i, v->num);
+    } else if (is_base) {
+      get_nth_val_ent(node, i, 1);
+    }
+  }
+}
+
+/* バイナリ形式の差分ファイルの1行 */
+static void
+read_bin_journal_row(void *p, struct record_bin_row *row)
+{
+  struct record_stat *rst = (struct record_stat *)p;
+  struct record_section *rsc;
+  struct trie_node *node;
+  xstr *xs;
+
+  if (row->offset >= rst->journal_seen &&
+      !strcmp(row->section, "UNKNOWN_WORD")) {
+    rst->unknown_word_updated = 1;
+  }
+  rsc = do_select_section(rst, row->section, 1);
+  if (!rsc) {
+    return ;
+  }
+  xs = anthy_cstr_to_xstr(row->key, ANTHY_UTF8_ENCODING);
+  if (row->op == RB_OP_ADD) {
+    node = do_select_row(rsc, xs, 1, LRU_USED);
+    /* 保存すべき row なら読み捨てる */
+    if (node && !(node->dirty & PROTECT)) {
+      set_bin_values(rst, node, row, 0);
+      do_truncate_row(node, row->nr_vals);
+    }
+  } else if (row->op == RB_OP_DEL) {
+    node = do_select_row(rsc, xs, 0, 0);
+    if (node) {
+      do_remove_row(rsc, node);
+    }
+  }
+  anthy_free_xstr(xs);
+}
+
+static void
+read_bin_journal_record(struct record_stat *rs)
+{
+  struct stat st;
+  long pos;
+
+  if (stat(rs->journal_fn, &st) < 0) {
+    return ;
+  }
+  if (st.st_size < rs->last_update) {
+    /* ファイルサイズが小さくなっているので、
+     * 最初から読み込む */
+    rs->last_update = 0;
+    rs->journal_seen = 0;
+  }
+  rs->journal_timestamp = st.st_mtime;
+  pos = anthy_record_bin_read(rs->journal_fn, rs->last_update,
+			      rs, read_bin_journal_row);
+  if (pos < 0) {
+    return ;
+  }
+  if (pos < st.st_size) {
+    /* 書き込みの途中で中断された行があるので、
+     * これから追記する行が読めるように取り除く */
+    anthy_log(0, "Truncating broken record file (%s).\n", rs->journal_fn);
+    anthy_record_bin_truncate(rs->journal_fn, pos);
+  }
+  rs->last_update = pos;
+  if (rs->last_update > rs->journal_seen) {
+    rs->journal_seen = rs->last_update;
+  }
+}
+
 /*
  * journal(差分)ファイルを読む
  */
@@ -1185,6 +1297,10 @@ read_journal_record(struct record_stat* rs)
   if (rs->is_anon) {
     return ;
   }
+  if (rs->is_binary) {
+    read_bin_journal_record(rs);
+    return ;
+  }
   fp = fopen(rs->journal_fn, "rb");
   if (fp == NULL) {
     return;
@@ -1197,6 +1313,7 @@ read_journal_record(struct record_stat* rs)
     /* ファイルサイズが小さくなっているので、
      * 最初から読み込む */
     fseek(fp, 0, SEEK_SET);
+    rs->journal_seen = 0;
   } else {
     fseek(fp, rs->last_update, SEEK_SET);
   }
@@ -1204,13 +1321,17 @@ read_journal_record(struct record_stat* rs)
   while (!feof(fp)) {
     char *op;
     int eol;
+    int is_new = (ftell(fp) >= rs->journal_seen);
     op = read_1_token(fp, &eol);
     if (op && !eol) {
-      read_1_row(rs, fp, op);
+      read_1_row(rs, fp, op, is_new);
     }
     free(op);
   }
   rs->last_update = ftell(fp);
+  if (rs->last_update > rs->journal_seen) {
+    rs->journal_seen = rs->last_update;
+  }
   fclose(fp);
 }
 
@@ -1255,12 +1376,73 @@ write_number(FILE* fp, int x)
   fprintf(fp, "%d", x);
 }
 
+/* rowをバイナリ形式で1行書き出す */
+static void
+write_bin_row(FILE *fp, int op, const char *sname,
+	      struct trie_node *node, int flags)
+{
+  struct record_bin_row row;
+  struct record_val *vals = node->row.vals;
+  int i, nr_vals = op == RB_OP_ADD ? node->row.nr_vals : 0;
+
+  row.op = op;
+  row.flags = flags;
+  row.section = sname;
+  row.key = anthy_xstr_to_cstr(&node->row.key, ANTHY_UTF8_ENCODING);
+  row.nr_vals = nr_vals;
+  row.vals = malloc(sizeof(struct record_bin_val) * (nr_vals + 1));
+  if (!row.key || !row.vals) {
+    free((char *)row.key);
+    free(row.vals);
+    return ;
+  }
+  for (i = 0; i < nr_vals; i++) {
+    struct record_bin_val *v = &row.vals[i];
+    xstr *xs = NULL;
+    v->type = RB_VAL_EMPTY;
+    v->str = NULL;
+    if (vals[i].type == RT_VAL) {
+      v->type = RB_VAL_NUM;
+      v->num = vals[i].u.val;
+    } else if (vals[i].type == RT_XSTR) {
+      xs = &vals[i].u.str;
+    } else if (vals[i].type == RT_XSTRP) {
+      xs = vals[i].u.strp;
+    }
+    if (vals[i].type == RT_XSTR || vals[i].type == RT_XSTRP) {
+      v->type = RB_VAL_STR;
+      /* 壊れた文字列は空の文字列にする(テキスト形式と同じ) */
+      v->str = xs ? anthy_xstr_to_cstr(xs, ANTHY_UTF8_ENCODING) : NULL;
+    }
+  }
+  anthy_record_bin_write_row(fp, &row);
+  for (i = 0; i < nr_vals; i++) {
+    free((char *)row.vals[i].str);
+  }
+  free(row.vals);
+  free((char *)row.key);
+}
+
+/*
+ * 追記した行を読んだことにする
+ * 追記する前の位置までを読んでいなければ、他のプロセスが追記した行を
+ * 読み飛ばしてしまうので、次に差分ファイルを読むときに自分の行も含めて読む
+ */
+static void
+advance_last_update(struct record_stat *rst, long before, long after)
+{
+  if (before == rst->last_update && after > before) {
+    rst->last_update = after;
+  }
+}
+
 /* journalに1行追記する */
 static void
 commit_add_row(struct record_stat* rst,
 	       const char* sname, struct trie_node* node)
 {
   FILE* fp;
+  long pos;
   int i;
 
   if (rst->is_anon)
@@ -1270,6 +1452,16 @@ commit_add_row(struct record_stat* rst,
   if (fp == NULL) {
     return;
   }
+  fseek(fp, 0, SEEK_END);
+  pos = ftell(fp);
+  if (rst->is_binary) {
+    if (!anthy_record_bin_begin(fp)) {
+      write_bin_row(fp, RB_OP_ADD, sname, node, 0);
+    }
+    advance_last_update(rst, pos, ftell(fp));
+    fclose(fp);
+    return ;
+  }
 
   write_string(fp, "ADD \"");
   write_quote_string(fp, sname);
@@ -1299,7 +1491,7 @@ commit_add_row(struct record_stat* rst,
     }
   }
   write_string(fp, "\n");
-  rst->last_update = ftell(fp);
+  advance_last_update(rst, pos, ftell(fp));
   fclose(fp);
 }
 
@@ -1371,6 +1563,30 @@ read_session(struct record_stat *rst)
   }
 }
 
+/* バイナリ形式の基本ファイルの1行 */
+static void
+read_bin_base_row(void *p, struct record_bin_row *row)
+{
+  struct record_stat *rst = (struct record_stat *)p;
+  struct record_section *rsc;
+  struct trie_node *node;
+  xstr *xs;
+
+  if (row->op != RB_OP_ADD) {
+    return ;
+  }
+  rsc = do_select_section(rst, row->section, 1);
+  if (!rsc) {
+    return ;
+  }
+  xs = anthy_cstr_to_xstr(row->key, ANTHY_UTF8_ENCODING);
+  node = do_select_row(rsc, xs, 1, row->flags & LRU_SUSED);
+  anthy_free_xstr(xs);
+  if (node) {
+    set_bin_values(rst, node, row, 1);
+  }
+}
+
 /* いまのデータベースを解放した後にファイルから読み込む */
 static void
 read_base_record(struct record_stat *rst)
@@ -1382,13 +1598,20 @@ read_base_record(struct record_stat *rst)
   }
   anthy_check_user_dir();
 
-  if (anthy_open_file(rst->base_fn) == -1) {
-    return ;
+  if (rst->is_binary) {
+    if (stat(rst->base_fn, &st) < 0) {
+      return ;
+    }
+    clear_record(rst);
+    anthy_record_bin_read(rst->base_fn, 0, rst, read_bin_base_row);
+  } else {
+    if (anthy_open_file(rst->base_fn) == -1) {
+      return ;
+    }
+    clear_record(rst);
+    read_session(rst);
+    anthy_close_file();
   }
-
-  clear_record(rst);
-  read_session(rst);
-  anthy_close_file();
   if (stat(rst->base_fn, &st) == 0) {
     rst->base_timestamp = st.st_mtime;
   }
@@ -1488,6 +1711,10 @@ update_base_record(struct record_stat* rst)
     anthy_log(0, "Failed to open temporaly session file.\n");
     return ;
   }
+  if (rst->is_binary && anthy_record_bin_begin(fp)) {
+    fclose(fp);
+    return ;
+  }
   /* 各セクションに対して */
   for (sec = rst->section_list.next;
        sec; sec = sec->next) {
@@ -1495,6 +1722,16 @@ update_base_record(struct record_stat* rst)
       /*このセクションは空*/
       continue;
     }
+    if (rst->is_binary) {
+      /* セクション名は最初の行にだけ付ける */
+      for (col = trie_first(&sec->cols); col;
+	   col = trie_next(&sec->cols, col)) {
+	write_bin_row(fp, RB_OP_ADD,
+		      col == trie_first(&sec->cols) ? sec->name : NULL, col,
+		      col->dirty ? LRU_SUSED : 0);
+      }
+      continue;
+    }
     /* セクション境界の文字列 */
     fprintf(fp, "--- %s\n", sec->name);
     /* 各カラムを保存する */
@@ -1514,27 +1751,207 @@ update_base_record(struct record_stat* rst)
   /* journalファイルを消す */
   unlink(rst->journal_fn);
   rst->last_update = 0;
+  rst->journal_seen = 0;
 }
 
 static void
 commit_del_row(struct record_stat* rst,
-	       const char* sname, struct trie_node* node)
+	       const char* sname, struct trie_node* node, int removed)
 {
   FILE* fp;
+  long pos;
 
   fp = fopen(rst->journal_fn, "ab");
   if (fp == NULL) {
     return;
   }
-  write_string(fp, "DEL \"");
-  write_quote_string(fp, sname);
-  write_string(fp, "\" S\"");
-  write_quote_xstr(fp, &node->row.key, rst->encoding);
-  write_string(fp, "\"");
-  write_string(fp, "\n");
+  fseek(fp, 0, SEEK_END);
+  pos = ftell(fp);
+  if (rst->is_binary) {
+    if (!anthy_record_bin_begin(fp)) {
+      write_bin_row(fp, RB_OP_DEL, sname, node, 0);
+    }
+  } else {
+    write_string(fp, "DEL \"");
+    write_quote_string(fp, sname);
+    write_string(fp, "\" S\"");
+    write_quote_xstr(fp, &node->row.key, rst->encoding);
+    write_string(fp, "\"");
+    write_string(fp, "\n");
+  }
+  /* メモリ上から消していなければ、差分ファイルを読んで消す */
+  if (removed) {
+    advance_last_update(rst, pos, ftell(fp));
+  }
   fclose(fp);
 }
 
+/* 単調増加する時刻をミリ秒で返す */
+static unsigned long
+get_time_ms(void)
+{
+#ifdef _WIN32
+  return GetTickCount();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+#endif
+}
+
+/*
+ * inotifyのインスタンスはプロセスで一つだけ作り、
+ * 届いた通知は watch_list の中の該当するデータベースに配る。
+ * watch_fd, watch_list と各データベースの notified は watch_mutex で保護する
+ */
+static anthy_mutex_t watch_mutex = ANTHY_MUTEX_INITIALIZER;
+#ifdef HAVE_SYS_INOTIFY_H
+static int watch_fd = -1;
+static int watch_fd_failed;
+#endif
+static struct record_stat *watch_list;
+
+/*
+ * 設定変数RECORD_CHECK_INTERVALが指定されていれば、
+ * ファイルを調べるのはその間隔(ミリ秒)に一度だけにする。
+ * inotifyが使える場合はファイルの変更の通知も受け取り、
+ * 通知があればすぐに調べる。
+ */
+static void
+start_watching(struct record_stat *rst)
+{
+  const char *val = anthy_conf_get_str("RECORD_CHECK_INTERVAL");
+  rst->check_interval = (val && !rst->is_anon) ? atol(val) : 0;
+  rst->last_check = get_time_ms();
+  rst->watching = 0;
+  rst->notified = 0;
+  rst->watch_next = NULL;
+  if (rst->check_interval <= 0) {
+    return ;
+  }
+#ifdef HAVE_SYS_INOTIFY_H
+  anthy_mutex_lock(&watch_mutex);
+  if (watch_fd < 0 && !watch_fd_failed) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+      /* 作れなければ時間の間隔だけで調べる */
+      watch_fd_failed = 1;
+    }
+  }
+  if (watch_fd >= 0) {
+    char *dir = strdup(rst->base_fn);
+    char *p = strrchr(dir, '/');
+    /* 同じディレクトリは同じwatchになるので、何度追加してもよい */
+    if (p) {
+      *p = 0;
+      if (inotify_add_watch(watch_fd, dir,
+			    IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+			    IN_DELETE | IN_MOVED_TO) >= 0) {
+	rst->watching = 1;
+	rst->watch_next = watch_list;
+	watch_list = rst;
+      }
+    }
+    free(dir);
+  }
+  anthy_mutex_unlock(&watch_mutex);
+#endif
+}
+
+/* 通知を受け取るのをやめる */
+static void
+stop_watching(struct record_stat *rst)
+{
+  struct record_stat **p;
+  if (!rst->watching) {
+    return ;
+  }
+  anthy_mutex_lock(&watch_mutex);
+  for (p = &watch_list; *p; p = &(*p)->watch_next) {
+    if (*p == rst) {
+      *p = rst->watch_next;
+      break;
+    }
+  }
+  anthy_mutex_unlock(&watch_mutex);
+  rst->watching = 0;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static int
+is_record_file(struct record_stat *rst, const char *name)
+{
+  return !strcmp(name, strrchr(rst->base_fn, '/') + 1) ||
+    !strcmp(name, strrchr(rst->journal_fn, '/') + 1);
+}
+#endif
+
+/* 学習データのファイルが変更された通知があれば1を返す */
+static int
+check_notification(struct record_stat *rst)
+{
+  int changed = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+  union {
+    struct inotify_event ev;
+    char buf[4096];
+  } u;
+  ssize_t len;
+  if (!rst->watching) {
+    return 0;
+  }
+  anthy_mutex_lock(&watch_mutex);
+  /* 溜まっている通知を全て読み、該当するデータベースに印を付ける */
+  while ((len = read(watch_fd, u.buf, sizeof(u.buf))) > 0) {
+    char *p;
+    for (p = u.buf; p < u.buf + len; ) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      struct record_stat *r;
+      for (r = watch_list; r; r = r->watch_next) {
+	if ((ev->mask & IN_Q_OVERFLOW) ||
+	    (ev->len && is_record_file(r, ev->name))) {
+	  r->notified = 1;
+	}
+      }
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  changed = rst->notified;
+  rst->notified = 0;
+  anthy_mutex_unlock(&watch_mutex);
+#else
+  (void)rst;
+#endif
+  return changed;
+}
+
+/* ファイルを調べる必要があれば1を返す */
+static int
+need_check_files(struct record_stat *rst)
+{
+  unsigned long now;
+  int notified;
+  if (rst->check_interval <= 0) {
+    return 1;
+  }
+  notified = check_notification(rst);
+  now = get_time_ms();
+  if (!notified && now - rst->last_check < (unsigned long)rst->check_interval) {
+    return 0;
+  }
+  rst->last_check = now;
+  return 1;
+}
+
+/* 自分で書き込んだことによる通知を読み捨てる
+ * 他のプロセスは書き込みの間ロックを取っているので、
+ * ロックを持っている間に呼べば他のプロセスの変更を見落とすことはない */
+static void
+ignore_own_changes(struct record_stat *rst)
+{
+  check_notification(rst);
+}
+
 /*
  * sync_add: ADD の書き込み
  * sync_del_and_del: DEL の書き込みと削除
@@ -1549,7 +1966,10 @@ sync_add(struct record_stat* rst, struct record_section* rsc,
 	 struct trie_node* node)
 {
   lock_record(rst);
-  if (!check_base_record_uptodate(rst)) {
+  if (!need_check_files(rst)) {
+    /* 他のプロセスによる更新は無いものとして書き込むだけ */
+    commit_add_row(rst, rsc->name, node);
+  } else if (!check_base_record_uptodate(rst)) {
     node->dirty |= PROTECT;
     /* 差分ファイルだけ読む */
     read_journal_record(rst);
@@ -1564,6 +1984,7 @@ sync_add(struct record_stat* rst, struct record_section* rsc,
   if (rst->last_update > FILE2_LIMIT) {
     update_base_record(rst);
   }
+  ignore_own_changes(rst);
   unlock_record(rst);
 }
 
@@ -1572,7 +1993,15 @@ sync_del_and_del(struct record_stat* rst, struct record_section* rsc,
 		 struct trie_node* node)
 {
   lock_record(rst);
-  commit_del_row(rst, rsc->name, node);
+  if (!need_check_files(rst)) {
+    /* 差分ファイルを読まないので、ここで削除する */
+    commit_del_row(rst, rsc->name, node, 1);
+    do_remove_row(rsc, node);
+    ignore_own_changes(rst);
+    unlock_record(rst);
+    return ;
+  }
+  commit_del_row(rst, rsc->name, node, 0);
   if (!check_base_record_uptodate(rst)) {
     read_base_record(rst);
   }
@@ -1580,6 +2009,7 @@ sync_del_and_del(struct record_stat* rst, struct record_section* rsc,
   if (rst->last_update > FILE2_LIMIT) {
     update_base_record(rst);
   }
+  ignore_own_changes(rst);
   unlock_record(rst);
 }
 
@@ -1694,6 +2124,38 @@ anthy_traverse_record_for_prediction(xstr* key, struct prediction_t* predictions
   return nr_predictions;
 }
 
+/* このスレッドでのロックの入れ子の深さと、ロックしたデータベース */
+static ANTHY_THREAD_LOCAL int record_lock_depth;
+static ANTHY_THREAD_LOCAL struct record_stat *locked_record;
+
+void
+anthy_lock_record(void)
+{
+  if (record_lock_depth++ > 0 || !anthy_current_record) {
+    return ;
+  }
+  locked_record = anthy_current_record;
+  anthy_mutex_lock(&locked_record->mutex);
+}
+
+void
+anthy_unlock_record(void)
+{
+  struct record_stat *rst = locked_record;
+  if (--record_lock_depth > 0 || !rst) {
+    return ;
+  }
+  /* カレントrowへの変更を書き出し、カーソルは次の操作に残さない */
+  if (rst->row_dirty && rst->cur_section && rst->cur_row) {
+    sync_add(rst, rst->cur_section, rst->cur_row);
+  }
+  rst->cur_section = NULL;
+  rst->cur_row = NULL;
+  rst->row_dirty = 0;
+  locked_record = NULL;
+  anthy_mutex_unlock(&rst->mutex);
+}
+
 /* Wrappers begin.. */
 int 
 anthy_select_section(const char *name, int flag)
@@ -1991,6 +2453,67 @@ check_record_encoding(struct record_stat *rst)
   strcat(rst->journal_fn, ENCODING_SUFFIX);
 }
 
+/* テキスト形式のファイル名からバイナリ形式のファイル名を作る */
+static char *
+binary_filename(const char *fn)
+{
+  size_t len = strlen(fn);
+  char *bin_fn = malloc(len + strlen(BINARY_SUFFIX) + 1);
+  if (!bin_fn) {
+    return NULL;
+  }
+  strcpy(bin_fn, fn);
+  if (len > strlen(ENCODING_SUFFIX) &&
+      !strcmp(fn + len - strlen(ENCODING_SUFFIX), ENCODING_SUFFIX)) {
+    bin_fn[len - strlen(ENCODING_SUFFIX)] = 0;
+  }
+  strcat(bin_fn, BINARY_SUFFIX);
+  return bin_fn;
+}
+
+/*
+ * 設定変数RECORD_FORMATが"binary"ならバイナリ形式のファイルを使う。
+ * バイナリ形式のファイルが無く、テキスト形式のファイルがあれば
+ * それを読み込んでバイナリ形式の基本ファイルに変換する。
+ * テキスト形式のファイルはそのまま残す。
+ */
+static void
+setup_record_format(struct record_stat *rst)
+{
+  const char *val = anthy_conf_get_str("RECORD_FORMAT");
+  char *base_fn, *journal_fn;
+  struct stat st;
+  int convert = 0;
+
+  if (rst->is_anon || !val || strcmp(val, "binary")) {
+    return ;
+  }
+  base_fn = binary_filename(rst->base_fn);
+  journal_fn = binary_filename(rst->journal_fn);
+  if (!base_fn || !journal_fn) {
+    free(base_fn);
+    free(journal_fn);
+    return ;
+  }
+  if (stat(base_fn, &st) < 0 && stat(journal_fn, &st) < 0 &&
+      (stat(rst->base_fn, &st) == 0 || stat(rst->journal_fn, &st) == 0)) {
+    /* テキスト形式で読み込んでおく */
+    read_base_record(rst);
+    read_journal_record(rst);
+    convert = 1;
+  }
+  free(rst->base_fn);
+  free(rst->journal_fn);
+  rst->base_fn = base_fn;
+  rst->journal_fn = journal_fn;
+  rst->is_binary = 1;
+  rst->encoding = ANTHY_UTF8_ENCODING;
+  if (convert) {
+    anthy_log(1, "Converting record to binary format (%s).\n", base_fn);
+    update_base_record(rst);
+  }
+}
+
 static void
 record_dtor(void *p)
 {
@@ -2001,24 +2524,55 @@ record_dtor(void *p)
     free(rst->base_fn);
     free(rst->journal_fn);
   }
+  stop_watching(rst);
   trie_remove_all(&rst->xstrs, &dummy, &dummy);
+  anthy_mutex_destroy(&rst->mutex);
 }
 
-void
-anthy_reload_record(void)
+static void
+do_reload_record(struct record_stat *rst)
 {
   struct stat st;
-  struct record_stat *rst = anthy_current_record;
-  
-  if (stat(rst->journal_fn, &st) == 0 &&
-      rst->journal_timestamp == st.st_mtime) {
-    return ;
+  int base_changed;
+
+  if (!rst->is_anon) {
+    if (!need_check_files(rst)) {
+      return ;
+    }
+    if (stat(rst->journal_fn, &st) == 0) {
+      if (rst->journal_timestamp == st.st_mtime) {
+	return ;
+      }
+    } else if (!check_base_record_uptodate(rst)) {
+      /* 差分ファイルが無く、基本ファイルも変わっていない */
+      return ;
+    }
   }
 
   lock_record(rst);
+  base_changed = check_base_record_uptodate(rst);
+  if (base_changed) {
+    /* 差分ファイルは作り直されている */
+    rst->journal_seen = 0;
+  }
   read_base_record(rst);
   read_journal_record(rst);
   unlock_record(rst);
+  if (base_changed || rst->unknown_word_updated) {
+    /* 未知語が変わったかもしれないので辞書のキャッシュを捨てさせる */
+    rst->unknown_word_updated = 0;
+    anthy_private_dic_changed();
+  }
+}
+
+void
+anthy_reload_record(void)
+{
+  struct record_stat *rst = anthy_current_record;
+
+  anthy_lock_record();
+  do_reload_record(rst);
+  anthy_unlock_record();
 }
 
 void
@@ -2066,11 +2620,15 @@ anthy_create_record(const char *id)
   rst->cur_row = 0;
   rst->row_dirty = 0;
   rst->encoding = ANTHY_EUC_JP_ENCODING;
+  rst->is_binary = 0;
+  anthy_mutex_init(&rst->mutex);
 
   /* ファイル名の文字列を作る */
   setup_filenames(id, rst);
 
   rst->last_update = 0;
+  rst->journal_seen = 0;
+  rst->unknown_word_updated = 0;
 
   if (!strcmp(id, ANON_ID)) {
     rst->is_anon = 1;
@@ -2079,12 +2637,16 @@ anthy_create_record(const char *id)
     anthy_check_user_dir();
   }
 
+  start_watching(rst);
+
   /* ファイルから読み込む */
   lock_record(rst);
   check_record_encoding(rst);
+  setup_record_format(rst);
   read_base_record(rst);
   read_journal_record(rst);
   unlock_record(rst);
+  rst->unknown_word_updated = 0;
 
   return rst;
 }
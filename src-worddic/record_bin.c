@@ -0,0 +1,502 @@
+/*
+ * 学習データのバイナリ形式
+ *
+ * テキスト形式では読み込みの度に字句解析が必要で、履歴が大きくなると
+ * 起動や基本ファイルへのマージに時間がかかるので、長さの付いた
+ * 行を並べた形式を用意する。
+ * 読み込みはファイルをmmapして行い、書き込みは追記で行う。
+ *
+ * ファイル: ヘッダ 行*
+ *  ヘッダ: "ANTHYREC" (8バイト) バージョン (4バイト)
+ *  行:     内容の長さ (4バイト) 内容のチェックサム (4バイト) 内容
+ *  内容:   操作 (1バイト) LRUのフラグ (1バイト) セクション名 キー
+ *          値の数 (2バイト) 値*
+ *  値:     型 (1バイト) の後に、数なら可変長の数、文字列なら文字列
+ *  文字列: 長さ (2バイト) UTF-8のバイト列
+ * 長さなどの固定長の数はリトルエンディアンで格納し、値の数は
+ * zigzag符号化した7ビットずつの可変長で格納する。
+ * セクション名が空の行は、前の行と同じセクションに属する。
+ *
+ * 書き込みが途中で中断された行はチェックサムで検出し、
+ * それ以降は読まない。後から追記した行が読まれなくなるので、
+ * 差分ファイルではその位置で切り詰める。
+ */
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <sys/mman.h>
+#else
+  #include <io.h>
+#endif
+
+#include <anthy/logger.h>
+#include "record_bin.h"
+
+#define RECORD_BIN_MAGIC "ANTHYREC"
+#define RECORD_BIN_MAGIC_LEN 8
+#define RECORD_BIN_VERSION 1
+#define RECORD_BIN_HEADER_SIZE (RECORD_BIN_MAGIC_LEN + 4)
+/* 行の長さとチェックサム */
+#define ROW_HEADER_SIZE 8
+/* これより長い行は壊れているものとする */
+#define MAX_ROW_LEN (1 << 24)
+
+static unsigned long
+get_u32(const unsigned char *p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+    ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void
+put_u32(unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+/* FNV-1a */
+static unsigned long
+checksum(const unsigned char *p, unsigned long len)
+{
+  unsigned long h = 2166136261UL;
+  unsigned long i;
+  for (i = 0; i < len; i++) {
+    h ^= p[i];
+    h = (h * 16777619UL) & 0xffffffffUL;
+  }
+  return h;
+}
+
+/*
+ * 読み込み
+ */
+
+/* ファイルの内容をメモリ上に置く */
+static unsigned char *
+map_file(const char *fn, long *size)
+{
+  unsigned char *ptr;
+#ifndef _WIN32
+  struct stat st;
+  int fd = open(fn, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < RECORD_BIN_HEADER_SIZE) {
+    close(fd);
+    return NULL;
+  }
+  ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+  *size = st.st_size;
+#else
+  FILE *fp = fopen(fn, "rb");
+  long len;
+  if (!fp) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (len < RECORD_BIN_HEADER_SIZE || !(ptr = malloc(len))) {
+    fclose(fp);
+    return NULL;
+  }
+  len = fread(ptr, 1, len, fp);
+  fclose(fp);
+  *size = len;
+#endif
+  return ptr;
+}
+
+static void
+unmap_file(unsigned char *ptr, long size)
+{
+#ifndef _WIN32
+  munmap(ptr, size);
+#else
+  (void)size;
+  free(ptr);
+#endif
+}
+
+/* 行の内容を読むためのカーソル */
+struct row_reader {
+  const unsigned char *p;
+  const unsigned char *end;
+  /* 文字列をNUL終端してコピーする先 */
+  char *buf;
+  int error;
+};
+
+static int
+read_byte(struct row_reader *rr)
+{
+  if (rr->p + 1 > rr->end) {
+    rr->error = 1;
+    return 0;
+  }
+  return *rr->p++;
+}
+
+static int
+read_u16(struct row_reader *rr)
+{
+  int v;
+  if (rr->p + 2 > rr->end) {
+    rr->error = 1;
+    return 0;
+  }
+  v = rr->p[0] | (rr->p[1] << 8);
+  rr->p += 2;
+  return v;
+}
+
+static const char *
+read_str(struct row_reader *rr)
+{
+  int len = read_u16(rr);
+  char *s = rr->buf;
+  if (rr->error || rr->p + len > rr->end) {
+    rr->error = 1;
+    return "";
+  }
+  memcpy(s, rr->p, len);
+  s[len] = 0;
+  rr->p += len;
+  rr->buf += len + 1;
+  return s;
+}
+
+static int
+read_varint(struct row_reader *rr)
+{
+  unsigned long v = 0;
+  int shift = 0;
+  while (1) {
+    int c = read_byte(rr);
+    if (rr->error || shift > 28) {
+      rr->error = 1;
+      return 0;
+    }
+    v |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      break;
+    }
+    shift += 7;
+  }
+  v &= 0xffffffffUL;
+  /* zigzag */
+  return (v & 1) ? -(int)(v >> 1) - 1 : (int)(v >> 1);
+}
+
+/* 行の内容を解釈する。成功すれば0を返す */
+static int
+decode_row(const unsigned char *p, unsigned long len,
+	   struct record_bin_row *row, char *buf,
+	   struct record_bin_val **vals, int *vals_size)
+{
+  struct row_reader rr;
+  int i;
+  rr.p = p;
+  rr.end = p + len;
+  rr.buf = buf;
+  rr.error = 0;
+
+  row->op = read_byte(&rr);
+  row->flags = read_byte(&rr);
+  row->section = read_str(&rr);
+  row->key = read_str(&rr);
+  row->nr_vals = read_u16(&rr);
+  if (rr.error) {
+    return -1;
+  }
+  if (row->nr_vals > *vals_size) {
+    struct record_bin_val *v;
+    v = realloc(*vals, sizeof(struct record_bin_val) * row->nr_vals);
+    if (!v) {
+      return -1;
+    }
+    *vals = v;
+    *vals_size = row->nr_vals;
+  }
+  row->vals = *vals;
+  for (i = 0; i < row->nr_vals && !rr.error; i++) {
+    struct record_bin_val *v = &row->vals[i];
+    v->type = read_byte(&rr);
+    v->num = 0;
+    v->str = NULL;
+    if (v->type == RB_VAL_NUM) {
+      v->num = read_varint(&rr);
+    } else if (v->type == RB_VAL_STR) {
+      v->str = read_str(&rr);
+    }
+  }
+  return rr.error ? -1 : 0;
+}
+
+/*
+ * ファイルfnのoffsetの位置から行を読み、各行についてfuncを呼ぶ
+ * @return 正しく読めた最後の行の終わりの位置。
+ *  ファイルが無いか、形式が違う場合は-1
+ */
+long
+anthy_record_bin_read(const char *fn, long offset, void *data,
+		      void (*func)(void *, struct record_bin_row *))
+{
+  unsigned char *ptr;
+  long size, pos;
+  char *buf = NULL;
+  long buf_size = 0;
+  struct record_bin_val *vals = NULL;
+  int vals_size = 0;
+  char *section = NULL;
+
+  ptr = map_file(fn, &size);
+  if (!ptr) {
+    return -1;
+  }
+  if (memcmp(ptr, RECORD_BIN_MAGIC, RECORD_BIN_MAGIC_LEN) ||
+      get_u32(ptr + RECORD_BIN_MAGIC_LEN) != RECORD_BIN_VERSION) {
+    anthy_log(0, "Unknown format of record file (%s).\n", fn);
+    unmap_file(ptr, size);
+    return -1;
+  }
+
+  pos = offset < RECORD_BIN_HEADER_SIZE ? RECORD_BIN_HEADER_SIZE : offset;
+  while (pos + ROW_HEADER_SIZE <= size) {
+    struct record_bin_row row;
+    unsigned long len = get_u32(ptr + pos);
+    const unsigned char *p = ptr + pos + ROW_HEADER_SIZE;
+    if (len > MAX_ROW_LEN || (long)len > size - pos - ROW_HEADER_SIZE ||
+	checksum(p, len) != get_u32(ptr + pos + 4)) {
+      /* 書き込み途中か、壊れている */
+      break;
+    }
+    /* 文字列のNUL終端の分を足しても内容の2倍には収まる */
+    if ((long)len * 2 + 2 > buf_size) {
+      char *b = realloc(buf, len * 2 + 2);
+      if (!b) {
+	break;
+      }
+      buf = b;
+      buf_size = len * 2 + 2;
+    }
+    if (decode_row(p, len, &row, buf, &vals, &vals_size)) {
+      break;
+    }
+    if (row.section[0]) {
+      free(section);
+      section = strdup(row.section);
+    } else if (section) {
+      /* 前の行と同じセクション */
+      row.section = section;
+    }
+    row.offset = pos;
+    func(data, &row);
+    pos += ROW_HEADER_SIZE + len;
+  }
+
+  free(buf);
+  free(vals);
+  free(section);
+  unmap_file(ptr, size);
+  return pos;
+}
+
+/*
+ * 書き込み
+ */
+
+struct row_writer {
+  unsigned char *buf;
+  unsigned long len;
+  unsigned long size;
+  int error;
+};
+
+static void
+write_bytes(struct row_writer *rw, const void *p, unsigned long len)
+{
+  if (!len) {
+    return ;
+  }
+  if (rw->len + len > rw->size) {
+    unsigned long size = rw->size ? rw->size : 256;
+    unsigned char *b;
+    while (size < rw->len + len) {
+      size *= 2;
+    }
+    b = realloc(rw->buf, size);
+    if (!b) {
+      rw->error = 1;
+      return ;
+    }
+    rw->buf = b;
+    rw->size = size;
+  }
+  memcpy(rw->buf + rw->len, p, len);
+  rw->len += len;
+}
+
+static void
+write_byte(struct row_writer *rw, int v)
+{
+  unsigned char c = v;
+  write_bytes(rw, &c, 1);
+}
+
+static void
+write_u16(struct row_writer *rw, int v)
+{
+  unsigned char b[2];
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+  write_bytes(rw, b, 2);
+}
+
+static void
+write_varint(struct row_writer *rw, int v)
+{
+  /* zigzag */
+  unsigned long u = v < 0 ? ((unsigned long)(-(v + 1)) << 1) | 1 :
+    (unsigned long)v << 1;
+  u &= 0xffffffffUL;
+  while (u >= 0x80) {
+    write_byte(rw, (u & 0x7f) | 0x80);
+    u >>= 7;
+  }
+  write_byte(rw, u);
+}
+
+static void
+write_str(struct row_writer *rw, const char *s)
+{
+  size_t len = s ? strlen(s) : 0;
+  if (len > 0xffff) {
+    rw->error = 1;
+    return ;
+  }
+  write_u16(rw, len);
+  write_bytes(rw, s, len);
+}
+
+/*
+ * ファイルが空であればヘッダを書く
+ * 追記する前に呼ぶ
+ * @return 失敗すれば-1
+ */
+int
+anthy_record_bin_begin(FILE *fp)
+{
+  unsigned char header[RECORD_BIN_HEADER_SIZE];
+  if (fseek(fp, 0, SEEK_END) < 0) {
+    return -1;
+  }
+  if (ftell(fp) > 0) {
+    return 0;
+  }
+  memcpy(header, RECORD_BIN_MAGIC, RECORD_BIN_MAGIC_LEN);
+  put_u32(header + RECORD_BIN_MAGIC_LEN, RECORD_BIN_VERSION);
+  if (fwrite(header, 1, RECORD_BIN_HEADER_SIZE, fp) < RECORD_BIN_HEADER_SIZE) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * 1行を書き出す
+ * row->sectionがNULLなら前の行と同じセクションとする
+ * 長さとチェックサムと内容を一度に書くので、
+ * 追記の途中で中断されても前の行までは壊れない
+ * @return 失敗すれば-1
+ */
+int
+anthy_record_bin_write_row(FILE *fp, struct record_bin_row *row)
+{
+  struct row_writer rw;
+  unsigned char *p;
+  int i, r = 0;
+
+  rw.buf = NULL;
+  rw.len = 0;
+  rw.size = 0;
+  rw.error = 0;
+  /* 長さとチェックサムは後で埋める */
+  write_bytes(&rw, "\0\0\0\0\0\0\0\0", ROW_HEADER_SIZE);
+  write_byte(&rw, row->op);
+  write_byte(&rw, row->flags);
+  write_str(&rw, row->section);
+  write_str(&rw, row->key);
+  write_u16(&rw, row->nr_vals);
+  for (i = 0; i < row->nr_vals; i++) {
+    struct record_bin_val *v = &row->vals[i];
+    write_byte(&rw, v->type);
+    if (v->type == RB_VAL_NUM) {
+      write_varint(&rw, v->num);
+    } else if (v->type == RB_VAL_STR) {
+      write_str(&rw, v->str);
+    }
+  }
+  if (rw.error || row->nr_vals > 0xffff) {
+    free(rw.buf);
+    return -1;
+  }
+
+  p = rw.buf;
+  put_u32(p, rw.len - ROW_HEADER_SIZE);
+  put_u32(p + 4, checksum(p + ROW_HEADER_SIZE, rw.len - ROW_HEADER_SIZE));
+  if (fwrite(p, 1, rw.len, fp) < rw.len) {
+    r = -1;
+  }
+  free(rw.buf);
+  return r;
+}
+
+/*
+ * 壊れた行の手前でファイルを切り詰める
+ * 返り値: 成功なら0
+ */
+int
+anthy_record_bin_truncate(const char *fn, long size)
+{
+#ifndef _WIN32
+  return truncate(fn, size);
+#else
+  int r, fd = _open(fn, _O_RDWR | _O_BINARY);
+  if (fd == -1) {
+    return -1;
+  }
+  r = _chsize(fd, size);
+  _close(fd);
+  return r;
+#endif
+}
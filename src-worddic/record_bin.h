@@ -0,0 +1,46 @@
+/*
+ * 学習データのバイナリ形式の読み書き
+ * record.cから使われる
+ */
+#ifndef _record_bin_h_included_
+#define _record_bin_h_included_
+
+#include <stdio.h>
+
+/* 行に対する操作 */
+#define RB_OP_ADD 1
+#define RB_OP_DEL 2
+
+/* 値の型 */
+#define RB_VAL_EMPTY 0
+#define RB_VAL_NUM 1
+#define RB_VAL_STR 2
+
+struct record_bin_val {
+  int type;
+  int num;
+  /* UTF-8の文字列 */
+  const char *str;
+};
+
+struct record_bin_row {
+  int op;
+  /* LRUのフラグ */
+  int flags;
+  /* 書き込み時にNULLなら前の行と同じセクション */
+  const char *section;
+  /* UTF-8の文字列 */
+  const char *key;
+  int nr_vals;
+  struct record_bin_val *vals;
+  /* ファイル中の行の位置(読み込み時のみ) */
+  long offset;
+};
+
+long anthy_record_bin_read(const char *fn, long offset, void *data,
+			   void (*func)(void *, struct record_bin_row *));
+int anthy_record_bin_begin(FILE *fp);
+int anthy_record_bin_write_row(FILE *fp, struct record_bin_row *row);
+int anthy_record_bin_truncate(const char *fn, long size);
+
+#endif
@@ -28,6 +28,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifndef _WIN32
   #include <unistd.h>
 #else
@@ -37,9 +39,41 @@
 #endif
 
 #include "anthy/textdic.h"
+#include "anthy/thread.h"
 
 #define BUFSIZE 1024
 
+/*
+ * In-memory index of a text dictionary.
+ *
+ * The whole file is read once and its lines are sorted by the key
+ * (column 0), so that a lookup does not have to scan the file.  The
+ * index is rebuilt when the file is modified, either by
+ * anthy_textdic_insert_line/anthy_textdic_delete_line or by another
+ * process (detected by the mtime and the size of the file).
+ */
+struct textdic_line {
+  const char *key;
+  const char *value;
+};
+
+struct textdic_index {
+  char *name;
+  time_t mtime;
+  off_t size;
+  /* contents of the file, columns are NUL terminated */
+  char *buf;
+  struct textdic_line *lines;
+  int nr_lines;
+  /* the index is freed when it is removed from the list and unused */
+  int ref_count;
+  struct textdic_index *next;
+};
+
+/* indices of text dictionaries, shared among threads */
+static struct textdic_index *index_list;
+static anthy_mutex_t index_lock = ANTHY_MUTEX_INITIALIZER;
+
 int
 anthy_textdic_scan (const char *name, long offset, void *data,
 		    int (*func)(void *, long, const char *, const char *))
@@ -100,6 +134,265 @@ anthy_textdic_scan (const char *name, long offset, void *data,
 }
 
 
+static int
+line_compare (const void *p1, const void *p2)
+{
+  const struct textdic_line *l1 = p1;
+  const struct textdic_line *l2 = p2;
+  int r = strcmp (l1->key, l2->key);
+
+  if (r)
+    return r;
+  /* keep the order in the file for the same key */
+  if (l1->key < l2->key)
+    return -1;
+  return l1->key > l2->key;
+}
+
+/*
+ * Split each line into two columns in the same way as
+ * anthy_textdic_scan, and sort them.
+ */
+static int
+build_index (struct textdic_index *ti)
+{
+  char *p = ti->buf, *end = ti->buf + ti->size;
+  int nr = 0;
+
+  for (; p < end; p++)
+    if (*p == '\n')
+      nr++;
+  ti->lines = malloc (sizeof (struct textdic_line) * (nr + 1));
+  if (!ti->lines)
+    return -1;
+
+  ti->nr_lines = 0;
+  for (p = ti->buf; p < end; )
+    {
+      char *eol = memchr (p, '\n', end - p);
+      char *column1 = NULL, *end_of_column0;
+
+      if (!eol)
+	eol = end;
+      *eol = '\0';
+      end_of_column0 = strchr (p, ' ');
+      if (end_of_column0)
+	{
+	  for (column1 = end_of_column0; *column1 == ' '; column1++)
+	    ;
+	  if (*column1 == '\0')
+	    column1 = NULL;
+	}
+      if (column1)
+	{
+	  *end_of_column0 = '\0';
+	  ti->lines[ti->nr_lines].key = p;
+	  ti->lines[ti->nr_lines].value = column1;
+	  ti->nr_lines++;
+	}
+      p = eol + 1;
+    }
+
+  qsort (ti->lines, ti->nr_lines, sizeof (struct textdic_line), line_compare);
+  return 0;
+}
+
+static void
+free_index (struct textdic_index *ti)
+{
+  free (ti->name);
+  free (ti->buf);
+  free (ti->lines);
+  free (ti);
+}
+
+static void
+unref_index (struct textdic_index *ti)
+{
+  int unused;
+
+  anthy_mutex_lock (&index_lock);
+  ti->ref_count--;
+  unused = (ti->ref_count == 0);
+  anthy_mutex_unlock (&index_lock);
+  if (unused)
+    free_index (ti);
+}
+
+/* remove the index from the list. must be called with index_lock held */
+static struct textdic_index *
+detach_index (const char *name)
+{
+  struct textdic_index **p, *ti;
+
+  for (p = &index_list; *p; p = &(*p)->next)
+    if (!strcmp ((*p)->name, name))
+      {
+	ti = *p;
+	*p = ti->next;
+	ti->ref_count--;
+	if (ti->ref_count == 0)
+	  return ti;
+	return NULL;
+      }
+  return NULL;
+}
+
+static void
+invalidate_index (const char *name)
+{
+  struct textdic_index *ti;
+
+  anthy_mutex_lock (&index_lock);
+  ti = detach_index (name);
+  anthy_mutex_unlock (&index_lock);
+  if (ti)
+    free_index (ti);
+}
+
+static struct textdic_index *
+load_index (const char *name, struct stat *st)
+{
+  struct textdic_index *ti;
+  FILE *fp;
+
+  ti = calloc (1, sizeof (struct textdic_index));
+  if (!ti)
+    return NULL;
+  ti->name = strdup (name);
+  ti->mtime = st->st_mtime;
+  ti->size = st->st_size;
+  ti->buf = malloc (ti->size + 1);
+  if (!ti->name || !ti->buf)
+    {
+      free_index (ti);
+      return NULL;
+    }
+
+  fp = fopen (name, "rb");
+  if (!fp)
+    {
+      free_index (ti);
+      return NULL;
+    }
+  ti->size = fread (ti->buf, 1, ti->size, fp);
+  fclose (fp);
+  ti->buf[ti->size] = '\0';
+
+  if (build_index (ti) < 0)
+    {
+      free_index (ti);
+      return NULL;
+    }
+  return ti;
+}
+
+/*
+ * Get the index of the file, building it if it does not exist or
+ * is out of date.  The caller has to unref_index it.
+ */
+static struct textdic_index *
+get_index (const char *name)
+{
+  struct textdic_index *ti, *stale;
+  struct stat st;
+
+  if (stat (name, &st) < 0)
+    {
+      invalidate_index (name);
+      return NULL;
+    }
+
+  anthy_mutex_lock (&index_lock);
+  for (ti = index_list; ti; ti = ti->next)
+    if (!strcmp (ti->name, name))
+      break;
+  if (ti && ti->mtime == st.st_mtime && ti->size == st.st_size)
+    {
+      ti->ref_count++;
+      anthy_mutex_unlock (&index_lock);
+      return ti;
+    }
+  anthy_mutex_unlock (&index_lock);
+
+  /* read the file without holding the lock */
+  ti = load_index (name, &st);
+  if (!ti)
+    return NULL;
+  /* one for the list and one for the caller */
+  ti->ref_count = 2;
+
+  anthy_mutex_lock (&index_lock);
+  stale = detach_index (name);
+  ti->next = index_list;
+  index_list = ti;
+  anthy_mutex_unlock (&index_lock);
+  if (stale)
+    free_index (stale);
+  return ti;
+}
+
+/*
+ * Look up KEYS, which have to be sorted by strcmp, in the text
+ * dictionary NAME, and call FUNC with the index of the key and
+ * column 1 of each line found.
+ *
+ * @return If failed, -1.
+ */
+int
+anthy_textdic_gang_lookup (const char *name, int nr, const char **keys,
+			   void *data,
+			   void (*func)(void *, int, const char *))
+{
+  struct textdic_index *ti;
+  int i, lo = 0;
+
+  ti = get_index (name);
+  if (!ti)
+    return -1;
+
+  for (i = 0; i < nr; i++)
+    {
+      int hi = ti->nr_lines;
+
+      /* the keys are sorted, so the lower bound never goes back */
+      while (lo < hi)
+	{
+	  int mid = (lo + hi) / 2;
+
+	  if (strcmp (ti->lines[mid].key, keys[i]) < 0)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      for (hi = lo;
+	   hi < ti->nr_lines && !strcmp (ti->lines[hi].key, keys[i]);
+	   hi++)
+	func (data, i, ti->lines[hi].value);
+    }
+
+  unref_index (ti);
+  return 0;
+}
+
+/* Free all the indices. */
+void
+anthy_textdic_free_index (void)
+{
+  struct textdic_index *ti, *next;
+
+  anthy_mutex_lock (&index_lock);
+  ti = index_list;
+  index_list = NULL;
+  anthy_mutex_unlock (&index_lock);
+  for (; ti; ti = next)
+    {
+      next = ti->next;
+      unref_index (ti);
+    }
+}
+
+
 /**
  * Open a temporary file to be able to convert file contents.
  * @param orig_filename  the original file.
@@ -210,6 +503,7 @@ do_textdic_at (const char *name, long offset, void *data,
 
   rename (filename, name);
   free (filename);
+  invalidate_index (name);
   return 0;
 
  error_file:
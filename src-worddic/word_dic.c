@@ -35,6 +35,7 @@
 #include <anthy/xchar.h>
 #include <anthy/feature_set.h>
 #include <anthy/textdic.h>
+#include <anthy/thread.h>
 
 #include <anthy/diclib.h>
 
@@ -50,9 +51,25 @@ static int dic_init_count;
 static struct word_dic *master_dic_file;
 
 /* 各パーソナリティごとの辞書 */
-struct mem_dic *anthy_current_personal_dic_cache;/* キャッシュ */
+static const char *personality_id;
+static struct mem_dic *personality_dic_cache;
+static struct record_stat *personality_record;
+
+/* セッションの辞書のキャッシュの大きさの上限(KB)のデフォルト */
+#define DEFAULT_DIC_CACHE_SIZE 2048
+
+/* 変換コンテキストごとの辞書 */
+struct dic_session {
+  /* キャッシュ */
+  struct mem_dic *md;
+  /* キャッシュを作った時の個人辞書の状態 */
+  unsigned long priv_dic_stamp;
+};
+
+/* このスレッドでactivateされている辞書 */
+ANTHY_THREAD_LOCAL struct mem_dic *anthy_current_personal_dic_cache;/* キャッシュ */
 /**/
-struct record_stat *anthy_current_record;
+ANTHY_THREAD_LOCAL struct record_stat *anthy_current_record;
 
 struct seq_ent *
 anthy_validate_seq_ent(struct seq_ent *seq, xstr *xs, int is_reverse)
@@ -61,9 +78,8 @@ anthy_validate_seq_ent(struct seq_ent *seq, xstr *xs, int is_reverse)
     return NULL;
   }
   if (seq->nr_dic_ents == 0 && seq->nr_compound_ents == 0) {
-    /* 無効なエントリを作成したのでcacheから削除 */
-    anthy_mem_dic_release_seq_ent(anthy_current_personal_dic_cache,
-				  xs, is_reverse);
+    /* 辞書に無い読みであることを覚えておくために、
+     * 単語の無いエントリもcacheに残す */
     return NULL;
   }
 
@@ -73,16 +89,7 @@ anthy_validate_seq_ent(struct seq_ent *seq, xstr *xs, int is_reverse)
 struct seq_ent *
 anthy_cache_get_seq_ent(xstr *xs, int is_reverse)
 {
-  struct seq_ent *seq;
-
-  /* キャッシュ中に既にあればそれを返す */
-  seq = anthy_mem_dic_find_seq_ent_by_xstr(anthy_current_personal_dic_cache,
-					   xs, is_reverse);
-  if (seq) {
-    return seq;
-  }
-
-  /* キャッシュ中に無いので確保 */
+  /* キャッシュ中に既にあればそれを返し、無ければ確保する */
   return anthy_mem_dic_alloc_seq_ent_by_xstr(anthy_current_personal_dic_cache,
 					     xs, is_reverse);
 }
@@ -168,32 +175,165 @@ anthy_get_seq_ent_from_xstr(xstr *xs, int is_reverse)
 }
 
 
-static void
-gang_elm_dtor(void *p)
+/* gang lookupで検索する部分文字列はこの長さ未満 */
+#define GANG_MAX_LEN 32
+
+/*
+ * 文の部分文字列を重複無しで集めた集合
+ * 重複はopen addressingのハッシュで取り除き、
+ * キーの文字列(UTF-8)は一つの領域(arena)にまとめて確保する
+ */
+struct gang_set {
+  /* 要素の実体 */
+  struct gang_elm *elms;
+  int nr;
+  /* ハッシュ表 */
+  struct gang_elm **hash;
+  unsigned int hash_mask;
+  /* キーの文字列 */
+  char *arena;
+  int arena_used;
+};
+
+static int
+xchar_utf8_len(xchar xc)
 {
-  struct gang_elm *ge = (struct gang_elm*) p;
-  free(ge->key);
+  if (xc < 0x80) {
+    return 1;
+  }
+  if (xc < 0x800) {
+    return 2;
+  }
+  if (xc < 0x10000) {
+    return 3;
+  }
+  return 4;
 }
 
-
-// 新しい gang_elm 要素を生成し, head->tmp.next に挿入する.
 static int
-find_gang_elm(allocator ator, struct gang_elm *head, xstr *xs)
+init_gang_set(struct gang_set *gs, xstr *sentence, int *offset)
+{
+  int from, len, nr_max = 0, arena_size = 0;
+  unsigned int hash_size = 1;
+  /* 部分文字列の数と、キーに必要な領域の大きさの上限を求める */
+  for (from = 0; from < sentence->len; from ++) {
+    for (len = 1; len < GANG_MAX_LEN && from + len <= sentence->len; len ++) {
+      nr_max ++;
+      arena_size += offset[from + len] - offset[from] + 1;
+    }
+  }
+  while (hash_size < (unsigned int)nr_max * 2) {
+    hash_size <<= 1;
+  }
+  gs->nr = 0;
+  gs->arena_used = 0;
+  gs->hash_mask = hash_size - 1;
+  gs->elms = malloc(sizeof(struct gang_elm) * (nr_max + 1));
+  gs->hash = calloc(hash_size, sizeof(struct gang_elm *));
+  gs->arena = malloc(arena_size + 1);
+  if (!gs->elms || !gs->hash || !gs->arena) {
+    free(gs->elms);
+    free(gs->hash);
+    free(gs->arena);
+    return -1;
+  }
+  return 0;
+}
+
+static void
+free_gang_set(struct gang_set *gs)
+{
+  free(gs->elms);
+  free(gs->hash);
+  free(gs->arena);
+}
+
+/* 集合に無ければ部分文字列を追加し、集合中の要素を返す */
+static struct gang_elm *
+add_gang_elm(struct gang_set *gs, xstr *xs, unsigned int h,
+	     const char *utf8, int bytes)
 {
-  char *str = anthy_xstr_to_cstr(xs, ANTHY_UTF8_ENCODING);
+  unsigned int i;
   struct gang_elm *ge;
-  for (ge = head->tmp.next; ge; ge = ge->tmp.next) {
-    if (!strcmp(ge->key, str)) {
-      free(str);
-      return 0;
+  for (i = h & gs->hash_mask; gs->hash[i]; i = (i + 1) & gs->hash_mask) {
+    ge = gs->hash[i];
+    if (ge->xs.len == xs->len &&
+	!memcmp(ge->xs.str, xs->str, sizeof(xchar) * xs->len)) {
+      return ge;
     }
   }
-  ge = anthy_smalloc(ator);
+  ge = &gs->elms[gs->nr];
+  gs->nr ++;
   ge->xs = *xs;
-  ge->key = str;
-  ge->tmp.next = head->tmp.next;
-  head->tmp.next = ge;
-  return 1;
+  ge->key = &gs->arena[gs->arena_used];
+  memcpy(ge->key, utf8, bytes);
+  ge->key[bytes] = 0;
+  gs->arena_used += bytes + 1;
+  gs->hash[i] = ge;
+  return ge;
+}
+
+/* 位置fromから始まる部分文字列の読みのインデックスを読みのtrieから求め、
+ * idx[長さ]に設定する。trieが無ければ-1を返す */
+static int
+find_prefix_words(xstr *sentence, int from, int *idx)
+{
+  int lens[GANG_MAX_LEN], indices[GANG_MAX_LEN];
+  int i, nr;
+  xstr xs;
+  xs.str = &sentence->str[from];
+  xs.len = sentence->len - from;
+  if (xs.len > GANG_MAX_LEN - 1) {
+    xs.len = GANG_MAX_LEN - 1;
+  }
+  nr = anthy_word_dic_prefix_search(master_dic_file, &xs, lens, indices);
+  if (nr < 0) {
+    return -1;
+  }
+  for (i = 0; i < GANG_MAX_LEN; i++) {
+    idx[i] = NO_WORD;
+  }
+  for (i = 0; i < nr; i++) {
+    idx[lens[i]] = indices[i];
+  }
+  return 0;
+}
+
+/* 文の部分文字列を列挙し、重複を除いて集合に入れる
+ * NULを含む部分文字列は入れない
+ * 辞書に読みのtrieがあれば各要素のtmp.idxに読みのインデックスを設定して0を、
+ * 無ければ-1を返す
+ */
+static int
+collect_gang_elms(struct gang_set *gs, xstr *sentence,
+		  const char *utf8, int *offset)
+{
+  int idx[GANG_MAX_LEN];
+  int from, len, has_trie = 1;
+  for (from = 0; from < sentence->len; from ++) {
+    /* 先頭が同じ部分文字列のハッシュ値は1文字ずつ伸ばしながら計算する */
+    unsigned int h = 2166136261u;
+    if (has_trie && find_prefix_words(sentence, from, idx)) {
+      has_trie = 0;
+    }
+    for (len = 1; len < GANG_MAX_LEN && from + len <= sentence->len; len ++) {
+      struct gang_elm *ge;
+      xstr xs;
+      if (!sentence->str[from + len - 1]) {
+	/* NULを含む部分文字列はキーにできないので、そこで止める */
+	break;
+      }
+      h = (h ^ (unsigned int)sentence->str[from + len - 1]) * 16777619u;
+      xs.str = &sentence->str[from];
+      xs.len = len;
+      ge = add_gang_elm(gs, &xs, h, &utf8[offset[from]],
+			offset[from + len] - offset[from]);
+      if (has_trie) {
+	ge->tmp.idx = idx[len];
+      }
+    }
+  }
+  return has_trie ? 0 : -1;
 }
 
 static int
@@ -204,14 +344,6 @@ gang_elm_compare_func(const void *p1, const void *p2)
   return strcmp((*s1)->key, (*s2)->key);
 }
 
-struct gang_scan_context {
-  /**/
-  int nr;
-  struct gang_elm **array;
-  /**/
-  int nth;
-};
-
 static int
 is_ext_ent(struct seq_ent *seq)
 {
@@ -260,43 +392,31 @@ load_word(xstr *xs, const char *n, int is_reverse)
   anthy_free_xstr(word_xs);
 }
 
-static int
-gang_scan(void *p, long offset, const char *key, const char *n)
-{
-  struct gang_scan_context *gsc = (struct gang_scan_context*) p;
-  struct gang_elm *elm;
-  int r;
-  (void)offset;
-  while (1) {
-    if (gsc->nth >= gsc->nr) {
-      return 0;
-    }
-    elm = gsc->array[gsc->nth];
-    r = strcmp(elm->key, key);
-    if (r == 0) {
-      /* find it */
-      load_word(&elm->xs, n, 0);
-      /* go next in dictionary */
-      return 0;
-    } else if (r > 0) {
-      /* go next in dictionary */
-      return 0;
-    } else {
-      /* go next in lookup */
-      gsc->nth ++;
-    }
-  }
-  return 0;
+static void
+gang_lookup(void *p, int nth, const char *n)
+{
+  struct gang_elm **array = (struct gang_elm **)p;
+  load_word(&array[nth]->xs, n, 0);
 }
 
+/* 読みでソートされた索引を引くので、ファイル全体を走査しない */
 static void
 scan_dict(const char *td, int nr, struct gang_elm **array)
 {
-  struct gang_scan_context gsc;
-  gsc.nr = nr;
-  gsc.array = array;
-  gsc.nth = 0;
-  anthy_textdic_scan(td, 0, &gsc, gang_scan);
+  const char **keys;
+  int i;
+  if (nr == 0) {
+    return ;
+  }
+  keys = malloc(sizeof(char *) * nr);
+  if (!keys) {
+    return ;
+  }
+  for (i = 0; i < nr; i++) {
+    keys[i] = array[i]->key;
+  }
+  anthy_textdic_gang_lookup(td, nr, keys, array, gang_lookup);
+  free(keys);
 }
 
 struct scan_arg {
@@ -311,35 +431,80 @@ request_scan(const char *tdname, void *arg)
   scan_dict(tdname, sarg->nr, sarg->array);
 }
 
+/* 全ての辞書から読み込み済みの読みか */
+static int
+is_loaded(xstr *xs, int is_reverse)
+{
+  struct seq_ent *seq;
+  seq = anthy_mem_dic_find_seq_ent_by_xstr(anthy_current_personal_dic_cache,
+					   xs, is_reverse);
+  return seq && (seq->seq_type & ST_LOADED);
+}
+
+static void
+mark_loaded(struct gang_elm **array, int nr, int is_reverse)
+{
+  int i;
+  for (i = 0; i < nr; i++) {
+    struct seq_ent *seq;
+    seq = anthy_mem_dic_find_seq_ent_by_xstr(anthy_current_personal_dic_cache,
+					     &array[i]->xs, is_reverse);
+    if (seq) {
+      seq->seq_type |= ST_LOADED;
+    }
+  }
+}
+
 static void
 do_gang_load_dic(xstr *sentence, int is_reverse)
 {
-  allocator ator = anthy_create_allocator(sizeof(struct gang_elm),
-					  gang_elm_dtor);
-  int from, len;
-  xstr xs;
-  int i, nr;
-  struct gang_elm head;
-  struct gang_elm **array, *cur;
+  struct gang_set gs;
+  struct gang_elm **array;
   struct scan_arg sarg;
-  head.tmp.next = NULL;
-  nr = 0;
-  for (from = 0; from < sentence->len ; from ++) {
-    for (len = 1; len < 32 && from + len <= sentence->len; len ++) {
-      xs.str = &sentence->str[from];
-      xs.len = len;
-      nr += find_gang_elm(ator, &head, &xs);
-    }
+  char *utf8;
+  int *offset;
+  int i, nr, has_trie;
+
+  /* 各文字がUTF-8の文字列の何バイト目から始まるか */
+  utf8 = anthy_xstr_to_cstr(sentence, ANTHY_UTF8_ENCODING);
+  offset = malloc(sizeof(int) * (sentence->len + 1));
+  if (!utf8 || !offset) {
+    free(utf8);
+    free(offset);
+    return ;
   }
-  array = (struct gang_elm**) malloc(sizeof(struct gang_elm*) * nr);
-  cur = head.tmp.next;
-  for (i = 0; i < nr; i++) {
-    array[i] = cur;
-    cur = cur->tmp.next;
+  offset[0] = 0;
+  for (i = 0; i < sentence->len; i++) {
+    offset[i + 1] = offset[i] + xchar_utf8_len(sentence->str[i]);
+  }
+  if (init_gang_set(&gs, sentence, offset)) {
+    free(utf8);
+    free(offset);
+    return ;
+  }
+  has_trie = !collect_gang_elms(&gs, sentence, utf8, offset);
+  free(utf8);
+  free(offset);
+
+  array = (struct gang_elm**) malloc(sizeof(struct gang_elm*) * (gs.nr + 1));
+  if (!array) {
+    free_gang_set(&gs);
+    return ;
+  }
+  /* 以前の変換で読み込んだものはキャッシュに残っている */
+  for (i = 0, nr = 0; i < gs.nr; i++) {
+    if (!is_loaded(&gs.elms[i].xs, is_reverse)) {
+      array[nr] = &gs.elms[i];
+      nr ++;
+    }
   }
   qsort(array, nr, sizeof(struct gang_elm *), gang_elm_compare_func);
-  /**/
-  anthy_gang_fill_seq_ent(master_dic_file, array, nr, is_reverse);
+  if (has_trie) {
+    /* 読みのインデックスは求めてあるので、単語を読み込むだけでよい */
+    anthy_gang_load_words(master_dic_file, array, nr, is_reverse);
+  } else {
+    anthy_gang_fill_seq_ent(master_dic_file, array, nr, is_reverse);
+  }
   /**/
   scan_misc_dic(array, nr, is_reverse);
   /* 個人辞書から読む */
@@ -347,8 +512,9 @@ do_gang_load_dic(xstr *sentence, int is_reverse)
   sarg.array = array;
   anthy_ask_scan(request_scan, (void *)&sarg);
   /**/
+  mark_loaded(array, nr, is_reverse);
   free(array);
-  anthy_free_allocator(ator);
+  free_gang_set(&gs);
 }
 
 void
@@ -683,26 +849,84 @@ anthy_unlock_dic(void)
 dic_session_t
 anthy_dic_create_session(void)
 {
-  return anthy_create_mem_dic();
+  struct dic_session *d;
+
+  d = malloc(sizeof(*d));
+  if (!d) {
+    return NULL;
+  }
+  d->md = anthy_create_mem_dic();
+  d->priv_dic_stamp = anthy_get_private_dic_stamp();
+  return d;
 }
 
 void
 anthy_dic_activate_session(dic_session_t d)
 {
-  anthy_current_personal_dic_cache = d;
+  if (!d) {
+    anthy_current_personal_dic_cache = personality_dic_cache;
+    anthy_current_record = personality_record;
+    return ;
+  }
+  anthy_current_personal_dic_cache = d->md;
+  anthy_current_record = personality_record;
+}
+
+/* キャッシュの大きさの上限をバイト数で返す */
+static long
+get_dic_cache_limit(void)
+{
+  const char *val = anthy_conf_get_str("DIC_CACHE_SIZE");
+  if (!val) {
+    return DEFAULT_DIC_CACHE_SIZE * 1024L;
+  }
+  return atol(val) * 1024L;
+}
+
+int
+anthy_dic_session_is_stale(dic_session_t d)
+{
+  return anthy_get_private_dic_stamp() != d->priv_dic_stamp;
+}
+
+void
+anthy_dic_flush_session(dic_session_t d)
+{
+  unsigned long stamp = anthy_get_private_dic_stamp();
+
+  if (stamp != d->priv_dic_stamp) {
+    /* 個人辞書が変わったので、キャッシュの内容は全て古い */
+    anthy_mem_dic_trim(d->md, 0);
+    d->priv_dic_stamp = stamp;
+    return ;
+  }
+  /* 次の変換のために、最近使われた読みは上限まで残しておく */
+  anthy_mem_dic_trim(d->md, get_dic_cache_limit());
+}
+
+void
+anthy_dic_get_session_stat(dic_session_t d, struct anthy_dic_cache_stat *st)
+{
+  anthy_mem_dic_get_stat(d ? d->md : personality_dic_cache, st);
 }
 
 void
 anthy_dic_release_session(dic_session_t d)
 {
-  anthy_release_mem_dic(d);
+  if (anthy_current_personal_dic_cache == d->md) {
+    anthy_dic_activate_session(NULL);
+  }
+  anthy_release_mem_dic(d->md);
+  free(d);
 }
 
 void
 anthy_dic_set_personality(const char *id)
 {
-  anthy_current_record = anthy_create_record(id);
-  anthy_current_personal_dic_cache = anthy_create_mem_dic();
+  personality_id = id;
+  personality_record = anthy_create_record(id);
+  personality_dic_cache = anthy_create_mem_dic();
+  anthy_dic_activate_session(NULL);
   anthy_init_private_dic(id);
 }
 
@@ -745,11 +969,17 @@ anthy_quit_dic(void)
   if (dic_init_count) {
     return;
   }
-  if (anthy_current_record) {
-    anthy_release_record(anthy_current_record);
+  if (personality_record) {
+    anthy_release_record(personality_record);
   }
   anthy_release_private_dic();
+  anthy_textdic_free_index();
+  anthy_quit_ext_ent();
+  personality_id = NULL;
+  personality_record = NULL;
+  personality_dic_cache = NULL;
   anthy_current_record = NULL;
+  anthy_current_personal_dic_cache = NULL;
   anthy_quit_mem_dic();
   anthy_quit_diclib();
 }
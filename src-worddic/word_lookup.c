@@ -53,14 +53,18 @@
 #include <anthy/logger.h>
 #include <anthy/xstr.h>
 #include <anthy/diclib.h>
+#include <anthy/thread.h>
 
 #include "dic_main.h"
 #include "dic_ent.h"
 
-#define NO_WORD -1
-
 static allocator word_dic_ator;
 
+/* 共有キャッシュの大きさの上限(バイト)、超えたら各コンテキストで読み込む */
+#define SHARED_CACHE_LIMIT (32 * 1024 * 1024)
+/* 共有キャッシュを保護する */
+static anthy_rwlock_t shared_cache_lock = ANTHY_RWLOCK_INITIALIZER;
+
 struct lookup_context {
   struct gang_elm **array;
   int nr;
@@ -394,6 +398,14 @@ mkxstr(char *s, xstr *x)
   int i, len;
   /* s[0]には巻き戻しの文字数 */
   x->len -= (s[0] - 1);
+  /* 印字可能なバイトの並びをまとめて変換する */
+  for (i = 1; is_printable(&s[i]); i ++);
+  len = anthy_utf8_to_ucs4(&s[1], i - 1, &x->str[x->len]);
+  if (len >= 0) {
+    x->len += len;
+    return i;
+  }
+  /* 不正なバイト列なので1文字ずつ変換する */
   for (i = 1; is_printable(&s[i]); i ++) {
     len = mb_fragment_len(&s[i]);
     if (len > 1) {
@@ -423,9 +435,23 @@ set_next_idx(struct lookup_context *lc)
   return 0;
 }
 
+static int compare_page_key(struct word_dic *wdic, struct gang_elm *ge,
+			    int page);
+
+/* 次に探す単語が次のページ以降にあることが分かるか */
+static int
+is_beyond_page(struct word_dic *wdic, struct lookup_context *lc, int page)
+{
+  if (!wdic->page_key || page + 1 >= wdic->nr_pages) {
+    return 0;
+  }
+  return compare_page_key(wdic, lc->array[lc->nth], page + 1) >= 0;
+}
+
 /** ページ中の単語の場所を調べる */
 static void
-search_words_in_page(struct lookup_context *lc, int page, char *s)
+search_words_in_page(struct word_dic *wdic, struct lookup_context *lc,
+		     int page, char *s)
 {
   int o = 0;
   xchar *buf;
@@ -439,11 +465,19 @@ search_words_in_page(struct lookup_context *lc, int page, char *s)
   while (*s) {
     int r;
     s += mkxstr(s, &xs);
-    r = anthy_xstrcmp(&xs, &lc->array[lc->nth]->xs);
+    /* ページ中の単語も探す単語も読みの順に並んでいるので、
+     * ページ中の単語より小さい単語は辞書に無い */
+    while ((r = anthy_xstrcmp(&xs, &lc->array[lc->nth]->xs)) > 0) {
+      lc->array[lc->nth]->tmp.idx = NO_WORD;
+      nr ++;
+      if (!set_next_idx(lc) || is_beyond_page(wdic, lc, page)) {
+	return ;
+      }
+    }
     if (!r) {
       lc->array[lc->nth]->tmp.idx = o + page * WORDS_PER_PAGE;
       nr ++;
-      if (!set_next_idx(lc)) {
+      if (!set_next_idx(lc) || is_beyond_page(wdic, lc, page)) {
 	return ;
       }
       /* 同じページ内で次の単語を探す */
@@ -463,7 +497,8 @@ static int
 compare_page_index(struct word_dic *wdic, const char *key, int page)
 {
   char buf[100];
-  char *s = &wdic->page[anthy_dic_ntohl(wdic->page_index[page])];
+  char *s = &wdic->page[anthy_dic_to_host(wdic->page_index[page],
+					  wdic->swap)];
   int i;
   s++;
   for (i = 0; is_printable(&s[i]);) {
@@ -497,6 +532,50 @@ get_page_index_search(struct word_dic *wdic, const char *key, int f, int t)
   } 
 }
 
+/* ページの先頭の読みの表(page key)を使ってgeとページの先頭の読みを比べる */
+static int
+compare_page_key(struct word_dic *wdic, struct gang_elm *ge, int page)
+{
+  const int *pk = &wdic->page_key[2 + page * (wdic->page_key_width + 1)];
+  int len = anthy_dic_to_host(pk[0], wdic->swap);
+  int i, m;
+
+  m = len < ge->xs.len ? len : ge->xs.len;
+  if (m > wdic->page_key_width) {
+    m = wdic->page_key_width;
+  }
+  for (i = 0; i < m; i++) {
+    xchar xc = anthy_dic_to_host(pk[i + 1], wdic->swap);
+    if (ge->xs.str[i] != xc) {
+      return ge->xs.str[i] < xc ? -1 : 1;
+    }
+  }
+  if (len > wdic->page_key_width && ge->xs.len >= wdic->page_key_width) {
+    /* 切り詰められた部分までは同じなので、ページの内容と比べる */
+    return compare_page_index(wdic, ge->key, page);
+  }
+  return ge->xs.len - len;
+}
+
+/* 読みがgeより大きくない最後のページをpage keyの表から探す */
+static int
+get_page_index_by_key(struct word_dic *wdic, struct gang_elm *ge)
+{
+  int base = 0;
+  int n = wdic->nr_pages;
+  if (compare_page_key(wdic, ge, 0) < 0) {
+    return -1;
+  }
+  while (n > 1) {
+    int half = n / 2;
+    if (compare_page_key(wdic, ge, base + half) >= 0) {
+      base += half;
+    }
+    n -= half;
+  }
+  return base;
+}
+
 /** keyを含む可能性のあるページの番号を得る、
  * 範囲チェックをしてバイナリサーチを行うget_page_index_searchを呼ぶ
  */
@@ -505,6 +584,9 @@ get_page_index(struct word_dic *wdic, struct lookup_context *lc)
 {
   int page;
   const char *key = lc->array[lc->nth]->key;
+  if (wdic->page_key) {
+    return get_page_index_by_key(wdic, lc->array[lc->nth]);
+  }
   /* 最初のページの読みよりも小さい */
   if (compare_page_index(wdic, key, 0) < 0) {
     return -1;
@@ -522,7 +604,7 @@ static int
 get_nr_page(struct word_dic *h)
 {
   int i;
-  for (i = 1; anthy_dic_ntohl(h->page_index[i]); i++);
+  for (i = 1; anthy_dic_to_host(h->page_index[i], h->swap); i++);
   return i;
 }
 
@@ -530,7 +612,7 @@ static char *
 get_section(struct word_dic *wdic, int section)
 {
   int *p = (int *)wdic->dic_file;
-  int offset = anthy_dic_ntohl(p[section]);
+  int offset = anthy_dic_to_host(p[section], wdic->swap);
   return &wdic->dic_file[offset];
 }
 
@@ -544,10 +626,89 @@ get_word_dic_sections(struct word_dic *wdic)
   wdic->page_index = (int *)get_section(wdic, 5);
   wdic->uc_section = (char *)get_section(wdic, 6);
   wdic->hash_ent = (unsigned char *)get_section(wdic, 7);
+  /* 古い辞書にはページの先頭の読みの表が無い */
+  if (((int *)wdic->dic_file)[8]) {
+    wdic->page_key = (int *)get_section(wdic, 8);
+  }
+  /* 読みのtrieも古い辞書には無い */
+  if (((int *)wdic->dic_file)[9]) {
+    wdic->trie = (int *)get_section(wdic, 9);
+  }
 
   return 0;
 }
 
+/* word_dic中のsectionの大きさ、次に置かれたセクションの先頭までとする */
+static size_t
+get_section_size(struct word_dic *wdic, int section)
+{
+  int *p = (int *)wdic->dic_file;
+  size_t start = anthy_dic_to_host(p[section], wdic->swap);
+  size_t end = anthy_file_dic_section_size(ANTHY_DIC_WORD_DIC);
+  int i;
+  for (i = 2; i < 10; i++) {
+    size_t o = anthy_dic_to_host(p[i], wdic->swap);
+    if (p[i] && o > start && o < end) {
+      end = o;
+    }
+  }
+  return end - start;
+}
+
+/*
+ * 単語の本体(エントリとページ)は読みごとにまばらに引くので先読みを止め、
+ * 辞書を引く度に参照する索引とtrieは最初の変換の前に読み込ませておく
+ */
+static void
+advise_word_dic_sections(struct word_dic *wdic)
+{
+  int *p = (int *)wdic->dic_file;
+  int i;
+  for (i = 2; i < 10; i++) {
+    if (p[i]) {
+      anthy_file_dic_advise(get_section(wdic, i), get_section_size(wdic, i),
+			    (i == 3 || i == 4) ?
+			    ANTHY_DIC_RANDOM : ANTHY_DIC_WILL_NEED);
+    }
+  }
+}
+
+/* 読みのtrieが使えるかを確認する */
+static void
+check_trie(struct word_dic *wdic)
+{
+  int nr_units, nr_chars;
+  if (!wdic->trie) {
+    return ;
+  }
+  nr_units = anthy_dic_to_host(wdic->trie[0], wdic->swap);
+  nr_chars = anthy_dic_to_host(wdic->trie[1], wdic->swap);
+  if (nr_units <= 0 || nr_chars < 0) {
+    wdic->trie = NULL;
+    return ;
+  }
+  wdic->trie_nr_units = nr_units;
+  wdic->trie_nr_chars = nr_chars;
+  wdic->trie_chars = &wdic->trie[2];
+  wdic->trie_units = &wdic->trie[2 + nr_chars];
+}
+
+/* ページの先頭の読みの表が使えるかを確認する */
+static void
+check_page_key(struct word_dic *wdic)
+{
+  if (!wdic->page_key) {
+    return ;
+  }
+  if ((int)anthy_dic_to_host(wdic->page_key[0], wdic->swap) !=
+      wdic->nr_pages ||
+      (int)anthy_dic_to_host(wdic->page_key[1], wdic->swap) <= 0) {
+    wdic->page_key = NULL;
+    return ;
+  }
+  wdic->page_key_width = anthy_dic_to_host(wdic->page_key[1], wdic->swap);
+}
+
 /** 指定された単語の辞書中のインデックスを調べる */
 static void
 search_yomi_index(struct word_dic *wdic, struct lookup_context *lc)
@@ -568,8 +729,8 @@ search_yomi_index(struct word_dic *wdic, struct lookup_context *lc)
     return ;
   }
 
-  page_number = anthy_dic_ntohl(wdic->page_index[p]);
-  search_words_in_page(lc, p, &wdic->page[page_number]);
+  page_number = anthy_dic_to_host(wdic->page_index[p], wdic->swap);
+  search_words_in_page(wdic, lc, p, &wdic->page[page_number]);
 }
 
 static void
@@ -597,6 +758,41 @@ find_words(struct word_dic *wdic, struct lookup_context *lc)
   }
 }
 
+/** 共有キャッシュから読みに対応するseq_entを得る
+ * 無ければ辞書のエントリから読み込んで共有キャッシュに加える
+ * 共有キャッシュが一杯ならNULLを返す
+ */
+static struct seq_ent *
+get_shared_seq_ent(struct word_dic *wdic, char *entry,
+		   xstr *xs, int is_reverse)
+{
+  struct anthy_dic_cache_stat st;
+  struct seq_ent *seq;
+
+  anthy_rwlock_rdlock(&shared_cache_lock);
+  seq = anthy_mem_dic_peek_seq_ent_by_xstr(wdic->shared_cache,
+					   xs, is_reverse);
+  anthy_rwlock_rdunlock(&shared_cache_lock);
+  if (seq) {
+    return seq;
+  }
+
+  anthy_rwlock_wrlock(&shared_cache_lock);
+  /* ロックを取り直す間に他のスレッドが読み込んだかもしれない */
+  seq = anthy_mem_dic_peek_seq_ent_by_xstr(wdic->shared_cache,
+					   xs, is_reverse);
+  if (!seq) {
+    anthy_mem_dic_get_stat(wdic->shared_cache, &st);
+    if (st.mem_used < SHARED_CACHE_LIMIT) {
+      seq = anthy_mem_dic_alloc_seq_ent_by_xstr(wdic->shared_cache,
+						xs, is_reverse);
+      fill_dic_ent(entry, seq, xs, is_reverse);
+    }
+  }
+  anthy_rwlock_wrunlock(&shared_cache_lock);
+  return seq;
+}
+
 static void
 load_words(struct word_dic *wdic, struct lookup_context *lc)
 {
@@ -606,19 +802,128 @@ load_words(struct word_dic *wdic, struct lookup_context *lc)
     yomi_index = lc->array[i]->tmp.idx;
     if (yomi_index != NO_WORD) {
       int entry_index;
-      struct seq_ent *seq;
+      struct seq_ent *seq, *shared = NULL;
       seq = anthy_cache_get_seq_ent(&lc->array[i]->xs,
 				    lc->is_reverse);
-      entry_index = anthy_dic_ntohl(wdic->entry_index[yomi_index]);
-      fill_dic_ent(&wdic->entry[entry_index],
-		   seq,
-		   &lc->array[i]->xs,
-		   lc->is_reverse);
+      entry_index = anthy_dic_to_host(wdic->entry_index[yomi_index],
+				      wdic->swap);
+      if (wdic->shared_cache && !seq->nr_dic_ents) {
+	shared = get_shared_seq_ent(wdic, &wdic->entry[entry_index],
+				    &lc->array[i]->xs, lc->is_reverse);
+      }
+      if (shared) {
+	/* 共有キャッシュの単語を参照する */
+	anthy_mem_dic_share_dic_ents(seq, shared);
+      } else {
+	fill_dic_ent(&wdic->entry[entry_index],
+		     seq,
+		     &lc->array[i]->xs,
+		     lc->is_reverse);
+      }
       anthy_validate_seq_ent(seq, &lc->array[i]->xs, lc->is_reverse);
     }
   }
 }
 
+/** word_dic中の各単語の場所を探して、array[]->tmp.idxに設定する
+ * 見つからなかった単語にはNO_WORDを設定する
+ */
+void
+anthy_gang_find_words(struct word_dic *wdic,
+		      struct gang_elm **array, int nr)
+{
+  struct lookup_context lc;
+  lc.array = array;
+  lc.nr = nr;
+  lc.is_reverse = 0;
+  find_words(wdic, &lc);
+}
+
+/* 読みの文字をtrieの遷移に使うコードにする、trieに無い文字なら0を返す */
+static int
+trie_code(struct word_dic *wdic, xchar xc)
+{
+  int lo = 0, hi = wdic->trie_nr_chars;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    xchar c = anthy_dic_to_host(wdic->trie_chars[mid], wdic->swap);
+    if (c == xc) {
+      return mid + 1;
+    }
+    if (c < xc) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
+
+#define TRIE_BASE(wdic, s) \
+  ((int)anthy_dic_to_host((wdic)->trie_units[(s) * 2], (wdic)->swap))
+#define TRIE_CHECK(wdic, s) \
+  ((int)anthy_dic_to_host((wdic)->trie_units[(s) * 2 + 1], (wdic)->swap))
+
+/* ユニットsからコードcで遷移した先、遷移できなければ-1 */
+static int
+trie_next(struct word_dic *wdic, int s, int c)
+{
+  int t = TRIE_BASE(wdic, s) + c;
+  if (t <= 0 || t >= wdic->trie_nr_units || TRIE_CHECK(wdic, t) != s) {
+    return -1;
+  }
+  return t;
+}
+
+/** xsの先頭の部分と一致する読みを読みのtrieから全て探す
+ * 見つかった読みの長さをlens[]に、読みのインデックスをindices[]に短い順に
+ * 格納し、その数を返す。lens[], indices[]にはxs->len個の領域が必要
+ * 辞書にtrieが無い場合は-1を返す
+ */
+int
+anthy_word_dic_prefix_search(struct word_dic *wdic, xstr *xs,
+			     int *lens, int *indices)
+{
+  int i, s = 0, nr = 0;
+  if (!wdic->trie) {
+    return -1;
+  }
+  for (i = 0; i < xs->len; i++) {
+    int c = trie_code(wdic, xs->str[i]);
+    int t;
+    if (!c) {
+      break;
+    }
+    s = trie_next(wdic, s, c);
+    if (s < 0) {
+      break;
+    }
+    /* 終端への遷移があれば、ここまでが読みになっている */
+    t = trie_next(wdic, s, 0);
+    if (t >= 0) {
+      lens[nr] = i + 1;
+      indices[nr] = -TRIE_BASE(wdic, t) - 1;
+      nr ++;
+    }
+  }
+  return nr;
+}
+
+/** 読みのインデックスが分かっている単語をword_dicから読み込む
+ * array[]->tmp.idxには読みのインデックスかNO_WORDを設定しておく
+ */
+void
+anthy_gang_load_words(struct word_dic *wdic,
+		      struct gang_elm **array, int nr,
+		      int is_reverse)
+{
+  struct lookup_context lc;
+  lc.array = array;
+  lc.nr = nr;
+  lc.is_reverse = is_reverse;
+  load_words(wdic, &lc);
+}
+
 /** word_dicから単語を検索する
  * 辞書キャッシュから呼ばれる
  * (gang lookupにすることを検討する)
@@ -648,14 +953,19 @@ anthy_create_word_dic(void)
   memset(wdic, 0, sizeof(*wdic));
 
   /* 辞書ファイルをマップする */
-  wdic->dic_file = anthy_file_dic_get_section("word_dic");
+  wdic->dic_file = anthy_file_dic_section(ANTHY_DIC_WORD_DIC);
+  wdic->swap = anthy_dic_swapped();
 
   /* 各セクションのポインタを取得する */
   if (get_word_dic_sections(wdic) == -1) {
     anthy_sfree(word_dic_ator, wdic);
     return 0;
   }
+  advise_word_dic_sections(wdic);
   wdic->nr_pages = get_nr_page(wdic);
+  check_page_key(wdic);
+  check_trie(wdic);
+  wdic->shared_cache = anthy_create_mem_dic();
 
   /* 用例辞書をマップする */
   return wdic;
@@ -664,6 +974,9 @@ anthy_create_word_dic(void)
 void
 anthy_release_word_dic(struct word_dic *wdic)
 {
+  if (wdic->shared_cache) {
+    anthy_release_mem_dic(wdic->shared_cache);
+  }
   anthy_sfree(word_dic_ator, wdic);
 }
 
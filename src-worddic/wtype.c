@@ -51,6 +51,7 @@ anthy_get_wtype (int pos, int cos, int scos, int cc, int ct, int wf)
 {
   wtype_t w;
 
+  memset(&w, 0, sizeof(w));
   w.pos = pos;
   w.cos = cos;
   w.scos = scos;
@@ -126,15 +127,10 @@ anthy_type_to_wtype(const char *s, wtype_t *t)
 int
 anthy_wtype_equal(wtype_t lhs, wtype_t rhs)
 {
-  union {
-    unsigned int u;
-    wtype_t wt;
-  } l, r;
-
-  l.wt = lhs;
-  r.wt = rhs;
-
-  return (l.u == r.u);
+  /* 使っていないビットの値によらないように、フィールドごとに比べる */
+  return (lhs.pos == rhs.pos && lhs.cos == rhs.cos &&
+	  lhs.scos == rhs.scos && lhs.cc == rhs.cc &&
+	  lhs.ct == rhs.ct && lhs.wf == rhs.wf);
 }
 
 
@@ -0,0 +1,356 @@
+/* 構造体アロケータのマイクロベンチマーク
+ *
+ * 変換一回分に似た使い方(文節分割の度にallocatorを作り、
+ * word_list, meta_word, 遷移状態のノードを大量に確保し、
+ * 枝刈りでノードの一部を解放してから、allocatorごと破棄する)と、
+ * 辞書のキャッシュのように多くのオブジェクトを持ったまま
+ * 確保と解放を繰り返す使い方の時間を計る
+ * 以前のページを線形に探す実装(old_*)と、今の実装を続けて計り、比べる
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <anthy/alloc.h>
+#include <anthy/splitter.h>
+#include <src-splitter/wordborder.h>
+
+#define NR_CONVERSIONS 2000
+#define NR_WORD_LISTS 600
+#define NR_META_WORDS 400
+#define NR_NODES 1500
+#define NR_CACHED 20000
+#define NR_CACHE_OPS 200000
+
+/* 遷移状態のノード(lattice.cのstruct lattice_nodeと同じ大きさ) */
+struct bench_node {
+  int border;
+  int seg_class;
+  double real_probability;
+  double adjusted_probability;
+  struct bench_node *before_node;
+  struct meta_word *mw;
+  struct bench_node *next;
+};
+
+/*
+ * 以前の実装
+ * ページのリストをたどり、ビットマップから空いているスロットを探す
+ */
+#define OLD_PAGE_SIZE 2048
+
+struct old_page {
+  int magic;
+  struct old_page *prev, *next;
+};
+
+struct old_allocator {
+  int size;
+  int max_num;
+  int storage_offset;
+  struct old_page page_list;
+  void (*dtor)(void *);
+};
+
+#define OLD_PAGE_AVAIL(p) ((unsigned char*)p + sizeof(struct old_page))
+#define OLD_PAGE_CHUNK(a, p, i) ((unsigned char *)p + a->storage_offset + a->size * (i))
+
+static int
+old_bit_test(unsigned char *bits, int pos)
+{
+  return bits[pos >> 3] & (1 << (7 - (pos & 0x7)));
+}
+
+static void
+old_bit_set(unsigned char *bits, int pos, int bit)
+{
+  unsigned char filter = 1 << (7 - (pos & 0x7));
+  if (bit == 0) {
+    bits[pos >> 3] &= ~filter;
+  } else {
+    bits[pos >> 3] |= filter;
+  }
+}
+
+static int
+old_roundup_align(int num)
+{
+  return (num + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+}
+
+static struct old_allocator *
+old_create_allocator(int size, void (*dtor)(void *))
+{
+  struct old_allocator *a = malloc(sizeof(*a));
+  size = old_roundup_align(size);
+  a->size = size;
+  a->max_num = (int)((OLD_PAGE_SIZE - sizeof(struct old_page) -
+		      sizeof(double)) * 8 / (size * 8 + 1));
+  a->storage_offset = old_roundup_align(sizeof(struct old_page) +
+					a->max_num / 8 + 1);
+  a->dtor = dtor;
+  a->page_list.next = &a->page_list;
+  a->page_list.prev = &a->page_list;
+  return a;
+}
+
+static void
+old_free_allocator(struct old_allocator *a)
+{
+  struct old_page *p, *p_next;
+  int i;
+  for (p = a->page_list.next; p != &a->page_list; p = p_next) {
+    p_next = p->next;
+    if (a->dtor) {
+      for (i = 0; i < a->max_num; i++) {
+	if (old_bit_test(OLD_PAGE_AVAIL(p), i)) {
+	  a->dtor(OLD_PAGE_CHUNK(a, p, i));
+	}
+      }
+    }
+    free(p);
+  }
+  free(a);
+}
+
+static void *
+old_smalloc(struct old_allocator *a)
+{
+  struct old_page *p;
+  int i;
+  for (p = a->page_list.next; p != &a->page_list; p = p->next) {
+    for (i = 0; i < a->max_num; i++) {
+      if (!old_bit_test(OLD_PAGE_AVAIL(p), i)) {
+	old_bit_set(OLD_PAGE_AVAIL(p), i, 1);
+	return OLD_PAGE_CHUNK(a, p, i);
+      }
+    }
+  }
+  p = malloc(OLD_PAGE_SIZE);
+  p->magic = 0x12345678;
+  memset(OLD_PAGE_AVAIL(p), 0, (a->max_num >> 3) + 1);
+  p->next = a->page_list.next;
+  p->prev = &a->page_list;
+  a->page_list.next->prev = p;
+  a->page_list.next = p;
+  return old_smalloc(a);
+}
+
+static void
+old_sfree(struct old_allocator *a, void *ptr)
+{
+  struct old_page *p;
+  unsigned char *c = ptr;
+  if (a->dtor) {
+    a->dtor(ptr);
+  }
+  for (p = a->page_list.next; p != &a->page_list; p = p->next) {
+    if ((unsigned char*)p < c && c < (unsigned char*)p + OLD_PAGE_SIZE) {
+      break;
+    }
+  }
+  old_bit_set(OLD_PAGE_AVAIL(p),
+	      (c - ((unsigned char *)p + a->storage_offset)) / a->size, 0);
+  if (a->page_list.next != p) {
+    p->prev->next = p->next;
+    p->next->prev = p->prev;
+    p->next = a->page_list.next;
+    p->prev = &a->page_list;
+    a->page_list.next->prev = p;
+    a->page_list.next = p;
+  }
+}
+
+/*
+ * 二つの実装を同じ形で呼ぶための表
+ */
+struct ator_ops {
+  void *(*create)(int, void (*)(void *));
+  void (*destroy)(void *);
+  void *(*alloc)(void *);
+  void (*free)(void *, void *);
+};
+
+static void *
+new_create(int size, void (*dtor)(void *))
+{
+  return anthy_create_allocator(size, dtor);
+}
+
+static void
+new_destroy(void *a)
+{
+  anthy_free_allocator(a);
+}
+
+static void *
+new_alloc(void *a)
+{
+  return anthy_smalloc(a);
+}
+
+static void
+new_free(void *a, void *p)
+{
+  anthy_sfree(a, p);
+}
+
+static void *
+old_create(int size, void (*dtor)(void *))
+{
+  return old_create_allocator(size, dtor);
+}
+
+static void
+old_destroy(void *a)
+{
+  old_free_allocator(a);
+}
+
+static void *
+old_alloc(void *a)
+{
+  return old_smalloc(a);
+}
+
+static void
+old_free(void *a, void *p)
+{
+  old_sfree(a, p);
+}
+
+static struct ator_ops new_ops = {new_create, new_destroy, new_alloc, new_free};
+static struct ator_ops old_ops = {old_create, old_destroy, old_alloc, old_free};
+
+/* dtorが呼ばれた回数 */
+static long nr_dtor;
+
+static void
+count_dtor(void *p)
+{
+  (void)p;
+  nr_dtor ++;
+}
+
+/* 実装によらず同じ列を返す乱数 */
+static unsigned long rand_state;
+
+static unsigned long
+next_rand(void)
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return (rand_state >> 16) & 0x7fff;
+}
+
+static double
+elapsed(struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) +
+    (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+/* 文節分割を何度も行うのに似た使い方の秒数を返す */
+static double
+run_conversions(struct ator_ops *ops)
+{
+  struct timespec t0, t1;
+  struct bench_node *nodes[NR_NODES];
+  int i, j, nr_nodes;
+
+  rand_state = 1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < NR_CONVERSIONS; i++) {
+    void *wl_ator = ops->create(sizeof(struct word_list), NULL);
+    void *mw_ator = ops->create(sizeof(struct meta_word), count_dtor);
+    void *node_ator = ops->create(sizeof(struct bench_node), count_dtor);
+    for (j = 0; j < NR_WORD_LISTS; j++) {
+      memset(ops->alloc(wl_ator), 0, sizeof(struct word_list));
+    }
+    for (j = 0; j < NR_META_WORDS; j++) {
+      memset(ops->alloc(mw_ator), 0, sizeof(struct meta_word));
+    }
+    /* ノードを作りながら、確率の低いものを捨てる */
+    nr_nodes = 0;
+    for (j = 0; j < NR_NODES; j++) {
+      struct bench_node *n = ops->alloc(node_ator);
+      n->border = j;
+      if (nr_nodes > 0 && next_rand() % 3 == 0) {
+	int k = next_rand() % nr_nodes;
+	ops->free(node_ator, nodes[k]);
+	nodes[k] = nodes[nr_nodes - 1];
+	nr_nodes --;
+      }
+      nodes[nr_nodes] = n;
+      nr_nodes ++;
+    }
+    ops->destroy(node_ator);
+    ops->destroy(mw_ator);
+    ops->destroy(wl_ator);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return elapsed(&t0, &t1);
+}
+
+/* 多くのオブジェクトを持ったまま入れ換える使い方の秒数を返す */
+static double
+run_cache(struct ator_ops *ops)
+{
+  struct timespec t0, t1;
+  void **objs = malloc(sizeof(void *) * NR_CACHED);
+  void *ator = ops->create(sizeof(struct bench_node), count_dtor);
+  int i;
+
+  rand_state = 1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < NR_CACHED; i++) {
+    objs[i] = ops->alloc(ator);
+  }
+  for (i = 0; i < NR_CACHE_OPS; i++) {
+    int k = (next_rand() << 15 | next_rand()) % NR_CACHED;
+    ops->free(ator, objs[k]);
+    objs[k] = ops->alloc(ator);
+  }
+  ops->destroy(ator);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  free(objs);
+  return elapsed(&t0, &t1);
+}
+
+int
+main(int argc, char **argv)
+{
+  double old_conv, new_conv, old_cache, new_cache;
+  long old_dtor, new_dtor;
+  (void)argc;
+  (void)argv;
+
+  nr_dtor = 0;
+  old_conv = run_conversions(&old_ops);
+  old_cache = run_cache(&old_ops);
+  old_dtor = nr_dtor;
+  nr_dtor = 0;
+  new_conv = run_conversions(&new_ops);
+  new_cache = run_cache(&new_ops);
+  new_dtor = nr_dtor;
+
+  printf("%d conversions\n", NR_CONVERSIONS);
+  printf("old : %.3f sec (%.1f usec/conversion)\n",
+	 old_conv, old_conv * 1000000 / NR_CONVERSIONS);
+  printf("new : %.3f sec (%.1f usec/conversion)\n",
+	 new_conv, new_conv * 1000000 / NR_CONVERSIONS);
+  if (new_conv > 0) {
+    printf("speedup : %.2f\n", old_conv / new_conv);
+  }
+  printf("%d frees with %d live objects\n", NR_CACHE_OPS, NR_CACHED);
+  printf("old : %.3f sec\n", old_cache);
+  printf("new : %.3f sec\n", new_cache);
+  if (new_cache > 0) {
+    printf("speedup : %.2f\n", old_cache / new_cache);
+  }
+  if (old_dtor != new_dtor) {
+    printf("dtor called %ld times (old %ld times).\n", new_dtor, old_dtor);
+  }
+
+  anthy_quit_allocator();
+  return old_dtor != new_dtor;
+}
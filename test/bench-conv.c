@@ -0,0 +1,514 @@
+/* 変換のベンチマーク
+ *
+ * コーパス(corpus/corpus.*.txt)の各文について、読みをanthy_set_stringで
+ * 変換し、文節の長さが例文と同じになるまで伸縮して、例文と同じ候補
+ * (無ければ先頭の候補)を確定する。
+ * 操作ごとの時間と、変換の段階(anthy/phase.h)ごとの一文あたりの時間の
+ * 中央値と99パーセンタイル、一秒あたりの変換数、初期化の時間と
+ * そのうちの辞書ファイルの読み込みの時間、最初の一文の変換での
+ * ページフォルトの数、最大RSSを出力する。
+ * 文節の長さと先頭の候補が例文と一致した数も出力するので、
+ * 変換結果が変わっていないかの確認にも使える
+ *
+ * bench-conv [-j] [-o ファイル] [-n 回数] [-m 読み込み方] [コーパスのファイル...]
+ *  -j  結果をJSONで出力する
+ *  -o  結果をファイルに書く(ライブラリも標準出力に書くことがあるので)
+ *  -n  コーパスを繰り返す回数
+ *  -m  辞書の読み込み方(DIC_LOAD_MODE)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+  #include <sys/resource.h>
+#endif
+#include <anthy/anthy.h>
+#include <anthy/conf.h>
+#include <anthy/diclib.h>
+#include <anthy/phase.h>
+
+#define BUF_SIZE 1024
+#define MAX_SEGMENTS 64
+#define NR_CORPUS 6
+
+#define CORPUS_FMT SRCDIR "/../corpus/corpus.%d.txt"
+
+/* 時間(マイクロ秒)の標本 */
+struct samples {
+  double *v;
+  int nr;
+  int size;
+};
+
+/* 操作ごとの時間 */
+enum {
+  OP_SET_STRING,
+  OP_RESIZE,
+  OP_COMMIT,
+  OP_SENTENCE,
+  NR_OPS
+};
+
+static const char *op_names[NR_OPS] = {
+  "set_string", "resize", "commit", "sentence"
+};
+
+/* 結果の出力先 */
+static FILE *out;
+
+static struct samples op_samples[NR_OPS];
+/* 変換の段階ごとの、一文あたりの時間 */
+static struct samples phase_samples[NR_ANTHY_PHASES];
+static long long sentence_phase_ns[NR_ANTHY_PHASES];
+
+/*
+ * 例文との比較
+ * 伸縮せずに文節の長さが一致した文の数と、
+ * 長さをあわせられた文の文節のうち、先頭の候補が一致した数
+ */
+static int nr_sentences, nr_split_ok;
+static int nr_segments, nr_cand_ok;
+
+/* 最初の一文の変換で起きたページフォルトの数 */
+static long first_minflt = -1, first_majflt = -1;
+
+static void
+push_sample(struct samples *s, double v)
+{
+  if (s->nr == s->size) {
+    s->size = s->size ? s->size * 2 : 1024;
+    s->v = realloc(s->v, sizeof(double) * s->size);
+  }
+  s->v[s->nr] = v;
+  s->nr ++;
+}
+
+static int
+compare_double(const void *p1, const void *p2)
+{
+  double d1 = *(const double *)p1, d2 = *(const double *)p2;
+  return (d1 > d2) - (d1 < d2);
+}
+
+static double
+percentile(struct samples *s, int p)
+{
+  if (!s->nr) {
+    return 0;
+  }
+  return s->v[(long)(s->nr - 1) * p / 100];
+}
+
+static double
+total(struct samples *s)
+{
+  double sum = 0;
+  int i;
+  for (i = 0; i < s->nr; i++) {
+    sum += s->v[i];
+  }
+  return sum;
+}
+
+static double
+elapsed_us(struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000000.0 +
+    (to->tv_nsec - from->tv_nsec) / 1000.0;
+}
+
+/* 操作の後に、その操作の時間と段階ごとの時間を足す */
+static void
+end_op(int op, struct timespec *t0)
+{
+  struct timespec t1;
+  long long ns[NR_ANTHY_PHASES];
+  int i;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  push_sample(&op_samples[op], elapsed_us(t0, &t1));
+  anthy_phase_take(ns);
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    sentence_phase_ns[i] += ns[i];
+  }
+}
+
+/* '|'で区切られた文節を切り出す、文節の数を返す */
+static int
+split_segments(char *str, char **segs)
+{
+  int nr = 0;
+  char *cur;
+  if (*str != '|') {
+    return 0;
+  }
+  str ++;
+  while ((cur = strchr(str, '|')) && nr < MAX_SEGMENTS) {
+    *cur = 0;
+    /* 候補の誤りの印 */
+    if (*str == '~') {
+      str ++;
+    }
+    segs[nr] = str;
+    nr ++;
+    str = cur + 1;
+  }
+  return nr;
+}
+
+/* UTF-8の文字列の文字数 */
+static int
+utf8_len(const char *s)
+{
+  int n = 0;
+  for (; *s; s++) {
+    if ((*s & 0xc0) != 0x80) {
+      n ++;
+    }
+  }
+  return n;
+}
+
+/*
+ * nth番目の文節の長さを例文にあわせる
+ * 伸縮せずに同じなら1、伸縮してあわせたら0、あわせられなければ-1を返す
+ */
+static int
+trim_segment(anthy_context_t ac, int nth, const char *seg)
+{
+  struct anthy_segment_stat ss;
+  int len = utf8_len(seg);
+  int i, nr_steps, old_len;
+  struct timespec t0;
+
+  if (anthy_get_segment_stat(ac, nth, &ss)) {
+    return -1;
+  }
+  if (ss.seg_len == len) {
+    return 1;
+  }
+  /* 一回で一文字ずつ伸縮するので、長さの差の回数だけ試す */
+  nr_steps = len > ss.seg_len ? len - ss.seg_len : ss.seg_len - len;
+  for (i = 0; i < nr_steps; i++) {
+    old_len = ss.seg_len;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    anthy_resize_segment(ac, nth, len > old_len ? 1 : -1);
+    end_op(OP_RESIZE, &t0);
+    if (anthy_get_segment_stat(ac, nth, &ss) || ss.seg_len == old_len) {
+      /* 伸縮できない */
+      return -1;
+    }
+    if (ss.seg_len == len) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* 例文と同じ候補を探す、無ければ先頭の候補を返す */
+static int
+find_candidate(anthy_context_t ac, int nth, const char *seg)
+{
+  char buf[BUF_SIZE];
+  struct anthy_segment_stat ss;
+  int i;
+  if (anthy_get_segment_stat(ac, nth, &ss)) {
+    return 0;
+  }
+  for (i = 0; i < ss.nr_candidate; i++) {
+    if (anthy_get_segment(ac, nth, i, buf, BUF_SIZE) >= 0 &&
+	!strcmp(buf, seg)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+static void
+get_faults(long *minflt, long *majflt)
+{
+#ifndef _WIN32
+  struct rusage ru;
+  if (!getrusage(RUSAGE_SELF, &ru)) {
+    *minflt = ru.ru_minflt;
+    *majflt = ru.ru_majflt;
+    return ;
+  }
+#endif
+  *minflt = -1;
+  *majflt = -1;
+}
+
+static void
+proc_sentence(anthy_context_t ac, char *line)
+{
+  char *yomi[MAX_SEGMENTS], *cand[MAX_SEGMENTS];
+  char str[BUF_SIZE];
+  char *sep;
+  int nr_yomi, nr_cand, i, split_ok = 1, trimmed = 1;
+  struct anthy_conv_stat cs;
+  struct timespec t0, t1;
+  long long ns[NR_ANTHY_PHASES];
+  long minflt, majflt;
+
+  line[strcspn(line, "\r\n")] = 0;
+  sep = strstr(line, "| |");
+  if (line[0] != '|' || !sep) {
+    return ;
+  }
+  sep[1] = 0;
+  nr_yomi = split_segments(line, yomi);
+  nr_cand = split_segments(&sep[2], cand);
+  if (!nr_yomi || nr_yomi != nr_cand) {
+    return ;
+  }
+  str[0] = 0;
+  for (i = 0; i < nr_yomi; i++) {
+    if (strlen(str) + strlen(yomi[i]) >= BUF_SIZE) {
+      return ;
+    }
+    strcat(str, yomi[i]);
+  }
+
+  anthy_phase_take(ns);
+  memset(sentence_phase_ns, 0, sizeof(sentence_phase_ns));
+  get_faults(&minflt, &majflt);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  anthy_set_string(ac, str);
+  end_op(OP_SET_STRING, &t0);
+  for (i = 0; i < nr_yomi; i++) {
+    int r = trim_segment(ac, i, yomi[i]);
+    if (r < 1) {
+      split_ok = 0;
+    }
+    if (r < 0) {
+      trimmed = 0;
+    }
+  }
+  if (anthy_get_stat(ac, &cs)) {
+    return ;
+  }
+  if (cs.nr_segment != nr_yomi) {
+    split_ok = 0;
+    trimmed = 0;
+  }
+  for (i = 0; i < cs.nr_segment; i++) {
+    struct timespec tc;
+    int nth = i < nr_cand ? find_candidate(ac, i, cand[i]) : 0;
+    /* 文節の長さをあわせた後の先頭の候補を比べる */
+    if (trimmed && nth == 0) {
+      char buf[BUF_SIZE];
+      if (anthy_get_segment(ac, i, 0, buf, BUF_SIZE) >= 0 &&
+	  !strcmp(buf, cand[i])) {
+	nr_cand_ok ++;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tc);
+    anthy_commit_segment(ac, i, nth);
+    end_op(OP_COMMIT, &tc);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  push_sample(&op_samples[OP_SENTENCE], elapsed_us(&t0, &t1));
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    push_sample(&phase_samples[i], sentence_phase_ns[i] / 1000.0);
+  }
+  if (!nr_sentences && minflt >= 0) {
+    get_faults(&first_minflt, &first_majflt);
+    first_minflt -= minflt;
+    first_majflt -= majflt;
+  }
+  nr_sentences ++;
+  if (split_ok) {
+    nr_split_ok ++;
+  }
+  if (trimmed) {
+    nr_segments += nr_yomi;
+  }
+}
+
+static int
+proc_corpus(anthy_context_t ac, const char *fn)
+{
+  char line[BUF_SIZE * 2];
+  FILE *fp = fopen(fn, "r");
+  if (!fp) {
+    fprintf(stderr, "failed to open %s.\n", fn);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    proc_sentence(ac, line);
+  }
+  fclose(fp);
+  return 0;
+}
+
+static long
+peak_rss_kb(void)
+{
+#ifndef _WIN32
+  struct rusage ru;
+  if (!getrusage(RUSAGE_SELF, &ru)) {
+    return ru.ru_maxrss;
+  }
+#endif
+  return -1;
+}
+
+static void
+print_text(int rounds, double load_us)
+{
+  double sec = total(&op_samples[OP_SENTENCE]) / 1000000;
+  int i;
+
+  fprintf(out, "%d sentences (%d rounds)\n", nr_sentences, rounds);
+  fprintf(out, "dictionary load : %.1f msec (file %.1f msec)\n",
+	  load_us / 1000, anthy_file_dic_load_time() / 1000000.0);
+  fprintf(out, "conversions/sec : %.1f\n", sec > 0 ? nr_sentences / sec : 0);
+  fprintf(out, "%-12s %8s %10s %10s\n", "usec", "count", "p50", "p99");
+  for (i = 0; i < NR_OPS; i++) {
+    fprintf(out, "%-12s %8d %10.1f %10.1f\n", op_names[i], op_samples[i].nr,
+	    percentile(&op_samples[i], 50), percentile(&op_samples[i], 99));
+  }
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    fprintf(out, "%-12s %8d %10.1f %10.1f\n", anthy_phase_name(i),
+	    phase_samples[i].nr, percentile(&phase_samples[i], 50),
+	    percentile(&phase_samples[i], 99));
+  }
+  fprintf(out, "segmentation : %d/%d sentences\n",
+	  nr_split_ok, nr_sentences);
+  fprintf(out, "candidates : %d/%d segments\n", nr_cand_ok, nr_segments);
+  fprintf(out, "first conversion faults : %ld minor, %ld major\n",
+	  first_minflt, first_majflt);
+  fprintf(out, "peak RSS : %ld KB\n", peak_rss_kb());
+}
+
+static void
+print_json_samples(const char *name, struct samples *s, int last)
+{
+  fprintf(out, "    \"%s\": {\"count\": %d, \"p50\": %.1f, \"p99\": %.1f}%s\n",
+	  name, s->nr, percentile(s, 50), percentile(s, 99), last ? "" : ",");
+}
+
+static void
+print_json(int rounds, double load_us)
+{
+  double sec = total(&op_samples[OP_SENTENCE]) / 1000000;
+  int i;
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"sentences\": %d,\n", nr_sentences);
+  fprintf(out, "  \"rounds\": %d,\n", rounds);
+  fprintf(out, "  \"dic_load_ms\": %.1f,\n", load_us / 1000);
+  fprintf(out, "  \"dic_file_load_ms\": %.1f,\n",
+	  anthy_file_dic_load_time() / 1000000.0);
+  fprintf(out, "  \"conversions_per_sec\": %.1f,\n",
+	  sec > 0 ? nr_sentences / sec : 0);
+  fprintf(out, "  \"latency_us\": {\n");
+  for (i = 0; i < NR_OPS; i++) {
+    print_json_samples(op_names[i], &op_samples[i], i == NR_OPS - 1);
+  }
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"phase_us\": {\n");
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    print_json_samples(anthy_phase_name(i), &phase_samples[i],
+		       i == NR_ANTHY_PHASES - 1);
+  }
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"segmentation_ok\": %d,\n", nr_split_ok);
+  fprintf(out, "  \"segments\": %d,\n", nr_segments);
+  fprintf(out, "  \"candidates_ok\": %d,\n", nr_cand_ok);
+  fprintf(out, "  \"first_conv_minflt\": %ld,\n", first_minflt);
+  fprintf(out, "  \"first_conv_majflt\": %ld,\n", first_majflt);
+  fprintf(out, "  \"peak_rss_kb\": %ld\n", peak_rss_kb());
+  fprintf(out, "}\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  anthy_context_t ac;
+  struct timespec t0, t1;
+  double load_us;
+  int json = 0, rounds = 1, nr_files = 0, i, r;
+  const char *out_fn = NULL, *load_mode = NULL;
+  const char **files = malloc(sizeof(char *) * (argc + NR_CORPUS));
+  char corpus[NR_CORPUS][BUF_SIZE];
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j")) {
+      json = 1;
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      out_fn = argv[++i];
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      load_mode = argv[++i];
+    } else {
+      files[nr_files] = argv[i];
+      nr_files ++;
+    }
+  }
+  out = stdout;
+  if (out_fn && !(out = fopen(out_fn, "w"))) {
+    fprintf(stderr, "failed to open %s.\n", out_fn);
+    return 1;
+  }
+  if (!nr_files) {
+    for (i = 0; i < NR_CORPUS; i++) {
+      snprintf(corpus[i], BUF_SIZE, CORPUS_FMT, i);
+      files[nr_files] = corpus[i];
+      nr_files ++;
+    }
+  }
+
+  anthy_conf_override("CONFFILE", "../anthy-conf");
+  anthy_conf_override("HOME", TEST_HOME);
+  anthy_conf_override("DIC_FILE", "../mkanthydic/anthy.dic");
+  if (load_mode) {
+    anthy_conf_override("DIC_LOAD_MODE", load_mode);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (anthy_init()) {
+    printf("failed to init anthy\n");
+    return 1;
+  }
+  /* 学習データは保存しない */
+  anthy_set_personality("");
+  ac = anthy_create_context();
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  load_us = elapsed_us(&t0, &t1);
+  anthy_context_set_encoding(ac, ANTHY_UTF8_ENCODING);
+
+  anthy_phase_enable(1);
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < nr_files; i++) {
+      if (proc_corpus(ac, files[i])) {
+	return 1;
+      }
+    }
+  }
+  anthy_phase_enable(0);
+
+  for (i = 0; i < NR_OPS; i++) {
+    qsort(op_samples[i].v, op_samples[i].nr, sizeof(double), compare_double);
+  }
+  for (i = 0; i < NR_ANTHY_PHASES; i++) {
+    qsort(phase_samples[i].v, phase_samples[i].nr, sizeof(double),
+	  compare_double);
+  }
+  if (json) {
+    print_json(rounds, load_us);
+  } else {
+    print_text(rounds, load_us);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  anthy_release_context(ac);
+  anthy_quit();
+  free(files);
+  return nr_sentences ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/* 辞書引きのマイクロベンチマーク
+ *
+ * test.txtの各文の部分文字列がファイル辞書のどこにあるかを
+ * 探す時間(anthy_gang_find_words)を計る
+ * ページの先頭の読みの表(page key)を使う場合と
+ * 使わない場合、読みのtrieを各位置から引く場合を続けて計り、比べる
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <anthy/anthy.h>
+#include <anthy/conf.h>
+#include <anthy/dic.h>
+#include <anthy/word_dic.h>
+#include <anthy/xstr.h>
+#include <src-worddic/dic_main.h>
+
+#define MAX_SENTENCES 1024
+#define NR_ROUNDS 200
+
+static const char *testdata = SRCDIR "/test.txt";
+
+/* 文ごとの部分文字列の配列 */
+struct lookup_set {
+  xstr *sentence;
+  struct gang_elm **array;
+  int nr;
+  /* page keyを使った時の検索結果 */
+  int *idx;
+};
+
+static struct lookup_set sets[MAX_SENTENCES];
+static int nr_sets;
+
+static int
+gang_elm_compare_func(const void *p1, const void *p2)
+{
+  const struct gang_elm ** s1 = (const struct gang_elm**) p1;
+  const struct gang_elm ** s2 = (const struct gang_elm**) p2;
+  return strcmp((*s1)->key, (*s2)->key);
+}
+
+/* 文の部分文字列を重複無しで並べる(anthy_gang_load_dicと同じもの) */
+static void
+make_lookup_set(struct lookup_set *ls, xstr *sentence)
+{
+  int from, len, i, nr = 0;
+  ls->sentence = sentence;
+  ls->array = malloc(sizeof(struct gang_elm *) * sentence->len * 32);
+  for (from = 0; from < sentence->len; from ++) {
+    for (len = 1; len < 32 && from + len <= sentence->len; len ++) {
+      struct gang_elm *ge = malloc(sizeof(*ge));
+      ge->xs.str = &sentence->str[from];
+      ge->xs.len = len;
+      ge->key = anthy_xstr_to_cstr(&ge->xs, ANTHY_UTF8_ENCODING);
+      ls->array[nr] = ge;
+      nr ++;
+    }
+  }
+  qsort(ls->array, nr, sizeof(struct gang_elm *), gang_elm_compare_func);
+  ls->nr = 0;
+  for (i = 0; i < nr; i++) {
+    if (ls->nr && !strcmp(ls->array[ls->nr - 1]->key, ls->array[i]->key)) {
+      continue;
+    }
+    ls->array[ls->nr] = ls->array[i];
+    ls->nr ++;
+  }
+  ls->idx = malloc(sizeof(int) * (ls->nr + 1));
+}
+
+/* 検索結果を保存する、もしくは保存したものと比べて違う数を返す */
+static int
+check_result(int save)
+{
+  int i, j, nr_diff = 0;
+  for (i = 0; i < nr_sets; i++) {
+    for (j = 0; j < sets[i].nr; j++) {
+      if (save) {
+	sets[i].idx[j] = sets[i].array[j]->tmp.idx;
+      } else if (sets[i].idx[j] != sets[i].array[j]->tmp.idx) {
+	nr_diff ++;
+      }
+    }
+  }
+  return nr_diff;
+}
+
+/* 読みのtrieで引いた結果が保存したものと違う数を返す */
+static int
+check_trie_result(struct word_dic *wdic)
+{
+  int lens[32], indices[32];
+  int i, j, k, nr, idx, nr_diff = 0;
+  for (i = 0; i < nr_sets; i++) {
+    for (j = 0; j < sets[i].nr; j++) {
+      xstr *xs = &sets[i].array[j]->xs;
+      nr = anthy_word_dic_prefix_search(wdic, xs, lens, indices);
+      idx = NO_WORD;
+      for (k = 0; k < nr; k++) {
+	if (lens[k] == xs->len) {
+	  idx = indices[k];
+	}
+      }
+      if (idx != sets[i].idx[j]) {
+	nr_diff ++;
+      }
+    }
+  }
+  return nr_diff;
+}
+
+static int
+read_sentences(void)
+{
+  char buf[256];
+  FILE *fp = fopen(testdata, "r");
+  if (!fp) {
+    printf("failed to open %s.\n", testdata);
+    return -1;
+  }
+  while (fgets(buf, 256, fp) && nr_sets < MAX_SENTENCES) {
+    xstr *xs;
+    if (buf[0] != '*') {
+      continue;
+    }
+    buf[strlen(buf) - 1] = 0;
+    xs = anthy_cstr_to_xstr(&buf[1], ANTHY_UTF8_ENCODING);
+    if (xs) {
+      make_lookup_set(&sets[nr_sets], xs);
+      nr_sets ++;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+static double
+elapsed(struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) +
+    (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+/* 全ての文の各位置から読みのtrieをNR_ROUNDS回ずつ引くのにかかった秒数を返す */
+static double
+run_trie(struct word_dic *wdic)
+{
+  struct timespec t0, t1;
+  int lens[32], indices[32];
+  double total = 0;
+  int i, r, from;
+
+  for (r = 0; r < NR_ROUNDS; r++) {
+    for (i = 0; i < nr_sets; i++) {
+      xstr *sentence = sets[i].sentence;
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for (from = 0; from < sentence->len; from ++) {
+	xstr xs;
+	xs.str = &sentence->str[from];
+	xs.len = sentence->len - from;
+	if (xs.len > 31) {
+	  xs.len = 31;
+	}
+	anthy_word_dic_prefix_search(wdic, &xs, lens, indices);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      total += elapsed(&t0, &t1);
+    }
+  }
+  return total;
+}
+
+/* 全ての文をNR_ROUNDS回ずつ引くのにかかった秒数を返す */
+static double
+run_lookup(struct word_dic *wdic)
+{
+  struct timespec t0, t1;
+  double total = 0;
+  int i, r;
+
+  for (r = 0; r < NR_ROUNDS; r++) {
+    for (i = 0; i < nr_sets; i++) {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      anthy_gang_find_words(wdic, sets[i].array, sets[i].nr);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      total += elapsed(&t0, &t1);
+    }
+  }
+  return total;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct word_dic *wdic;
+  double with_key, without_key, with_trie = 0;
+  int n, nr_diff;
+  (void)argc;
+  (void)argv;
+
+  anthy_conf_override("CONFFILE", "../anthy-conf");
+  anthy_conf_override("HOME", TEST_HOME);
+  anthy_conf_override("DIC_FILE", "../mkanthydic/anthy.dic");
+  if (anthy_init()) {
+    printf("failed to init anthy\n");
+    return 1;
+  }
+  wdic = anthy_create_word_dic();
+
+  if (read_sentences() || !nr_sets) {
+    return 1;
+  }
+  n = nr_sets * NR_ROUNDS;
+  if (!wdic->page_key) {
+    printf("the dictionary has no page key section.\n");
+  }
+
+  with_key = run_lookup(wdic);
+  check_result(1);
+  wdic->page_key = NULL;
+  without_key = run_lookup(wdic);
+  nr_diff = check_result(0);
+  if (wdic->trie) {
+    with_trie = run_trie(wdic);
+    nr_diff += check_trie_result(wdic);
+  } else {
+    printf("the dictionary has no yomi trie.\n");
+  }
+
+  printf("%d lookups\n", n);
+  printf("page key   : %.3f sec (%.1f usec/sentence)\n",
+	 with_key, with_key * 1000000 / n);
+  printf("page index : %.3f sec (%.1f usec/sentence)\n",
+	 without_key, without_key * 1000000 / n);
+  if (wdic->trie) {
+    printf("yomi trie  : %.3f sec (%.1f usec/sentence)\n",
+	   with_trie, with_trie * 1000000 / n);
+  }
+  if (with_key > 0) {
+    printf("speedup : %.2f\n", without_key / with_key);
+  }
+  if (with_trie > 0) {
+    printf("speedup (trie) : %.2f\n", without_key / with_trie);
+  }
+  if (nr_diff) {
+    printf("%d results differ.\n", nr_diff);
+  }
+
+  anthy_release_word_dic(wdic);
+  anthy_quit();
+  return nr_diff ? 1 : 0;
+}
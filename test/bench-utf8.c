@@ -0,0 +1,365 @@
+/* UTF-8とUCS-4の変換の検査とベンチマーク
+ *
+ * 各実装(スカラ, SSE2, AVX2)の結果を、1文字ずつ変換する
+ * anthy_utf8_to_ucs4_xcharと、put_xchar_to_utf8_strと同じ手順の
+ * ref_encodeの結果と比べる。正しいUTF-8の列の他に、壊した列や
+ * ランダムなバイト列も与えて、不正なバイト列の扱いも比べる。
+ * その後、かな漢字の多い文字列とASCIIの文字列の変換速度を計る
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <anthy/xstr.h>
+
+#define NR_RANDOM_STRINGS 200000
+#define MAX_RANDOM_LEN 96
+#define BENCH_CHARS 4096
+#define BENCH_ROUNDS 10000
+/* 書き過ぎを見付けるためにバッファの後ろに置くバイト */
+#define GUARD 0xa5
+#define GUARD_LEN 64
+
+static const char *impl_names[] = {"scalar", "sse2", "avx2"};
+
+static unsigned long rand_state;
+
+static unsigned long
+next_rand(void)
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return (rand_state >> 16) & 0x7fff;
+}
+
+static unsigned long
+rand_range(unsigned long n)
+{
+  return ((next_rand() << 15) | next_rand()) % n;
+}
+
+/* 文字の種類ごとに偏らせて、サロゲートでない文字を選ぶ */
+static xchar
+random_xchar(int kind)
+{
+  xchar xc;
+  switch (kind) {
+  case 0:
+    return 0x20 + rand_range(0x5f);
+  case 1:
+    return 0x80 + rand_range(0x780);
+  case 2:
+    /* ひらがな、カタカナ、漢字 */
+    switch (rand_range(3)) {
+    case 0:
+      return 0x3041 + rand_range(0x56);
+    case 1:
+      return 0x30a1 + rand_range(0x5a);
+    default:
+      return 0x4e00 + rand_range(0x5200);
+    }
+  case 3:
+    do {
+      xc = 0x800 + rand_range(0x10000 - 0x800);
+    } while (xc >= 0xd800 && xc <= 0xdfff);
+    return xc;
+  default:
+    return 0x10000 + rand_range(0x100000);
+  }
+}
+
+/* 文字の種類の割合を変えた文字列を作る */
+static int
+random_xstr(xchar *buf, int max)
+{
+  int len = rand_range(max + 1);
+  int mix = rand_range(4);
+  int i;
+  for (i = 0; i < len; i++) {
+    int kind;
+    switch (mix) {
+    case 0:
+      kind = 0;
+      break;
+    case 1:
+      kind = rand_range(8) ? 2 : 0;
+      break;
+    case 2:
+      kind = rand_range(5);
+      break;
+    default:
+      /* 同じ種類が続く */
+      kind = (i / 12) % 5;
+      break;
+    }
+    buf[i] = random_xchar(kind);
+  }
+  return len;
+}
+
+/* put_xchar_to_utf8_strと同じ手順 */
+static int
+ref_encode(const xchar *src, int len, char *dst)
+{
+  unsigned char *buf = (unsigned char *)dst;
+  int i, j, l, t = 0;
+  for (i = 0; i < len; i++) {
+    xchar xc = src[i];
+    if (xc < 0x80) {
+      buf[t] = 0;
+      l = 1;
+    } else if (xc < 0x800) {
+      buf[t] = 0xc0;
+      l = 2;
+    } else if (xc < 0x10000) {
+      buf[t] = 0xe0;
+      l = 3;
+    } else {
+      buf[t] = 0xf0;
+      l = 4;
+    }
+    for (j = l - 1; j > 0; j--) {
+      buf[t + j] = (xc & 0x3f) | 0x80;
+      xc >>= 6;
+    }
+    buf[t] += xc;
+    t += l;
+  }
+  buf[t] = 0;
+  return t;
+}
+
+/* anthy_utf8_to_ucs4_xcharを繰り返す、NULで終わる文字列を与える */
+static int
+ref_decode(const char *s, xchar *dst)
+{
+  int n = 0;
+  while (*s) {
+    s = anthy_utf8_to_ucs4_xchar(s, &dst[n]);
+    if (!s) {
+      return -1;
+    }
+    n ++;
+  }
+  return n;
+}
+
+static int
+check_guard(const unsigned char *p)
+{
+  int i;
+  for (i = 0; i < GUARD_LEN; i++) {
+    if (p[i] != GUARD) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* 一つのバイト列を各実装で変換して比べる、違っていれば1を返す */
+static int
+check_decode(const char *s, int len, int *impls, int nr_impls)
+{
+  xchar ref[MAX_RANDOM_LEN * 4 + 1];
+  /* 出力の位置をずらすために前に余分を置く */
+  xchar out[MAX_RANDOM_LEN * 4 + 1 + GUARD_LEN + 4];
+  int nr_ref = ref_decode(s, ref);
+  int i, off = rand_range(4);
+  for (i = 0; i < nr_impls; i++) {
+    xchar *d = &out[off];
+    int n;
+    memset(d, GUARD, sizeof(xchar) * len + GUARD_LEN);
+    anthy_utf8_select_impl(impls[i]);
+    n = anthy_utf8_to_ucs4(s, len, d);
+    if (n != nr_ref ||
+	(n >= 0 && (memcmp(d, ref, sizeof(xchar) * n) ||
+		    !check_guard((unsigned char *)&d[n])))) {
+      printf("decode mismatch (%s) len=%d: %d chars, expected %d\n",
+	     impl_names[impls[i]], len, n, nr_ref);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+check_encode(const xchar *src, int len, int *impls, int nr_impls)
+{
+  char ref[MAX_RANDOM_LEN * 4 + 1];
+  char out[MAX_RANDOM_LEN * 4 + 1 + GUARD_LEN + 4];
+  int nr_ref = ref_encode(src, len, ref);
+  int i, off = rand_range(4);
+  for (i = 0; i < nr_impls; i++) {
+    char *d = &out[off];
+    int n;
+    memset(d, GUARD, len * 4 + 1 + GUARD_LEN);
+    anthy_utf8_select_impl(impls[i]);
+    n = anthy_ucs4_to_utf8(src, len, d);
+    if (n != nr_ref || memcmp(d, ref, n + 1) ||
+	!check_guard((unsigned char *)&d[len * 4 + 1])) {
+      printf("encode mismatch (%s) len=%d: %d bytes, expected %d\n",
+	     impl_names[impls[i]], len, n, nr_ref);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* 正しい列を1バイト壊す、切り詰める、もしくはランダムなバイト列にする */
+static int
+break_bytes(char *s, int len)
+{
+  int i;
+  switch (rand_range(4)) {
+  case 0:
+    if (len) {
+      s[rand_range(len)] = 1 + rand_range(255);
+    }
+    break;
+  case 1:
+    if (len) {
+      len = rand_range(len);
+      s[len] = 0;
+    }
+    break;
+  case 2:
+    for (i = 0; i < len; i++) {
+      s[i] = 1 + rand_range(255);
+    }
+    break;
+  default:
+    /* 3バイトの文字の並びの中にサロゲートや不正な先頭バイトを置く */
+    for (i = 0; i + 3 <= len; i += 3) {
+      s[i] = 0xe3;
+      s[i + 1] = 0x81;
+      s[i + 2] = 0x82;
+    }
+    if (len >= 3) {
+      i = rand_range(len / 3) * 3;
+      s[i] = rand_range(2) ? 0xed : 0xe0 + rand_range(16);
+      s[i + 1] = 0x80 + rand_range(0x40);
+    }
+    break;
+  }
+  return len;
+}
+
+static int
+run_checks(int *impls, int nr_impls)
+{
+  xchar xs[MAX_RANDOM_LEN];
+  char s[MAX_RANDOM_LEN * 4 + 1];
+  int i, len, nr_failed = 0;
+  xchar xc;
+
+  rand_state = 1;
+  for (i = 0; i < NR_RANDOM_STRINGS && nr_failed < 10; i++) {
+    len = random_xstr(xs, MAX_RANDOM_LEN);
+    nr_failed += check_encode(xs, len, impls, nr_impls);
+    len = ref_encode(xs, len, s);
+    nr_failed += check_decode(s, len, impls, nr_impls);
+    len = break_bytes(s, len);
+    nr_failed += check_decode(s, len, impls, nr_impls);
+  }
+  /* 全ての文字を、ASCIIとかなの並びの中に置いて変換する */
+  for (xc = 1; xc < 0x110000 && nr_failed < 10; xc++) {
+    if (xc >= 0xd800 && xc <= 0xdfff) {
+      continue;
+    }
+    for (i = 0; i < 40; i++) {
+      xs[i] = (i & 1) ? 0x3042 : 'a';
+    }
+    xs[xc % 40] = xc;
+    nr_failed += check_encode(xs, 40, impls, nr_impls);
+    len = ref_encode(xs, 40, s);
+    nr_failed += check_decode(s, len, impls, nr_impls);
+  }
+  return nr_failed;
+}
+
+static double
+elapsed(struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) +
+    (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+/* 1文字ずつの変換と各実装の速度をMB/s(UTF-8のバイト数)で表示する */
+static void
+bench_text(const char *name, int kind, int *impls, int nr_impls)
+{
+  xchar *xs = malloc(sizeof(xchar) * BENCH_CHARS);
+  xchar *out = malloc(sizeof(xchar) * BENCH_CHARS);
+  char *s = malloc(BENCH_CHARS * 4 + 1);
+  struct timespec t0, t1;
+  double mb;
+  int i, j, len;
+
+  rand_state = 2;
+  for (i = 0; i < BENCH_CHARS; i++) {
+    /* かな漢字の文字列には句読点や数字を少し混ぜる */
+    xs[i] = random_xchar((kind && rand_range(16)) ? 2 : 0);
+  }
+  len = ref_encode(xs, BENCH_CHARS, s);
+  mb = (double)len * BENCH_ROUNDS / 1000000;
+  printf("%s (%d chars, %d bytes)\n", name, BENCH_CHARS, len);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < BENCH_ROUNDS; i++) {
+    ref_decode(s, out);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  printf(" decode per char : %8.1f MB/s\n", mb / elapsed(&t0, &t1));
+  for (j = 0; j < nr_impls; j++) {
+    anthy_utf8_select_impl(impls[j]);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+      anthy_utf8_to_ucs4(s, len, out);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf(" decode %-8s : %8.1f MB/s\n", impl_names[impls[j]],
+	   mb / elapsed(&t0, &t1));
+  }
+  for (j = 0; j < nr_impls; j++) {
+    anthy_utf8_select_impl(impls[j]);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+      anthy_ucs4_to_utf8(xs, BENCH_CHARS, s);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf(" encode %-8s : %8.1f MB/s\n", impl_names[impls[j]],
+	   mb / elapsed(&t0, &t1));
+  }
+  free(xs);
+  free(out);
+  free(s);
+}
+
+int
+main(int argc, char **argv)
+{
+  int impls[3];
+  int i, nr_impls = 0, nr_failed;
+  (void)argc;
+  (void)argv;
+
+  /* このCPUとコンパイラで使える実装 */
+  for (i = ANTHY_UTF8_SCALAR; i <= ANTHY_UTF8_AVX2; i++) {
+    if (anthy_utf8_select_impl(i) == i) {
+      impls[nr_impls] = i;
+      nr_impls ++;
+    } else {
+      printf("%s is not available.\n", impl_names[i]);
+    }
+  }
+
+  nr_failed = run_checks(impls, nr_impls);
+  if (nr_failed) {
+    printf("%d mismatches.\n", nr_failed);
+    return 1;
+  }
+  printf("all implementations agree with the per character conversion.\n");
+
+  bench_text("kana kanji", 1, impls, nr_impls);
+  bench_text("ascii", 0, impls, nr_impls);
+  return 0;
+}
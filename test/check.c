@@ -1,8 +1,12 @@
 /* リリース前のチェックを行う */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 #include <anthy/anthy.h>
 #include <anthy/xstr.h>
+#include <anthy/wtype.h>
 
 static int
 init(void)
@@ -91,6 +95,308 @@ shake_test(const char *str)
   return 0;
 }
 
+/* 文節分割の候補を選ぶと、その通りに区切られることを調べる */
+static int
+segmentation_test(const char *str)
+{
+  int i, j, nr, nr_seg;
+  int seg_len[100];
+  anthy_context_t ac;
+  ac = anthy_create_context();
+  if (!ac) {
+    printf("failed to create context\n");
+    return 1;
+  }
+  anthy_context_set_encoding(ac, ANTHY_UTF8_ENCODING);
+  anthy_set_string(ac, str);
+  nr = anthy_get_nr_segmentation(ac);
+  if (nr < 1) {
+    printf("no segmentation\n");
+    anthy_release_context(ac);
+    return 1;
+  }
+  for (i = nr - 1; i >= 0; i--) {
+    struct anthy_conv_stat cs;
+    nr_seg = anthy_get_nth_segmentation(ac, i, seg_len, 100);
+    if (anthy_select_segmentation(ac, i)) {
+      printf("failed to select segmentation %d\n", i);
+      anthy_release_context(ac);
+      return 1;
+    }
+    anthy_get_stat(ac, &cs);
+    if (cs.nr_segment != nr_seg) {
+      printf("segmentation %d has %d segments (expected %d)\n",
+	     i, cs.nr_segment, nr_seg);
+      anthy_release_context(ac);
+      return 1;
+    }
+    for (j = 0; j < nr_seg; j++) {
+      struct anthy_segment_stat ss;
+      anthy_get_segment_stat(ac, j, &ss);
+      if (ss.seg_len != seg_len[j]) {
+	printf("segmentation %d differs at %d\n", i, j);
+	anthy_release_context(ac);
+	return 1;
+      }
+    }
+  }
+  anthy_release_context(ac);
+  return 0;
+}
+
+/* 二つのコンテキストの文節と全ての候補が同じことを調べる */
+static int
+compare_segments(anthy_context_t ac, anthy_context_t ref, int nr_chars)
+{
+  int i, j;
+  char buf1[1000], buf2[1000];
+  struct anthy_conv_stat cs1, cs2;
+  anthy_get_stat(ac, &cs1);
+  anthy_get_stat(ref, &cs2);
+  if (cs1.nr_segment != cs2.nr_segment) {
+    printf("%d chars: %d segments (expected %d)\n",
+	   nr_chars, cs1.nr_segment, cs2.nr_segment);
+    return 1;
+  }
+  for (i = 0; i < cs1.nr_segment; i++) {
+    struct anthy_segment_stat ss1, ss2;
+    anthy_get_segment_stat(ac, i, &ss1);
+    anthy_get_segment_stat(ref, i, &ss2);
+    if (ss1.seg_len != ss2.seg_len || ss1.nr_candidate != ss2.nr_candidate) {
+      printf("%d chars: segment %d has %d chars and %d candidates "
+	     "(expected %d and %d)\n", nr_chars, i,
+	     ss1.seg_len, ss1.nr_candidate, ss2.seg_len, ss2.nr_candidate);
+      return 1;
+    }
+    for (j = 0; j < ss1.nr_candidate; j++) {
+      anthy_get_segment(ac, i, j, buf1, 1000);
+      anthy_get_segment(ref, i, j, buf2, 1000);
+      if (strcmp(buf1, buf2)) {
+	printf("%d chars: candidate %d of segment %d is (%s) (expected (%s))\n",
+	       nr_chars, j, i, buf1, buf2);
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* 二つのコンテキストの文節分割の候補が同じことを調べる */
+static int
+compare_segmentations(anthy_context_t ac, anthy_context_t ref, int nr_chars)
+{
+  int i, j, nr, nr_seg1, nr_seg2;
+  int seg_len1[100], seg_len2[100];
+  nr = anthy_get_nr_segmentation(ac);
+  if (nr != anthy_get_nr_segmentation(ref)) {
+    printf("%d chars: %d segmentations (expected %d)\n",
+	   nr_chars, nr, anthy_get_nr_segmentation(ref));
+    return 1;
+  }
+  for (i = 0; i < nr; i++) {
+    nr_seg1 = anthy_get_nth_segmentation(ac, i, seg_len1, 100);
+    nr_seg2 = anthy_get_nth_segmentation(ref, i, seg_len2, 100);
+    if (nr_seg1 != nr_seg2) {
+      printf("%d chars: segmentation %d has %d segments (expected %d)\n",
+	     nr_chars, i, nr_seg1, nr_seg2);
+      return 1;
+    }
+    for (j = 0; j < nr_seg1 && j < 100; j++) {
+      if (seg_len1[j] != seg_len2[j]) {
+	printf("%d chars: segmentation %d differs at %d\n", nr_chars, i, j);
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* 一文字ずつ入力した結果が、まとめて入力した結果と同じことを調べる */
+static int
+incremental_test(const char *str)
+{
+  int i, len, res = 0;
+  anthy_context_t ac, ref;
+  xstr *xs;
+  ac = anthy_create_context();
+  ref = anthy_create_context();
+  if (!ac || !ref) {
+    printf("failed to create context\n");
+    return 1;
+  }
+  anthy_context_set_encoding(ac, ANTHY_UTF8_ENCODING);
+  anthy_context_set_encoding(ref, ANTHY_UTF8_ENCODING);
+  xs = anthy_cstr_to_xstr(str, ANTHY_UTF8_ENCODING);
+  len = xs->len;
+  for (i = 1; i <= len && !res; i++) {
+    xstr part;
+    char *cs;
+    part.str = xs->str;
+    part.len = i;
+    cs = anthy_xstr_to_cstr(&part, ANTHY_UTF8_ENCODING);
+    anthy_set_string(ac, cs);
+    anthy_reset_context(ref);
+    anthy_set_string(ref, cs);
+    free(cs);
+    res = compare_segments(ac, ref, i) || compare_segmentations(ac, ref, i);
+  }
+  anthy_free_xstr(xs);
+  anthy_release_context(ref);
+  anthy_release_context(ac);
+  return res;
+}
+
+/* 使っていないビットが違っても、同じ品詞は等しいと判定されることを調べる */
+static int
+wtype_test(void)
+{
+  union {
+    unsigned int u;
+    wtype_t wt;
+  } l, r;
+  wtype_t t, n;
+
+  anthy_type_to_wtype("#T35", &t);
+  anthy_type_to_wtype("#NN", &n);
+  l.u = 0;
+  r.u = ~0u;
+  l.wt.pos = r.wt.pos = t.pos;
+  l.wt.cos = r.wt.cos = t.cos;
+  l.wt.scos = r.wt.scos = t.scos;
+  l.wt.cc = r.wt.cc = t.cc;
+  l.wt.ct = r.wt.ct = t.ct;
+  l.wt.wf = r.wt.wf = t.wf;
+  if (!anthy_wtype_equal(l.wt, r.wt) || !anthy_wtype_equal(l.wt, t)) {
+    printf("equal wtypes differ\n");
+    return 1;
+  }
+  if (anthy_wtype_equal(t, n)) {
+    printf("different wtypes are equal\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* 並行変換のテスト用。長い変換の回数を数え、変換中は奇数になる */
+static pthread_mutex_t conc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int conc_gen;
+static int conc_done;
+
+static int
+get_conc_gen(void)
+{
+  int g;
+  pthread_mutex_lock(&conc_mutex);
+  g = conc_gen;
+  pthread_mutex_unlock(&conc_mutex);
+  return g;
+}
+
+static int
+conc_done_p(void)
+{
+  int d;
+  pthread_mutex_lock(&conc_mutex);
+  d = conc_done;
+  pthread_mutex_unlock(&conc_mutex);
+  return d;
+}
+
+static void
+set_conc_state(int gen_inc, int done)
+{
+  pthread_mutex_lock(&conc_mutex);
+  conc_gen += gen_inc;
+  conc_done |= done;
+  pthread_mutex_unlock(&conc_mutex);
+}
+
+/* 長い文字列を変換し続けるスレッド */
+static void *
+long_conv_thread(void *arg)
+{
+  const char *str = arg;
+  anthy_context_t ac;
+  int i;
+  ac = anthy_create_context();
+  anthy_context_set_encoding(ac, ANTHY_UTF8_ENCODING);
+  for (i = 0; i < 300 && !conc_done_p(); i++) {
+    anthy_reset_context(ac);
+    set_conc_state(1, 0);
+    anthy_set_string(ac, str);
+    set_conc_state(1, 0);
+  }
+  set_conc_state(0, 1);
+  anthy_release_context(ac);
+  return NULL;
+}
+
+static long
+cpu_usec(clockid_t clk)
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * 別のスレッドが一回の長い変換をしている間に、このスレッドで短い変換が
+ * 何回か終わり、そのうち二つ以上の間で相手もCPUを使って変換を進めて
+ * いたことを調べる。変換全体が排他されていると、相手が変換を進めるのは
+ * 一続きの間だけなので、このようにはならない
+ */
+static int
+concurrency_test(const char *long_str, const char *short_str)
+{
+  pthread_t th;
+  clockid_t clk;
+  anthy_context_t ac;
+  int g, last_g = -1, nr_progress = 0;
+  long cpu, last_cpu = 0;
+  ac = anthy_create_context();
+  if (!ac) {
+    printf("failed to create context\n");
+    return 1;
+  }
+  anthy_context_set_encoding(ac, ANTHY_UTF8_ENCODING);
+  conc_gen = 0;
+  conc_done = 0;
+  if (pthread_create(&th, NULL, long_conv_thread, (void *)long_str)) {
+    printf("failed to create thread\n");
+    anthy_release_context(ac);
+    return 1;
+  }
+  if (pthread_getcpuclockid(th, &clk)) {
+    /* 相手のCPU時間が分からなければ調べられない */
+    nr_progress = 2;
+  }
+  while (nr_progress < 2 && !conc_done_p()) {
+    g = get_conc_gen();
+    anthy_reset_context(ac);
+    anthy_set_string(ac, short_str);
+    cpu = cpu_usec(clk);
+    if (!(g & 1) || get_conc_gen() != g) {
+      /* 相手の変換の最中に始まって終わったのではない */
+      continue;
+    }
+    if (g != last_g) {
+      nr_progress = 0;
+    } else if (cpu - last_cpu > 1000) {
+      nr_progress++;
+    }
+    last_g = g;
+    last_cpu = cpu;
+  }
+  set_conc_state(0, 1);
+  pthread_join(th, NULL);
+  anthy_release_context(ac);
+  if (nr_progress < 2) {
+    printf("conversions did not run concurrently\n");
+    return 1;
+  }
+  return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -112,6 +418,20 @@ main(int argc, char **argv)
   if (shake_test("あいうえおかきくけこ")) {
     printf("fail (shake_test)\n");
   }
+  if (segmentation_test("きょうはいいてんきです")) {
+    printf("fail (segmentation_test)\n");
+  }
+  if (incremental_test("わたしのなまえはなかのです")) {
+    printf("fail (incremental_test)\n");
+  }
+  if (wtype_test()) {
+    printf("fail (wtype_test)\n");
+  }
+  if (concurrency_test("わたしのなまえはなかのですきょうはいいてんきですね"
+		       "あしたもはれるといいのですがどうでしょうか",
+		       "あい")) {
+    printf("fail (concurrency_test)\n");
+  }
   printf("done\n");
   return 0;
 }